@@ -1,3 +1,4 @@
+#define _GNU_SOURCE  // copy_file_range(), SEEK_DATA/SEEK_HOLE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,20 +12,96 @@
 #include <sys/stat.h>
 #include <semaphore.h>
 #include <signal.h>
+#include <sys/signalfd.h>
+#include <spawn.h>
+#include <sys/timerfd.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <sys/select.h>
+#include <math.h>
+#include <errno.h>
 
-#define MAX_TASKS 50
+#define TASK_SLAB_SIZE 64  // Tasks per slab in the task table
+#define TASK_SLOT_BITS 20  // Low bits of a task ID hold the slot
+#define MAX_TASK_SLOTS (1 << TASK_SLOT_BITS)
 #define MAX_NAME_LENGTH 50
 #define MAX_PATH_LENGTH 256
 #define TIME_QUANTUM 2  // For Round Robin scheduling
+#define TICKS_PER_SECOND 1000  // Virtual clock resolution
+#define LOAD_BALANCE_INTERVAL 100  // Ticks between run-queue rebalancing
+#define PRIORITY_LEVELS 64  // One bit per level in the run-queue bitmap
+#define MAX_PRIORITY (PRIORITY_LEVELS - 1)
+#define PAGE_SIZE_KB 4
+#define PTE_PRESENT 0x80000000u  // Page table entry: present bit | frame number
+#define TLB_SETS 64
+#define TLB_WAYS 4
+#define FRAME_MAP_COLS 64
+#define FRAME_MAP_ROWS 16
+#define ALLOC_MAP_COLS 64
+#define ALLOC_MAP_ROWS 8
+#define LINES_PER_PAGE 64  // Sequential patterns walk 64-byte lines
+#define WS_SCAN_LIMIT 64
+#define RES_RAM_BITS 24   // Packed free-resource word: RAM | HDD << 24 | cores << 52
+#define RES_HDD_BITS 28
+#define RES_CORE_BITS 12
+#define SWAP_SEEK_MS 8     // Swap-in cost: one seek plus a transfer per MB
+#define SWAP_MS_PER_MB 10
+#define SHUTDOWN_GRACE_MS 2000  // SIGTERM to SIGKILL at shutdown
+#define LAUNCH_POOL_MAX 256  // Pre-forked idle workers
+#define COPY_CHUNK (64 << 20)  // Largest single kernel copy call
+#define COPY_BUFFER_SIZE (1 << 20)  // Aligned buffer of the read/write fallback
+#define COPY_SMALL_FILE (64 << 10)
+#define TREE_MAX_THREADS 64
+#define TREE_DIRENT_BUFFER 32768
+#define FS_MAGIC 0x31534653  // "SFS1"
+#define FS_BLOCK_SIZE 4096
+#define FS_INLINE_EXTENTS 10
+#define FS_EXTENTS_PER_BLOCK (FS_BLOCK_SIZE / 8)
+#define FS_NAME_MAX 55
+#define FS_BYTES_PER_INODE 16384  // Inode table sizing, as in mke2fs
+#define FS_MAX_INODES (1 << 24)
+#define FS_ROOT 1
+#define CACHE_READAHEAD_MIN 4  // Blocks; the window doubles per sequential read
+#define CACHE_READAHEAD_MAX 64
+#define CACHE_FLUSH_BATCH 256  // Blocks copied out per unlocked write-back
+#define DISK_SECTOR_SIZE 512
+#define DISK_READ_EXPIRE_US 500000  // Deadline I/O scheduler, as Linux's read_expire
+#define DISK_WRITE_EXPIRE_US 5000000
 
 typedef enum {
     FCFS,
     ROUND_ROBIN,
-    PRIORITY
+    PRIORITY,
+    MLFQ,
+    CFS,
+    SJF,
+    SRTF,
+    EDF,
+    LOTTERY,
+    STRIDE
 } SchedulingAlgorithm;
 
+#define SCHED_ALGORITHM_COUNT 10
+#define MLFQ_MAX_LEVELS 8
+#define TICKET_POOL_MAX 32
+
+// Task classes get their own Round Robin quantum
+typedef enum {
+    CLASS_SYSTEM,
+    CLASS_INTERACTIVE,
+    CLASS_FILE_IO,
+    CLASS_GAME,
+    CLASS_BATCH
+} TaskClass;
+
+#define TASK_CLASS_COUNT 5
+
 typedef struct {
     pid_t pid;
     char name[MAX_NAME_LENGTH];
@@ -36,40 +113,1036 @@ typedef struct {
     time_t start_time;
     int priority;  // For priority scheduling
     int remaining_time;  // For Round Robin
+    int deadline;  // Seconds after start, for EDF
+    int tickets;  // For Lottery/Stride, unless the name has a ticket pool
+    int is_simulated;  // No backing child process (headless replay)
+    int is_reaped;  // Child already exited and was collected by the reaper
+    int job_id;  // Slot in the discrete-event engine
+    int asid;  // Address space in the paging model, -1 when paging is off
+    int ram_base;  // First MB of the task's physical block, -1 if none
+    int is_swapped;  // RAM image lives on the HDD
+    int lru_prev;  // Minimized-and-resident LRU list (slots), oldest first
+    int lru_next;
+    int banker_client;  // Deadlock-avoidance bookkeeping, -1 when not tracked
+    
+    // Task table bookkeeping
+    int id;  // Stable ID: generation << TASK_SLOT_BITS | slot
+    unsigned int generation;  // Bumped every time the slot is freed
+    int in_use;
+    int prev;  // Live list (creation order), or free list via next
+    int next;
 } Task;
 
+// Free RAM, HDD and cores share one 64-bit word so a reservation of all
+// three is a single compare-and-swap; see res_reserve()
 typedef struct {
     int total_ram;
     int total_hdd;
     int total_cores;
-    int available_ram;
-    int available_hdd;
-    int available_cores;
+    unsigned long long available;
 } SystemResources;
 
-Task tasks[MAX_TASKS];
+// Tasks live in fixed-size slabs so a Task pointer stays valid while the
+// table grows; freed slots go on a free list and live tasks are chained
+// in creation order.
+Task **task_slabs = NULL;
+int task_slab_count = 0;
+int task_free_slot = -1;
+int task_head = -1;
+int task_tail = -1;
+
+// PID -> slot index, open addressing with linear probing
+typedef struct {
+    pid_t pid;  // 0 = empty
+    int slot;
+} PidEntry;
+
+PidEntry *pid_index = NULL;
+int pid_index_cap = 0;
+int pid_index_count = 0;
+int max_tasks = 0;  // Optional cap on live tasks, 0 = unlimited
 SystemResources system_res;
 int task_count = 0;
 int current_mode = 0;
-sem_t resource_sem;
+sem_t resource_sem;  // Serializes the physical allocator
 pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
 SchedulingAlgorithm current_scheduler = FCFS;
+int headless_mode = 0;  // Trace replay: no prompts, no sleeps, no fork
+int quiet_mode = 0;     // Suppress print_* status messages
+pid_t next_sim_pid = 100000;
+int priority_aging_interval = 5;  // Seconds of waiting per priority boost, 0 = off
+long long rr_quantum = (long long)TIME_QUANTUM * TICKS_PER_SECOND;  // Ticks
+long long class_quantum[TASK_CLASS_COUNT];  // Per-class override in ticks, 0 = rr_quantum
+
+// Default I/O behaviour per class in ms: CPU time between waits, wait length
+int class_io_interval[TASK_CLASS_COUNT] = { 20, 100, 100, 50, 0 };
+int class_io_time[TASK_CLASS_COUNT] = { 200, 100, 50, 20, 0 };
+
+int mlfq_levels = 3;
+long long mlfq_quanta[MLFQ_MAX_LEVELS] = { 200, 400, 800, 1600, 3200, 6400, 12800, 25600 };
+long long mlfq_boost_period = 5000;  // Ticks between priority boosts
+
+long long cfs_target_latency = 200;  // Ticks in which every runnable job should run once
+long long cfs_min_granularity = 20;  // Shortest slice CFS hands out
+
+int deadline_factor = 4;  // Default deadline is this many bursts after arrival
+
+// Every task with a pooled name draws on one shared ticket count
+typedef struct {
+    char name[MAX_NAME_LENGTH];
+    int tickets;
+} TicketPool;
+
+TicketPool ticket_pools[TICKET_POOL_MAX];
+int ticket_pool_count = 0;
+unsigned long long rng_state = 0x9E3779B97F4A7C15ULL;
+
+typedef enum {
+    JOB_FREE,
+    JOB_READY,
+    JOB_RUNNING,
+    JOB_BLOCKED,  // Waiting for simulated I/O
+    JOB_CANCELLED,
+    JOB_SWAPPED,  // Off every queue until its task is swapped back in
+    JOB_WAITING   // Off every queue until a deferred resource request is granted
+} JobState;
+
+typedef struct {
+    pid_t pid;  // Owning Task
+    JobState state;
+    int priority;
+    TaskClass task_class;
+    long long arrival;
+    long long burst;
+    long long remaining;
+    long long first_run;  // -1 until first dispatched
+    int next_free;
+    int rq_next;  // Intrusive ready-queue link
+    int core;  // Core whose queue holds the job, or that is running it
+    long long ready_since;  // Last became ready; kept when the balancer moves it
+    
+    // CPU time between I/O waits (0 = CPU bound) and length of each wait
+    long long io_interval;
+    long long io_time;
+    long long until_io;
+    long long io_total;
+    long long disk_lba;  // --disk-io: sector the job's next request goes to
+    
+    // MLFQ state; the level is only valid while mlfq_epoch is current
+    int mlfq_level;
+    long long mlfq_used;
+    long long mlfq_epoch;
+    
+    // CFS state: weighted virtual runtime (-1 until first enqueued) and
+    // red-black tree links
+    long long vruntime;
+    int cfs_weight;
+    
+    long long deadline;  // Absolute, in ticks
+    
+    // Swapping: set while the task is out (or on its way back in); the job
+    // leaves the ready queue or I/O wait the next time it surfaces there
+    int swap_pending;
+    long long swap_ready_at;  // Swap-in completes, -1 while still out
+    
+    // Banker's modes: CPU time between incremental resource requests
+    // (0 = none left) and until the next one
+    long long request_interval;
+    long long until_request;
+    
+    // Real-time enforcement: the job's process is held with SIGSTOP
+    int stopped;
+    
+    // Lottery/Stride: own tickets, or the ticket pool shared by its name
+    int tickets;
+    int ticket_pool;
+    long long stride_pass;
+    int rb_parent;
+    int rb_left;
+    int rb_right;
+    int rb_red;
+} SimJob;
+
+typedef enum {
+    EV_ARRIVAL,
+    EV_SLICE_END,
+    EV_BALANCE,
+    EV_IO_DONE,
+    EV_DISK_DONE
+} EventType;
+
+typedef struct {
+    long long time;
+    unsigned long long seq;  // FIFO tie-break for equal times
+    EventType type;
+    int core;
+    int job;
+    unsigned int gen;
+} SimEvent;
+
+// A scheduling policy owns the ready queue. time_slice() returning 0 means
+// the job runs until it completes or blocks. account(), when set, is told
+// how long the job ran and whether its slice expired (rather than ending
+// in I/O or completion) before the job is requeued. preempts(), when set,
+// decides whether a newly ready job takes the CPU from the running one.
+// migrate(), when set, is told that a job is moving between cores' queues.
+typedef struct {
+    const char *name;
+    void *(*create)(void);
+    void (*destroy)(void *rq);
+    void (*enqueue)(void *rq, int job);
+    int (*pick_next)(void *rq);  // -1 when empty
+    long long (*time_slice)(void *rq, int job);
+    void (*account)(void *rq, int job, long long ran, int expired);
+    int (*preempts)(void *rq, int running, int woken);
+    void (*migrate)(void *from, void *to, int job);
+} SchedPolicy;
+
+typedef struct {
+    double arrival;  // Seconds
+    char name[MAX_NAME_LENGTH];
+    int ram;
+    int hdd;
+    int cpu;
+    int priority;
+    int burst;
+    int io_interval;  // Optional, ms of CPU between I/O waits (-1 = class default)
+    int io_time;      // Optional, ms per I/O wait (-1 = class default)
+    double deadline;  // Optional, seconds after arrival (-1 = burst * deadline_factor)
+    int tickets;      // Optional, Lottery/Stride tickets (-1 = priority + 1)
+} TraceRecord;
+
+typedef struct {
+    FILE *fp;
+    int line_no;
+    int status;  // Last read_trace_record() result
+} TraceReader;
+
+typedef struct {
+    long long *samples;
+    long count;
+    long cap;
+    double sum;
+} MetricSeries;
+
+typedef enum {
+    WORKLOAD_UNIFORM,
+    WORKLOAD_BURSTY,
+    WORKLOAD_HEAVY_TAILED,
+    WORKLOAD_PRIORITY_SKEWED,
+    WORKLOAD_MIXED
+} WorkloadKind;
+
+#define WORKLOAD_KIND_COUNT 5
+
+typedef struct {
+    WorkloadKind kind;
+    long remaining;
+    double clock;
+    double rate;  // Arrival-rate multiplier, e.g. the core count
+    int burst_left;  // Arrivals left in the current burst (bursty only)
+    unsigned long long rng;
+} SyntheticWorkload;
+
+// One simulated CPU core with its own ready queue
+typedef struct {
+    void *rq;
+    long queued;  // Jobs in rq, including cancelled ones not yet popped
+    int running;  // Job on the core, -1 when idle
+    long long slice_start;
+    unsigned int slice_gen;  // Invalidates stale EV_SLICE_END events
+    int slice_expires;  // Slice length came from the policy quantum
+    int last_job;  // -1 before the first dispatch, -2 once it has finished
+    long long busy_time;
+    long dispatches;
+    long migrations;  // Jobs moved onto this core
+    long steals;      // ... of which pulled while idle
+} SimCore;
+
+typedef struct {
+    long long clock;
+    
+    SimEvent *events;
+    int event_count;
+    int event_cap;
+    unsigned long long event_seq;
+    
+    SimJob *jobs;
+    int job_cap;
+    int free_job;
+    int live_jobs;
+    int swapped_jobs;  // Live but parked in JOB_SWAPPED
+    int waiting_jobs;  // ... or in JOB_WAITING
+    
+    const SchedPolicy *policy;
+    SimCore *cores;
+    int core_count;
+    long queued;
+    int balance_armed;
+    
+    // Streaming arrival source; one record of lookahead lives in the queue
+    int (*next_arrival)(void *ctx, TraceRecord *rec);
+    void *arrival_ctx;
+    TraceRecord pending;
+    
+    long submitted;
+    long started;
+    long rejected;
+    long completed;
+    long dispatches;
+    long context_switches;  // CPU handed to a different job
+    long preemptions;       // Quantum expired with work left
+    long migrations;
+    long deadline_misses;
+    long long busy_time;
+    
+    // Per-job samples in ticks, recorded on completion
+    MetricSeries turnaround;
+    MetricSeries waiting;
+    MetricSeries response;
+    
+    int jobs_only;        // Arrivals skip the task table (scheduler benchmarks)
+    int time_decisions;   // Time every enqueue/pick_next call
+    long decisions;
+    long timed_calls;
+    long long decision_ns;
+} SimEngine;
+
+SimEngine engine;
+
+typedef enum {
+    REPLACE_FIFO,
+    REPLACE_LRU,
+    REPLACE_CLOCK,
+    REPLACE_WS
+} ReplacementPolicy;
+
+#define REPLACEMENT_POLICY_COUNT 4
+
+typedef enum {
+    ACCESS_SEQUENTIAL,
+    ACCESS_RANDOM,
+    ACCESS_HOT_COLD,
+    ACCESS_LOOP
+} AccessPattern;
+
+#define ACCESS_PATTERN_COUNT 4
+
+typedef struct {
+    unsigned int *pte;  // One entry per virtual page
+    int pages;
+    int resident;
+    long faults;
+    AccessPattern pattern;
+    int cursor;  // Line position for sequential and loop patterns
+    unsigned long long rng;
+    int next_free;
+} VmSpace;
+
+typedef struct {
+    int asid;  // -1 when free
+    int vpn;
+    int prev;  // FIFO/LRU order, or the free list via next
+    int next;
+    int referenced;
+    long long last_use;  // In accesses, for the working-set policy
+} Frame;
+
+typedef struct {
+    unsigned long long tag;  // (asid << 32 | vpn) + 1, 0 = invalid
+    int frame;
+    long long stamp;
+} TlbEntry;
+
+typedef struct {
+    Frame *frames;
+    int frame_count;
+    int free_frame;
+    int list_head;  // Oldest (FIFO) or least recently used (LRU)
+    int list_tail;
+    int hand;       // Clock / WSClock position
+    VmSpace *spaces;
+    int space_cap;
+    int free_space;
+    TlbEntry tlb[TLB_SETS][TLB_WAYS];
+    ReplacementPolicy policy;
+    long long clock;  // Total accesses so far
+    long accesses;
+    long faults;
+    long tlb_hits;
+    long evictions;
+} VmSystem;
+
+VmSystem vm;
+
+typedef enum {
+    ALLOC_BUDDY,
+    ALLOC_FIRST_FIT,
+    ALLOC_BEST_FIT,
+    ALLOC_SEGREGATED
+} AllocStrategy;
+
+#define ALLOC_STRATEGY_COUNT 4
+
+typedef struct {
+    int *tree;   // tree[1] is the root, leaves start at tree[leaves]
+    int leaves;  // Rounded up to a power of two
+} MaxTree;
+
+typedef struct {
+    AllocStrategy strategy;
+    int units;           // 1 MB each
+    int *size;           // Block length at its first unit, 0 elsewhere
+    int *tag;            // Block's first unit, stored at its last unit
+    int *asked;          // Requested length of an allocated block
+    unsigned char *used;
+    int *next;           // Free list links, indexed by first unit
+    int *prev;
+    int *bins;           // Free list heads
+    int bin_count;
+    MaxTree by_addr;     // Free block length at each first unit
+    MaxTree by_bin;      // 1 where a bin's list is non-empty
+    int free_units;
+    int requested;       // Sum of requested lengths of allocated blocks
+    long allocs;
+    long frees;
+    long failures;
+    long fragmentation_rejects;  // Enough free RAM, but no block large enough
+    double external_sum;  // Fragmentation sampled after every allocation
+    double internal_sum;
+    long long alloc_ns;
+    long long free_ns;
+    long long max_alloc_ns;
+} PhysMem;
+
+PhysMem phys;
+AllocStrategy alloc_strategy = ALLOC_FIRST_FIT;
+
+typedef struct {
+    int enabled;
+    int lru_head;  // Minimized tasks still in RAM, least recently used first
+    int lru_tail;
+    int swapped_tasks;
+    int swapped_mb;  // HDD space currently holding RAM images
+    long swap_outs;
+    long swap_ins;
+    long long out_mb;
+    long long in_mb;
+    long restores;  // Restores of minimized tasks...
+    long resident_restores;  // ...that found the task still in RAM
+    long long swap_in_ticks;
+} SwapSpace;
+
+SwapSpace swap_space = { .lru_head = -1, .lru_tail = -1 };
+
+typedef enum {
+    ADMIT_OFF,
+    ADMIT_FIFO,
+    ADMIT_SMALLEST,
+    ADMIT_PRIORITY
+} AdmissionPolicy;
+
+#define ADMISSION_POLICY_COUNT 4
+
+typedef struct {
+    TraceRecord spec;  // The request as submitted, priority already drawn
+    long long queued_at;
+    long order;  // Submission order: the FIFO key and every tie-break
+    int next_free;
+} PendingTask;
+
+typedef struct {
+    AdmissionPolicy policy;
+    int batch;  // Most tasks started per pass, 0 = no limit
+    int limit;  // Most waiting tasks, 0 = no limit
+    void *queue;  // JobHeap over pending slots
+    PendingTask *pending;
+    int cap;
+    int free_slot;
+    int depth;
+    int max_depth;
+    int kick;  // Resources were released since the last pass
+    long order;
+    long queued;
+    long admitted;
+    long dropped;  // Could never fit, or the queue was full
+    MetricSeries wait;  // Ticks from submission to start
+} AdmissionQueue;
+
+AdmissionQueue admission = { .policy = ADMIT_FIFO, .free_slot = -1 };
+
+#define RES_KINDS 3  // RAM, HDD and cores, in that order, in Banker's vectors
+
+typedef enum {
+    BANKER_OFF,
+    BANKER_AVOID,
+    BANKER_DETECT
+} BankerMode;
+
+#define BANKER_MODE_COUNT 3
+
+typedef struct {
+    int max[RES_KINDS];  // Declared claim
+    int alloc[RES_KINDS];
+    int need[RES_KINDS];  // max - alloc
+    int want[RES_KINDS];  // Pending request
+    int rank[RES_KINDS];  // Position in each banker.order list
+    int ram_claim;  // MB; the RAM entries above count allocator units
+    int ram_step;  // MB the pending request adds to the task
+    int task_slot;  // -1 for benchmark clients
+    int job;
+    int waiting;
+    int wait_next;  // FIFO of waiting clients
+    int in_use;
+    int next_free;
+} BankerClient;
+
+// Need is copied next to the client so the safety check scans memory in order
+typedef struct {
+    int need;
+    int client;
+} BankerRank;
+
+typedef struct {
+    BankerMode mode;
+    int steps;  // A claim is requested in this many equal shares
+    BankerClient *clients;
+    int cap;
+    int free_client;
+    int count;
+    BankerRank *order[RES_KINDS];  // Live clients by ascending need of each resource
+    int *passed;  // Cycle search scratch, valid where passed_epoch == epoch
+    unsigned int *passed_epoch;  // Also epoch + lists passed, in the safety check
+    unsigned int epoch;
+    int wait_head;
+    int wait_tail;
+    int waiting;
+    int retrying;
+    int retry_again;
+    long requests;
+    long checks;
+    long fast_checks;  // Settled without a full pass
+    long unsafe;  // Requests deferred because granting them was unsafe...
+    long blocked;  // ...or because the resources were not free
+    long deadlocks;
+    long victims;
+    char last_cycle[256];
+} Banker;
+
+Banker banker = { .mode = BANKER_OFF, .steps = 4, .free_client = -1, .wait_head = -1, .wait_tail = -1 };
+
+// Collects exited children from a SIGCHLD signalfd on its own thread
+typedef struct {
+    int fd;  // -1 when not running; terminate_task_process() waits itself
+    pthread_t thread;
+    int stopping;  // Set by reaper_stop() before it wakes the thread
+    pid_t *pids;  // Every child we forked or spawned, under queue_mutex
+    int cap;
+    int children;  // Entries in pids, i.e. forked and not yet collected
+    long reaped;
+    long exited;  // Exited on their own while their task was still live
+    long long reclaimed_mb;
+    long killed;  // Still running after the shutdown grace period
+} Reaper;
+
+Reaper reaper = { .fd = -1 };
+
+// How a background task's child process is created
+typedef enum {
+    LAUNCH_FORK,   // fork() the whole simulator
+    LAUNCH_SPAWN,  // posix_spawn() a fresh copy of the binary as --child NAME
+    LAUNCH_POOL    // Hand the task to an idle pre-forked worker over a pipe
+} LaunchMethod;
+
+#define LAUNCH_METHOD_COUNT 3
+
+typedef struct {
+    LaunchMethod method;
+    int pool_size;  // Idle workers kept ready between bursts
+    pid_t idle_pid[LAUNCH_POOL_MAX];
+    int idle_fd[LAUNCH_POOL_MAX];  // Write end of each worker's command pipe
+    int idle;
+    char exe[MAX_PATH_LENGTH];  // Our own binary, "" if it cannot be found
+    long launches;
+    long pooled;
+    long fallbacks;  // Pool empty or spawn failed
+    MetricSeries latency;  // Microseconds per launch
+} Launcher;
+
+Launcher launcher = { .method = LAUNCH_POOL, .pool_size = 16 };
+extern char **environ;
+
+// Drives the event engine from a timerfd and makes the real children
+// follow it with SIGSTOP/SIGCONT
+typedef struct {
+    int enabled;  // --enforce
+    long long period;  // Ticks (ms) between passes
+    int fd;  // timerfd, -1 when not running
+    pthread_t thread;
+    long long armed_at;  // ns; expiry n is due at armed_at + n * period
+    unsigned long long expirations;
+    long passes;
+    long overruns;  // Expirations that went by without their own pass
+    long stops;
+    long conts;
+    MetricSeries jitter;  // us between an expiry and the pass starting
+    MetricSeries overhead;  // us per pass, engine step plus signals
+} Enforcer;
+
+Enforcer enforcer = { .period = 10, .fd = -1 };
+
+// Copy engine methods, cheapest last; each falls back to the one before
+typedef enum {
+    COPY_LOOP,      // The old fread/fwrite loop, benchmark baseline only
+    COPY_BUFFERED,  // pread/pwrite through an aligned buffer
+    COPY_SENDFILE,
+    COPY_RANGE,     // copy_file_range()
+    COPY_REFLINK    // FICLONE, shares extents with the source
+} CopyMethod;
+
+typedef struct {
+    CopyMethod method;  // What actually copied the data
+    long long total;
+    long long bytes;  // Data copied; holes are not counted
+    long long hole_bytes;
+    double seconds;
+    void (*progress)(long long done, long long total);  // Optional
+} CopyStats;
+
+typedef enum {
+    TREE_COPY,
+    TREE_DELETE,
+    TREE_MOVE  // Only reported; a move is a rename or a copy plus a delete
+} TreeOp;
+
+// Record layout returned by getdents64()
+typedef struct {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} TreeDirent;
+
+typedef struct TreeDir {
+    int src_fd;
+    int dst_fd;  // Matching directory of a copy, -1 otherwise
+    struct TreeDir *parent;  // NULL for the root
+    char *name;  // Entry name within the parent
+    int pending;  // Unfinished entries, plus one while still being listed
+} TreeDir;
+
+typedef struct {
+    TreeDir *dir;
+    char *name;
+    unsigned char type;  // DT_DIR, DT_REG, DT_LNK, ...
+} TreeItem;
+
+// One recursive operation: the shared work stack and its results
+typedef struct {
+    TreeOp op;
+    const char *root;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    TreeItem *stack;
+    int depth;
+    int cap;
+    int done;  // Root finished; idle workers exit
+    long files;
+    long dirs;
+    long long bytes;
+    long errors;
+    char first_error[MAX_PATH_LENGTH + 64];
+    double seconds;
+} TreeWalk;
+
+// Simulated disk image: block 0 holds the superblock, followed by the
+// block bitmap, the inode table and the data blocks
+typedef struct {
+    unsigned int magic;
+    unsigned int block_size;
+    unsigned int clean;  // Set on unmount, cleared while mounted
+    unsigned int mounts;
+    unsigned long long block_count;
+    unsigned long long free_blocks;
+    unsigned long long bitmap_start;
+    unsigned long long inode_start;
+    unsigned long long data_start;
+    unsigned long long alloc_hint;  // Where the next extent search starts
+    unsigned int inode_count;  // Including the unused inode 0
+    unsigned int free_inodes;
+    unsigned int inode_hint;
+    unsigned int reserved;
+    long long formatted;
+} FsSuper;
+
+typedef enum {
+    FS_FREE,
+    FS_FILE,
+    FS_DIR
+} FsType;
+
+typedef struct {
+    unsigned int start;
+    unsigned int length;  // Blocks
+} FsExtent;
+
+// 128 bytes; extents past the inline ones live in one extra block
+typedef struct {
+    unsigned short type;
+    unsigned short links;
+    unsigned int extent_count;
+    unsigned long long size;
+    long long mtime;
+    long long ctime;
+    unsigned int blocks;  // Data blocks in the extents
+    unsigned int extent_block;  // 0 = none
+    unsigned int parent;  // Directory holding this inode
+    unsigned int reserved;
+    FsExtent extents[FS_INLINE_EXTENTS];
+} FsInode;
+
+// Directories are arrays of these; inode 0 marks a free slot
+typedef struct {
+    unsigned int inode;
+    unsigned int hash;  // Of the name, checked before comparing it
+    char name[FS_NAME_MAX + 1];
+} FsDirent;
+
+typedef struct {
+    unsigned int dir;
+    unsigned long long offset;  // Of the next entry
+    FsDirent block[FS_BLOCK_SIZE / sizeof(FsDirent)];
+} FsDirIter;
+
+typedef struct {
+    int fd;  // -1 when no image is mounted
+    unsigned char *image;
+    size_t size;
+    FsSuper *sb;
+    unsigned long long *bitmap;
+    FsInode *inodes;
+    char path[MAX_PATH_LENGTH];
+    int charged_mb;  // HDD taken from the resource pool for blocks in use
+    int recovered;  // Free counts were rebuilt after an unclean shutdown
+    long long mount_ns;
+    long long bytes_read;
+    long long bytes_written;
+} SimFs;
+
+SimFs simfs = { .fd = -1 };
+
+// Block buffer cache between the filesystem and the image
+typedef enum {
+    CACHE_LRU,
+    CACHE_ARC  // Adaptive replacement: recency and frequency lists sized by ghost hits
+} CachePolicy;
+
+#define CACHE_POLICY_COUNT 2
+
+// ARC's four lists; LRU keeps everything on CACHE_T1. B1 and B2 hold
+// ghosts, headers of recently evicted blocks without their data.
+typedef enum {
+    CACHE_T1,
+    CACHE_T2,
+    CACHE_B1,
+    CACHE_B2
+} CacheList;
+
+typedef struct CacheBuf {
+    unsigned long long block;
+    unsigned char *data;  // NULL for a ghost
+    struct CacheBuf *hash_next;
+    struct CacheBuf *prev;  // Towards the most recently used end
+    struct CacheBuf *next;
+    unsigned char list;
+    unsigned char dirty;
+    unsigned char writing;  // Being written back with the lock dropped
+    unsigned char prefetched;  // Read ahead and not used yet
+    long long dirtied;  // ns
+} CacheBuf;
+
+typedef struct {
+    CacheBuf *head;  // Most recently used
+    CacheBuf *tail;
+    long count;
+} CacheQueue;
+
+typedef struct {
+    CachePolicy policy;
+    int mb;  // --cache-mb, 0 = every access goes to the disk
+    int ram_base;  // Physical RAM charged for the buffers, -1 = none
+    long long flush_ms;  // Dirty blocks are written back after at most this long
+    long capacity;  // Buffers; 0 while uncached
+    pthread_mutex_t lock;
+    pthread_cond_t wake;  // Flusher: time to write back
+    pthread_cond_t idle;  // A write-back pass finished
+    pthread_t flusher;
+    int running;
+    CacheBuf *headers;
+    CacheBuf *spare;  // Unused headers, linked through hash_next
+    unsigned char *memory;
+    unsigned char **slots;  // Unused data buffers
+    long free_slots;
+    CacheBuf **buckets;
+    unsigned long long hash_mask;
+    CacheQueue lists[4];
+    long target;  // ARC's p, the size T1 is steered towards
+    long dirty;
+    long writing;
+    unsigned char *staging;  // Read-ahead batches
+    unsigned long long ra_next;  // Block a sequential reader asks for next
+    unsigned long long ra_end;  // First block past what was read ahead
+    int ra_window;
+    long long hits;
+    long long misses;
+    long long ghost_hits;
+    long long readahead;
+    long long readahead_used;
+    long long evict_writes;  // Dirty victims written back synchronously
+    long long disk_reads;
+    long long disk_writes;
+    long long disk_blocks_read;
+    long long disk_blocks_written;
+    long long write_errors;  // Blocks whose write-back failed
+    long flushes;
+    MetricSeries flush_latency;  // us per write-back pass
+} BufferCache;
+
+BufferCache bcache = { .policy = CACHE_ARC, .mb = 16, .ram_base = -1, .flush_ms = 1000 };
+
+// Head scheduling on the simulated HDD
+typedef enum {
+    DISK_FCFS,
+    DISK_SSTF,
+    DISK_SCAN,
+    DISK_CSCAN,
+    DISK_LOOK,
+    DISK_CLOOK,
+    DISK_DEADLINE
+} DiskSchedAlgorithm;
+
+#define DISK_SCHED_COUNT 7
+
+typedef struct {
+    int job;  // DES job blocked on it, -1 in the benchmark
+    int write;
+    int sectors;
+    long long lba;
+    long long cylinder;
+    long long arrival;  // us
+    long long deadline;
+} DiskRequest;
+
+typedef struct {
+    // Geometry: every cylinder holds heads x sectors_per_track sectors
+    long long cylinders;
+    int heads;
+    int sectors_per_track;
+    int rpm;
+    int track_seek_us;  // To the next cylinder
+    int avg_seek_us;  // Over a third of the stroke
+    int full_seek_us;
+    DiskSchedAlgorithm algorithm;
+    int enabled;  // --disk-io: the DES's I/O waits are requests to this disk
+    long long head;  // Cylinder
+    int direction;  // SCAN and LOOK: 1 towards higher cylinders, -1 back
+    long long clock;  // us; the disk is busy until then
+    long long travel_us;  // Sweeps to an edge, charged to the next request
+    long long sweep;  // Deadline: cylinder the C-LOOK sweep has reached
+    DiskRequest *queue;  // Pending, in arrival order
+    int count;
+    int cap;
+    long dropped;  // Requests the queue had no room for, waited out in fixed time
+    DiskRequest current;
+    int busy;
+    long requests;
+    long long sectors_done;
+    long long seek_cylinders;
+    long long busy_us;
+    MetricSeries latency;  // us from arrival to completion
+} DiskModel;
+
+DiskModel disk = {
+    .heads = 4, .sectors_per_track = 2000, .rpm = 7200,
+    .track_seek_us = 800, .avg_seek_us = 8500, .full_seek_us = 15000,
+    .algorithm = DISK_CLOOK
+};
+
+int tree_threads = 8;  // Workers per recursive file operation
+const char *disk_image_path = "disk.img";  // --disk-image
+long vm_accesses_per_tick = 10;  // Memory accesses per ms of CPU time, 0 = paging off
+long long vm_ws_window = 50000;  // Working-set window in accesses
 
 void boot_os();
 void show_main_menu();
 void execute_task(char *task_name);
 void create_process(char *task_name, int ram, int hdd, int cpu);
+int create_process_ex(char *task_name, int ram, int hdd, int cpu, const TraceRecord *spec);
+void terminate_task_process(Task *task);
 void show_running_tasks();
-void close_task(int task_index);
-void minimize_task(int task_index);
-void restore_task(int task_index);
+void close_task(int task_id);
+void minimize_task(int task_id);
+void restore_task(int task_id);
 void switch_mode();
 void shutdown_os();
-void manage_resources(int ram, int hdd, int cpu, int allocate);
+void reaper_start();
+void reaper_stop();
+void reaper_track(pid_t pid);
+int reaper_forget(pid_t pid);
+void reaper_wait_all();
+void reaper_collect();
+void show_reaper_stats();
+void child_main(const char *task_name);
+void launcher_init();
+pid_t launch_child(const char *task_name);
+int launcher_refill();
+void launcher_drain();
+const char *launch_method_name(LaunchMethod method);
+int parse_launch_method(const char *name);
+void show_launcher_stats();
+int run_launch_benchmark(long launches, const char *csv_path);
+void enforcer_start();
+void enforcer_run(long long until_ns);
+void show_enforcer_stats();
+int run_enforce_benchmark(long seconds, const char *csv_path);
+int manage_resources(int ram, int hdd, int cpu, int allocate, int *ram_base);
 int check_resources(int ram, int hdd, int cpu);
+int resources_fit(int ram, int hdd, int cpu);
+int start_background_task(char *task_name, int ram, int hdd, int cpu, const TraceRecord *spec);
+int admission_submit(char *task_name, int ram, int hdd, int cpu, const TraceRecord *spec);
+void admission_run();
+void admission_set_policy(AdmissionPolicy policy);
+const char *admission_policy_name(AdmissionPolicy policy);
+int parse_admission_policy(const char *name);
+void show_admission_stats();
+void configure_admission();
+int grow_resources(Task *task, int ram, int hdd, int cpu);
+int banker_can_admit(int ram, int hdd, int cpu);
+void banker_attach(Task *task, int ram, int hdd, int cpu);
+void banker_remove(int client);
+void banker_retry();
+int banker_next_request(int job);
+const char *banker_mode_name(BankerMode mode);
+int parse_banker_mode(const char *name);
+void show_banker_stats();
+void configure_banker();
+void configure_disk_scheduler();
+int run_banker_benchmark(long checks, const char *csv_path);
+void res_init(int ram, int hdd, int cores);
+int res_reserve(int ram, int hdd, int cores);
+void res_adjust(int ram, int hdd, int cores);
+int res_available_ram();
+int res_available_hdd();
+int res_available_cores();
+int run_reserve_benchmark(long operations, const char *csv_path);
+void swap_lru_append(Task *task);
+void swap_lru_remove(Task *task);
+int swap_room_possible(int ram, int hdd);
+void swap_make_room(int ram, int hdd);
+int swap_out_task(Task *task);
+int swap_in_task(Task *task);
+void show_swap_stats();
 void schedule_tasks();
 void set_scheduling_algorithm();
 void show_scheduling_info();
+int parse_scheduler_name(const char *name);
+const char *scheduler_name(SchedulingAlgorithm algorithm);
+
+void sim_seed(unsigned long long seed);
+unsigned int sim_rand();
+unsigned int rng_next(unsigned long long *state);
+
+void metric_add(MetricSeries *m, long long value);
+double metric_mean(MetricSeries *m);
+double metric_percentile(MetricSeries *m, double pct);
+void metric_free(MetricSeries *m);
+
+int synthetic_next_arrival(void *ctx, TraceRecord *rec);
+const char *workload_name(WorkloadKind kind);
+FILE *bench_csv_open(const char *path, const char *header);
+int run_scheduler_benchmark(long task_total, const char *csv_path);
+int run_smp_benchmark(long task_total, const char *csv_path);
+int run_share_benchmark(long seconds, const char *csv_path);
+int run_vm_benchmark(long accesses, const char *csv_path);
+
+void vm_init(int frame_count);
+int vm_attach(int pages, AccessPattern pattern);
+void vm_detach(int asid);
+void vm_run(int asid, long accesses);
+void vm_set_policy(ReplacementPolicy policy);
+const char *replacement_policy_name(ReplacementPolicy policy);
+int parse_replacement_policy(const char *name);
+AccessPattern access_pattern_for(TaskClass task_class);
+const char *access_pattern_name(AccessPattern pattern);
+void show_frame_map();
+void phys_init(int units, AllocStrategy strategy);
+int phys_alloc(int units);
+int phys_free(int start);
+int phys_can_alloc(int units);
+int phys_block_size(int units);
+int phys_largest_free();
+double phys_external_fragmentation();
+double phys_internal_fragmentation();
+int phys_set_strategy(AllocStrategy strategy);
+const char *alloc_strategy_name(AllocStrategy strategy);
+int parse_alloc_strategy(const char *name);
+void show_allocation_map();
+int run_alloc_benchmark(long operations, const char *csv_path);
+long long monotonic_ns();
+void sim_sleep(int seconds);
+int read_trace_record(FILE *fp, TraceRecord *rec, int *line_no);
+int replay_trace(const char *path);
+int trace_next_arrival(void *ctx, TraceRecord *rec);
+void remove_task(Task *task);
+Task *task_alloc();
+void task_release(Task *task);
+Task *task_slot(int slot);
+Task *task_lookup(int task_id);
+Task *task_by_pid(pid_t pid);
+Task *task_first();
+Task *task_next(Task *task);
+Task *task_last();
+void pid_index_insert(pid_t pid, int slot);
+void pid_index_remove(pid_t pid);
+const SchedPolicy *policy_for(SchedulingAlgorithm algorithm);
+TaskClass task_class_for(const char *task_name);
+const char *task_class_name(TaskClass task_class);
+int parse_task_class(const char *name);
+void configure_time_quantum();
+void configure_mlfq();
+void configure_cfs();
+void configure_ticket_pools();
+int set_ticket_pool(const char *name, int tickets);
+int ticket_pool_for(const char *name);
+void show_share_report();
+int parse_mlfq_quanta(const char *list);
+
+void des_init(const SchedPolicy *policy);
+void des_set_policy(const SchedPolicy *policy);
+int des_submit(pid_t pid, const TraceRecord *spec);
+void des_cancel(int job);
+int des_suspend(int job);
+void des_set_requests(int job, long long interval);
+void des_grant(int job);
+void des_resume(int job, long long delay);
+long long des_job_remaining(int job);
+int des_job_core(int job);
+int des_job_blocked(int job);
+long long des_job_deadline(int job);
+void des_wake(int job);
+void des_handle_slice_end(int core);
+void des_handle_disk_done();
+void show_core_stats();
+void des_set_arrivals(int (*next)(void *ctx, TraceRecord *rec), void *ctx);
+void des_advance(long long ticks);
+void des_run_until(long long limit);
+void *job_heap_create(long long (*key)(int job));
+void job_heap_destroy(void *rq);
+void job_heap_push(void *rq, int job);
+int job_heap_pop(void *rq);
+int job_heap_peek(void *rq);
+void print_usage(const char *prog);
 
 void notepad();
 void calculator();
@@ -77,6 +1150,52 @@ void show_time();
 void create_file();
 void move_file();
 void copy_file();
+int copy_engine(const char *source, const char *dest, CopyMethod method, CopyStats *stats);
+const char *copy_method_name(CopyMethod method);
+void copy_progress(long long done, long long total);
+int run_copy_benchmark(long max_mb, const char *dir, const char *csv_path);
+int copy_fds(int in, int out, long long size, CopyMethod method, CopyStats *stats);
+int tree_run(TreeOp op, const char *source, const char *dest, int threads, TreeWalk *w);
+int tree_move(const char *source, const char *dest, int threads, TreeWalk *w, TreeWalk *removed);
+void print_tree_result(const char *verb, TreeWalk *w);
+int run_tree_benchmark(long files, const char *dir, const char *csv_path);
+int fs_mount(const char *path, long long mb);
+void fs_unmount();
+const char *host_path(const char *path);
+void fs_path_hint();
+int fs_lookup(const char *path);
+int fs_create(const char *path, FsType type);
+int fs_open_empty(const char *path);
+long long fs_read(unsigned int ino, unsigned long long offset, void *buf, size_t len);
+long long fs_write(unsigned int ino, unsigned long long offset, const void *buf, size_t len);
+int fs_unlink(const char *path);
+int fs_rename(const char *source, const char *dest);
+int fs_copy(const char *source, const char *dest);
+long fs_remove_tree(const char *path);
+int fs_import(const char *host, const char *path);
+int fs_export(const char *path, const char *host);
+FsInode *fs_inode(unsigned int ino);
+int fs_dir_empty(unsigned int dir);
+void fs_print_info(const char *path);
+void show_fs_stats();
+int run_fs_benchmark(long mb, const char *dir, const char *csv_path);
+void bcache_io(unsigned long long block, unsigned long long end, unsigned int in, char *buf, size_t len,
+               int write);
+void bcache_forget(unsigned long long start, unsigned long long count);
+int bcache_start(int mb, CachePolicy policy);
+void bcache_stop();
+void bcache_sync();
+const char *cache_policy_name(CachePolicy policy);
+int parse_cache_policy(const char *name);
+void show_cache_stats();
+int run_cache_benchmark(long mb, const char *dir, const char *csv_path);
+void disk_init(long long mb);
+void disk_submit_job(int job);
+long long disk_start(long long now);
+const char *disk_sched_name(DiskSchedAlgorithm algorithm);
+int parse_disk_sched(const char *name);
+void show_disk_stats();
+int run_disk_benchmark(long requests, int hdd_mb, const char *csv_path);
 void delete_file();
 void file_info();
 void minesweeper();
@@ -99,9 +1218,343 @@ void loading_animation(char *message, int seconds);
 void beep_sound(int duration_ms, int frequency);
 int kbhit();
 
-int main() {
+int main(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--child") == 0) {
+        child_main(argv[2]);  // Spawned task process, never returns
+    }
     sem_init(&resource_sem, 0, 1);
     
+    char *trace_path = NULL;
+    char *csv_path = NULL;
+    long bench_tasks = 0;
+    long smp_tasks = 0;
+    long share_seconds = 0;
+    long vm_bench_accesses = 0;
+    long alloc_operations = 0;
+    long reserve_operations = 0;
+    long banker_checks = 0;
+    long launch_count = 0;
+    long enforce_seconds = 0;
+    long copy_max_mb = 0;
+    long tree_files = 0;
+    long fs_file_mb = 0;
+    long cache_file_mb = 0;
+    long disk_requests = 0;
+    const char *copy_dir = ".";
+    int vm_frames = 0;
+    int vm_rate_set = 0;
+    int ram_arg = 4096, hdd_arg = 102400, cores_arg = 8;
+    int bench_cores = 0;
+    int verbose = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            sim_seed(strtoull(argv[++i], NULL, 10));
+        } else if (strcmp(argv[i], "--ram") == 0 && i + 1 < argc) {
+            ram_arg = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hdd") == 0 && i + 1 < argc) {
+            hdd_arg = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+            cores_arg = atoi(argv[++i]);
+            bench_cores = cores_arg;
+        } else if (strcmp(argv[i], "--scheduler") == 0 && i + 1 < argc) {
+            int algorithm = parse_scheduler_name(argv[++i]);
+            if (algorithm < 0) {
+                fprintf(stderr, "Unknown scheduler %s\n", argv[i]);
+                return 1;
+            }
+            current_scheduler = algorithm;
+        } else if (strcmp(argv[i], "--bench-sched") == 0) {
+            bench_tasks = 100000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                bench_tasks = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--bench-smp") == 0) {
+            smp_tasks = 100000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                smp_tasks = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--bench-share") == 0) {
+            share_seconds = 1000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                share_seconds = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--bench-vm") == 0) {
+            vm_bench_accesses = 10000000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                vm_bench_accesses = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--bench-alloc") == 0) {
+            alloc_operations = 1000000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                alloc_operations = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--mem-alloc") == 0 && i + 1 < argc) {
+            int strategy = parse_alloc_strategy(argv[++i]);
+            if (strategy < 0) {
+                fprintf(stderr, "Unknown allocator %s\n", argv[i]);
+                return 1;
+            }
+            alloc_strategy = strategy;
+        } else if (strcmp(argv[i], "--bench-reserve") == 0) {
+            reserve_operations = 4000000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                reserve_operations = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--swap") == 0) {
+            swap_space.enabled = 1;
+        } else if (strcmp(argv[i], "--banker") == 0 && i + 1 < argc) {
+            int mode = parse_banker_mode(argv[++i]);
+            if (mode < 0) {
+                fprintf(stderr, "Unknown deadlock mode %s\n", argv[i]);
+                return 1;
+            }
+            banker.mode = mode;
+        } else if (strcmp(argv[i], "--banker-steps") == 0 && i + 1 < argc) {
+            banker.steps = atoi(argv[++i]);
+            if (banker.steps < 1) banker.steps = 1;
+        } else if (strcmp(argv[i], "--bench-banker") == 0) {
+            banker_checks = 100000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                banker_checks = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--launcher") == 0 && i + 1 < argc) {
+            int method = parse_launch_method(argv[++i]);
+            if (method < 0) {
+                fprintf(stderr, "Unknown launcher %s\n", argv[i]);
+                return 1;
+            }
+            launcher.method = method;
+        } else if (strcmp(argv[i], "--launch-pool") == 0 && i + 1 < argc) {
+            launcher.pool_size = atoi(argv[++i]);
+            if (launcher.pool_size < 0) launcher.pool_size = 0;
+            if (launcher.pool_size > LAUNCH_POOL_MAX) launcher.pool_size = LAUNCH_POOL_MAX;
+        } else if (strcmp(argv[i], "--bench-launch") == 0) {
+            launch_count = 200;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                launch_count = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--enforce") == 0) {
+            enforcer.enabled = 1;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                enforcer.period = atoll(argv[++i]);
+                if (enforcer.period <= 0) enforcer.period = 10;
+            }
+        } else if (strcmp(argv[i], "--bench-enforce") == 0) {
+            enforce_seconds = -1;  // Sized from the quantum below
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                enforce_seconds = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--bench-copy") == 0) {
+            copy_max_mb = 1024;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                copy_max_mb = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--bench-tree") == 0) {
+            tree_files = 100000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                tree_files = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--tree-threads") == 0 && i + 1 < argc) {
+            tree_threads = atoi(argv[++i]);
+            if (tree_threads < 1) tree_threads = 1;
+            if (tree_threads > TREE_MAX_THREADS) tree_threads = TREE_MAX_THREADS;
+        } else if (strcmp(argv[i], "--disk-image") == 0 && i + 1 < argc) {
+            disk_image_path = argv[++i];
+        } else if (strcmp(argv[i], "--bench-fs") == 0) {
+            fs_file_mb = 256;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                fs_file_mb = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            bcache.mb = atoi(argv[++i]);
+            if (bcache.mb < 0) bcache.mb = 0;
+        } else if (strcmp(argv[i], "--cache-policy") == 0 && i + 1 < argc) {
+            int policy = parse_cache_policy(argv[++i]);
+            if (policy < 0) {
+                fprintf(stderr, "Unknown cache policy %s\n", argv[i]);
+                return 1;
+            }
+            bcache.policy = policy;
+        } else if (strcmp(argv[i], "--flush-ms") == 0 && i + 1 < argc) {
+            bcache.flush_ms = atoll(argv[++i]);
+            if (bcache.flush_ms < 1) bcache.flush_ms = 1;
+        } else if (strcmp(argv[i], "--bench-cache") == 0) {
+            cache_file_mb = 256;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                cache_file_mb = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--disk-sched") == 0 && i + 1 < argc) {
+            int algorithm = parse_disk_sched(argv[++i]);
+            if (algorithm < 0) {
+                fprintf(stderr, "Unknown disk scheduler %s\n", argv[i]);
+                return 1;
+            }
+            disk.algorithm = algorithm;
+        } else if (strcmp(argv[i], "--disk-io") == 0) {
+            disk.enabled = 1;
+        } else if (strcmp(argv[i], "--bench-disk") == 0) {
+            disk_requests = 20000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                disk_requests = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--bench-dir") == 0 && i + 1 < argc) {
+            copy_dir = argv[++i];
+        } else if (strcmp(argv[i], "--admission") == 0 && i + 1 < argc) {
+            int policy = parse_admission_policy(argv[++i]);
+            if (policy < 0) {
+                fprintf(stderr, "Unknown admission policy %s\n", argv[i]);
+                return 1;
+            }
+            admission.policy = policy;
+        } else if (strcmp(argv[i], "--admit-batch") == 0 && i + 1 < argc) {
+            admission.batch = atoi(argv[++i]);
+            if (admission.batch < 0) admission.batch = 0;
+        } else if (strcmp(argv[i], "--admit-limit") == 0 && i + 1 < argc) {
+            admission.limit = atoi(argv[++i]);
+            if (admission.limit < 0) admission.limit = 0;
+        } else if (strcmp(argv[i], "--vm-policy") == 0 && i + 1 < argc) {
+            int policy = parse_replacement_policy(argv[++i]);
+            if (policy < 0) {
+                fprintf(stderr, "Unknown replacement policy %s\n", argv[i]);
+                return 1;
+            }
+            vm.policy = policy;
+        } else if (strcmp(argv[i], "--vm-rate") == 0 && i + 1 < argc) {
+            vm_accesses_per_tick = atol(argv[++i]);
+            vm_rate_set = 1;
+        } else if (strcmp(argv[i], "--vm-frames") == 0 && i + 1 < argc) {
+            vm_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tickets") == 0 && i + 1 < argc) {
+            // NAME=N, e.g. "Music Player=400"
+            char pool_name[MAX_NAME_LENGTH];
+            int pool_tickets;
+            if (sscanf(argv[++i], "%49[^=]=%d", pool_name, &pool_tickets) != 2 ||
+                !set_ticket_pool(pool_name, pool_tickets)) {
+                fprintf(stderr, "Bad --tickets value %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if (strcmp(argv[i], "--quantum") == 0 && i + 1 < argc) {
+            rr_quantum = atoll(argv[++i]);
+            if (rr_quantum <= 0) rr_quantum = (long long)TIME_QUANTUM * TICKS_PER_SECOND;
+        } else if (strcmp(argv[i], "--class-quantum") == 0 && i + 1 < argc) {
+            // CLASS=MS, e.g. interactive=500
+            char class_name[32];
+            long long quantum;
+            if (sscanf(argv[++i], "%31[^=]=%lld", class_name, &quantum) != 2 ||
+                parse_task_class(class_name) < 0) {
+                fprintf(stderr, "Bad --class-quantum value %s\n", argv[i]);
+                return 1;
+            }
+            class_quantum[parse_task_class(class_name)] = quantum;
+        } else if (strcmp(argv[i], "--mlfq-quanta") == 0 && i + 1 < argc) {
+            if (!parse_mlfq_quanta(argv[++i])) {
+                fprintf(stderr, "Bad --mlfq-quanta value %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--mlfq-boost") == 0 && i + 1 < argc) {
+            mlfq_boost_period = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--deadline-factor") == 0 && i + 1 < argc) {
+            deadline_factor = atoi(argv[++i]);
+            if (deadline_factor <= 0) deadline_factor = 4;
+        } else if (strcmp(argv[i], "--cfs-latency") == 0 && i + 1 < argc) {
+            cfs_target_latency = atoll(argv[++i]);
+            if (cfs_target_latency <= 0) cfs_target_latency = 200;
+        } else if (strcmp(argv[i], "--cfs-min-gran") == 0 && i + 1 < argc) {
+            cfs_min_granularity = atoll(argv[++i]);
+            if (cfs_min_granularity <= 0) cfs_min_granularity = 20;
+        } else if (strcmp(argv[i], "--aging") == 0 && i + 1 < argc) {
+            priority_aging_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-tasks") == 0 && i + 1 < argc) {
+            max_tasks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = 1;
+        } else {
+            print_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    
+    if (vm_bench_accesses > 0) {
+        return run_vm_benchmark(vm_bench_accesses, csv_path);
+    }
+    if (alloc_operations > 0) {
+        return run_alloc_benchmark(alloc_operations, csv_path);
+    }
+    if (reserve_operations > 0) {
+        return run_reserve_benchmark(reserve_operations, csv_path);
+    }
+    if (banker_checks > 0) {
+        return run_banker_benchmark(banker_checks, csv_path);
+    }
+    if (launch_count > 0) {
+        launcher_init();
+        return run_launch_benchmark(launch_count, csv_path);
+    }
+    if (copy_max_mb > 0) {
+        return run_copy_benchmark(copy_max_mb, copy_dir, csv_path);
+    }
+    if (tree_files > 0) {
+        return run_tree_benchmark(tree_files, copy_dir, csv_path);
+    }
+    if (fs_file_mb > 0) {
+        return run_fs_benchmark(fs_file_mb, copy_dir, csv_path);
+    }
+    if (cache_file_mb > 0) {
+        return run_cache_benchmark(cache_file_mb, copy_dir, csv_path);
+    }
+    if (disk_requests > 0) {
+        return run_disk_benchmark(disk_requests, hdd_arg, csv_path);
+    }
+    if (enforce_seconds != 0) {
+        // Long enough for Round Robin to rotate through 50 quanta
+        if (enforce_seconds < 0) {
+            enforce_seconds = (50 * rr_quantum + TICKS_PER_SECOND - 1) / TICKS_PER_SECOND;
+        }
+        // One simulated core per real one unless --cores says otherwise
+        system_res.total_cores = bench_cores > 0 ? bench_cores : 1;
+        return run_enforce_benchmark(enforce_seconds, csv_path);
+    }
+    
+    if (bench_tasks > 0 || smp_tasks > 0 || share_seconds > 0 || trace_path != NULL) {
+        headless_mode = 1;
+        // Paging costs per access; replays only model it when asked to
+        if (!vm_rate_set) vm_accesses_per_tick = 0;
+        quiet_mode = !verbose;
+        res_init(ram_arg, hdd_arg, cores_arg);
+        phys_init(ram_arg, alloc_strategy);
+    }
+    
+    if (bench_tasks > 0) {
+        // The policy comparison defaults to a single CPU unless --cores is given
+        system_res.total_cores = bench_cores > 0 ? bench_cores : 1;
+        quiet_mode = 1;
+        return run_scheduler_benchmark(bench_tasks, csv_path);
+    }
+    if (smp_tasks > 0) {
+        quiet_mode = 1;
+        return run_smp_benchmark(smp_tasks, csv_path);
+    }
+    if (share_seconds > 0) {
+        system_res.total_cores = bench_cores > 0 ? bench_cores : 1;
+        quiet_mode = 1;
+        return run_share_benchmark(share_seconds, csv_path);
+    }
+    
+    if (trace_path != NULL) {
+        if (vm_accesses_per_tick > 0) {
+            vm_init(vm_frames > 0 ? vm_frames : system_res.total_ram * (1024 / PAGE_SIZE_KB));
+        }
+        int status = replay_trace(trace_path);
+        sem_destroy(&resource_sem);
+        pthread_mutex_destroy(&queue_mutex);
+        return status;
+    }
+    
     printf("Enter total RAM (MB): ");
     if (scanf("%d", &system_res.total_ram) != 1) {
         print_error("Invalid input for RAM!");
@@ -120,10 +1573,17 @@ int main() {
         return 1;
     }
     
-    system_res.available_ram = system_res.total_ram;
-    system_res.available_hdd = system_res.total_hdd;
-    system_res.available_cores = system_res.total_cores;
+    res_init(system_res.total_ram, system_res.total_hdd, system_res.total_cores);
+    phys_init(system_res.total_ram, alloc_strategy);
     
+    des_init(policy_for(current_scheduler));
+    if (vm_accesses_per_tick > 0) {
+        vm_init(vm_frames > 0 ? vm_frames : system_res.total_ram * (1024 / PAGE_SIZE_KB));
+    }
+    launcher_init();
+    reaper_start();
+    if (launcher.method == LAUNCH_POOL) launcher_refill();
+    enforcer_start();
     boot_os();
     
     int choice;
@@ -186,6 +1646,21 @@ void boot_os() {
 	 printf("   	    ╚═╝  ╚═╝ ╚═════╝  \n");
          printf("      Operating System Simulator\n");
     loading_animation("Booting OS", 3);
+    
+    int mounted = fs_mount(disk_image_path, system_res.total_hdd);
+    if (mounted != 0) {
+        char message[MAX_PATH_LENGTH + 96];
+        snprintf(message, sizeof(message), mounted < 0 ?
+                 "Cannot mount disk image %s (%s), file apps use the host filesystem" :
+                 "Disk image %s holds more data than the HDD pool%s", disk_image_path,
+                 mounted < 0 ? strerror(errno) : "");
+        print_warning(message);
+        sleep(2);
+    }
+    if (simfs.fd >= 0 && bcache_start(bcache.mb, bcache.policy) != 0) {
+        print_warning("Not enough RAM for the buffer cache, disk image I/O is uncached");
+        sleep(2);
+    }
     create_process("Calendar", 15, 2, 1);
 }
 
@@ -211,9 +1686,7 @@ void show_main_menu() {
     printf("18. End Task Immediately\n");
     printf("19. Switch Mode (%s)\n", current_mode ? "Kernel" : "User");
     printf("20. Shutdown\n");
-    printf("21. Set CPU Scheduling (%s)\n", 
-           current_scheduler == FCFS ? "FCFS" : 
-           current_scheduler == ROUND_ROBIN ? "Round Robin" : "Priority");
+    printf("21. Set CPU Scheduling (%s)\n", scheduler_name(current_scheduler));
 }
 
 void execute_task(char *task_name) {
@@ -257,54 +1730,41 @@ void execute_task(char *task_name) {
 }
 
 void create_process(char *task_name, int ram, int hdd, int cpu) {
-    if (!check_resources(ram, hdd, cpu)) {
+    create_process_ex(task_name, ram, hdd, cpu, NULL);
+}
+
+// spec carries the trace fields for headless tasks; NULL or -1 fields are
+// drawn from the simulator RNG / class defaults. Returns 1 if the task was
+// started (or run in the foreground), 2 if it is waiting for admission,
+// 0 if it was rejected.
+int create_process_ex(char *task_name, int ram, int hdd, int cpu, const TraceRecord *spec) {
+    // Once tasks are waiting, newcomers queue behind them rather than
+    // taking the room a release frees up for the head of the queue
+    int queue_first = admission.policy != ADMIT_OFF &&
+                      (admission.depth > 0 || (max_tasks > 0 && task_count >= max_tasks));
+    if (queue_first || !check_resources(ram, hdd, cpu)) {
+        if (admission.policy != ADMIT_OFF) {
+            return admission_submit(task_name, ram, hdd, cpu, spec);
+        }
         print_error("Not enough resources to start this task!");
-        sleep(1);
-        return;
+        sim_sleep(1);
+        return 0;
     }
 
-    printf("Run in background? (y/n): ");
-    char bg;
-    scanf(" %c", &bg);
-    int run_in_background = (bg == 'y' || bg == 'Y');
+    int run_in_background = 1;
+    if (!headless_mode) {
+        printf("Run in background? (y/n): ");
+        char bg;
+        scanf(" %c", &bg);
+        run_in_background = (bg == 'y' || bg == 'Y');
+    }
 
     if (run_in_background) {
-        pid_t pid = fork();
-        
-        if (pid == 0) {
-            if (strcmp(task_name, "Calendar") == 0) {
-                while(1) { sleep(60); }
-            } else if (strcmp(task_name, "Time") == 0) {
-                while(1) { sleep(1); }
-            }
-            exit(0);
-        } else if (pid > 0) {
-            pthread_mutex_lock(&queue_mutex);
-            
-            if (task_count < MAX_TASKS) {
-                tasks[task_count].pid = pid;
-                strcpy(tasks[task_count].name, task_name);
-                tasks[task_count].ram_usage = ram;
-                tasks[task_count].hdd_usage = hdd;
-                tasks[task_count].cpu_usage = cpu;
-                tasks[task_count].is_running = 1;
-                tasks[task_count].is_minimized = 0;
-                tasks[task_count].start_time = time(NULL);
-                tasks[task_count].priority = rand() % 5 + 1;  // Random priority 1-5
-                tasks[task_count].remaining_time = (rand() % 10) + 1;  // Random burst time 1-10
-                
-                manage_resources(ram, hdd, cpu, 1);
-                task_count++;
-                
-                print_success("Task started in background!");
-            } else {
-                print_error("Maximum number of tasks reached!");
-                kill(pid, SIGTERM);
-            }
-            
-            pthread_mutex_unlock(&queue_mutex);
-            sleep(1);
-        }
+        // Pause on the result here rather than in start_background_task(),
+        // which the admission queue calls once per waiting task
+        int started = start_background_task(task_name, ram, hdd, cpu, spec);
+        sim_sleep(1);
+        return started;
     } else {
         if (strcmp(task_name, "Notepad") == 0) {
             notepad();
@@ -340,71 +1800,165 @@ void create_process(char *task_name, int ram, int hdd, int cpu) {
             help_system();
         }
     }
+    return 1;
 }
 
-void schedule_tasks() {
-    if (task_count == 0) return;
-
+// Forks (or, headless, numbers) the task and reserves its resources.
+// Returns 1 if it was started, 0 if the reservation or a task slot was
+// not available after all.
+int start_background_task(char *task_name, int ram, int hdd, int cpu, const TraceRecord *spec) {
+    int priority = spec != NULL ? spec->priority : -1;
+    int burst = spec != NULL ? spec->burst : -1;
+    
+    // Held across fork() so a child that exits at once is not collected
+    // by the reaper before its task is registered
     pthread_mutex_lock(&queue_mutex);
-
-    switch(current_scheduler) {
-        case FCFS:
-            // First-Come-First-Serve - no reordering needed
-            break;
-            
-        case ROUND_ROBIN: {
-            // Move the first task to the end of the queue
-            Task temp = tasks[0];
-            for (int i = 0; i < task_count - 1; i++) {
-                tasks[i] = tasks[i + 1];
+    pid_t pid = headless_mode ? next_sim_pid++ : launch_child(task_name);
+    int started = 0;
+    
+    if (pid < 0) {
+        pthread_mutex_unlock(&queue_mutex);
+        print_error("Failed to start the task process!");
+    } else {
+        // check_resources() only screened the request; the reservation
+        // is what counts, and it fails if another launcher got there first.
+        // Under the Banker's modes ram/hdd/cpu are claims and the task
+        // starts with the first step of each. Minimized tasks are swapped
+        // out here, once the task is starting
+        int grant[RES_KINDS] = { ram, hdd, cpu };
+        if (banker.mode != BANKER_OFF) {
+            for (int r = 0; r < RES_KINDS; r++) {
+                grant[r] = (grant[r] + banker.steps - 1) / banker.steps;
             }
-            tasks[task_count - 1] = temp;
+        }
+        if (swap_space.enabled && !phys_can_alloc(grant[0])) swap_make_room(grant[0], grant[1]);
+        int ram_base = -1;
+        int reserved = (banker.mode == BANKER_OFF || banker_can_admit(ram, hdd, cpu)) &&
+                       manage_resources(grant[0], grant[1], grant[2], 1, &ram_base);
+        Task *task = reserved && (max_tasks == 0 || task_count < max_tasks) ? task_alloc() : NULL;
+        
+        if (task != NULL) {
+            task->ram_base = ram_base;
+            task->pid = pid;
+            strncpy(task->name, task_name, MAX_NAME_LENGTH - 1);
+            task->name[MAX_NAME_LENGTH - 1] = '\0';
+            task->ram_usage = grant[0];
+            task->hdd_usage = grant[1];
+            task->cpu_usage = grant[2];
+            task->is_running = 1;
+            task->is_minimized = 0;
+            task->is_swapped = 0;
+            task->start_time = time(NULL);
+            task->priority = priority >= 0 ? priority : (int)(sim_rand() % MAX_PRIORITY) + 1;  // Random priority 1-63
+            task->remaining_time = burst >= 0 ? burst : (int)(sim_rand() % 10) + 1;  // Random burst time 1-10
+            task->deadline = spec != NULL && spec->deadline >= 0 ?
+                             (int)spec->deadline : task->remaining_time * deadline_factor;
+            task->tickets = spec != NULL && spec->tickets > 0 ? spec->tickets : task->priority + 1;
+            task->is_simulated = headless_mode;
+            task->asid = vm_attach(ram * (1024 / PAGE_SIZE_KB), access_pattern_for(task_class_for(task_name)));
             
-            // Decrease remaining time for current task
-            tasks[task_count - 1].remaining_time -= TIME_QUANTUM;
-            
-            // If task is done, remove it
-            if (tasks[task_count - 1].remaining_time <= 0) {
-                manage_resources(tasks[task_count - 1].ram_usage, 
-                                tasks[task_count - 1].hdd_usage, 
-                                tasks[task_count - 1].cpu_usage, 0);
-                kill(tasks[task_count - 1].pid, SIGTERM);
-                waitpid(tasks[task_count - 1].pid, NULL, 0);
-                task_count--;
+            TraceRecord job_spec;
+            if (spec != NULL) {
+                job_spec = *spec;
+            } else {
+                memset(&job_spec, 0, sizeof(job_spec));
+                job_spec.io_interval = job_spec.io_time = -1;
+                job_spec.deadline = task->deadline;
             }
-            break;
-        }
+            strcpy(job_spec.name, task->name);
+            job_spec.tickets = task->tickets;
+            job_spec.priority = task->priority;
+            job_spec.burst = task->remaining_time;
+            task->job_id = des_submit(pid, &job_spec);
+            task->banker_client = -1;
+            if (banker.mode != BANKER_OFF) banker_attach(task, ram, hdd, cpu);
+            pid_index_insert(pid, task->id & (MAX_TASK_SLOTS - 1));
+            started = 1;
             
-        case PRIORITY: {
-            // Sort tasks by priority (higher priority first)
-            for (int i = 0; i < task_count - 1; i++) {
-                for (int j = 0; j < task_count - i - 1; j++) {
-                    if (tasks[j].priority < tasks[j + 1].priority) {
-                        Task temp = tasks[j];
-                        tasks[j] = tasks[j + 1];
-                        tasks[j + 1] = temp;
-                    }
+            print_success("Task started in background!");
+        } else {
+            if (reserved) {
+                manage_resources(grant[0], grant[1], grant[2], 0, &ram_base);
+                print_error(max_tasks == 0 || task_count < max_tasks ?
+                            "Cannot grow the task table!" : "Maximum number of tasks reached!");
+            } else {
+                print_error("Not enough resources to start this task!");
+            }
+            if (!headless_mode) {
+                kill(pid, SIGTERM);
+                if (reaper.fd < 0) {
+                    waitpid(pid, NULL, 0);
+                    reaper_forget(pid);
                 }
             }
-            break;
         }
+        
+        pthread_mutex_unlock(&queue_mutex);
     }
+    return started;
+}
 
-    pthread_mutex_unlock(&queue_mutex);
+// Caller holds queue_mutex. With the reaper running this only signals;
+// the exit is collected asynchronously.
+void terminate_task_process(Task *task) {
+    if (task->is_simulated || task->is_reaped) return;
+    
+    kill(task->pid, SIGTERM);
+    // A child held by the enforcer only acts on SIGTERM once continued
+    if (enforcer.fd >= 0) kill(task->pid, SIGCONT);
+    if (reaper.fd < 0) {
+        waitpid(task->pid, NULL, 0);
+        reaper_forget(task->pid);
+    }
+}
+
+// Each scheduling pass lets one default quantum of virtual time elapse
+// on the discrete-event engine, whichever policy is selected.
+void schedule_tasks() {
+    // With enforcement on, the enforcer thread advances the clock in real time
+    if (task_count > 0 && enforcer.fd < 0) {
+        pthread_mutex_lock(&queue_mutex);
+        des_advance(rr_quantum);
+        pthread_mutex_unlock(&queue_mutex);
+    }
+    
+    // Tasks that completed above may have made room for waiting ones
+    if (admission.kick) admission_run();
+    // Forks for the next burst happen here, off the launch path
+    if (launcher.method == LAUNCH_POOL) launcher_refill();
 }
 
+// Tunables offered below the algorithm list in set_scheduling_algorithm()
+typedef struct {
+    const char *label;
+    void (*configure)();
+} SchedSetting;
+
+const SchedSetting scheduler_settings[] = {
+    { "Time Quantum", configure_time_quantum },
+    { "MLFQ", configure_mlfq },
+    { "CFS", configure_cfs },
+    { "Ticket Pools", configure_ticket_pools },
+    { "Admission Queue", configure_admission },
+    { "Deadlock Handling", configure_banker },
+    { "Disk Scheduling", configure_disk_scheduler },
+};
+
+#define SCHED_SETTING_COUNT (int)(sizeof(scheduler_settings) / sizeof(scheduler_settings[0]))
+
 void set_scheduling_algorithm() {
     clear_screen();
     printf("=== CPU Scheduling Algorithm ===\n");
-    printf("Current algorithm: %s\n", 
-           current_scheduler == FCFS ? "First-Come-First-Serve" : 
-           current_scheduler == ROUND_ROBIN ? "Round Robin" : "Priority");
+    printf("Current algorithm: %s\n", scheduler_name(current_scheduler));
     
     printf("\nSelect new algorithm:\n");
-    printf("1. First-Come-First-Serve (FCFS)\n");
-    printf("2. Round Robin\n");
-    printf("3. Priority Scheduling\n");
-    printf("4. Back to Main Menu\n");
+    for (int i = 0; i < SCHED_ALGORITHM_COUNT; i++) {
+        printf("%d. %s\n", i + 1, scheduler_name(i));
+    }
+    for (int i = 0; i < SCHED_SETTING_COUNT; i++) {
+        printf("%d. Configure %s\n", SCHED_ALGORITHM_COUNT + i + 1, scheduler_settings[i].label);
+    }
+    printf("%d. Back to Main Menu\n", SCHED_ALGORITHM_COUNT + SCHED_SETTING_COUNT + 1);
     
     int choice;
     printf("\nEnter your choice: ");
@@ -413,40 +1967,282 @@ void set_scheduling_algorithm() {
         return;
     }
     
-    switch(choice) {
-        case 1: current_scheduler = FCFS; break;
-        case 2: current_scheduler = ROUND_ROBIN; break;
-        case 3: current_scheduler = PRIORITY; break;
-        case 4: return;
-        default: print_error("Invalid choice!"); sleep(1); return;
+    if (choice > SCHED_ALGORITHM_COUNT && choice <= SCHED_ALGORITHM_COUNT + SCHED_SETTING_COUNT) {
+        scheduler_settings[choice - SCHED_ALGORITHM_COUNT - 1].configure();
+        return;
+    } else if (choice == SCHED_ALGORITHM_COUNT + SCHED_SETTING_COUNT + 1) {
+        return;
+    } else if (choice < 1 || choice > SCHED_ALGORITHM_COUNT) {
+        print_error("Invalid choice!");
+        sleep(1);
+        return;
     }
+    current_scheduler = choice - 1;
+    
+    pthread_mutex_lock(&queue_mutex);
+    des_set_policy(policy_for(current_scheduler));
+    pthread_mutex_unlock(&queue_mutex);
     
     print_success("Scheduling algorithm changed!");
     sleep(1);
 }
 
+void configure_time_quantum() {
+    printf("\nDefault quantum is %lld ms\n", rr_quantum);
+    printf("Enter new default quantum in ms (0 keeps current): ");
+    long long quantum;
+    if (scanf("%lld", &quantum) != 1 || quantum < 0) {
+        print_error("Invalid input!");
+        return;
+    }
+    if (quantum > 0) rr_quantum = quantum;
+    
+    printf("\nPer-class overrides (0 uses the default):\n");
+    for (int i = 0; i < TASK_CLASS_COUNT; i++) {
+        printf("%-12s [%lld ms]: ", task_class_name(i), class_quantum[i]);
+        if (scanf("%lld", &quantum) != 1 || quantum < 0) {
+            print_error("Invalid input!");
+            return;
+        }
+        class_quantum[i] = quantum;
+    }
+    
+    print_success("Time quantum updated!");
+    sleep(1);
+}
+
+void configure_mlfq() {
+    printf("\nNumber of levels (1-%d) [%d]: ", MLFQ_MAX_LEVELS, mlfq_levels);
+    int levels;
+    if (scanf("%d", &levels) != 1 || levels < 1 || levels > MLFQ_MAX_LEVELS) {
+        print_error("Invalid input!");
+        return;
+    }
+    
+    for (int i = 0; i < levels; i++) {
+        printf("Level %d quantum in ms [%lld]: ", i, mlfq_quanta[i]);
+        long long quantum;
+        if (scanf("%lld", &quantum) != 1 || quantum <= 0) {
+            print_error("Invalid input!");
+            return;
+        }
+        mlfq_quanta[i] = quantum;
+    }
+    
+    printf("Priority boost period in ms, 0 disables [%lld]: ", mlfq_boost_period);
+    long long period;
+    if (scanf("%lld", &period) != 1 || period < 0) {
+        print_error("Invalid input!");
+        return;
+    }
+    
+    mlfq_levels = levels;
+    mlfq_boost_period = period;
+    print_success("MLFQ settings updated!");
+    sleep(1);
+}
+
+void configure_cfs() {
+    printf("\nTarget latency in ms [%lld]: ", cfs_target_latency);
+    long long latency;
+    if (scanf("%lld", &latency) != 1 || latency <= 0) {
+        print_error("Invalid input!");
+        return;
+    }
+    
+    printf("Minimum granularity in ms [%lld]: ", cfs_min_granularity);
+    long long granularity;
+    if (scanf("%lld", &granularity) != 1 || granularity <= 0) {
+        print_error("Invalid input!");
+        return;
+    }
+    
+    cfs_target_latency = latency;
+    cfs_min_granularity = granularity;
+    print_success("CFS settings updated!");
+    sleep(1);
+}
+
+// Adds, updates or (with 0 tickets) removes the pool for a task name.
+// Only affects tasks started afterwards.
+int set_ticket_pool(const char *name, int tickets) {
+    int pool = ticket_pool_for(name);
+    
+    if (tickets < 0) return 0;
+    if (tickets == 0) {
+        if (pool >= 0) ticket_pools[pool] = ticket_pools[--ticket_pool_count];
+        return 1;
+    }
+    if (pool < 0) {
+        if (ticket_pool_count == TICKET_POOL_MAX) return 0;
+        pool = ticket_pool_count++;
+        strncpy(ticket_pools[pool].name, name, MAX_NAME_LENGTH - 1);
+        ticket_pools[pool].name[MAX_NAME_LENGTH - 1] = '\0';
+    }
+    ticket_pools[pool].tickets = tickets;
+    return 1;
+}
+
+int ticket_pool_for(const char *name) {
+    for (int i = 0; i < ticket_pool_count; i++) {
+        if (strcmp(ticket_pools[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+void configure_ticket_pools() {
+    printf("\nTicket pools (tasks without one get priority + 1 tickets):\n");
+    for (int i = 0; i < ticket_pool_count; i++) {
+        printf("  %-20s %d tickets\n", ticket_pools[i].name, ticket_pools[i].tickets);
+    }
+    
+    char name[MAX_NAME_LENGTH];
+    printf("\nTask name: ");
+    if (scanf(" %49[^\n]", name) != 1) {
+        print_error("Invalid input!");
+        return;
+    }
+    
+    int tickets;
+    printf("Tickets shared by every %s (0 removes the pool): ", name);
+    if (scanf("%d", &tickets) != 1 || !set_ticket_pool(name, tickets)) {
+        print_error("Invalid input!");
+        return;
+    }
+    print_success("Ticket pools updated!");
+    sleep(1);
+}
+
+// Requested share is the client's tickets over all live clients' tickets;
+// achieved share is its CPU time over all CPU time used by live tasks
+void show_share_report() {
+    double pool_cpu[TICKET_POOL_MAX] = { 0 };
+    int pool_live[TICKET_POOL_MAX] = { 0 };
+    double total_cpu = 0, total_tickets = 0, max_err = 0;
+    
+    for (Task *t = task_first(); t != NULL; t = task_next(t)) {
+        double cpu = (double)t->remaining_time * TICKS_PER_SECOND - des_job_remaining(t->job_id);
+        int pool = ticket_pool_for(t->name);
+        total_cpu += cpu;
+        if (pool >= 0) {
+            pool_cpu[pool] += cpu;
+            if (pool_live[pool]++ == 0) total_tickets += ticket_pools[pool].tickets;
+        } else {
+            total_tickets += t->tickets;
+        }
+    }
+    if (total_tickets == 0) return;
+    
+    printf("\nTicket Shares:\n");
+    printf("%-20s %8s %10s %10s\n", "Client", "Tickets", "Requested", "Achieved");
+    for (int i = 0; i < ticket_pool_count; i++) {
+        if (pool_live[i] == 0) continue;
+        double requested = 100.0 * ticket_pools[i].tickets / total_tickets;
+        double achieved = total_cpu > 0 ? 100.0 * pool_cpu[i] / total_cpu : 0.0;
+        if (fabs(achieved - requested) > max_err) max_err = fabs(achieved - requested);
+        printf("%-20s %8d %9.1f%% %9.1f%%  (pool of %d)\n", ticket_pools[i].name,
+               ticket_pools[i].tickets, requested, achieved, pool_live[i]);
+    }
+    for (Task *t = task_first(); t != NULL; t = task_next(t)) {
+        if (ticket_pool_for(t->name) >= 0) continue;
+        double cpu = (double)t->remaining_time * TICKS_PER_SECOND - des_job_remaining(t->job_id);
+        double requested = 100.0 * t->tickets / total_tickets;
+        double achieved = total_cpu > 0 ? 100.0 * cpu / total_cpu : 0.0;
+        if (fabs(achieved - requested) > max_err) max_err = fabs(achieved - requested);
+        printf("%-20s %8d %9.1f%% %9.1f%%\n", t->name, t->tickets, requested, achieved);
+    }
+    printf("Max fairness error: %.1f points\n", max_err);
+}
+
+// Comma-separated per-level quanta in ms; also sets the level count
+int parse_mlfq_quanta(const char *list) {
+    int levels = 0;
+    const char *p = list;
+    
+    while (*p != '\0' && levels < MLFQ_MAX_LEVELS) {
+        char *end;
+        long long quantum = strtoll(p, &end, 10);
+        if (end == p || quantum <= 0) return 0;
+        mlfq_quanta[levels++] = quantum;
+        if (*end != ',') break;
+        p = end + 1;
+    }
+    mlfq_levels = levels;
+    return levels > 0;
+}
+
 void show_scheduling_info() {
     printf("\n=== CPU Scheduling Information ===\n");
     printf("Current algorithm: %s\n", 
-           current_scheduler == FCFS ? "First-Come-First-Serve" : 
-           current_scheduler == ROUND_ROBIN ? "Round Robin" : "Priority");
+           current_scheduler == FCFS ? "First-Come-First-Serve" : scheduler_name(current_scheduler));
     
     if (current_scheduler == ROUND_ROBIN) {
-        printf("Time Quantum: %d seconds\n", TIME_QUANTUM);
+        printf("Time Quantum: %lld ms", rr_quantum);
+        for (int i = 0; i < TASK_CLASS_COUNT; i++) {
+            if (class_quantum[i] > 0) {
+                printf(" | %s: %lld ms", task_class_name(i), class_quantum[i]);
+            }
+        }
+        printf("\n");
+    } else if (current_scheduler == PRIORITY) {
+        printf("Priority levels: 1-%d | Aging: +1 level every %d seconds waiting\n",
+               MAX_PRIORITY, priority_aging_interval);
+    } else if (current_scheduler == MLFQ) {
+        printf("MLFQ levels: %d | Quanta (ms):", mlfq_levels);
+        for (int i = 0; i < mlfq_levels; i++) {
+            printf(" %lld", mlfq_quanta[i]);
+        }
+        printf(" | Boost every %lld ms\n", mlfq_boost_period);
+    } else if (current_scheduler == LOTTERY || current_scheduler == STRIDE) {
+        printf("Time Quantum: %lld ms | Ticket pools: %d\n", rr_quantum, ticket_pool_count);
+    } else if (current_scheduler == CFS) {
+        printf("Target latency: %lld ms | Minimum granularity: %lld ms\n",
+               cfs_target_latency, cfs_min_granularity);
+    }
+    printf("Virtual clock: %.2f seconds\n", (double)engine.clock / TICKS_PER_SECOND);
+    printf("Completed: %ld | Dispatches: %ld | Context switches: %ld | Quantum expiries: %ld\n",
+           engine.completed, engine.dispatches, engine.context_switches, engine.preemptions);
+    if (engine.completed > 0) {
+        printf("Avg turnaround: %.2f s | Avg waiting: %.2f s | Avg response: %.2f s\n",
+               metric_mean(&engine.turnaround) / TICKS_PER_SECOND,
+               metric_mean(&engine.waiting) / TICKS_PER_SECOND,
+               metric_mean(&engine.response) / TICKS_PER_SECOND);
+        printf("Deadline misses: %ld of %ld (%.1f%%)\n", engine.deadline_misses, engine.completed,
+               100.0 * engine.deadline_misses / engine.completed);
     }
     
     printf("\nTask Queue:\n");
-    printf("%-5s %-20s %-10s %-10s %-10s\n", 
-           "ID", "Name", "Priority", "Rem Time", "Status");
+    printf("%-5s %-20s %-10s %-10s %-10s %-10s\n", 
+           "ID", "Name", "Priority", "Rem Time", "Deadline", "Status");
+    pthread_mutex_lock(&queue_mutex);
     
-    for (int i = 0; i < task_count; i++) {
-        printf("%-5d %-20s %-10d %-10d %-10s\n", 
-               i, 
-               tasks[i].name, 
-               tasks[i].priority,
-               tasks[i].remaining_time,
-               tasks[i].is_minimized ? "Minimized" : "Running");
+    for (Task *t = task_first(); t != NULL; t = task_next(t)) {
+        long long remaining = des_job_remaining(t->job_id);
+        int core = des_job_core(t->job_id);
+        char status[24];
+        if (t->is_swapped) {
+            strcpy(status, "Swapped");
+        } else if (t->is_minimized) {
+            strcpy(status, "Minimized");
+        } else if (core >= 0) {
+            snprintf(status, sizeof(status), "On CPU %d", core);
+        } else if (des_job_blocked(t->job_id)) {
+            strcpy(status, "Waiting I/O");
+        } else {
+            strcpy(status, "Running");
+        }
+        printf("%-5d %-20s %-10d %-10.1f %-10.1f %-10s\n", 
+               t->id, 
+               t->name, 
+               t->priority,
+               (double)remaining / TICKS_PER_SECOND,
+               (double)(des_job_deadline(t->job_id) - engine.clock) / TICKS_PER_SECOND,
+               status);
     }
+    if (current_scheduler == LOTTERY || current_scheduler == STRIDE) {
+        show_share_report();
+    }
+    pthread_mutex_unlock(&queue_mutex);
     
     printf("\nPress any key to continue...");
     getchar(); getchar();
@@ -463,19 +2259,19 @@ void end_task_immediately() {
     }
     
     printf("Running Tasks:\n");
-    for (int i = 0; i < task_count; i++) {
-        printf("%d. %s(PID: %d)\n", i, tasks[i].name, tasks[i].pid);
+    for (Task *t = task_first(); t != NULL; t = task_next(t)) {
+        printf("%d. %s(PID: %d)\n", t->id, t->name, t->pid);
     }
     
-    printf("\nEnter task number to end (or -1 to cancel): ");
-    int task_num;
-    if (scanf("%d", &task_num) != 1) {
+    printf("\nEnter task ID to end (or -1 to cancel): ");
+    int task_id;
+    if (scanf("%d", &task_id) != 1) {
         print_error("Invalid input!");
         return;
     }
     
-    if (task_num >= 0 && task_num < task_count) {
-        close_task(task_num);
+    if (task_id >= 0) {
+        close_task(task_id);
     }
 }
 
@@ -490,18 +2286,18 @@ void show_running_tasks() {
         printf("%-5s %-20s %-10s %-10s %-10s %-10s %-15s\n", 
                "ID", "Name", "RAM(MB)", "HDD(MB)", "CPU", "Status", "Running Time");
         
-        for (int i = 0; i < task_count; i++) {
-            if (tasks[i].is_running) {
+        for (Task *t = task_first(); t != NULL; t = task_next(t)) {
+            if (t->is_running) {
                 time_t now = time(NULL);
-                double running_time = difftime(now, tasks[i].start_time);
+                double running_time = difftime(now, t->start_time);
                 
                 printf("%-5d %-20s %-10d %-10d %-10d %-10s %.0f seconds\n", 
-                       i, 
-                       tasks[i].name, 
-                       tasks[i].ram_usage, 
-                       tasks[i].hdd_usage, 
-                       tasks[i].cpu_usage,
-                       tasks[i].is_minimized ? "Minimized" : "Running",
+                       t->id, 
+                       t->name, 
+                       t->ram_usage, 
+                       t->hdd_usage, 
+                       t->cpu_usage,
+                       t->is_swapped ? "Swapped" : t->is_minimized ? "Minimized" : "Running",
                        running_time);
             }
         }
@@ -529,7 +2325,7 @@ void show_running_tasks() {
                 return;
             }
             
-            if (task_id >= 0 && task_id < task_count && tasks[task_id].is_running) {
+            if (task_lookup(task_id) != NULL) {
                 switch(choice) {
                     case 1: close_task(task_id); break;
                     case 2: minimize_task(task_id); break;
@@ -548,258 +2344,8337 @@ void show_running_tasks() {
     }
 }
 
-void close_task(int task_index) {
-    if (task_index < 0 || task_index >= task_count || !tasks[task_index].is_running) {
-        print_error("Invalid task index!");
+void close_task(int task_id) {
+    pthread_mutex_lock(&queue_mutex);
+    
+    Task *task = task_lookup(task_id);
+    if (task == NULL || !task->is_running) {
+        pthread_mutex_unlock(&queue_mutex);
+        print_error("Invalid task ID!");
         return;
     }
     
-    kill(tasks[task_index].pid, SIGTERM);
-    waitpid(tasks[task_index].pid, NULL, 0);
+    des_cancel(task->job_id);
+    remove_task(task);
+    pthread_mutex_unlock(&queue_mutex);
+    
+    print_success("Task closed successfully!");
+    sim_sleep(1);
+    admission_run();
+}
+
+// Caller holds queue_mutex
+void remove_task(Task *task) {
+    terminate_task_process(task);
+    vm_detach(task->asid);
+    if (task->is_swapped) {
+        res_adjust(0, task->ram_usage, 0);
+        swap_space.swapped_tasks--;
+        swap_space.swapped_mb -= task->ram_usage;
+    } else if (task->is_minimized) {
+        swap_lru_remove(task);
+    }
     
-    manage_resources(tasks[task_index].ram_usage, 
-                     tasks[task_index].hdd_usage, 
-                     tasks[task_index].cpu_usage, 0);
+    banker_remove(task->banker_client);
+    manage_resources(task->ram_usage, 
+                     task->hdd_usage, 
+                     task->cpu_usage, 0, &task->ram_base);
     
-    pthread_mutex_lock(&queue_mutex);
+    task_release(task);
+    banker_retry();
+}
+
+Task *task_slot(int slot) {
+    return &task_slabs[slot / TASK_SLAB_SIZE][slot % TASK_SLAB_SIZE];
+}
+
+// O(1): pops the free list, growing the table by one slab when it is
+// empty. NULL when the table is at MAX_TASK_SLOTS or out of memory.
+Task *task_alloc() {
+    if (task_free_slot < 0) {
+        int base = task_slab_count * TASK_SLAB_SIZE;
+        if (base + TASK_SLAB_SIZE > MAX_TASK_SLOTS) return NULL;
+        
+        Task **slabs = realloc(task_slabs, (task_slab_count + 1) * sizeof(Task *));
+        if (slabs == NULL) return NULL;
+        task_slabs = slabs;
+        Task *slab = calloc(TASK_SLAB_SIZE, sizeof(Task));
+        if (slab == NULL) return NULL;
+        task_slabs[task_slab_count++] = slab;
+        for (int slot = base + TASK_SLAB_SIZE - 1; slot >= base; slot--) {
+            task_slot(slot)->next = task_free_slot;
+            task_free_slot = slot;
+        }
+    }
+    
+    int slot = task_free_slot;
+    Task *task = task_slot(slot);
+    task_free_slot = task->next;
+    
+    unsigned int generation = task->generation;
+    memset(task, 0, sizeof(Task));
+    task->generation = generation;
+    task->id = (int)((generation << TASK_SLOT_BITS) | slot);
+    task->in_use = 1;
+    task->job_id = -1;
     
-    for (int i = task_index; i < task_count - 1; i++) {
-        tasks[i] = tasks[i + 1];
+    task->prev = task_tail;
+    task->next = -1;
+    if (task_tail >= 0) {
+        task_slot(task_tail)->next = slot;
+    } else {
+        task_head = slot;
     }
+    task_tail = slot;
+    task_count++;
+    return task;
+}
+
+// O(1): unlinks from the live list and retires the ID by bumping the
+// slot generation, so stale IDs no longer resolve
+void task_release(Task *task) {
+    int slot = task->id & (MAX_TASK_SLOTS - 1);
+    
+    if (task->prev >= 0) task_slot(task->prev)->next = task->next;
+    else task_head = task->next;
+    if (task->next >= 0) task_slot(task->next)->prev = task->prev;
+    else task_tail = task->prev;
+    
+    pid_index_remove(task->pid);
+    task->in_use = 0;
+    task->is_running = 0;
+    task->generation = (task->generation + 1) & ((1u << (31 - TASK_SLOT_BITS)) - 1);
+    task->next = task_free_slot;
+    task_free_slot = slot;
     task_count--;
+}
+
+Task *task_lookup(int task_id) {
+    if (task_id < 0) return NULL;
     
-    pthread_mutex_unlock(&queue_mutex);
+    int slot = task_id & (MAX_TASK_SLOTS - 1);
+    if (slot >= task_slab_count * TASK_SLAB_SIZE) return NULL;
     
-    print_success("Task closed successfully!");
-    sleep(1);
+    Task *task = task_slot(slot);
+    return (task->in_use && task->id == task_id) ? task : NULL;
+}
+
+Task *task_first() {
+    return task_head >= 0 ? task_slot(task_head) : NULL;
+}
+
+Task *task_next(Task *task) {
+    return task->next >= 0 ? task_slot(task->next) : NULL;
+}
+
+Task *task_last() {
+    return task_tail >= 0 ? task_slot(task_tail) : NULL;
+}
+
+unsigned int pid_hash(pid_t pid) {
+    return ((unsigned int)pid * 2654435761u) & (pid_index_cap - 1);
+}
+
+void pid_index_insert(pid_t pid, int slot) {
+    if ((pid_index_count + 1) * 2 > pid_index_cap) {
+        // Rehash at 50% load; out of memory, the old table is used until
+        // it has no free entry left
+        PidEntry *grown = calloc(pid_index_cap ? pid_index_cap * 2 : 64, sizeof(PidEntry));
+        if (grown != NULL) {
+            PidEntry *old = pid_index;
+            int old_cap = pid_index_cap;
+            
+            pid_index = grown;
+            pid_index_cap = old_cap ? old_cap * 2 : 64;
+            pid_index_count = 0;
+            for (int i = 0; i < old_cap; i++) {
+                if (old[i].pid != 0) pid_index_insert(old[i].pid, old[i].slot);
+            }
+            free(old);
+        } else if (pid_index_count + 1 >= pid_index_cap) {
+            return;
+        }
+    }
+    
+    unsigned int i = pid_hash(pid);
+    while (pid_index[i].pid != 0 && pid_index[i].pid != pid) {
+        i = (i + 1) & (pid_index_cap - 1);
+    }
+    if (pid_index[i].pid == 0) pid_index_count++;
+    pid_index[i].pid = pid;
+    pid_index[i].slot = slot;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones
+void pid_index_remove(pid_t pid) {
+    if (pid_index_cap == 0) return;
+    
+    unsigned int mask = pid_index_cap - 1;
+    unsigned int i = pid_hash(pid);
+    while (pid_index[i].pid != pid) {
+        if (pid_index[i].pid == 0) return;
+        i = (i + 1) & mask;
+    }
+    
+    unsigned int j = i;
+    while (1) {
+        pid_index[i].pid = 0;
+        while (1) {
+            j = (j + 1) & mask;
+            if (pid_index[j].pid == 0) {
+                pid_index_count--;
+                return;
+            }
+            unsigned int home = pid_hash(pid_index[j].pid);
+            // Move j back only if its home is not cyclically within (i, j]
+            if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) break;
+        }
+        pid_index[i] = pid_index[j];
+        i = j;
+    }
+}
+
+Task *task_by_pid(pid_t pid) {
+    if (pid_index_cap == 0) return NULL;
+    
+    unsigned int i = pid_hash(pid);
+    while (pid_index[i].pid != 0) {
+        if (pid_index[i].pid == pid) return task_slot(pid_index[i].slot);
+        i = (i + 1) & (pid_index_cap - 1);
+    }
+    return NULL;
 }
 
-void minimize_task(int task_index) {
-    if (task_index < 0 || task_index >= task_count || !tasks[task_index].is_running) {
-        print_error("Invalid task index!");
+void minimize_task(int task_id) {
+    pthread_mutex_lock(&queue_mutex);
+    
+    Task *task = task_lookup(task_id);
+    if (task == NULL || !task->is_running) {
+        pthread_mutex_unlock(&queue_mutex);
+        print_error("Invalid task ID!");
         return;
     }
     
-    tasks[task_index].is_minimized = 1;
+    if (!task->is_minimized) {
+        task->is_minimized = 1;
+        swap_lru_append(task);
+    }
+    pthread_mutex_unlock(&queue_mutex);
     print_success("Task minimized successfully!");
+    sim_sleep(1);
+}
+
+void restore_task(int task_id) {
+    pthread_mutex_lock(&queue_mutex);
+    
+    Task *task = task_lookup(task_id);
+    if (task == NULL || !task->is_running) {
+        pthread_mutex_unlock(&queue_mutex);
+        print_error("Invalid task ID!");
+        return;
+    }
+    
+    int latency = 0;
+    if (task->is_swapped) {
+        latency = swap_in_task(task);
+        if (latency < 0) {
+            pthread_mutex_unlock(&queue_mutex);
+            print_error("Not enough memory to swap the task back in!");
+            sim_sleep(1);
+            return;
+        }
+    } else if (task->is_minimized) {
+        swap_lru_remove(task);
+        swap_space.resident_restores++;
+    }
+    if (task->is_minimized) swap_space.restores++;
+    task->is_minimized = 0;
+    pthread_mutex_unlock(&queue_mutex);
+    
+    if (latency > 0) {
+        char message[64];
+        snprintf(message, sizeof(message), "Task swapped in from disk (%d ms)!", latency);
+        print_success(message);
+    } else {
+        print_success("Task restored successfully!");
+    }
+    sim_sleep(1);
+}
+
+void switch_mode() {
+    current_mode = !current_mode;
+    print_success(current_mode ? "Switched to Kernel Mode" : "Switched to User Mode");
     sleep(1);
 }
 
-void restore_task(int task_index) {
-    if (task_index < 0 || task_index >= task_count || !tasks[task_index].is_running) {
-        print_error("Invalid task index!");
-        return;
+void shutdown_os() {
+    clear_screen();
+    printf("\n\n");
+    printf("    ███████╗██╗  ██╗██╗   ██╗████████╗███████╗██████╗ \n");
+    printf("    ██╔════╝██║  ██║██║   ██║╚══██╔══╝██╔════╝██╔══██╗\n");
+    printf("    ███████╗███████║██║   ██║   ██║   █████╗  ██║  ██║\n");
+    printf("    ╚════██║██╔══██║██║   ██║   ██║   ██╔══╝  ██║  ██║\n");
+    printf("    ███████║██║  ██║╚██████╔╝   ██║   ███████╗██████╔╝\n");
+    printf("    ╚══════╝╚═╝  ╚═╝ ╚═════╝    ╚═╝   ╚══════╝╚═════╝ \n");
+    
+    // Signal every child at once, give them a grace period to exit
+    // and only then fall back to SIGKILL
+    long long start = monotonic_ns();
+    launcher_drain();
+    pthread_mutex_lock(&queue_mutex);
+    int signalled = 0;
+    for (Task *t = task_first(); t != NULL; t = task_next(t)) {
+        if (t->is_running && !t->is_simulated && !t->is_reaped) {
+            kill(t->pid, SIGTERM);
+            if (enforcer.fd >= 0) kill(t->pid, SIGCONT);
+            signalled++;
+        }
+    }
+    
+    long long deadline = start + (long long)SHUTDOWN_GRACE_MS * 1000000;
+    while (reaper.children > 0 && monotonic_ns() < deadline) {
+        pthread_mutex_unlock(&queue_mutex);
+        if (reaper.fd < 0) reaper_collect();
+        struct timespec pause = { 0, 10000000 };
+        nanosleep(&pause, NULL);
+        pthread_mutex_lock(&queue_mutex);
+    }
+    
+    for (Task *t = task_first(); t != NULL; t = task_next(t)) {
+        if (t->is_running && !t->is_simulated && !t->is_reaped) {
+            kill(t->pid, SIGKILL);
+            reaper.killed++;
+        }
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    // Stopped first so it cannot collect a child between our waits
+    reaper_stop();
+    reaper_wait_all();
+    fs_unmount();
+    
+    printf("\n    Stopped %d processes in %lld ms (%ld killed after the grace period)\n",
+           signalled, (monotonic_ns() - start) / 1000000, reaper.killed);
+    loading_animation("Shutting down", 3);
+    exit(0);
+}
+
+// ---- Child reaping ----
+//
+// SIGCHLD is blocked in every thread and read from a signalfd by the
+// reaper thread, which polls each child we launched with
+// waitid(P_PID, WNOHANG) (several exits can share one signal). Children
+// we did not launch, such as the shell behind system(), are left to
+// whoever started them. A child that exits on its own has its task
+// removed and its resources released right there, so nothing is left
+// charged to a zombie; released resources wake the admission queue at
+// the next scheduling pass.
+
+void *reaper_main(void *arg) {
+    (void)arg;
+    struct signalfd_siginfo info;
+    
+    while (!reaper.stopping) {
+        ssize_t n = read(reaper.fd, &info, sizeof(info));
+        if (reaper.stopping) break;
+        if (n == sizeof(info)) {
+            reaper_collect();
+        } else if (n < 0 && errno != EINTR) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+void reaper_start() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    
+    reaper.fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (reaper.fd >= 0 && pthread_create(&reaper.thread, NULL, reaper_main, NULL) != 0) {
+        close(reaper.fd);
+        reaper.fd = -1;
+    }
+    if (reaper.fd < 0) {
+        // Without the reaper children are collected when they are closed
+        pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+        print_warning("Child reaper unavailable, exited tasks are collected on close");
+    }
+}
+
+// Wakes the thread with a SIGCHLD of its own and waits for it to exit
+void reaper_stop() {
+    if (reaper.fd < 0) return;
+    
+    reaper.stopping = 1;
+    pthread_kill(reaper.thread, SIGCHLD);
+    pthread_join(reaper.thread, NULL);
+    close(reaper.fd);
+    reaper.fd = -1;
+}
+
+// Caller holds queue_mutex when the reaper is running
+void reaper_track(pid_t pid) {
+    if (reaper.children == reaper.cap) {
+        int cap = reaper.cap > 0 ? reaper.cap * 2 : 64;
+        pid_t *pids = realloc(reaper.pids, cap * sizeof(pid_t));
+        if (pids == NULL) return;
+        reaper.pids = pids;
+        reaper.cap = cap;
+    }
+    reaper.pids[reaper.children++] = pid;
+}
+
+// Returns 1 if the pid was one of ours
+int reaper_forget(pid_t pid) {
+    for (int i = 0; i < reaper.children; i++) {
+        if (reaper.pids[i] == pid) {
+            reaper.pids[i] = reaper.pids[--reaper.children];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Blocks until every child we launched has been collected. Only called
+// once the reaper thread is stopped.
+void reaper_wait_all() {
+    for (int i = 0; i < reaper.children; i++) {
+        waitpid(reaper.pids[i], NULL, 0);
+    }
+    reaper.children = 0;
+}
+
+// Caller must not hold queue_mutex
+void reaper_collect() {
+    pthread_mutex_lock(&queue_mutex);
+    for (int i = 0; i < reaper.children; ) {
+        siginfo_t info;
+        info.si_pid = 0;
+        pid_t pid = reaper.pids[i];
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG) != 0 || info.si_pid == 0) {
+            i++;
+            continue;
+        }
+        
+        reaper.pids[i] = reaper.pids[--reaper.children];
+        reaper.reaped++;
+        Task *task = task_by_pid(pid);
+        if (task != NULL && task->is_running && !task->is_simulated) {
+            task->is_reaped = 1;
+            reaper.exited++;
+            reaper.reclaimed_mb += task->ram_usage;
+            des_cancel(task->job_id);
+            remove_task(task);
+        }
+    }
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+void show_reaper_stats() {
+    if (reaper.fd < 0) {
+        printf("\nReaper: off | Live children: %d\n", reaper.children);
+        return;
+    }
+    printf("\nReaper: %ld children collected, %ld exited on their own (%lld MB reclaimed) | Live: %d\n",
+           reaper.reaped, reaper.exited, reaper.reclaimed_mb, reaper.children);
+}
+
+// ---- Process launch ----
+//
+// A background task's process only sleeps (Calendar, Time) or exits at
+// once, but fork() still has to copy the page tables of the whole
+// simulator heap. Two cheaper launchers are available: posix_spawn()
+// runs a fresh copy of this binary as "--child NAME" (glibc spawns with
+// CLONE_VFORK, so no page tables are copied), and the pool keeps idle
+// workers, forked between bursts while the heap is quiet, each blocked
+// reading its task name from a pipe. Launching from the pool is one
+// write(); when it runs dry the launch falls back to posix_spawn().
+
+void child_main(const char *task_name) {
+    if (strcmp(task_name, "Calendar") == 0) {
+        while(1) { sleep(60); }
+    } else if (strcmp(task_name, "Time") == 0) {
+        while(1) { sleep(1); }
+    } else if (strcmp(task_name, "Spin") == 0) {
+        // CPU-bound stand-in used by --bench-enforce
+        volatile unsigned long spins = 0;
+        while(1) { spins++; }
+    }
+    _exit(0);
+}
+
+const char *launch_method_name(LaunchMethod method) {
+    switch (method) {
+        case LAUNCH_FORK: return "fork";
+        case LAUNCH_SPAWN: return "posix_spawn";
+        case LAUNCH_POOL: return "Pre-forked pool";
+    }
+    return "Unknown";
+}
+
+int parse_launch_method(const char *name) {
+    if (strcmp(name, "fork") == 0) return LAUNCH_FORK;
+    if (strcmp(name, "spawn") == 0) return LAUNCH_SPAWN;
+    if (strcmp(name, "pool") == 0) return LAUNCH_POOL;
+    return -1;
+}
+
+void launcher_init() {
+    ssize_t n = readlink("/proc/self/exe", launcher.exe, sizeof(launcher.exe) - 1);
+    launcher.exe[n > 0 ? n : 0] = '\0';
+    // A worker that died while idle must not kill us when handed a task
+    signal(SIGPIPE, SIG_IGN);
+}
+
+// Children must not keep the pool's pipes open, or closing them would
+// never reach the idle workers
+void launcher_close_idle() {
+    for (int i = 0; i < launcher.idle; i++) {
+        close(launcher.idle_fd[i]);
+    }
+}
+
+pid_t launch_fork(const char *task_name) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        launcher_close_idle();
+        child_main(task_name);
+    }
+    return pid;
+}
+
+pid_t launch_spawn(const char *task_name) {
+    if (launcher.exe[0] == '\0') return -1;
+    
+    posix_spawnattr_t attr;
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);  // SIGCHLD is blocked for the reaper
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    
+    char *argv[] = { launcher.exe, "--child", (char *)task_name, NULL };
+    pid_t pid;
+    int rc = posix_spawn(&pid, launcher.exe, NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    return rc == 0 ? pid : -1;
+}
+
+pid_t launch_pooled(const char *task_name) {
+    size_t len = strlen(task_name);
+    
+    while (launcher.idle > 0) {
+        launcher.idle--;
+        int fd = launcher.idle_fd[launcher.idle];
+        pid_t pid = launcher.idle_pid[launcher.idle];
+        int sent = write(fd, task_name, len) == (ssize_t)len;
+        close(fd);
+        if (sent) return pid;
+        // The worker is gone; the reaper has collected or will collect it
+    }
+    return -1;
+}
+
+// Caller holds queue_mutex when the reaper is running
+pid_t launch_child(const char *task_name) {
+    long long start = monotonic_ns();
+    pid_t pid = -1;
+    
+    if (launcher.method == LAUNCH_POOL) {
+        pid = launch_pooled(task_name);
+        if (pid > 0) {
+            launcher.pooled++;
+        } else {
+            launcher.fallbacks++;
+        }
+    }
+    if (pid < 0 && launcher.method != LAUNCH_FORK) {
+        pid = launch_spawn(task_name);
+        if (pid < 0 && launcher.method == LAUNCH_SPAWN) launcher.fallbacks++;
+        if (pid > 0) reaper_track(pid);
+    }
+    if (pid < 0) {
+        pid = launch_fork(task_name);
+        if (pid > 0) reaper_track(pid);
+    }
+    
+    if (pid > 0) {
+        launcher.launches++;
+        metric_add(&launcher.latency, (monotonic_ns() - start) / 1000);
+    }
+    return pid;
+}
+
+// Caller must not hold queue_mutex. Forks workers until the pool is full
+// and returns how many were added.
+int launcher_refill() {
+    int added = 0;
+    
+    while (launcher.idle < launcher.pool_size) {
+        int fds[2];
+        if (pipe(fds) != 0) break;
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);  // Spawned tasks must not inherit it
+        
+        pthread_mutex_lock(&queue_mutex);
+        pid_t pid = fork();
+        if (pid == 0) {
+            launcher_close_idle();
+            close(fds[1]);
+            char name[MAX_NAME_LENGTH];
+            ssize_t n = read(fds[0], name, sizeof(name) - 1);
+            if (n <= 0) _exit(0);  // Pool drained
+            name[n] = '\0';
+            close(fds[0]);
+            child_main(name);
+        }
+        if (pid > 0) reaper_track(pid);
+        pthread_mutex_unlock(&queue_mutex);
+        
+        close(fds[0]);
+        if (pid < 0) {
+            close(fds[1]);
+            break;
+        }
+        launcher.idle_pid[launcher.idle] = pid;
+        launcher.idle_fd[launcher.idle] = fds[1];
+        launcher.idle++;
+        added++;
+    }
+    return added;
+}
+
+// Idle workers see end-of-file on their pipe and exit
+void launcher_drain() {
+    launcher_close_idle();
+    launcher.idle = 0;
+}
+
+void show_launcher_stats() {
+    printf("\nLauncher: %s", launch_method_name(launcher.method));
+    if (launcher.method == LAUNCH_POOL) {
+        printf(" (%d of %d idle)", launcher.idle, launcher.pool_size);
+    }
+    printf(" | Launches: %ld (%ld from the pool, %ld fallbacks)\n",
+           launcher.launches, launcher.pooled, launcher.fallbacks);
+    printf("Launch latency: avg %.0f us, p99 %.0f us\n",
+           metric_mean(&launcher.latency), metric_percentile(&launcher.latency, 99));
+}
+
+// Bursts of `launches` Calendar processes per launcher, with and without
+// a large touched heap to stand in for a busy simulator
+int run_launch_benchmark(long launches, const char *csv_path) {
+    const int heap_sizes[] = { 0, 256, 1024 };
+    
+    FILE *csv = bench_csv_open(csv_path, "launcher,heap_mb,launches,launches_per_s,avg_us,p99_us,refill_ms,fallbacks");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    pid_t *pids = malloc(launches * sizeof(pid_t));
+    printf("=== Launch Benchmark (bursts of %ld launches, pool of up to %d) ===\n",
+           launches, LAUNCH_POOL_MAX);
+    printf("%-16s %7s %11s %9s %9s %10s %9s\n",
+           "Launcher", "Heap MB", "Launches/s", "Avg us", "p99 us", "Refill ms", "Fallback");
+    
+    for (int h = 0; h < 3; h++) {
+        size_t heap_bytes = (size_t)heap_sizes[h] << 20;
+        char *heap = heap_bytes > 0 ? malloc(heap_bytes) : NULL;
+        if (heap_bytes > 0 && heap == NULL) {
+            printf("(skipping %d MB heap: allocation failed)\n", heap_sizes[h]);
+            continue;
+        }
+        if (heap != NULL) memset(heap, 1, heap_bytes);
+        
+        for (int m = 0; m < LAUNCH_METHOD_COUNT; m++) {
+            launcher.method = m;
+            launcher.pool_size = launches < LAUNCH_POOL_MAX ? (int)launches : LAUNCH_POOL_MAX;
+            launcher.launches = launcher.pooled = launcher.fallbacks = 0;
+            metric_free(&launcher.latency);
+            
+            double refill_ms = 0.0;
+            if (m == LAUNCH_POOL) {
+                long long refill_start = monotonic_ns();
+                launcher_refill();
+                refill_ms = (monotonic_ns() - refill_start) / 1e6;
+            }
+            
+            long started = 0;
+            long long start = monotonic_ns();
+            for (long i = 0; i < launches; i++) {
+                pid_t pid = launch_child("Calendar");
+                if (pid < 0) break;
+                pids[started++] = pid;
+            }
+            double wall = (monotonic_ns() - start) / 1e9;
+            
+            for (long i = 0; i < started; i++) {
+                kill(pids[i], SIGKILL);
+                waitpid(pids[i], NULL, 0);
+                reaper_forget(pids[i]);
+            }
+            launcher_drain();
+            reaper_wait_all();
+            
+            double rate = wall > 0 ? started / wall : 0.0;
+            double avg = metric_mean(&launcher.latency);
+            double p99 = metric_percentile(&launcher.latency, 99);
+            printf("%-16s %7d %11.0f %9.0f %9.0f %10.1f %9ld\n",
+                   launch_method_name(m), heap_sizes[h], rate, avg, p99, refill_ms, launcher.fallbacks);
+            if (csv != NULL) {
+                fprintf(csv, "%s,%d,%ld,%.1f,%.1f,%.1f,%.2f,%ld\n",
+                        launch_method_name(m), heap_sizes[h], started, rate, avg, p99,
+                        refill_ms, launcher.fallbacks);
+            }
+        }
+        free(heap);
+    }
+    
+    free(pids);
+    metric_free(&launcher.latency);
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// ---- Real-time enforcement ----
+//
+// Without enforcement the children run freely whatever the scheduler
+// decides. With --enforce a thread reads a periodic timerfd, advances the
+// event engine by the real time that passed and then holds every job's
+// process to the engine's choice: processes of running jobs are sent
+// SIGCONT, all others SIGSTOP. Signals only go out when a job's state
+// changes. Each pass records how late it woke up against the timer's
+// deadline (jitter) and how long it took (overhead).
+
+// Caller holds queue_mutex
+void enforcer_apply() {
+    for (int job = 0; job < engine.job_cap; job++) {
+        SimJob *j = &engine.jobs[job];
+        if (j->state == JOB_FREE || j->pid <= 0) continue;
+        
+        int on_cpu = j->state == JOB_RUNNING;
+        if (on_cpu && j->stopped) {
+            kill(j->pid, SIGCONT);
+            j->stopped = 0;
+            enforcer.conts++;
+        } else if (!on_cpu && !j->stopped) {
+            kill(j->pid, SIGSTOP);
+            j->stopped = 1;
+            enforcer.stops++;
+        }
+    }
+}
+
+// Arms a fresh periodic timer with an absolute first expiry, so the
+// deadline of every pass is known exactly
+int enforcer_arm() {
+    enforcer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (enforcer.fd < 0) return 0;
+    
+    long long period_ns = enforcer.period * 1000000;
+    enforcer.armed_at = monotonic_ns();
+    enforcer.expirations = 0;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = period_ns / 1000000000;
+    spec.it_interval.tv_nsec = period_ns % 1000000000;
+    spec.it_value.tv_sec = (enforcer.armed_at + period_ns) / 1000000000;
+    spec.it_value.tv_nsec = (enforcer.armed_at + period_ns) % 1000000000;
+    if (timerfd_settime(enforcer.fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+        close(enforcer.fd);
+        enforcer.fd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+// Runs passes until until_ns (monotonic), or forever when it is negative
+void enforcer_run(long long until_ns) {
+    long long period_ns = enforcer.period * 1000000;
+    
+    while (until_ns < 0 || monotonic_ns() < until_ns) {
+        unsigned long long expired;
+        ssize_t n = read(enforcer.fd, &expired, sizeof(expired));
+        if (n != sizeof(expired)) {
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+        long long start = monotonic_ns();
+        enforcer.expirations += expired;
+        enforcer.overruns += expired - 1;
+        metric_add(&enforcer.jitter, (start - enforcer.armed_at - enforcer.expirations * period_ns) / 1000);
+        
+        pthread_mutex_lock(&queue_mutex);
+        des_advance(expired * enforcer.period);
+        enforcer_apply();
+        pthread_mutex_unlock(&queue_mutex);
+        
+        enforcer.passes++;
+        metric_add(&enforcer.overhead, (monotonic_ns() - start) / 1000);
+    }
+}
+
+void *enforcer_main(void *arg) {
+    (void)arg;
+    enforcer_run(-1);
+    return NULL;
+}
+
+void enforcer_start() {
+    if (!enforcer.enabled) return;
+    
+    if (!enforcer_arm()) {
+        print_warning("Could not create the enforcement timer, children run freely");
+        return;
+    }
+    if (pthread_create(&enforcer.thread, NULL, enforcer_main, NULL) != 0) {
+        close(enforcer.fd);
+        enforcer.fd = -1;
+        print_warning("Could not start the enforcement thread, children run freely");
+    }
+}
+
+void show_enforcer_stats() {
+    if (enforcer.fd < 0) {
+        printf("\nEnforcement: off (background processes run freely)\n");
+        return;
+    }
+    printf("\nEnforcement: every %lld ms | Passes: %ld (%ld overruns) | SIGSTOP: %ld | SIGCONT: %ld\n",
+           enforcer.period, enforcer.passes, enforcer.overruns, enforcer.stops, enforcer.conts);
+    printf("Jitter: avg %.0f us, p99 %.0f us | Overhead: avg %.0f us, p99 %.0f us per pass\n",
+           metric_mean(&enforcer.jitter), metric_percentile(&enforcer.jitter, 99),
+           metric_mean(&enforcer.overhead), metric_percentile(&enforcer.overhead, 99));
+}
+
+// User plus system CPU time of a process, in clock ticks, or -1
+long long process_cpu_ticks(pid_t pid) {
+    char path[64];
+    char line[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return -1;
+    char *ok = fgets(line, sizeof(line), fp);
+    fclose(fp);
+    
+    // The command name may contain spaces; fields resume after its ')'
+    char *rest = ok != NULL ? strrchr(line, ')') : NULL;
+    unsigned long long utime, stime;
+    if (rest == NULL || sscanf(rest + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                               &utime, &stime) != 2) {
+        return -1;
+    }
+    return (long long)(utime + stime);
+}
+
+// Four spinning processes with 10/20/30/40% of the tickets run under each
+// policy for `seconds`; the CPU share each job got in the engine is
+// compared with the CPU time its process actually used
+// Kills and collects the first `count` spinners, the ones that started
+void enforce_kill_spinners(const pid_t *pids, int count) {
+    for (int i = 0; i < count; i++) {
+        kill(pids[i], SIGKILL);
+        waitpid(pids[i], NULL, 0);
+    }
+}
+
+int run_enforce_benchmark(long seconds, const char *csv_path) {
+    static const SchedulingAlgorithm policies[] = { ROUND_ROBIN, CFS, LOTTERY, STRIDE };
+    static const int tickets[] = { 100, 200, 300, 400 };
+    int job_count = 4;
+    
+    FILE *csv = bench_csv_open(csv_path, "scheduler,job,tickets,sim_pct,real_pct,jitter_avg_us,jitter_p99_us,"
+                                         "overhead_avg_us,overhead_p99_us,signals_per_s");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    printf("=== Enforcement Benchmark (%ld s per policy, %d cores, %lld ms passes, %ld CPUs online) ===\n",
+           seconds, system_res.total_cores, enforcer.period, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-12s %-19s %-19s %7s %14s %14s %9s\n",
+           "Policy", "Sim share %", "Real share %", "MaxErr", "Jitter us", "Overhead us", "Signals/s");
+    
+    for (int p = 0; p < 4; p++) {
+        des_init(policy_for(policies[p]));
+        metric_free(&enforcer.jitter);
+        metric_free(&enforcer.overhead);
+        enforcer.passes = enforcer.overruns = enforcer.stops = enforcer.conts = 0;
+        
+        pid_t pids[4];
+        int jobs[4];
+        for (int i = 0; i < job_count; i++) {
+            TraceRecord rec;
+            memset(&rec, 0, sizeof(rec));
+            snprintf(rec.name, sizeof(rec.name), "Spin %d", i + 1);
+            rec.priority = 1;
+            rec.burst = seconds + 1;
+            rec.deadline = -1;
+            rec.tickets = tickets[i];
+            rec.io_interval = rec.io_time = 0;
+            pids[i] = launch_fork("Spin");
+            if (pids[i] < 0) {
+                fprintf(stderr, "Cannot start a spinning process\n");
+                enforce_kill_spinners(pids, i);
+                if (csv != NULL) fclose(csv);
+                return 1;
+            }
+            jobs[i] = des_submit(pids[i], &rec);
+        }
+        
+        des_advance(0);
+        enforcer_apply();
+        if (!enforcer_arm()) {
+            fprintf(stderr, "Cannot create a timerfd\n");
+            enforce_kill_spinners(pids, job_count);
+            if (csv != NULL) fclose(csv);
+            return 1;
+        }
+        long long cpu_start[4];
+        for (int i = 0; i < job_count; i++) {
+            cpu_start[i] = process_cpu_ticks(pids[i]);
+        }
+        enforcer_run(monotonic_ns() + seconds * 1000000000LL);
+        
+        double sim[4], real[4], sim_total = 0, real_total = 0;
+        for (int i = 0; i < job_count; i++) {
+            sim[i] = engine.jobs[jobs[i]].burst - des_job_remaining(jobs[i]);
+            real[i] = process_cpu_ticks(pids[i]) - cpu_start[i];
+            sim_total += sim[i];
+            real_total += real[i];
+            kill(pids[i], SIGKILL);
+            waitpid(pids[i], NULL, 0);
+        }
+        close(enforcer.fd);
+        enforcer.fd = -1;
+        
+        char sim_text[32], real_text[32];
+        int sim_len = 0, real_len = 0;
+        double max_err = 0;
+        double signal_rate = (double)(enforcer.stops + enforcer.conts) / seconds;
+        for (int i = 0; i < job_count; i++) {
+            sim[i] = sim_total > 0 ? 100.0 * sim[i] / sim_total : 0.0;
+            real[i] = real_total > 0 ? 100.0 * real[i] / real_total : 0.0;
+            if (fabs(real[i] - sim[i]) > max_err) max_err = fabs(real[i] - sim[i]);
+            sim_len += snprintf(sim_text + sim_len, sizeof(sim_text) - sim_len, "%s%.1f", i ? "/" : "", sim[i]);
+            real_len += snprintf(real_text + real_len, sizeof(real_text) - real_len, "%s%.1f", i ? "/" : "", real[i]);
+            if (csv != NULL) {
+                fprintf(csv, "%s,%d,%d,%.2f,%.2f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+                        scheduler_name(policies[p]), i + 1, tickets[i], sim[i], real[i],
+                        metric_mean(&enforcer.jitter), metric_percentile(&enforcer.jitter, 99),
+                        metric_mean(&enforcer.overhead), metric_percentile(&enforcer.overhead, 99),
+                        signal_rate);
+            }
+        }
+        printf("%-12s %-19s %-19s %6.1f%% %6.0f /%6.0f %6.0f /%6.0f %9.1f\n",
+               scheduler_name(policies[p]), sim_text, real_text, max_err,
+               metric_mean(&enforcer.jitter), metric_percentile(&enforcer.jitter, 99),
+               metric_mean(&enforcer.overhead), metric_percentile(&enforcer.overhead, 99),
+               signal_rate);
+    }
+    printf("Jitter and overhead columns are avg / p99.\n");
+    
+    des_init(policy_for(current_scheduler));
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// ---- Resource reservation ----
+//
+// The free amounts of all three resources are packed into one word.
+// res_reserve() takes a snapshot, checks every field and publishes the
+// reduced word with a single compare-and-swap, retrying if another thread
+// changed it in between, so a reservation is all-or-nothing and two
+// launchers can never both take the last MB. No field can exceed its
+// total, so a release is a plain atomic add.
+
+unsigned long long res_pack(long long ram, long long hdd, long long cores) {
+    return (unsigned long long)ram |
+           (unsigned long long)hdd << RES_RAM_BITS |
+           (unsigned long long)cores << (RES_RAM_BITS + RES_HDD_BITS);
+}
+
+void res_init(int ram, int hdd, int cores) {
+    if (ram >= 1 << RES_RAM_BITS) ram = (1 << RES_RAM_BITS) - 1;
+    if (hdd >= 1 << RES_HDD_BITS) hdd = (1 << RES_HDD_BITS) - 1;
+    if (cores >= 1 << RES_CORE_BITS) cores = (1 << RES_CORE_BITS) - 1;
+    
+    system_res.total_ram = ram;
+    system_res.total_hdd = hdd;
+    system_res.total_cores = cores;
+    __atomic_store_n(&system_res.available, res_pack(ram, hdd, cores), __ATOMIC_RELEASE);
+}
+
+int res_available_ram() {
+    return __atomic_load_n(&system_res.available, __ATOMIC_ACQUIRE) & ((1ULL << RES_RAM_BITS) - 1);
+}
+
+int res_available_hdd() {
+    return __atomic_load_n(&system_res.available, __ATOMIC_ACQUIRE) >> RES_RAM_BITS &
+           ((1ULL << RES_HDD_BITS) - 1);
+}
+
+int res_available_cores() {
+    return __atomic_load_n(&system_res.available, __ATOMIC_ACQUIRE) >> (RES_RAM_BITS + RES_HDD_BITS);
+}
+
+// Returns 1 and takes all three amounts, or 0 and takes nothing
+int res_reserve(int ram, int hdd, int cores) {
+    unsigned long long seen = __atomic_load_n(&system_res.available, __ATOMIC_ACQUIRE);
+    unsigned long long want = res_pack(ram, hdd, cores);
+    
+    for (;;) {
+        if ((seen & ((1ULL << RES_RAM_BITS) - 1)) < (unsigned long long)ram ||
+            (seen >> RES_RAM_BITS & ((1ULL << RES_HDD_BITS) - 1)) < (unsigned long long)hdd ||
+            seen >> (RES_RAM_BITS + RES_HDD_BITS) < (unsigned long long)cores) {
+            return 0;
+        }
+        // On failure `seen` is refreshed with the current word
+        if (__atomic_compare_exchange_n(&system_res.available, &seen, seen - want, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+    }
+}
+
+// Gives back (or, with negative amounts, takes without checking) resources
+// that are known to be available
+void res_adjust(int ram, int hdd, int cores) {
+    unsigned long long delta = (unsigned long long)(long long)ram +
+                               ((unsigned long long)(long long)hdd << RES_RAM_BITS) +
+                               ((unsigned long long)(long long)cores << (RES_RAM_BITS + RES_HDD_BITS));
+    __atomic_fetch_add(&system_res.available, delta, __ATOMIC_ACQ_REL);
+}
+
+// Reserves (allocate = 1) or releases a task's resources. RAM is reserved
+// at the size the physical allocator will hand out (buddy rounds up), then
+// placed under resource_sem; *ram_base receives the block. Returns 0 with
+// nothing held if any resource is short or free RAM is too fragmented.
+int manage_resources(int ram, int hdd, int cpu, int allocate, int *ram_base) {
+    if (!allocate) {
+        sem_wait(&resource_sem);
+        int freed = phys_free(*ram_base);
+        sem_post(&resource_sem);
+        *ram_base = -1;
+        res_adjust(freed, hdd, cpu);
+        admission.kick = 1;
+        return 1;
+    }
+    
+    int block = phys_block_size(ram);
+    if (!res_reserve(block, hdd, cpu)) return 0;
+    
+    sem_wait(&resource_sem);
+    *ram_base = phys_alloc(ram);
+    if (*ram_base < 0 && ram > 0) phys.fragmentation_rejects++;
+    sem_post(&resource_sem);
+    
+    if (*ram_base < 0 && ram > 0) {
+        res_adjust(block, hdd, cpu);
+        return 0;
+    }
+    return 1;
+}
+
+// Caller holds queue_mutex. Adds to a running task's reservation. Its RAM
+// is re-placed as one larger block (task memory is virtual, so the block
+// may move). Returns 0 with nothing changed if the addition does not fit.
+int grow_resources(Task *task, int ram, int hdd, int cpu) {
+    int block = phys_block_size(task->ram_usage + ram) - phys_block_size(task->ram_usage);
+    if (!res_reserve(block, hdd, cpu)) return 0;
+    
+    if (ram > 0) {
+        sem_wait(&resource_sem);
+        phys_free(task->ram_base);
+        int base = phys_alloc(task->ram_usage + ram);
+        int moved = base >= 0;
+        if (!moved) base = phys_alloc(task->ram_usage);  // Its old room is still free
+        sem_post(&resource_sem);
+        task->ram_base = base;
+        
+        // A Banker's grant counts on the free total, so fragmentation must
+        // not refuse it: compact RAM with the task laid out at its new size
+        if (!moved) {
+            phys.fragmentation_rejects++;
+            task->ram_usage += ram;
+            moved = phys_set_strategy(phys.strategy);
+            task->ram_usage -= ram;
+            if (moved) res_adjust(block, 0, 0);  // Taken again by the relayout
+        }
+        if (!moved) {
+            res_adjust(block, hdd, cpu);
+            return 0;
+        }
+    }
+    
+    task->ram_usage += ram;
+    task->hdd_usage += hdd;
+    task->cpu_usage += cpu;
+    return 1;
+}
+
+// A lock-free pre-check that lets launchers turn requests away before
+// forking; manage_resources() makes the binding reservation
+int check_resources(int ram, int hdd, int cpu) {
+    if (resources_fit(ram, hdd, cpu)) return 1;
+    
+    if (!phys_can_alloc(ram) && res_available_ram() >= ram) phys.fragmentation_rejects++;
+    return 0;
+}
+
+// check_resources() without the rejection accounting, for the admission
+// queue, which asks about the same waiting task on every pass. Only looks:
+// a task that fits by swapping minimized tasks out counts as fitting, and
+// the launch does the swapping
+int resources_fit(int ram, int hdd, int cpu) {
+    if (banker.mode != BANKER_OFF) return banker_can_admit(ram, hdd, cpu);
+    
+    int swappable = 0;
+    if (swap_space.enabled && !phys_can_alloc(ram)) {
+        pthread_mutex_lock(&queue_mutex);
+        swappable = swap_room_possible(ram, hdd);
+        pthread_mutex_unlock(&queue_mutex);
+    }
+    
+    return (phys_can_alloc(ram) || swappable) && 
+           (res_available_hdd() >= hdd) && 
+           (res_available_cores() >= cpu);
+}
+
+// Launcher threads hammer one small shared pool with reserve/hold/release
+// cycles. "Two-step" is the old path: a locked check, then a separately
+// locked update, which can overcommit; "Locked" holds the semaphore across
+// both; "CAS" is res_reserve()/res_adjust(). Overcommit counts
+// reservations that drove a counter below zero.
+typedef struct {
+    int mode;
+    long operations;
+    unsigned long long rng;
+    long granted;
+} ReserveWorker;
+
+sem_t bench_sem;
+int bench_ram, bench_hdd, bench_cores;
+long bench_overcommits;
+
+void *reserve_worker(void *arg) {
+    ReserveWorker *w = arg;
+    
+    for (long i = 0; i < w->operations; i++) {
+        int ram = 1 + rng_next(&w->rng) % 64;
+        int hdd = 1 + rng_next(&w->rng) % 16;
+        int cores = 1 + rng_next(&w->rng) % 2;
+        
+        if (w->mode == 2) {
+            if (!res_reserve(ram, hdd, cores)) continue;
+            w->granted++;
+            sched_yield();  // The task holds its reservation for a while
+            res_adjust(ram, hdd, cores);
+            continue;
+        }
+        
+        sem_wait(&bench_sem);
+        int fits = bench_ram >= ram && bench_hdd >= hdd && bench_cores >= cores;
+        if (w->mode == 0) {
+            sem_post(&bench_sem);
+            if (!fits) continue;
+            sched_yield();  // Where create_process() forks between the two steps
+            sem_wait(&bench_sem);
+        } else if (!fits) {
+            sem_post(&bench_sem);
+            continue;
+        }
+        bench_ram -= ram;
+        bench_hdd -= hdd;
+        bench_cores -= cores;
+        if (bench_ram < 0 || bench_hdd < 0 || bench_cores < 0) bench_overcommits++;
+        sem_post(&bench_sem);
+        
+        w->granted++;
+        sched_yield();
+        sem_wait(&bench_sem);
+        bench_ram += ram;
+        bench_hdd += hdd;
+        bench_cores += cores;
+        sem_post(&bench_sem);
+    }
+    return NULL;
+}
+
+int run_reserve_benchmark(long operations, const char *csv_path) {
+    const char *modes[] = { "Two-step", "Locked", "CAS" };
+    const int thread_counts[] = { 1, 2, 4, 8, 16, 32, 64 };
+    
+    FILE *csv = bench_csv_open(csv_path, "mode,threads,operations,granted,overcommits,mops_per_s,mgrants_per_s");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    sem_init(&bench_sem, 0, 1);
+    printf("=== Reservation Benchmark (%ld operations per run, pool 256 MB / 64 MB / 8 cores) ===\n",
+           operations);
+    printf("%-9s %7s %10s %11s %9s %10s\n",
+           "Mode", "Threads", "Granted", "Overcommit", "Mops/s", "Mgrants/s");
+    
+    for (int m = 0; m < 3; m++) {
+        for (int t = 0; t < 7; t++) {
+            int threads = thread_counts[t];
+            pthread_t tids[64];
+            ReserveWorker workers[64];
+            
+            res_init(256, 64, 8);
+            bench_ram = 256;
+            bench_hdd = 64;
+            bench_cores = 8;
+            bench_overcommits = 0;
+            
+            long long start = monotonic_ns();
+            for (int i = 0; i < threads; i++) {
+                workers[i].mode = m;
+                workers[i].operations = operations / threads;
+                workers[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+                workers[i].granted = 0;
+                pthread_create(&tids[i], NULL, reserve_worker, &workers[i]);
+            }
+            long granted = 0;
+            for (int i = 0; i < threads; i++) {
+                pthread_join(tids[i], NULL);
+                granted += workers[i].granted;
+            }
+            double wall = (monotonic_ns() - start) / 1e9;
+            double rate = wall > 0 ? operations / wall / 1e6 : 0.0;
+            double grant_rate = wall > 0 ? granted / wall / 1e6 : 0.0;
+            
+            printf("%-9s %7d %10ld %11ld %9.2f %10.2f\n",
+                   modes[m], threads, granted, bench_overcommits, rate, grant_rate);
+            if (csv != NULL) {
+                fprintf(csv, "%s,%d,%ld,%ld,%ld,%.3f,%.3f\n",
+                        modes[m], threads, operations, granted, bench_overcommits, rate, grant_rate);
+            }
+        }
+    }
+    
+    sem_destroy(&bench_sem);
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// ---- Swapping ----
+//
+// Minimized tasks that still hold RAM sit on an LRU list in the order
+// they were minimized. When a new task does not fit, the oldest are
+// written out to the HDD (their RAM image is reserved as HDD space)
+// until it does. A swapped-out task's job is taken off the CPU; restoring
+// the task reads it back in, which costs a seek plus a per-MB transfer
+// before the job may run again.
+
+// Caller holds queue_mutex
+void swap_lru_append(Task *task) {
+    int slot = task->id & (MAX_TASK_SLOTS - 1);
+    
+    task->lru_prev = swap_space.lru_tail;
+    task->lru_next = -1;
+    if (swap_space.lru_tail >= 0) {
+        task_slot(swap_space.lru_tail)->lru_next = slot;
+    } else {
+        swap_space.lru_head = slot;
+    }
+    swap_space.lru_tail = slot;
+}
+
+// Caller holds queue_mutex
+void swap_lru_remove(Task *task) {
+    if (task->lru_prev >= 0) {
+        task_slot(task->lru_prev)->lru_next = task->lru_next;
+    } else {
+        swap_space.lru_head = task->lru_next;
+    }
+    if (task->lru_next >= 0) {
+        task_slot(task->lru_next)->lru_prev = task->lru_prev;
+    } else {
+        swap_space.lru_tail = task->lru_prev;
+    }
+}
+
+// Caller holds queue_mutex
+// Returns 0 if the HDD has no room for the task's RAM image
+int swap_out_task(Task *task) {
+    if (!res_reserve(0, task->ram_usage, 0)) return 0;
+    swap_lru_remove(task);
+    if (!des_suspend(task->job_id)) {
+        // The job finished as it was taken off the CPU, which already
+        // released the task and its memory
+        res_adjust(0, task->ram_usage, 0);
+        return 1;
+    }
+    
+    sem_wait(&resource_sem);
+    int freed = phys_free(task->ram_base);
+    sem_post(&resource_sem);
+    task->ram_base = -1;
+    res_adjust(freed, 0, 0);
+    
+    vm_detach(task->asid);
+    task->asid = -1;
+    task->is_swapped = 1;
+    swap_space.swapped_tasks++;
+    swap_space.swapped_mb += task->ram_usage;
+    swap_space.swap_outs++;
+    swap_space.out_mb += task->ram_usage;
+    return 1;
+}
+
+// Caller holds queue_mutex. Whether swapping out minimized tasks, in the
+// order swap_make_room() would, frees `ram` MB in total before the HDD
+// runs short. Free RAM can still be fragmented afterwards.
+int swap_room_possible(int ram, int hdd) {
+    int ram_free = phys.free_units;
+    int hdd_free = res_available_hdd() - hdd;
+    for (int slot = swap_space.lru_head; slot >= 0 && ram_free < ram; slot = task_slot(slot)->lru_next) {
+        Task *victim = task_slot(slot);
+        if (hdd_free < victim->ram_usage) break;
+        hdd_free -= victim->ram_usage;
+        ram_free += victim->ram_usage;
+    }
+    return ram_free >= ram;
+}
+
+// Caller holds queue_mutex. Swaps out least recently minimized tasks
+// until `ram` MB fit, as long as the HDD can hold them alongside `hdd` MB
+// for the new task. Nothing is swapped out unless that can free enough.
+void swap_make_room(int ram, int hdd) {
+    if (!swap_room_possible(ram, hdd)) return;
+    while (!phys_can_alloc(ram) && swap_space.lru_head >= 0) {
+        Task *victim = task_slot(swap_space.lru_head);
+        if (res_available_hdd() - victim->ram_usage < hdd || !swap_out_task(victim)) break;
+    }
+}
+
+// Caller holds queue_mutex. Returns the swap-in latency in ticks, or -1
+// if there is no room for the task even after swapping others out.
+int swap_in_task(Task *task) {
+    if (!phys_can_alloc(task->ram_usage) && swap_space.enabled) {
+        swap_make_room(task->ram_usage, 0);
+    }
+    if (!manage_resources(task->ram_usage, 0, 0, 1, &task->ram_base)) return -1;
+    res_adjust(0, task->ram_usage, 0);
+    
+    task->asid = vm_attach(task->ram_usage * (1024 / PAGE_SIZE_KB),
+                           access_pattern_for(task_class_for(task->name)));
+    task->is_swapped = 0;
+    
+    int latency = SWAP_SEEK_MS + task->ram_usage * SWAP_MS_PER_MB;
+    des_resume(task->job_id, latency);
+    swap_space.swapped_tasks--;
+    swap_space.swapped_mb -= task->ram_usage;
+    swap_space.swap_ins++;
+    swap_space.in_mb += task->ram_usage;
+    swap_space.swap_in_ticks += latency;
+    return latency;
+}
+
+void show_swap_stats() {
+    printf("\nSwapping: %s\n", swap_space.enabled ? "Enabled (LRU of minimized tasks)" : "Disabled");
+    printf("Swapped out: %d task%s, %d MB on HDD\n", swap_space.swapped_tasks,
+           swap_space.swapped_tasks == 1 ? "" : "s", swap_space.swapped_mb);
+    printf("Swap-outs: %ld (%lld MB) | Swap-ins: %ld (%lld MB, avg %.0f ms)\n",
+           swap_space.swap_outs, swap_space.out_mb, swap_space.swap_ins, swap_space.in_mb,
+           swap_space.swap_ins > 0 ? (double)swap_space.swap_in_ticks / swap_space.swap_ins : 0.0);
+    printf("Restore hit rate: %.1f%% (%ld of %ld restores still in RAM)\n",
+           swap_space.restores > 0 ? 100.0 * swap_space.resident_restores / swap_space.restores : 0.0,
+           swap_space.resident_restores, swap_space.restores);
+}
+
+// ---- Admission control ----
+//
+// Tasks that do not fit wait in an admission queue instead of being
+// turned away. Whenever a task releases its resources the queue is
+// marked, and at the next safe point (outside queue_mutex) waiting tasks
+// are started in policy order for as long as the one at the head fits.
+// A head that does not fit blocks those behind it, so a large task is
+// not starved by a stream of smaller ones; smallest-first gives that up
+// for throughput.
+
+long long admission_key(int slot) {
+    PendingTask *p = &admission.pending[slot];
+    switch(admission.policy) {
+        case ADMIT_SMALLEST: return p->spec.ram;
+        case ADMIT_PRIORITY: return -p->spec.priority;
+        default: return p->order;
+    }
+}
+
+const char *admission_policy_name(AdmissionPolicy policy) {
+    switch(policy) {
+        case ADMIT_OFF: return "Off";
+        case ADMIT_FIFO: return "FIFO";
+        case ADMIT_SMALLEST: return "Smallest first";
+        case ADMIT_PRIORITY: return "Priority";
+    }
+    return "Unknown";
+}
+
+int parse_admission_policy(const char *name) {
+    if (strcmp(name, "off") == 0) return ADMIT_OFF;
+    if (strcmp(name, "fifo") == 0) return ADMIT_FIFO;
+    if (strcmp(name, "smallest") == 0) return ADMIT_SMALLEST;
+    if (strcmp(name, "priority") == 0) return ADMIT_PRIORITY;
+    return -1;
+}
+
+// Re-keys the waiting tasks. Turning admission off only stops new
+// requests from queueing; those already waiting are still started (FIFO).
+void admission_set_policy(AdmissionPolicy policy) {
+    admission.policy = policy;
+    if (admission.queue == NULL) return;
+    
+    void *old = admission.queue;
+    admission.queue = job_heap_create(admission_key);
+    for (int slot = job_heap_pop(old); slot >= 0; slot = job_heap_pop(old)) {
+        job_heap_push(admission.queue, slot);
+    }
+    job_heap_destroy(old);
+}
+
+// Queues a request that cannot start yet. Returns 2 once it is waiting,
+// 0 if it could never fit or the queue is full.
+int admission_submit(char *task_name, int ram, int hdd, int cpu, const TraceRecord *spec) {
+    if (phys_block_size(ram) > system_res.total_ram || hdd > system_res.total_hdd ||
+        cpu > system_res.total_cores ||
+        (admission.limit > 0 && admission.depth >= admission.limit)) {
+        admission.dropped++;
+        print_error("Not enough resources to start this task!");
+        sim_sleep(1);
+        return 0;
+    }
+    
+    if (admission.queue == NULL) admission.queue = job_heap_create(admission_key);
+    if (admission.free_slot < 0) {
+        int base = admission.cap;
+        admission.cap = admission.cap ? admission.cap * 2 : 64;
+        admission.pending = realloc(admission.pending, admission.cap * sizeof(PendingTask));
+        for (int slot = admission.cap - 1; slot >= base; slot--) {
+            admission.pending[slot].next_free = admission.free_slot;
+            admission.free_slot = slot;
+        }
+    }
+    
+    int slot = admission.free_slot;
+    PendingTask *p = &admission.pending[slot];
+    admission.free_slot = p->next_free;
+    
+    if (spec != NULL) {
+        p->spec = *spec;
+    } else {
+        memset(&p->spec, 0, sizeof(p->spec));
+        p->spec.io_interval = p->spec.io_time = -1;
+        p->spec.deadline = -1;
+        p->spec.tickets = -1;
+        p->spec.priority = p->spec.burst = -1;
+    }
+    strncpy(p->spec.name, task_name, MAX_NAME_LENGTH - 1);
+    p->spec.name[MAX_NAME_LENGTH - 1] = '\0';
+    p->spec.ram = ram;
+    p->spec.hdd = hdd;
+    p->spec.cpu = cpu;
+    // Drawn now so the priority policy can order the task while it waits
+    if (p->spec.priority < 0) p->spec.priority = (int)(sim_rand() % MAX_PRIORITY) + 1;
+    p->queued_at = engine.clock;
+    p->order = admission.order++;
+    
+    job_heap_push(admission.queue, slot);
+    admission.queued++;
+    if (++admission.depth > admission.max_depth) admission.max_depth = admission.depth;
+    // A newcomer may sort ahead of the current head
+    admission.kick = 1;
+    
+    if (!quiet_mode) {
+        char message[96];
+        snprintf(message, sizeof(message), "Not enough resources - task queued (%d waiting)",
+                 admission.depth);
+        print_warning(message);
+        sim_sleep(1);
+    }
+    return 2;
+}
+
+// Caller must not hold queue_mutex
+void admission_run() {
+    admission.kick = 0;
+    
+    int started = 0;
+    while (admission.depth > 0) {
+        if (admission.batch > 0 && started == admission.batch) {
+            admission.kick = 1;  // Carry on at the next safe point
+            break;
+        }
+        
+        int slot = job_heap_peek(admission.queue);
+        PendingTask *p = &admission.pending[slot];
+        if ((max_tasks > 0 && task_count >= max_tasks) ||
+            !resources_fit(p->spec.ram, p->spec.hdd, p->spec.cpu)) {
+            break;
+        }
+        
+        job_heap_pop(admission.queue);
+        TraceRecord spec = p->spec;
+        if (!start_background_task(spec.name, spec.ram, spec.hdd, spec.cpu, &spec)) {
+            // Another launcher took the room; the task keeps its place
+            job_heap_push(admission.queue, slot);
+            break;
+        }
+        
+        metric_add(&admission.wait, engine.clock - p->queued_at);
+        p->next_free = admission.free_slot;
+        admission.free_slot = slot;
+        admission.depth--;
+        admission.admitted++;
+        engine.started++;
+        started++;
+    }
+}
+
+void show_admission_stats() {
+    printf("\nAdmission: %s", admission_policy_name(admission.policy));
+    if (admission.batch > 0) printf(", up to %d per pass", admission.batch);
+    printf(" | Waiting: %d (max %d)\n", admission.depth, admission.max_depth);
+    printf("Queued: %ld | Admitted: %ld | Dropped: %ld | Avg wait: %.0f ms (p99 %.0f ms)\n",
+           admission.queued, admission.admitted, admission.dropped,
+           metric_mean(&admission.wait), metric_percentile(&admission.wait, 99));
+}
+
+void configure_admission() {
+    printf("\nAdmission policy:");
+    for (int i = 0; i < ADMISSION_POLICY_COUNT; i++) {
+        printf(" %d. %s", i + 1, admission_policy_name(i));
+    }
+    printf(" [%s]: ", admission_policy_name(admission.policy));
+    int choice;
+    if (scanf("%d", &choice) != 1 || choice < 1 || choice > ADMISSION_POLICY_COUNT) {
+        print_error("Invalid input!");
+        return;
+    }
+    
+    printf("Most tasks started per pass, 0 = no limit [%d]: ", admission.batch);
+    int batch;
+    if (scanf("%d", &batch) != 1 || batch < 0) {
+        print_error("Invalid input!");
+        return;
+    }
+    
+    admission.batch = batch;
+    if (choice - 1 != (int)admission.policy) admission_set_policy(choice - 1);
+    print_success("Admission settings updated!");
+    sleep(1);
+}
+
+// ---- Deadlock avoidance ----
+//
+// Under the Banker's modes a task's RAM, HDD and core counts are maximum
+// claims. It starts with the first of banker.steps equal shares and asks
+// for the next each time it has run another 1/steps of its burst. "avoid"
+// grants a request only if the state it leads to is safe, i.e. every task
+// could still finish in some order. "detect" grants whatever is free and,
+// when a request blocks, looks for waiting tasks that can never be
+// satisfied, reports their wait-for cycle and aborts the youngest in it.
+//
+// RAM is counted in the physical allocator's units (phys_block_size()),
+// as reservations take it, so buddy rounding cannot strand a grant.
+// Clients are kept in one list per resource, sorted by remaining need.
+// The free pool only grows while the safety check runs, so one cursor per
+// list passes each client at most once, and a client can finish once all
+// of its cursors are past it: O(clients * resources) per check. As soon
+// as the pool covers the largest need of every resource, the check stops.
+
+const char *banker_mode_name(BankerMode mode) {
+    switch(mode) {
+        case BANKER_OFF: return "Off";
+        case BANKER_AVOID: return "Avoidance";
+        case BANKER_DETECT: return "Detection";
+    }
+    return "Unknown";
+}
+
+int parse_banker_mode(const char *name) {
+    if (strcmp(name, "off") == 0) return BANKER_OFF;
+    if (strcmp(name, "avoid") == 0) return BANKER_AVOID;
+    if (strcmp(name, "detect") == 0) return BANKER_DETECT;
+    return -1;
+}
+
+int banker_step(int claim) {
+    return (claim + banker.steps - 1) / banker.steps;
+}
+
+// The free pool as the algorithm sees it: the RAM images of swapped tasks
+// still belong to those tasks, and the HDD space holding them does not
+void banker_available(int *avail) {
+    avail[0] = res_available_ram() - swap_space.swapped_mb;
+    avail[1] = res_available_hdd() + swap_space.swapped_mb;
+    avail[2] = res_available_cores();
+}
+
+// First index in [lo, hi) whose need is above `need`, or equal to it
+// when `inclusive` is set
+int banker_rank_search(const BankerRank *order, int lo, int hi, int need, int inclusive) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (order[mid].need > need || (inclusive && order[mid].need == need)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// Moves client c to its place in resource r's list after its need changed
+void banker_order_fix(int c, int r) {
+    BankerClient *cl = banker.clients;
+    BankerRank *order = banker.order[r];
+    BankerRank entry = { cl[c].need[r], c };
+    int i = cl[c].rank[r];
+    int j = i;
+    
+    if (i > 0 && order[i - 1].need > entry.need) {
+        j = banker_rank_search(order, 0, i, entry.need, 0);
+        memmove(&order[j + 1], &order[j], (i - j) * sizeof(BankerRank));
+        for (int k = j + 1; k <= i; k++) {
+            cl[order[k].client].rank[r] = k;
+        }
+    } else if (i + 1 < banker.count && order[i + 1].need < entry.need) {
+        j = banker_rank_search(order, i + 1, banker.count, entry.need, 1) - 1;
+        memmove(&order[i], &order[i + 1], (j - i) * sizeof(BankerRank));
+        for (int k = i; k < j; k++) {
+            cl[order[k].client].rank[r] = k;
+        }
+    }
+    order[j] = entry;
+    cl[c].rank[r] = j;
+}
+
+// Reserves `span` consecutive epoch values, clearing the stamps on wrap
+unsigned int banker_next_epoch(unsigned int span) {
+    if (banker.epoch > 0xFFFFFFFFu - span) {
+        memset(banker.passed_epoch, 0, banker.cap * sizeof(unsigned int));
+        banker.epoch = 0;
+    }
+    unsigned int base = banker.epoch + 1;
+    banker.epoch += span;
+    return base;
+}
+
+int banker_add(const int *max, const int *alloc) {
+    if (banker.free_client < 0) {
+        int base = banker.cap;
+        banker.cap = banker.cap ? banker.cap * 2 : 64;
+        banker.clients = realloc(banker.clients, banker.cap * sizeof(BankerClient));
+        for (int r = 0; r < RES_KINDS; r++) {
+            banker.order[r] = realloc(banker.order[r], banker.cap * sizeof(BankerRank));
+        }
+        banker.passed = realloc(banker.passed, banker.cap * sizeof(int));
+        banker.passed_epoch = realloc(banker.passed_epoch, banker.cap * sizeof(unsigned int));
+        for (int c = banker.cap - 1; c >= base; c--) {
+            banker.passed_epoch[c] = 0;
+            banker.clients[c].in_use = 0;
+            banker.clients[c].next_free = banker.free_client;
+            banker.free_client = c;
+        }
+    }
+    
+    int c = banker.free_client;
+    BankerClient *cl = &banker.clients[c];
+    banker.free_client = cl->next_free;
+    
+    for (int r = 0; r < RES_KINDS; r++) {
+        cl->max[r] = max[r];
+        cl->alloc[r] = alloc[r];
+        cl->need[r] = max[r] - alloc[r];
+        cl->want[r] = 0;
+        cl->rank[r] = banker.count;
+        banker.order[r][banker.count].client = c;
+    }
+    banker.count++;
+    for (int r = 0; r < RES_KINDS; r++) {
+        banker_order_fix(c, r);
+    }
+    cl->task_slot = -1;
+    cl->job = -1;
+    cl->waiting = 0;
+    cl->in_use = 1;
+    return c;
+}
+
+// Tracks a task that has just started holding the first step of its claims
+void banker_attach(Task *task, int ram, int hdd, int cpu) {
+    int claim[RES_KINDS] = { phys_block_size(ram), hdd, cpu };
+    int held[RES_KINDS] = { phys_block_size(task->ram_usage), task->hdd_usage, task->cpu_usage };
+    int c = banker_add(claim, held);
+    BankerClient *cl = &banker.clients[c];
+    
+    cl->ram_claim = ram;
+    cl->task_slot = task->id & (MAX_TASK_SLOTS - 1);
+    cl->job = task->job_id;
+    task->banker_client = c;
+    if (cl->need[0] + cl->need[1] + cl->need[2] > 0) {
+        des_set_requests(task->job_id, (long long)task->remaining_time * TICKS_PER_SECOND / banker.steps);
+    }
+}
+
+void banker_unlink_waiting(int c) {
+    int prev = -1;
+    for (int w = banker.wait_head; w >= 0 && w != c; w = banker.clients[w].wait_next) {
+        prev = w;
+    }
+    int next = banker.clients[c].wait_next;
+    if (prev < 0) banker.wait_head = next; else banker.clients[prev].wait_next = next;
+    if (banker.wait_tail == c) banker.wait_tail = prev;
+    banker.clients[c].waiting = 0;
+    banker.waiting--;
+}
+
+void banker_remove(int c) {
+    if (c < 0) return;
+    BankerClient *cl = &banker.clients[c];
+    
+    if (cl->waiting) banker_unlink_waiting(c);
+    banker.count--;
+    for (int r = 0; r < RES_KINDS; r++) {
+        BankerRank *order = banker.order[r];
+        int rank = cl->rank[r];
+        memmove(&order[rank], &order[rank + 1], (banker.count - rank) * sizeof(BankerRank));
+        for (int i = rank; i < banker.count; i++) {
+            banker.clients[order[i].client].rank[r] = i;
+        }
+    }
+    cl->in_use = 0;
+    cl->next_free = banker.free_client;
+    banker.free_client = c;
+}
+
+// Would the state be safe with client `self` holding `alloc`, still
+// needing `need`, and `avail` left free? self may be -1 for a task that
+// is not tracked yet.
+int banker_safe(int self, const int *alloc, const int *need, const int *avail) {
+    BankerClient *cl = banker.clients;
+    int work[RES_KINDS];
+    int top_need[RES_KINDS];  // Largest need among the other clients
+    
+    banker.checks++;
+    for (int r = 0; r < RES_KINDS; r++) {
+        work[r] = avail[r];
+        int top = banker.count - 1;
+        if (top >= 0 && banker.order[r][top].client == self) top--;
+        top_need[r] = top >= 0 ? banker.order[r][top].need : 0;
+    }
+    
+    int others = banker.count - (self >= 0);
+    int cursor[RES_KINDS] = { 0 };
+    int finished = 0, self_done = 0;
+    unsigned int base = banker_next_epoch(RES_KINDS + 1);
+    int progress = 1;
+    
+    while (progress && !(self_done && finished == others)) {
+        // Once the pool covers every remaining need, everyone can finish
+        int covered = 1;
+        for (int r = 0; r < RES_KINDS; r++) {
+            if (top_need[r] > work[r] || (!self_done && need[r] > work[r])) covered = 0;
+        }
+        if (covered) {
+            banker.fast_checks++;
+            return 1;
+        }
+        
+        progress = 0;
+        if (!self_done && need[0] <= work[0] && need[1] <= work[1] && need[2] <= work[2]) {
+            for (int r = 0; r < RES_KINDS; r++) {
+                work[r] += alloc[r];
+            }
+            self_done = progress = 1;
+        }
+        for (int r = 0; r < RES_KINDS; r++) {
+            BankerRank *order = banker.order[r];
+            while (cursor[r] < banker.count && order[cursor[r]].need <= work[r]) {
+                int c = order[cursor[r]++].client;
+                if (c == self) continue;
+                if (banker.passed_epoch[c] < base) banker.passed_epoch[c] = base;
+                if (++banker.passed_epoch[c] - base < RES_KINDS) continue;
+                
+                for (int k = 0; k < RES_KINDS; k++) {
+                    work[k] += cl[c].alloc[k];
+                }
+                finished++;
+                progress = 1;
+            }
+        }
+    }
+    return self_done && finished == others;
+}
+
+// The textbook check, sweeping clients in registration order until a
+// sweep finishes nobody: O(clients^2 * resources) at worst. For the
+// benchmark.
+int banker_safe_naive(int self, const int *alloc, const int *need, const int *avail) {
+    BankerClient *cl = banker.clients;
+    int *done = calloc(banker.cap, sizeof(int));
+    int work[RES_KINDS];
+    int self_done = 0, finished = 0;
+    int others = banker.count - (self >= 0);
+    
+    for (int r = 0; r < RES_KINDS; r++) {
+        work[r] = avail[r];
+    }
+    int progress = 1;
+    while (progress) {
+        progress = 0;
+        if (!self_done && need[0] <= work[0] && need[1] <= work[1] && need[2] <= work[2]) {
+            for (int r = 0; r < RES_KINDS; r++) {
+                work[r] += alloc[r];
+            }
+            self_done = progress = 1;
+        }
+        for (int c = 0; c < banker.cap; c++) {
+            if (!cl[c].in_use || c == self || done[c] || cl[c].need[0] > work[0] ||
+                cl[c].need[1] > work[1] || cl[c].need[2] > work[2]) {
+                continue;
+            }
+            for (int r = 0; r < RES_KINDS; r++) {
+                work[r] += cl[c].alloc[r];
+            }
+            done[c] = 1;
+            finished++;
+            progress = 1;
+        }
+    }
+    free(done);
+    return self_done && finished == others;
+}
+
+// Whether a task claiming ram/hdd/cpu may start now with its first step
+int banker_can_admit(int ram, int hdd, int cpu) {
+    int claim[RES_KINDS] = { ram, hdd, cpu };
+    int total[RES_KINDS] = { system_res.total_ram, system_res.total_hdd, system_res.total_cores };
+    int avail[RES_KINDS], step[RES_KINDS], need[RES_KINDS];
+    
+    banker_available(avail);
+    for (int r = 0; r < RES_KINDS; r++) {
+        step[r] = banker_step(claim[r]);
+    }
+    if (!phys_can_alloc(step[0])) return 0;
+    claim[0] = phys_block_size(ram);
+    step[0] = phys_block_size(step[0]);
+    for (int r = 0; r < RES_KINDS; r++) {
+        need[r] = claim[r] - step[r];
+        if (claim[r] > total[r] || step[r] > avail[r]) return 0;
+        avail[r] -= step[r];
+    }
+    return banker.mode != BANKER_AVOID || banker_safe(-1, step, need, avail);
+}
+
+// Grants client c its pending request. Returns 1 if granted, 0 if the
+// resources are not free, -1 if granting would be unsafe.
+int banker_try(int c) {
+    BankerClient *cl = &banker.clients[c];
+    int avail[RES_KINDS], alloc[RES_KINDS], need[RES_KINDS];
+    
+    banker_available(avail);
+    for (int r = 0; r < RES_KINDS; r++) {
+        if (cl->want[r] > avail[r]) return 0;
+        alloc[r] = cl->alloc[r] + cl->want[r];
+        need[r] = cl->need[r] - cl->want[r];
+        avail[r] -= cl->want[r];
+    }
+    if (banker.mode == BANKER_AVOID && !banker_safe(c, alloc, need, avail)) return -1;
+    if (!grow_resources(task_slot(cl->task_slot), cl->ram_step, cl->want[1], cl->want[2])) return 0;
+    
+    for (int r = 0; r < RES_KINDS; r++) {
+        cl->alloc[r] = alloc[r];
+        cl->need[r] = need[r];
+        if (cl->want[r] > 0) banker_order_fix(c, r);
+        cl->want[r] = 0;
+    }
+    if (need[0] + need[1] + need[2] == 0) des_set_requests(cl->job, 0);
+    return 1;
+}
+
+// Aborts the youngest task on a cycle of waiting tasks each short of
+// something the next one holds. `work` is what the detection pass could
+// free; deadlocked clients are waiting ones not stamped with `epoch`.
+// Returns 0 if what they wait for is held by tasks started before the
+// mode was switched on, which will give it back in time.
+int banker_break_cycle(const int *work, unsigned int epoch) {
+    BankerClient *cl = banker.clients;
+    int *trail = malloc(banker.waiting * sizeof(int));
+    int len = 0;
+    unsigned int seen = banker_next_epoch(1);
+    
+    int u = banker.wait_head;
+    while (banker.passed_epoch[u] == epoch) u = cl[u].wait_next;
+    while (banker.passed_epoch[u] != seen) {
+        banker.passed_epoch[u] = seen;
+        banker.passed[u] = len;
+        trail[len++] = u;
+        
+        // Every deadlocked client is short of some resource that only
+        // other deadlocked clients hold
+        int r = 0;
+        while (cl[u].want[r] <= work[r]) r++;
+        int next = -1;
+        for (int w = banker.wait_head; w >= 0; w = cl[w].wait_next) {
+            if (banker.passed_epoch[w] != epoch && w != u && cl[w].alloc[r] > 0 &&
+                (next < 0 || cl[w].alloc[r] > cl[next].alloc[r])) {
+                next = w;
+            }
+        }
+        if (next < 0) {
+            free(trail);
+            return 0;
+        }
+        u = next;
+    }
+    
+    int victim = -1;
+    int pos = 0;
+    banker.last_cycle[0] = '\0';
+    for (int i = banker.passed[u]; i <= len; i++) {
+        int c = trail[i < len ? i : banker.passed[u]];
+        Task *task = task_slot(cl[c].task_slot);
+        pos += snprintf(banker.last_cycle + pos, sizeof(banker.last_cycle) - pos, "%s%s (PID %d)",
+                        i > banker.passed[u] ? " -> " : "", task->name, task->pid);
+        if (pos >= (int)sizeof(banker.last_cycle)) pos = sizeof(banker.last_cycle) - 1;
+        if (i < len && (victim < 0 || engine.jobs[cl[c].job].arrival > engine.jobs[cl[victim].job].arrival)) {
+            victim = c;
+        }
+    }
+    free(trail);
+    
+    Task *task = task_slot(cl[victim].task_slot);
+    banker.deadlocks++;
+    banker.victims++;
+    if (!quiet_mode) {
+        char message[sizeof(banker.last_cycle) + MAX_NAME_LENGTH + 32];
+        snprintf(message, sizeof(message), "Deadlock: %s - aborting %s", banker.last_cycle, task->name);
+        print_warning(message);
+    }
+    des_cancel(task->job_id);
+    remove_task(task);
+    return 1;
+}
+
+// Waiting clients whose requests cannot be met even if every other client
+// runs to completion are deadlocked; each pass breaks one cycle among them
+void banker_detect() {
+    BankerClient *cl = banker.clients;
+    
+    while (banker.wait_head >= 0) {
+        int work[RES_KINDS];
+        unsigned int epoch = banker_next_epoch(1);
+        
+        banker_available(work);
+        for (int i = 0; i < banker.count; i++) {
+            int c = banker.order[0][i].client;
+            if (cl[c].waiting) continue;
+            for (int r = 0; r < RES_KINDS; r++) {
+                work[r] += cl[c].alloc[r];
+            }
+        }
+        
+        int progress = 1, stuck = 0;
+        while (progress) {
+            progress = 0;
+            stuck = 0;
+            for (int c = banker.wait_head; c >= 0; c = cl[c].wait_next) {
+                if (banker.passed_epoch[c] == epoch) continue;
+                if (cl[c].want[0] > work[0] || cl[c].want[1] > work[1] || cl[c].want[2] > work[2]) {
+                    stuck++;
+                    continue;
+                }
+                banker.passed_epoch[c] = epoch;
+                for (int r = 0; r < RES_KINDS; r++) {
+                    work[r] += cl[c].alloc[r];
+                }
+                progress = 1;
+            }
+        }
+        if (stuck == 0 || !banker_break_cycle(work, epoch)) return;
+    }
+}
+
+// Called by the engine when a job reaches its next request point.
+// Returns 1 if the job may carry on, 0 if it now waits or was aborted.
+int banker_next_request(int job) {
+    SimJob *j = &engine.jobs[job];
+    Task *task = j->pid != 0 ? task_by_pid(j->pid) : NULL;
+    if (task == NULL || task->banker_client < 0) {
+        j->request_interval = 0;
+        return 1;
+    }
+    
+    int c = task->banker_client;
+    BankerClient *cl = &banker.clients[c];
+    for (int r = 1; r < RES_KINDS; r++) {
+        int step = banker_step(cl->max[r]);
+        cl->want[r] = step < cl->need[r] ? step : cl->need[r];
+    }
+    // RAM is requested in MB steps but counted as the allocator rounds it,
+    // which is what the reservation will take
+    cl->ram_step = banker_step(cl->ram_claim);
+    if (cl->ram_step > cl->ram_claim - task->ram_usage) cl->ram_step = cl->ram_claim - task->ram_usage;
+    cl->want[0] = phys_block_size(task->ram_usage + cl->ram_step) - phys_block_size(task->ram_usage);
+    j->until_request = j->request_interval;
+    banker.requests++;
+    
+    int granted = banker_try(c);
+    if (granted > 0) return 1;
+    if (granted < 0) banker.unsafe++; else banker.blocked++;
+    
+    cl->waiting = 1;
+    cl->wait_next = -1;
+    if (banker.wait_tail >= 0) banker.clients[banker.wait_tail].wait_next = c; else banker.wait_head = c;
+    banker.wait_tail = c;
+    banker.waiting++;
+    j->state = JOB_WAITING;
+    engine.waiting_jobs++;
+    
+    if (banker.mode == BANKER_DETECT) banker_detect();
+    return 0;
+}
+
+// Resources came back: grant waiting requests in arrival order. Granting
+// can run the engine (a woken job may preempt and complete another), so
+// a nested call only asks the outer one to go round again.
+void banker_retry() {
+    if (banker.wait_head < 0) return;
+    if (banker.retrying) {
+        banker.retry_again = 1;
+        return;
+    }
+    
+    banker.retrying = 1;
+    do {
+        banker.retry_again = 0;
+        for (int c = banker.wait_head; c >= 0; c = banker.clients[c].wait_next) {
+            if (banker_try(c) <= 0) continue;
+            
+            banker_unlink_waiting(c);
+            des_grant(banker.clients[c].job);
+            banker.retry_again = 1;
+            break;
+        }
+    } while (banker.retry_again);
+    banker.retrying = 0;
+}
+
+// Times the safety check against the textbook one on synthetic states of
+// 10 to 10000 clients. "Spread" leaves about twice the average remaining
+// need free, so most clients can finish straight away; "Chained" only has
+// a safe sequence in which each client waits for the ones before it, in
+// an order unrelated to registration. Each check asks whether one random
+// client may be granted a little more; "Update" is the cost of re-sorting
+// the need lists when a request is granted.
+int run_banker_benchmark(long checks, const char *csv_path) {
+    const int client_counts[] = { 10, 100, 1000, 10000 };
+    const char *states[] = { "Spread", "Chained" };
+    
+    FILE *csv = bench_csv_open(csv_path, "state,clients,checks,safe_pct,fast_pct,check_ns,naive_ns,update_ns,mismatches");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    printf("=== Banker's Safety Check Benchmark (%ld checks per run) ===\n", checks);
+    printf("%-8s %8s %7s %7s %10s %12s %8s %10s %9s\n", "State", "Clients", "Safe%", "Fast%",
+           "Check ns", "Naive ns", "Speedup", "Update ns", "Mismatch");
+    
+    for (int state = 0; state < 2; state++) {
+        for (int n_idx = 0; n_idx < 4; n_idx++) {
+            int n = client_counts[n_idx];
+            unsigned long long rng = 0x9e3779b97f4a7c15ULL;
+            int (*max)[RES_KINDS] = malloc(n * sizeof(*max));
+            int (*alloc)[RES_KINDS] = malloc(n * sizeof(*alloc));
+            int *seq = malloc(n * sizeof(int));
+            int avail[RES_KINDS] = { 16, 64, 1 };
+            long long need_sum[RES_KINDS] = { 0 };
+            
+            for (int i = 0; i < n; i++) {
+                int limit[RES_KINDS] = { 64, 256, 4 };
+                for (int r = 0; r < RES_KINDS; r++) {
+                    max[i][r] = 1 + rng_next(&rng) % limit[r];
+                    alloc[i][r] = rng_next(&rng) % (max[i][r] + 1);
+                    need_sum[r] += max[i][r] - alloc[i][r];
+                }
+                seq[i] = i;
+            }
+            if (state == 0) {
+                for (int r = 0; r < RES_KINDS; r++) {
+                    avail[r] = (int)(2 * need_sum[r] / n) + 1;
+                }
+            } else {
+                int work[RES_KINDS] = { avail[0], avail[1], avail[2] };
+                for (int i = n - 1; i > 0; i--) {
+                    int k = rng_next(&rng) % (i + 1);
+                    int tmp = seq[i];
+                    seq[i] = seq[k];
+                    seq[k] = tmp;
+                }
+                for (int i = 0; i < n; i++) {
+                    int c = seq[i];
+                    for (int r = 0; r < RES_KINDS; r++) {
+                        int need = work[r] - (int)(rng_next(&rng) % 3);
+                        max[c][r] = alloc[c][r] + (need > 0 ? need : 0);
+                        work[r] += alloc[c][r];
+                    }
+                }
+            }
+            
+            banker.count = 0;
+            banker.free_client = -1;
+            banker.cap = 0;
+            banker.epoch = 0;
+            for (int i = 0; i < n; i++) {
+                banker_add(max[i], alloc[i]);
+            }
+            free(max);
+            free(alloc);
+            free(seq);
+            
+            long naive_checks = 200000000L / ((long)n * n);
+            if (naive_checks < 1) naive_checks = 1;
+            if (naive_checks > checks) naive_checks = checks;
+            
+            long safe = 0, mismatches = 0;
+            long long check_ns = 0, naive_ns = 0, update_ns = 0;
+            banker.checks = banker.fast_checks = 0;
+            
+            for (long k = 0; k < checks; k++) {
+                int c = rng_next(&rng) % n;
+                BankerClient *cl = &banker.clients[c];
+                int grant[RES_KINDS], held[RES_KINDS], need[RES_KINDS], left[RES_KINDS];
+                for (int r = 0; r < RES_KINDS; r++) {
+                    int most = cl->need[r] < avail[r] ? cl->need[r] : avail[r];
+                    grant[r] = most > 0 ? rng_next(&rng) % 2 : 0;
+                    held[r] = cl->alloc[r] + grant[r];
+                    need[r] = cl->need[r] - grant[r];
+                    left[r] = avail[r] - grant[r];
+                }
+                
+                long long t0 = monotonic_ns();
+                int ok = banker_safe(c, held, need, left);
+                check_ns += monotonic_ns() - t0;
+                safe += ok;
+                
+                if (k < naive_checks) {
+                    t0 = monotonic_ns();
+                    int naive_ok = banker_safe_naive(c, held, need, left);
+                    naive_ns += monotonic_ns() - t0;
+                    if (naive_ok != ok) mismatches++;
+                }
+                
+                // Grant and take back, keeping the state stationary
+                t0 = monotonic_ns();
+                for (int pass = 0; pass < 2; pass++) {
+                    for (int r = 0; r < RES_KINDS; r++) {
+                        if (grant[r] == 0) continue;
+                        cl->need[r] += pass ? grant[r] : -grant[r];
+                        banker_order_fix(c, r);
+                    }
+                }
+                update_ns += monotonic_ns() - t0;
+            }
+            
+            double per_check = (double)check_ns / checks;
+            double per_naive = (double)naive_ns / naive_checks;
+            double per_update = (double)update_ns / checks / 2;
+            double safe_pct = 100.0 * safe / checks;
+            double fast_pct = 100.0 * banker.fast_checks / checks;
+            printf("%-8s %8d %6.1f%% %6.1f%% %10.0f %12.0f %7.1fx %10.0f %9ld\n",
+                   states[state], n, safe_pct, fast_pct, per_check, per_naive,
+                   per_check > 0 ? per_naive / per_check : 0.0, per_update, mismatches);
+            if (csv != NULL) {
+                fprintf(csv, "%s,%d,%ld,%.2f,%.2f,%.1f,%.1f,%.1f,%ld\n", states[state], n, checks,
+                        safe_pct, fast_pct, per_check, per_naive, per_update, mismatches);
+            }
+            
+            free(banker.clients);
+            free(banker.passed);
+            free(banker.passed_epoch);
+            for (int r = 0; r < RES_KINDS; r++) {
+                free(banker.order[r]);
+                banker.order[r] = NULL;
+            }
+            banker.clients = NULL;
+            banker.passed = NULL;
+            banker.passed_epoch = NULL;
+        }
+    }
+    
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+void show_banker_stats() {
+    if (banker.mode == BANKER_OFF) return;
+    
+    printf("\nDeadlock handling: %s, claims requested in %d steps\n",
+           banker_mode_name(banker.mode), banker.steps);
+    printf("Tracked tasks: %d | Waiting: %d | Requests: %ld (%ld deferred as unsafe, %ld blocked)\n",
+           banker.count, banker.waiting, banker.requests, banker.unsafe, banker.blocked);
+    printf("Safety checks: %ld (%.1f%% settled by the fast path)\n", banker.checks,
+           banker.checks > 0 ? 100.0 * banker.fast_checks / banker.checks : 0.0);
+    if (banker.deadlocks > 0) {
+        printf("Deadlocks: %ld | Last cycle: %s\n", banker.deadlocks, banker.last_cycle);
+    }
+}
+
+void configure_banker() {
+    printf("\nDeadlock handling:");
+    for (int i = 0; i < BANKER_MODE_COUNT; i++) {
+        printf(" %d. %s", i + 1, banker_mode_name(i));
+    }
+    printf(" [%s]: ", banker_mode_name(banker.mode));
+    int choice;
+    if (scanf("%d", &choice) != 1 || choice < 1 || choice > BANKER_MODE_COUNT) {
+        print_error("Invalid input!");
+        return;
+    }
+    
+    printf("Steps each claim is requested in [%d]: ", banker.steps);
+    int steps;
+    if (scanf("%d", &steps) != 1 || steps < 1) {
+        print_error("Invalid input!");
+        return;
+    }
+    
+    // Tasks already running keep the mode they started under
+    banker.mode = choice - 1;
+    banker.steps = steps;
+    print_success("Deadlock handling updated!");
+    sleep(1);
+}
+
+// ---- Discrete-event engine ----
+//
+// Virtual time advances from event to event instead of by wall-clock sleeps.
+// Events are kept in a binary min-heap ordered by (time, seq). Every
+// simulated core owns a ready queue of the active SchedPolicy; idle cores
+// steal from the busiest queue and a periodic balancer evens queue lengths.
+
+void event_push(EventType type, long long time, int core, int job, unsigned int gen) {
+    if (engine.event_count == engine.event_cap) {
+        engine.event_cap = engine.event_cap ? engine.event_cap * 2 : 64;
+        engine.events = realloc(engine.events, engine.event_cap * sizeof(SimEvent));
+    }
+    
+    SimEvent ev = { time, engine.event_seq++, type, core, job, gen };
+    int i = engine.event_count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        SimEvent *p = &engine.events[parent];
+        if (p->time < ev.time || (p->time == ev.time && p->seq < ev.seq)) break;
+        engine.events[i] = *p;
+        i = parent;
+    }
+    engine.events[i] = ev;
+}
+
+SimEvent event_pop() {
+    SimEvent top = engine.events[0];
+    SimEvent last = engine.events[--engine.event_count];
+    int n = engine.event_count, i = 0;
+    
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= n) break;
+        SimEvent *c = &engine.events[child];
+        if (child + 1 < n) {
+            SimEvent *r = &engine.events[child + 1];
+            if (r->time < c->time || (r->time == c->time && r->seq < c->seq)) {
+                child++;
+                c = r;
+            }
+        }
+        if (last.time < c->time || (last.time == c->time && last.seq < c->seq)) break;
+        engine.events[i] = *c;
+        i = child;
+    }
+    if (n > 0) engine.events[i] = last;
+    return top;
+}
+
+// Core count follows system_res.total_cores (at least one)
+void des_init(const SchedPolicy *policy) {
+    if (engine.policy != NULL) {
+        for (int c = 0; c < engine.core_count; c++) {
+            engine.policy->destroy(engine.cores[c].rq);
+        }
+    }
+    free(engine.cores);
+    free(engine.events);
+    free(engine.jobs);
+    metric_free(&engine.turnaround);
+    metric_free(&engine.waiting);
+    metric_free(&engine.response);
+    
+    memset(&engine, 0, sizeof(engine));
+    engine.free_job = -1;
+    engine.policy = policy;
+    engine.core_count = system_res.total_cores > 0 ? system_res.total_cores : 1;
+    disk_init(system_res.total_hdd);
+    engine.cores = calloc(engine.core_count, sizeof(SimCore));
+    for (int c = 0; c < engine.core_count; c++) {
+        engine.cores[c].rq = policy->create();
+        engine.cores[c].running = -1;
+        engine.cores[c].last_job = -1;
+    }
+}
+
+// Migrates every queued job into the new policy's ready queues
+void des_set_policy(const SchedPolicy *policy) {
+    if (policy == engine.policy) return;
+    
+    for (int c = 0; c < engine.core_count; c++) {
+        void *rq = policy->create();
+        int job;
+        while ((job = engine.policy->pick_next(engine.cores[c].rq)) >= 0) {
+            policy->enqueue(rq, job);
+        }
+        engine.policy->destroy(engine.cores[c].rq);
+        engine.cores[c].rq = rq;
+    }
+    engine.policy = policy;
+}
+
+long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void rq_enqueue(int core, int job) {
+    SimCore *c = &engine.cores[core];
+    
+    engine.jobs[job].core = core;
+    c->queued++;
+    engine.queued++;
+    
+    if (!engine.time_decisions) {
+        engine.policy->enqueue(c->rq, job);
+        return;
+    }
+    long long t0 = monotonic_ns();
+    engine.policy->enqueue(c->rq, job);
+    engine.decision_ns += monotonic_ns() - t0;
+    engine.timed_calls++;
+}
+
+int rq_pick_next(int core) {
+    SimCore *c = &engine.cores[core];
+    int job;
+    
+    if (!engine.time_decisions) {
+        job = engine.policy->pick_next(c->rq);
+    } else {
+        long long t0 = monotonic_ns();
+        job = engine.policy->pick_next(c->rq);
+        engine.decision_ns += monotonic_ns() - t0;
+        engine.timed_calls++;
+        engine.decisions++;
+    }
+    
+    if (job >= 0) {
+        c->queued--;
+        engine.queued--;
+    }
+    return job;
+}
+
+// Least loaded core, counting the job on the CPU
+int des_place(int job) {
+    (void)job;
+    int best = 0;
+    long best_load = -1;
+    
+    for (int c = 0; c < engine.core_count; c++) {
+        long load = engine.cores[c].queued + (engine.cores[c].running >= 0);
+        if (best_load < 0 || load < best_load) {
+            best = c;
+            best_load = load;
+            if (load == 0) break;
+        }
+    }
+    return best;
+}
+
+int job_alloc() {
+    if (engine.free_job < 0) {
+        int old_cap = engine.job_cap;
+        engine.job_cap = old_cap ? old_cap * 2 : 64;
+        engine.jobs = realloc(engine.jobs, engine.job_cap * sizeof(SimJob));
+        for (int i = engine.job_cap - 1; i >= old_cap; i--) {
+            engine.jobs[i].state = JOB_FREE;
+            engine.jobs[i].next_free = engine.free_job;
+            engine.free_job = i;
+        }
+    }
+    
+    int job = engine.free_job;
+    engine.free_job = engine.jobs[job].next_free;
+    engine.live_jobs++;
+    return job;
+}
+
+void job_free(int job) {
+    SimCore *c = &engine.cores[engine.jobs[job].core];
+    if (c->last_job == job) c->last_job = -2;
+    
+    engine.jobs[job].state = JOB_FREE;
+    engine.jobs[job].next_free = engine.free_job;
+    engine.free_job = job;
+    engine.live_jobs--;
+}
+
+void des_arm_balancer() {
+    if (engine.core_count > 1 && !engine.balance_armed) {
+        engine.balance_armed = 1;
+        event_push(EV_BALANCE, engine.clock + LOAD_BALANCE_INTERVAL, -1, -1, 0);
+    }
+}
+
+long long arrival_ticks(double seconds) {
+    return (long long)(seconds * TICKS_PER_SECOND + 0.5);
+}
+
+int des_submit(pid_t pid, const TraceRecord *spec) {
+    int job = job_alloc();
+    SimJob *j = &engine.jobs[job];
+    TaskClass task_class = task_class_for(spec->name);
+    
+    j->pid = pid;
+    j->state = JOB_READY;
+    j->priority = spec->priority;
+    j->task_class = task_class;
+    // A replayed task arrived when the trace says, however long admission
+    // kept it waiting
+    j->arrival = engine.clock;
+    if (headless_mode && arrival_ticks(spec->arrival) < j->arrival) {
+        j->arrival = arrival_ticks(spec->arrival);
+    }
+    j->burst = (long long)spec->burst * TICKS_PER_SECOND;
+    if (j->burst <= 0) j->burst = 1;
+    j->remaining = j->burst;
+    j->first_run = -1;
+    j->core = 0;
+    
+    // 1 tick == 1 ms
+    j->io_interval = spec->io_interval >= 0 ? spec->io_interval : class_io_interval[task_class];
+    j->io_time = spec->io_time >= 0 ? spec->io_time : class_io_time[task_class];
+    if (j->io_time <= 0) j->io_interval = 0;
+    j->until_io = j->io_interval;
+    j->io_total = 0;
+    j->disk_lba = -1;
+    j->mlfq_level = 0;
+    j->mlfq_used = 0;
+    j->mlfq_epoch = -1;
+    j->vruntime = -1;
+    j->deadline = j->arrival + (spec->deadline >= 0 ?
+                                  (long long)(spec->deadline * TICKS_PER_SECOND) :
+                                  j->burst * deadline_factor);
+    j->tickets = spec->tickets > 0 ? spec->tickets : spec->priority + 1;
+    j->ticket_pool = ticket_pool_for(spec->name);
+    j->stride_pass = 0;
+    j->swap_pending = 0;
+    j->request_interval = j->until_request = 0;
+    j->stopped = 0;
+    
+    des_wake(job);
+    des_arm_balancer();
+    return job;
+}
+
+void des_migrate(int from, int to, int job) {
+    if (from != to && engine.policy->migrate != NULL) {
+        engine.policy->migrate(engine.cores[from].rq, engine.cores[to].rq, job);
+    }
+}
+
+// The job stops for a resource request every `interval` ticks of CPU time
+void des_set_requests(int job, long long interval) {
+    engine.jobs[job].request_interval = engine.jobs[job].until_request = interval;
+}
+
+// Queues a newly ready job and lets the policy preempt the job running on
+// the chosen core
+void des_wake(int job) {
+    int core = des_place(job);
+    SimCore *c = &engine.cores[core];
+    
+    des_migrate(engine.jobs[job].core, core, job);
+    engine.jobs[job].ready_since = engine.clock;
+    rq_enqueue(core, job);
+    if (engine.policy->preempts != NULL && c->running >= 0 &&
+        engine.policy->preempts(c->rq, c->running, job)) {
+        c->slice_expires = 0;
+        des_handle_slice_end(core);
+    }
+}
+
+// Charges the job on `core` for the CPU time it used in this slice
+void des_stop_running(int core) {
+    SimCore *c = &engine.cores[core];
+    SimJob *j = &engine.jobs[c->running];
+    long long ran = engine.clock - c->slice_start;
+    
+    j->remaining -= ran;
+    c->busy_time += ran;
+    engine.busy_time += ran;
+    c->running = -1;
+    c->slice_gen++;
+    
+    // The slice's memory traffic goes through the paging model
+    if (vm_accesses_per_tick > 0 && j->pid != 0 && ran > 0) {
+        Task *task = task_by_pid(j->pid);
+        if (task != NULL) vm_run(task->asid, ran * vm_accesses_per_tick);
+    }
+}
+
+// A cancelled job still sitting in a ready queue, or blocked in I/O, is
+// dropped when it next surfaces
+void des_cancel(int job) {
+    if (job < 0 || engine.jobs[job].state == JOB_FREE) return;
+    
+    if (engine.jobs[job].state == JOB_RUNNING) {
+        des_stop_running(engine.jobs[job].core);
+        job_free(job);
+    } else if (engine.jobs[job].state == JOB_SWAPPED) {
+        engine.swapped_jobs--;
+        job_free(job);
+    } else if (engine.jobs[job].state == JOB_WAITING) {
+        engine.waiting_jobs--;
+        job_free(job);
+    } else {
+        engine.jobs[job].state = JOB_CANCELLED;
+    }
+}
+
+// Takes a swapped-out task's job off the CPU; a queued or blocked job is
+// parked when it next surfaces. Returns 0 if the job completed instead.
+int des_suspend(int job) {
+    if (job < 0 || engine.jobs[job].state == JOB_FREE) return 0;
+    
+    SimJob *j = &engine.jobs[job];
+    if (j->state == JOB_RUNNING) {
+        SimCore *c = &engine.cores[j->core];
+        c->slice_expires = 0;
+        des_handle_slice_end(j->core);
+        if (j->state == JOB_FREE) return 0;
+    }
+    j->swap_pending = 1;
+    j->swap_ready_at = -1;
+    return 1;
+}
+
+// The job may run again `delay` ticks from now
+void des_resume(int job, long long delay) {
+    if (job < 0 || engine.jobs[job].state == JOB_FREE) return;
+    
+    SimJob *j = &engine.jobs[job];
+    if (j->state == JOB_SWAPPED) {
+        engine.swapped_jobs--;
+        j->state = JOB_BLOCKED;
+        j->swap_pending = 0;
+        event_push(EV_IO_DONE, engine.clock + delay, -1, job, 0);
+        des_arm_balancer();
+    } else {
+        j->swap_ready_at = engine.clock + delay;
+    }
+}
+
+// A job parked in JOB_WAITING had its resource request granted
+void des_grant(int job) {
+    if (job < 0 || engine.jobs[job].state != JOB_WAITING) return;
+    
+    engine.jobs[job].state = JOB_READY;
+    engine.waiting_jobs--;
+    des_wake(job);
+    des_arm_balancer();
+}
+
+// A job whose task was swapped out while it sat in a queue or I/O wait
+// leaves the engine here, or is held until its swap-in completes.
+// Returns 1 if the job was taken.
+int des_park_swapped(int job) {
+    SimJob *j = &engine.jobs[job];
+    if (!j->swap_pending) return 0;
+    
+    if (j->swap_ready_at < 0) {
+        j->state = JOB_SWAPPED;
+        engine.swapped_jobs++;
+    } else {
+        j->state = JOB_BLOCKED;
+        j->swap_pending = 0;
+        event_push(EV_IO_DONE, j->swap_ready_at > engine.clock ? j->swap_ready_at : engine.clock,
+                   -1, job, 0);
+    }
+    return 1;
+}
+
+long long des_job_remaining(int job) {
+    if (job < 0 || engine.jobs[job].state == JOB_FREE) return 0;
+    
+    SimJob *j = &engine.jobs[job];
+    long long remaining = j->remaining;
+    if (j->state == JOB_RUNNING) {
+        remaining -= engine.clock - engine.cores[j->core].slice_start;
+    }
+    return remaining;
+}
+
+long long des_job_deadline(int job) {
+    if (job < 0 || engine.jobs[job].state == JOB_FREE) return 0;
+    return engine.jobs[job].deadline;
+}
+
+int des_job_blocked(int job) {
+    return job >= 0 && engine.jobs[job].state == JOB_BLOCKED;
+}
+
+// Core the job is running on, or -1 if it is not on a CPU
+int des_job_core(int job) {
+    if (job < 0 || engine.jobs[job].state != JOB_RUNNING) return -1;
+    return engine.jobs[job].core;
+}
+
+void des_set_arrivals(int (*next)(void *ctx, TraceRecord *rec), void *ctx) {
+    engine.next_arrival = next;
+    engine.arrival_ctx = ctx;
+    
+    if (next(ctx, &engine.pending)) {
+        event_push(EV_ARRIVAL, arrival_ticks(engine.pending.arrival), -1, -1, 0);
+    }
+}
+
+void des_handle_arrival() {
+    TraceRecord *rec = &engine.pending;
+    
+    engine.submitted++;
+    if (engine.jobs_only) {
+        des_submit(0, rec);
+        engine.started++;
+    } else {
+        // Jobs share the cores through the scheduling policy instead of
+        // holding them, so only RAM and HDD gate admission. A task asking
+        // for more cores than exist is still turned away.
+        int cpu = rec->cpu <= system_res.total_cores ? 0 : rec->cpu;
+        // Queued tasks (2) are counted as started when admission runs them
+        int status = create_process_ex(rec->name, rec->ram, rec->hdd, cpu, rec);
+        if (status == 1) {
+            engine.started++;
+        } else if (status == 0) {
+            engine.rejected++;
+        }
+    }
+    
+    if (engine.next_arrival(engine.arrival_ctx, rec)) {
+        long long when = arrival_ticks(rec->arrival);
+        event_push(EV_ARRIVAL, when > engine.clock ? when : engine.clock, -1, -1, 0);
+    }
+}
+
+void des_complete(int job) {
+    SimJob *j = &engine.jobs[job];
+    pid_t pid = j->pid;
+    
+    metric_add(&engine.turnaround, engine.clock - j->arrival);
+    metric_add(&engine.waiting, engine.clock - j->arrival - j->burst - j->io_total);
+    metric_add(&engine.response, j->first_run - j->arrival);
+    if (engine.clock > j->deadline) engine.deadline_misses++;
+    
+    job_free(job);
+    engine.completed++;
+    
+    if (pid == 0) return;
+    
+    Task *task = task_by_pid(pid);
+    if (task != NULL) {
+        remove_task(task);
+    }
+}
+
+void des_handle_slice_end(int core) {
+    SimCore *c = &engine.cores[core];
+    int job = c->running;
+    SimJob *j = &engine.jobs[job];
+    long long ran = engine.clock - c->slice_start;
+    
+    if (engine.policy->account != NULL) {
+        engine.policy->account(c->rq, job, ran, c->slice_expires);
+    }
+    des_stop_running(core);
+    j->until_io -= ran;
+    j->until_request -= ran;
+    
+    if (j->remaining <= 0) {
+        des_complete(job);
+    } else if (j->request_interval > 0 && j->until_request <= 0 && !banker_next_request(job)) {
+        // Parked in JOB_WAITING, or aborted to break a deadlock
+    } else if (j->io_interval > 0 && j->until_io <= 0) {
+        j->state = JOB_BLOCKED;
+        j->until_io = j->io_interval;
+        if (disk.enabled) {
+            disk_submit_job(job);
+        } else {
+            j->io_total += j->io_time;
+            event_push(EV_IO_DONE, engine.clock + j->io_time, -1, job, 0);
+        }
+    } else {
+        engine.preemptions++;
+        j->state = JOB_READY;
+        j->ready_since = engine.clock;
+        rq_enqueue(core, job);
+    }
+}
+
+void des_handle_io_done(int job) {
+    if (engine.jobs[job].state == JOB_CANCELLED) {
+        job_free(job);
+        return;
+    }
+    if (des_park_swapped(job)) return;
+    engine.jobs[job].state = JOB_READY;
+    des_wake(job);
+}
+
+// The request in service finished: its job wakes and the next one starts
+void des_handle_disk_done() {
+    SimJob *j = &engine.jobs[disk.current.job];
+    disk.busy = 0;
+    j->io_total += engine.clock - disk.current.arrival / 1000;
+    des_handle_io_done(disk.current.job);
+    if (disk.count > 0) {
+        event_push(EV_DISK_DONE, (disk_start(disk.clock) + 999) / 1000, -1, -1, 0);
+    }
+}
+
+int des_busiest_core(int exclude) {
+    int busiest = -1;
+    for (int c = 0; c < engine.core_count; c++) {
+        if (c != exclude && engine.cores[c].queued > 0 &&
+            (busiest < 0 || engine.cores[c].queued > engine.cores[busiest].queued)) {
+            busiest = c;
+        }
+    }
+    return busiest;
+}
+
+// An idle core with an empty queue pulls the next job of the busiest core
+int des_steal(int core) {
+    int victim = des_busiest_core(core);
+    if (victim < 0) return -1;
+    
+    int job = rq_pick_next(victim);
+    if (job >= 0 && engine.jobs[job].state != JOB_CANCELLED) {
+        des_migrate(victim, core, job);
+        engine.jobs[job].core = core;
+        engine.cores[core].steals++;
+        engine.cores[core].migrations++;
+        engine.migrations++;
+    }
+    return job;
+}
+
+void des_dispatch_core(int core) {
+    SimCore *c = &engine.cores[core];
+    
+    while (c->running < 0) {
+        int job = rq_pick_next(core);
+        if (job < 0) job = des_steal(core);
+        if (job < 0) return;
+        
+        SimJob *j = &engine.jobs[job];
+        if (j->state == JOB_CANCELLED) {
+            job_free(job);
+            continue;
+        }
+        if (des_park_swapped(job)) continue;
+        
+        long long slice = engine.policy->time_slice(c->rq, job);
+        c->slice_expires = slice > 0;
+        if (slice <= 0 || slice >= j->remaining) {
+            slice = j->remaining;
+            c->slice_expires = 0;
+        }
+        if (j->io_interval > 0 && j->until_io <= slice) {
+            slice = j->until_io;
+            c->slice_expires = 0;
+        }
+        if (j->request_interval > 0 && j->until_request <= slice) {
+            slice = j->until_request;
+            c->slice_expires = 0;
+        }
+        
+        if (j->first_run < 0) j->first_run = engine.clock;
+        j->state = JOB_RUNNING;
+        j->core = core;
+        c->running = job;
+        c->slice_start = engine.clock;
+        c->dispatches++;
+        engine.dispatches++;
+        if (c->last_job != -1 && c->last_job != job) {
+            engine.context_switches++;
+        }
+        c->last_job = job;
+        event_push(EV_SLICE_END, engine.clock + slice, core, job, c->slice_gen);
+    }
+}
+
+void des_dispatch() {
+    for (int core = 0; core < engine.core_count && engine.queued > 0; core++) {
+        if (engine.cores[core].running < 0) {
+            des_dispatch_core(core);
+        }
+    }
+}
+
+// Moves jobs from the longest to the shortest queue until no two queues
+// differ by more than one
+void des_handle_balance() {
+    engine.balance_armed = 0;
+    
+    for (int moves = 0; moves < engine.core_count * 4; moves++) {
+        int busiest = 0, idlest = 0;
+        for (int c = 1; c < engine.core_count; c++) {
+            if (engine.cores[c].queued > engine.cores[busiest].queued) busiest = c;
+            if (engine.cores[c].queued < engine.cores[idlest].queued) idlest = c;
+        }
+        if (engine.cores[busiest].queued - engine.cores[idlest].queued <= 1) break;
+        
+        int job = rq_pick_next(busiest);
+        if (engine.jobs[job].state == JOB_CANCELLED) {
+            job_free(job);
+            continue;
+        }
+        des_migrate(busiest, idlest, job);
+        rq_enqueue(idlest, job);
+        engine.cores[idlest].migrations++;
+        engine.migrations++;
+    }
+    
+    if (engine.live_jobs > engine.swapped_jobs + engine.waiting_jobs) {
+        des_arm_balancer();
+    }
+}
+
+// Processes events up to and including `limit` (or until the simulation
+// drains when limit < 0), then parks the clock at `limit`.
+void des_run_until(long long limit) {
+    while (1) {
+        des_dispatch();
+        
+        if (engine.event_count == 0) break;
+        if (limit >= 0 && engine.events[0].time > limit) break;
+        
+        SimEvent ev = event_pop();
+        engine.clock = ev.time;
+        
+        switch(ev.type) {
+            case EV_ARRIVAL:
+                des_handle_arrival();
+                break;
+            case EV_SLICE_END:
+                if (ev.gen == engine.cores[ev.core].slice_gen) {
+                    des_handle_slice_end(ev.core);
+                }
+                break;
+            case EV_BALANCE:
+                des_handle_balance();
+                break;
+            case EV_IO_DONE:
+                des_handle_io_done(ev.job);
+                break;
+            case EV_DISK_DONE:
+                des_handle_disk_done();
+                break;
+        }
+        
+        // Interactive runs hold queue_mutex here and admit from
+        // schedule_tasks() instead
+        if (admission.kick && headless_mode) admission_run();
+    }
+    
+    if (limit > engine.clock) {
+        engine.clock = limit;
+    }
+}
+
+void des_advance(long long ticks) {
+    des_run_until(engine.clock + ticks);
+}
+
+// ---- Scheduling policies ----
+
+// FIFO ready queue on a power-of-two ring buffer: enqueue, pop and the
+// Round Robin rotation (pop + enqueue) are all O(1).
+typedef struct {
+    int *slots;
+    unsigned int head;
+    unsigned int count;
+    unsigned int mask;
+} RingQueue;
+
+void *ring_queue_create() {
+    RingQueue *q = malloc(sizeof(RingQueue));
+    q->slots = malloc(16 * sizeof(int));
+    q->head = 0;
+    q->count = 0;
+    q->mask = 15;
+    return q;
+}
+
+void ring_queue_destroy(void *rq) {
+    RingQueue *q = rq;
+    free(q->slots);
+    free(q);
+}
+
+void ring_queue_push(void *rq, int job) {
+    RingQueue *q = rq;
+    
+    if (q->count > q->mask) {
+        // Unwrap into a buffer twice the size
+        unsigned int cap = (q->mask + 1) * 2;
+        int *slots = malloc(cap * sizeof(int));
+        for (unsigned int i = 0; i < q->count; i++) {
+            slots[i] = q->slots[(q->head + i) & q->mask];
+        }
+        free(q->slots);
+        q->slots = slots;
+        q->head = 0;
+        q->mask = cap - 1;
+    }
+    q->slots[(q->head + q->count) & q->mask] = job;
+    q->count++;
+}
+
+int ring_queue_pop(void *rq) {
+    RingQueue *q = rq;
+    if (q->count == 0) return -1;
+    
+    int job = q->slots[q->head];
+    q->head = (q->head + 1) & q->mask;
+    q->count--;
+    return job;
+}
+
+// Priority queue: one list per base level, kept in ready_since order, plus
+// a bitmap of the non-empty levels. Each job gains a level for every
+// priority_aging_interval seconds it has waited since it last became
+// ready, so the head of a list is its most aged job and a pick only
+// compares the heads of the non-empty levels.
+typedef struct {
+    int head[PRIORITY_LEVELS];
+    int tail[PRIORITY_LEVELS];
+    unsigned long long bitmap;
+} PriorityRunQueue;
+
+void *priority_create() {
+    PriorityRunQueue *q = malloc(sizeof(PriorityRunQueue));
+    for (int i = 0; i < PRIORITY_LEVELS; i++) {
+        q->head[i] = q->tail[i] = -1;
+    }
+    q->bitmap = 0;
+    return q;
+}
+
+void priority_destroy(void *rq) {
+    free(rq);
+}
+
+void priority_enqueue(void *rq, int job) {
+    PriorityRunQueue *q = rq;
+    int level = engine.jobs[job].priority;
+    if (level < 0) level = 0;
+    if (level > MAX_PRIORITY) level = MAX_PRIORITY;
+    
+    SimJob *j = &engine.jobs[job];
+    j->rq_next = -1;
+    q->bitmap |= 1ULL << level;
+    if (q->tail[level] < 0) {
+        q->head[level] = q->tail[level] = job;
+        return;
+    }
+    // A job that just became ready goes last; one that kept an older
+    // ready_since is walked in ahead of the jobs younger than it
+    if (engine.jobs[q->tail[level]].ready_since <= j->ready_since) {
+        engine.jobs[q->tail[level]].rq_next = job;
+        q->tail[level] = job;
+        return;
+    }
+    int *link = &q->head[level];
+    while (engine.jobs[*link].ready_since <= j->ready_since) {
+        link = &engine.jobs[*link].rq_next;
+    }
+    j->rq_next = *link;
+    *link = job;
+}
+
+// A job's level after aging; it falls back to its base level the next
+// time it is enqueued after running
+int priority_effective(int job, int level) {
+    if (priority_aging_interval <= 0) return level;
+    
+    long long interval = (long long)priority_aging_interval * TICKS_PER_SECOND;
+    long long aged = level + (engine.clock - engine.jobs[job].ready_since) / interval;
+    return aged < MAX_PRIORITY ? (int)aged : MAX_PRIORITY;
+}
+
+int priority_pick_next(void *rq) {
+    PriorityRunQueue *q = rq;
+    if (q->bitmap == 0) return -1;
+    
+    // Levels are visited top-down, so ties go to the higher base level
+    int level = -1, best = -1;
+    unsigned long long pending = q->bitmap;
+    while (pending && best < MAX_PRIORITY) {
+        int l = 63 - __builtin_clzll(pending);
+        pending &= ~(1ULL << l);
+        int effective = priority_effective(q->head[l], l);
+        if (effective > best) {
+            level = l;
+            best = effective;
+        }
+    }
+    int job = q->head[level];
+    q->head[level] = engine.jobs[job].rq_next;
+    if (q->head[level] < 0) {
+        q->tail[level] = -1;
+        q->bitmap &= ~(1ULL << level);
+    }
+    return job;
+}
+
+// Multilevel feedback queue: level 0 is the highest priority. A job keeps
+// its level until it has used that level's quantum in total (across I/O
+// waits), then drops one level. Every mlfq_boost_period all jobs return to
+// level 0; the boost is applied lazily by comparing epochs.
+typedef struct {
+    int head[MLFQ_MAX_LEVELS];
+    int tail[MLFQ_MAX_LEVELS];
+    unsigned int bitmap;
+    long long epoch;
+} MlfqRunQueue;
+
+long long mlfq_current_epoch() {
+    return mlfq_boost_period > 0 ? engine.clock / mlfq_boost_period : 0;
+}
+
+int mlfq_job_level(int job) {
+    SimJob *j = &engine.jobs[job];
+    if (j->mlfq_epoch != mlfq_current_epoch()) {
+        j->mlfq_epoch = mlfq_current_epoch();
+        j->mlfq_level = 0;
+        j->mlfq_used = 0;
+    }
+    return j->mlfq_level;
+}
+
+void *mlfq_create() {
+    MlfqRunQueue *q = malloc(sizeof(MlfqRunQueue));
+    for (int i = 0; i < MLFQ_MAX_LEVELS; i++) {
+        q->head[i] = q->tail[i] = -1;
+    }
+    q->bitmap = 0;
+    q->epoch = mlfq_current_epoch();
+    return q;
+}
+
+void mlfq_destroy(void *rq) {
+    free(rq);
+}
+
+void mlfq_enqueue(void *rq, int job) {
+    MlfqRunQueue *q = rq;
+    int level = mlfq_job_level(job);
+    
+    engine.jobs[job].rq_next = -1;
+    if (q->tail[level] < 0) {
+        q->head[level] = job;
+    } else {
+        engine.jobs[q->tail[level]].rq_next = job;
+    }
+    q->tail[level] = job;
+    q->bitmap |= 1u << level;
+}
+
+// Priority boost: splice every lower level onto level 0 in arrival order
+void mlfq_boost(MlfqRunQueue *q) {
+    for (int level = 1; level < MLFQ_MAX_LEVELS; level++) {
+        if (q->head[level] < 0) continue;
+        
+        if (q->tail[0] < 0) {
+            q->head[0] = q->head[level];
+        } else {
+            engine.jobs[q->tail[0]].rq_next = q->head[level];
+        }
+        q->tail[0] = q->tail[level];
+        q->head[level] = q->tail[level] = -1;
+    }
+    if (q->bitmap) q->bitmap = 1;
+}
+
+int mlfq_pick_next(void *rq) {
+    MlfqRunQueue *q = rq;
+    
+    if (q->epoch != mlfq_current_epoch()) {
+        q->epoch = mlfq_current_epoch();
+        mlfq_boost(q);
+    }
+    if (q->bitmap == 0) return -1;
+    
+    int level = __builtin_ctz(q->bitmap);
+    int job = q->head[level];
+    q->head[level] = engine.jobs[job].rq_next;
+    if (q->head[level] < 0) {
+        q->tail[level] = -1;
+        q->bitmap &= ~(1u << level);
+    }
+    return job;
+}
+
+// Whatever is left of the current level's allotment
+long long mlfq_slice(void *rq, int job) {
+    (void)rq;
+    int level = mlfq_job_level(job);
+    long long left = mlfq_quanta[level] - engine.jobs[job].mlfq_used;
+    return left > 0 ? left : 1;
+}
+
+void mlfq_account(void *rq, int job, long long ran, int expired) {
+    (void)rq;
+    (void)expired;
+    SimJob *j = &engine.jobs[job];
+    int level = mlfq_job_level(job);
+    
+    j->mlfq_used += ran;
+    if (j->mlfq_used >= mlfq_quanta[level]) {
+        if (level < mlfq_levels - 1) j->mlfq_level = level + 1;
+        j->mlfq_used = 0;
+    }
+}
+
+// Completely fair scheduler: runnable jobs sit in a red-black tree keyed
+// on weighted virtual runtime and the leftmost (least served) job runs
+// next. Weights follow the Linux nice table, with priority 0-63 mapped
+// onto nice 19..-20.
+#define NICE_0_WEIGHT 1024
+
+static const int cfs_nice_weights[40] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45, 36, 29, 23, 18, 15
+};
+
+typedef struct {
+    int root;
+    int leftmost;
+    int nr_running;
+    long long total_weight;
+    long long min_vruntime;
+} CfsRunQueue;
+
+int cfs_weight(int priority) {
+    if (priority < 0) priority = 0;
+    if (priority > MAX_PRIORITY) priority = MAX_PRIORITY;
+    int nice = 19 - priority * 39 / MAX_PRIORITY;
+    return cfs_nice_weights[nice + 20];
+}
+
+// Ties on vruntime fall back to the job index so keys are unique
+int cfs_less(int a, int b) {
+    long long va = engine.jobs[a].vruntime, vb = engine.jobs[b].vruntime;
+    return va < vb || (va == vb && a < b);
+}
+
+int rb_is_red(int node) {
+    return node >= 0 && engine.jobs[node].rb_red;
+}
+
+void rb_replace_child(CfsRunQueue *q, int parent, int old, int node) {
+    if (parent < 0) {
+        q->root = node;
+    } else if (engine.jobs[parent].rb_left == old) {
+        engine.jobs[parent].rb_left = node;
+    } else {
+        engine.jobs[parent].rb_right = node;
+    }
+    if (node >= 0) engine.jobs[node].rb_parent = parent;
+}
+
+void rb_rotate_left(CfsRunQueue *q, int x) {
+    SimJob *jobs = engine.jobs;
+    int y = jobs[x].rb_right;
+    
+    jobs[x].rb_right = jobs[y].rb_left;
+    if (jobs[y].rb_left >= 0) jobs[jobs[y].rb_left].rb_parent = x;
+    rb_replace_child(q, jobs[x].rb_parent, x, y);
+    jobs[y].rb_left = x;
+    jobs[x].rb_parent = y;
+}
+
+void rb_rotate_right(CfsRunQueue *q, int x) {
+    SimJob *jobs = engine.jobs;
+    int y = jobs[x].rb_left;
+    
+    jobs[x].rb_left = jobs[y].rb_right;
+    if (jobs[y].rb_right >= 0) jobs[jobs[y].rb_right].rb_parent = x;
+    rb_replace_child(q, jobs[x].rb_parent, x, y);
+    jobs[y].rb_right = x;
+    jobs[x].rb_parent = y;
+}
+
+void rb_insert(CfsRunQueue *q, int z) {
+    SimJob *jobs = engine.jobs;
+    int parent = -1, node = q->root, leftmost = 1;
+    
+    while (node >= 0) {
+        parent = node;
+        if (cfs_less(z, node)) {
+            node = jobs[node].rb_left;
+        } else {
+            node = jobs[node].rb_right;
+            leftmost = 0;
+        }
+    }
+    jobs[z].rb_parent = parent;
+    jobs[z].rb_left = jobs[z].rb_right = -1;
+    jobs[z].rb_red = 1;
+    if (parent < 0) {
+        q->root = z;
+    } else if (cfs_less(z, parent)) {
+        jobs[parent].rb_left = z;
+    } else {
+        jobs[parent].rb_right = z;
+    }
+    if (leftmost) q->leftmost = z;
+    
+    int p;
+    while ((p = jobs[z].rb_parent) >= 0 && jobs[p].rb_red) {
+        int g = jobs[p].rb_parent;
+        if (p == jobs[g].rb_left) {
+            int uncle = jobs[g].rb_right;
+            if (rb_is_red(uncle)) {
+                jobs[p].rb_red = jobs[uncle].rb_red = 0;
+                jobs[g].rb_red = 1;
+                z = g;
+                continue;
+            }
+            if (z == jobs[p].rb_right) {
+                rb_rotate_left(q, p);
+                z = p;
+                p = jobs[z].rb_parent;
+            }
+            jobs[p].rb_red = 0;
+            jobs[g].rb_red = 1;
+            rb_rotate_right(q, g);
+        } else {
+            int uncle = jobs[g].rb_left;
+            if (rb_is_red(uncle)) {
+                jobs[p].rb_red = jobs[uncle].rb_red = 0;
+                jobs[g].rb_red = 1;
+                z = g;
+                continue;
+            }
+            if (z == jobs[p].rb_left) {
+                rb_rotate_right(q, p);
+                z = p;
+                p = jobs[z].rb_parent;
+            }
+            jobs[p].rb_red = 0;
+            jobs[g].rb_red = 1;
+            rb_rotate_left(q, g);
+        }
+    }
+    jobs[q->root].rb_red = 0;
+}
+
+void rb_erase(CfsRunQueue *q, int z) {
+    SimJob *jobs = engine.jobs;
+    int x, x_parent;
+    int removed_red = jobs[z].rb_red;
+    
+    if (q->leftmost == z) {
+        // The leftmost node has no left child
+        int next = jobs[z].rb_right;
+        if (next >= 0) {
+            while (jobs[next].rb_left >= 0) next = jobs[next].rb_left;
+        } else {
+            next = jobs[z].rb_parent;
+        }
+        q->leftmost = next;
+    }
+    
+    if (jobs[z].rb_left < 0 || jobs[z].rb_right < 0) {
+        x = jobs[z].rb_left >= 0 ? jobs[z].rb_left : jobs[z].rb_right;
+        x_parent = jobs[z].rb_parent;
+        rb_replace_child(q, x_parent, z, x);
+    } else {
+        int y = jobs[z].rb_right;
+        while (jobs[y].rb_left >= 0) y = jobs[y].rb_left;
+        removed_red = jobs[y].rb_red;
+        x = jobs[y].rb_right;
+        
+        if (jobs[y].rb_parent == z) {
+            x_parent = y;
+        } else {
+            x_parent = jobs[y].rb_parent;
+            rb_replace_child(q, x_parent, y, x);
+            jobs[y].rb_right = jobs[z].rb_right;
+            jobs[jobs[y].rb_right].rb_parent = y;
+        }
+        rb_replace_child(q, jobs[z].rb_parent, z, y);
+        jobs[y].rb_left = jobs[z].rb_left;
+        jobs[jobs[y].rb_left].rb_parent = y;
+        jobs[y].rb_red = jobs[z].rb_red;
+    }
+    if (removed_red) return;
+    
+    while (x != q->root && !rb_is_red(x)) {
+        if (x == jobs[x_parent].rb_left) {
+            int w = jobs[x_parent].rb_right;
+            if (jobs[w].rb_red) {
+                jobs[w].rb_red = 0;
+                jobs[x_parent].rb_red = 1;
+                rb_rotate_left(q, x_parent);
+                w = jobs[x_parent].rb_right;
+            }
+            if (!rb_is_red(jobs[w].rb_left) && !rb_is_red(jobs[w].rb_right)) {
+                jobs[w].rb_red = 1;
+                x = x_parent;
+                x_parent = jobs[x].rb_parent;
+                continue;
+            }
+            if (!rb_is_red(jobs[w].rb_right)) {
+                jobs[jobs[w].rb_left].rb_red = 0;
+                jobs[w].rb_red = 1;
+                rb_rotate_right(q, w);
+                w = jobs[x_parent].rb_right;
+            }
+            jobs[w].rb_red = jobs[x_parent].rb_red;
+            jobs[x_parent].rb_red = 0;
+            jobs[jobs[w].rb_right].rb_red = 0;
+            rb_rotate_left(q, x_parent);
+        } else {
+            int w = jobs[x_parent].rb_left;
+            if (jobs[w].rb_red) {
+                jobs[w].rb_red = 0;
+                jobs[x_parent].rb_red = 1;
+                rb_rotate_right(q, x_parent);
+                w = jobs[x_parent].rb_left;
+            }
+            if (!rb_is_red(jobs[w].rb_left) && !rb_is_red(jobs[w].rb_right)) {
+                jobs[w].rb_red = 1;
+                x = x_parent;
+                x_parent = jobs[x].rb_parent;
+                continue;
+            }
+            if (!rb_is_red(jobs[w].rb_left)) {
+                jobs[jobs[w].rb_right].rb_red = 0;
+                jobs[w].rb_red = 1;
+                rb_rotate_left(q, w);
+                w = jobs[x_parent].rb_left;
+            }
+            jobs[w].rb_red = jobs[x_parent].rb_red;
+            jobs[x_parent].rb_red = 0;
+            jobs[jobs[w].rb_left].rb_red = 0;
+            rb_rotate_right(q, x_parent);
+        }
+        x = q->root;
+    }
+    if (x >= 0) jobs[x].rb_red = 0;
+}
+
+void *cfs_create() {
+    CfsRunQueue *q = malloc(sizeof(CfsRunQueue));
+    q->root = q->leftmost = -1;
+    q->nr_running = 0;
+    q->total_weight = 0;
+    q->min_vruntime = 0;
+    return q;
+}
+
+void cfs_destroy(void *rq) {
+    free(rq);
+}
+
+// New jobs start at min_vruntime. A job returning from I/O keeps its
+// vruntime but gets at most half a latency period of credit, so sleepers
+// are favoured without being able to starve everyone else.
+void cfs_enqueue(void *rq, int job) {
+    CfsRunQueue *q = rq;
+    SimJob *j = &engine.jobs[job];
+    
+    if (j->vruntime < 0) {
+        j->vruntime = q->min_vruntime;
+    } else if (j->vruntime < q->min_vruntime - cfs_target_latency / 2) {
+        j->vruntime = q->min_vruntime - cfs_target_latency / 2;
+    }
+    j->cfs_weight = cfs_weight(j->priority);
+    
+    rb_insert(q, job);
+    q->nr_running++;
+    q->total_weight += j->cfs_weight;
+}
+
+// vruntime is only comparable within one queue, so a job moving to
+// another core keeps its lead or lag over the source queue's min_vruntime
+void cfs_migrate(void *from, void *to, int job) {
+    SimJob *j = &engine.jobs[job];
+    if (j->vruntime < 0) return;
+    j->vruntime += ((CfsRunQueue *)to)->min_vruntime - ((CfsRunQueue *)from)->min_vruntime;
+    if (j->vruntime < 0) j->vruntime = 0;
+}
+
+int cfs_pick_next(void *rq) {
+    CfsRunQueue *q = rq;
+    int job = q->leftmost;
+    
+    if (job < 0) return -1;
+    rb_erase(q, job);
+    q->nr_running--;
+    q->total_weight -= engine.jobs[job].cfs_weight;
+    return job;
+}
+
+// The job's weighted share of one scheduling period. The period stretches
+// once there are too many jobs to give each the minimum granularity.
+long long cfs_slice(void *rq, int job) {
+    CfsRunQueue *q = rq;
+    long long weight = engine.jobs[job].cfs_weight;
+    long long nr = q->nr_running + 1;
+    long long period = cfs_target_latency;
+    
+    if (nr * cfs_min_granularity > period) period = nr * cfs_min_granularity;
+    long long slice = period * weight / (q->total_weight + weight);
+    return slice > cfs_min_granularity ? slice : cfs_min_granularity;
+}
+
+void cfs_account(void *rq, int job, long long ran, int expired) {
+    (void)expired;
+    CfsRunQueue *q = rq;
+    SimJob *j = &engine.jobs[job];
+    
+    j->vruntime += ran * NICE_0_WEIGHT / j->cfs_weight;
+    
+    long long floor = j->vruntime;
+    if (q->leftmost >= 0 && engine.jobs[q->leftmost].vruntime < floor) {
+        floor = engine.jobs[q->leftmost].vruntime;
+    }
+    if (floor > q->min_vruntime) q->min_vruntime = floor;
+}
+
+// Binary min-heap of jobs shared by SJF, SRTF and EDF, which differ only
+// in the key: total burst, remaining time or absolute deadline. The key is
+// captured at enqueue time (a queued job's remaining time cannot change)
+// and equal keys leave in FIFO order.
+typedef struct {
+    long long key;
+    unsigned long long seq;
+    int job;
+} HeapEntry;
+
+typedef struct {
+    HeapEntry *items;
+    int count;
+    int cap;
+    unsigned long long seq;
+    long long (*key)(int job);
+} JobHeap;
+
+long long sjf_key(int job) {
+    return engine.jobs[job].burst;
+}
+
+long long srtf_key(int job) {
+    return engine.jobs[job].remaining;
+}
+
+long long edf_key(int job) {
+    return engine.jobs[job].deadline;
+}
+
+int heap_entry_less(const HeapEntry *a, const HeapEntry *b) {
+    return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+void *job_heap_create(long long (*key)(int job)) {
+    JobHeap *h = malloc(sizeof(JobHeap));
+    h->cap = 16;
+    h->items = malloc(h->cap * sizeof(HeapEntry));
+    h->count = 0;
+    h->seq = 0;
+    h->key = key;
+    return h;
+}
+
+void *sjf_create() {
+    return job_heap_create(sjf_key);
+}
+
+void *srtf_create() {
+    return job_heap_create(srtf_key);
+}
+
+void *edf_create() {
+    return job_heap_create(edf_key);
+}
+
+void job_heap_destroy(void *rq) {
+    JobHeap *h = rq;
+    free(h->items);
+    free(h);
+}
+
+void job_heap_push(void *rq, int job) {
+    JobHeap *h = rq;
+    
+    if (h->count == h->cap) {
+        h->cap *= 2;
+        h->items = realloc(h->items, h->cap * sizeof(HeapEntry));
+    }
+    HeapEntry entry = { h->key(job), h->seq++, job };
+    int i = h->count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!heap_entry_less(&entry, &h->items[parent])) break;
+        h->items[i] = h->items[parent];
+        i = parent;
+    }
+    h->items[i] = entry;
+}
+
+int job_heap_pop(void *rq) {
+    JobHeap *h = rq;
+    
+    if (h->count == 0) return -1;
+    int job = h->items[0].job;
+    HeapEntry last = h->items[--h->count];
+    
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= h->count) break;
+        if (child + 1 < h->count && heap_entry_less(&h->items[child + 1], &h->items[child])) {
+            child++;
+        }
+        if (!heap_entry_less(&h->items[child], &last)) break;
+        h->items[i] = h->items[child];
+        i = child;
+    }
+    h->items[i] = last;
+    return job;
+}
+
+int job_heap_peek(void *rq) {
+    JobHeap *h = rq;
+    return h->count > 0 ? h->items[0].job : -1;
+}
+
+int srtf_preempts(void *rq, int running, int woken) {
+    (void)rq;
+    return engine.jobs[woken].remaining < des_job_remaining(running);
+}
+
+int edf_preempts(void *rq, int running, int woken) {
+    (void)rq;
+    return engine.jobs[woken].deadline < engine.jobs[running].deadline;
+}
+
+// Proportional-share scheduling. Lottery and stride both schedule
+// "clients": a single job, or every queued job belonging to one ticket
+// pool (see ticket_pools), which then take turns in FIFO order. Lottery
+// draws a client with probability tickets/total through a Fenwick tree
+// over client slots; stride runs the client with the lowest pass from a
+// heap, where each entry carries a version so re-keyed clients just push
+// a fresh entry and stale ones are skipped.
+#define STRIDE1 (1LL << 20)
+
+typedef struct {
+    int head;
+    int tail;
+    int count;  // Queued member jobs, 0 = slot is free
+    int tickets;
+    int pool;  // -1 for a single-job client
+    unsigned int version;
+    int next_free;
+} ShareClient;
+
+typedef struct {
+    int stride;
+    ShareClient *clients;
+    int client_cap;  // Power of two
+    int free_client;
+    long long *fenwick;  // 1-based, lottery only
+    HeapEntry *heap;     // seq holds the client version, job the client slot
+    int heap_count;
+    int heap_cap;
+    int pool_client[TICKET_POOL_MAX];
+    long long pool_pass[TICKET_POOL_MAX];
+    long long total_tickets;
+    long long global_pass;
+} ShareQueue;
+
+void share_fenwick_add(ShareQueue *q, int slot, long long delta) {
+    for (int i = slot + 1; i <= q->client_cap; i += i & -i) {
+        q->fenwick[i] += delta;
+    }
+}
+
+// Client slot owning ticket number `ticket` (0 <= ticket < total_tickets)
+int share_fenwick_find(ShareQueue *q, long long ticket) {
+    int pos = 0;
+    for (int step = q->client_cap; step > 0; step >>= 1) {
+        if (pos + step <= q->client_cap && q->fenwick[pos + step] <= ticket) {
+            pos += step;
+            ticket -= q->fenwick[pos];
+        }
+    }
+    return pos;
+}
+
+void share_grow(ShareQueue *q) {
+    int old_cap = q->client_cap;
+    
+    q->client_cap = old_cap > 0 ? old_cap * 2 : 16;
+    q->clients = realloc(q->clients, q->client_cap * sizeof(ShareClient));
+    for (int i = q->client_cap - 1; i >= old_cap; i--) {
+        q->clients[i].count = 0;
+        q->clients[i].version = 0;
+        q->clients[i].next_free = q->free_client;
+        q->free_client = i;
+    }
+    
+    if (!q->stride) {
+        free(q->fenwick);
+        q->fenwick = calloc(q->client_cap + 1, sizeof(long long));
+        for (int i = 0; i < old_cap; i++) {
+            if (q->clients[i].count > 0) share_fenwick_add(q, i, q->clients[i].tickets);
+        }
+    }
+}
+
+void share_heap_push(ShareQueue *q, long long pass, int slot) {
+    if (q->heap_count == q->heap_cap) {
+        q->heap_cap = q->heap_cap > 0 ? q->heap_cap * 2 : 16;
+        q->heap = realloc(q->heap, q->heap_cap * sizeof(HeapEntry));
+    }
+    HeapEntry entry = { pass, q->clients[slot].version, slot };
+    int i = q->heap_count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (q->heap[parent].key <= entry.key) break;
+        q->heap[i] = q->heap[parent];
+        i = parent;
+    }
+    q->heap[i] = entry;
+}
+
+HeapEntry share_heap_pop(ShareQueue *q) {
+    HeapEntry top = q->heap[0];
+    HeapEntry last = q->heap[--q->heap_count];
+    
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= q->heap_count) break;
+        if (child + 1 < q->heap_count && q->heap[child + 1].key < q->heap[child].key) child++;
+        if (q->heap[child].key >= last.key) break;
+        q->heap[i] = q->heap[child];
+        i = child;
+    }
+    q->heap[i] = last;
+    return top;
+}
+
+long long *share_pass(ShareQueue *q, int slot) {
+    ShareClient *client = &q->clients[slot];
+    return client->pool >= 0 ? &q->pool_pass[client->pool] : &engine.jobs[client->head].stride_pass;
+}
+
+void *share_create(int stride) {
+    ShareQueue *q = calloc(1, sizeof(ShareQueue));
+    q->stride = stride;
+    q->free_client = -1;
+    for (int i = 0; i < TICKET_POOL_MAX; i++) {
+        q->pool_client[i] = -1;
+    }
+    share_grow(q);
+    return q;
+}
+
+void *lottery_create() {
+    return share_create(0);
+}
+
+void *stride_create() {
+    return share_create(1);
+}
+
+void share_destroy(void *rq) {
+    ShareQueue *q = rq;
+    free(q->clients);
+    free(q->fenwick);
+    free(q->heap);
+    free(q);
+}
+
+void share_enqueue(void *rq, int job) {
+    ShareQueue *q = rq;
+    SimJob *j = &engine.jobs[job];
+    int pool = j->ticket_pool;
+    
+    j->rq_next = -1;
+    if (pool >= 0 && q->pool_client[pool] >= 0) {
+        ShareClient *client = &q->clients[q->pool_client[pool]];
+        engine.jobs[client->tail].rq_next = job;
+        client->tail = job;
+        client->count++;
+        return;
+    }
+    
+    if (q->free_client < 0) share_grow(q);
+    int slot = q->free_client;
+    ShareClient *client = &q->clients[slot];
+    q->free_client = client->next_free;
+    
+    client->head = client->tail = job;
+    client->count = 1;
+    client->pool = pool;
+    client->tickets = pool >= 0 ? ticket_pools[pool].tickets : j->tickets;
+    if (client->tickets <= 0) client->tickets = 1;
+    if (pool >= 0) q->pool_client[pool] = slot;
+    q->total_tickets += client->tickets;
+    
+    if (q->stride) {
+        // A client that was away does not bank credit for the time it missed
+        long long *pass = share_pass(q, slot);
+        if (*pass < q->global_pass) *pass = q->global_pass;
+        share_heap_push(q, *pass, slot);
+    } else {
+        share_fenwick_add(q, slot, client->tickets);
+    }
+}
+
+int share_pick_next(void *rq) {
+    ShareQueue *q = rq;
+    int slot;
+    
+    if (q->total_tickets == 0) return -1;
+    if (q->stride) {
+        HeapEntry top;
+        do {
+            top = share_heap_pop(q);
+        } while (top.seq != q->clients[top.job].version || q->clients[top.job].count == 0);
+        slot = top.job;
+    } else {
+        slot = share_fenwick_find(q, sim_rand() % q->total_tickets);
+    }
+    
+    ShareClient *client = &q->clients[slot];
+    int job = client->head;
+    client->head = engine.jobs[job].rq_next;
+    
+    if (--client->count > 0) {
+        // Pool with more members waiting: keep it in the draw
+        if (q->stride) share_heap_push(q, *share_pass(q, slot), slot);
+        return job;
+    }
+    
+    q->total_tickets -= client->tickets;
+    if (!q->stride) share_fenwick_add(q, slot, -client->tickets);
+    if (client->pool >= 0) q->pool_client[client->pool] = -1;
+    client->version++;
+    client->next_free = q->free_client;
+    q->free_client = slot;
+    return job;
+}
+
+// Stride charges the client for the CPU it actually used, so a job that
+// blocks early is not billed a whole quantum
+void share_account(void *rq, int job, long long ran, int expired) {
+    (void)expired;
+    ShareQueue *q = rq;
+    SimJob *j = &engine.jobs[job];
+    
+    if (!q->stride) return;
+    
+    int pool = j->ticket_pool;
+    int slot = pool >= 0 ? q->pool_client[pool] : -1;
+    long long tickets = pool >= 0 ? ticket_pools[pool].tickets : j->tickets;
+    if (tickets <= 0) tickets = 1;
+    
+    // global_pass moves at the rate of all active clients, including the
+    // one that just ran if it has left the queue
+    long long active = q->total_tickets + (slot < 0 ? tickets : 0);
+    q->global_pass += ran * STRIDE1 / active;
+    
+    if (pool < 0) {
+        j->stride_pass += ran * STRIDE1 / tickets;
+        return;
+    }
+    q->pool_pass[pool] += ran * STRIDE1 / tickets;
+    if (slot >= 0) {
+        q->clients[slot].version++;
+        share_heap_push(q, q->pool_pass[pool], slot);
+    }
+}
+
+long long run_to_completion(void *rq, int job) {
+    (void)rq;
+    (void)job;
+    return 0;
+}
+
+long long round_robin_slice(void *rq, int job) {
+    (void)rq;
+    long long quantum = class_quantum[engine.jobs[job].task_class];
+    return quantum > 0 ? quantum : rr_quantum;
+}
+
+const SchedPolicy fcfs_policy = {
+    "FCFS", ring_queue_create, ring_queue_destroy,
+    ring_queue_push, ring_queue_pop, run_to_completion, NULL, NULL, NULL
+};
+
+const SchedPolicy round_robin_policy = {
+    "Round Robin", ring_queue_create, ring_queue_destroy,
+    ring_queue_push, ring_queue_pop, round_robin_slice, NULL, NULL, NULL
+};
+
+const SchedPolicy priority_policy = {
+    "Priority", priority_create, priority_destroy,
+    priority_enqueue, priority_pick_next, run_to_completion, NULL, NULL, NULL
+};
+
+const SchedPolicy mlfq_policy = {
+    "MLFQ", mlfq_create, mlfq_destroy,
+    mlfq_enqueue, mlfq_pick_next, mlfq_slice, mlfq_account, NULL, NULL
+};
+
+const SchedPolicy cfs_policy = {
+    "CFS", cfs_create, cfs_destroy,
+    cfs_enqueue, cfs_pick_next, cfs_slice, cfs_account, NULL, cfs_migrate
+};
+
+const SchedPolicy sjf_policy = {
+    "SJF", sjf_create, job_heap_destroy,
+    job_heap_push, job_heap_pop, run_to_completion, NULL, NULL, NULL
+};
+
+const SchedPolicy srtf_policy = {
+    "SRTF", srtf_create, job_heap_destroy,
+    job_heap_push, job_heap_pop, run_to_completion, NULL, srtf_preempts, NULL
+};
+
+const SchedPolicy edf_policy = {
+    "EDF", edf_create, job_heap_destroy,
+    job_heap_push, job_heap_pop, run_to_completion, NULL, edf_preempts, NULL
+};
+
+const SchedPolicy lottery_policy = {
+    "Lottery", lottery_create, share_destroy,
+    share_enqueue, share_pick_next, round_robin_slice, share_account, NULL, NULL
+};
+
+const SchedPolicy stride_policy = {
+    "Stride", stride_create, share_destroy,
+    share_enqueue, share_pick_next, round_robin_slice, share_account, NULL, NULL
+};
+
+const SchedPolicy *policy_for(SchedulingAlgorithm algorithm) {
+    switch(algorithm) {
+        case FCFS: return &fcfs_policy;
+        case ROUND_ROBIN: return &round_robin_policy;
+        case PRIORITY: return &priority_policy;
+        case MLFQ: return &mlfq_policy;
+        case CFS: return &cfs_policy;
+        case SJF: return &sjf_policy;
+        case SRTF: return &srtf_policy;
+        case EDF: return &edf_policy;
+        case LOTTERY: return &lottery_policy;
+        case STRIDE: return &stride_policy;
+    }
+    return &fcfs_policy;
+}
+
+TaskClass task_class_for(const char *task_name) {
+    if (strcmp(task_name, "Calendar") == 0 || strcmp(task_name, "Time") == 0 ||
+        strcmp(task_name, "System Monitor") == 0 || strcmp(task_name, "Process Manager") == 0 ||
+        strcmp(task_name, "Memory Viewer") == 0 || strcmp(task_name, "Help System") == 0) {
+        return CLASS_SYSTEM;
+    } else if (strcmp(task_name, "Notepad") == 0 || strcmp(task_name, "Calculator") == 0 ||
+               strcmp(task_name, "Music Player") == 0) {
+        return CLASS_INTERACTIVE;
+    } else if (strcmp(task_name, "Create File") == 0 || strcmp(task_name, "Move File") == 0 ||
+               strcmp(task_name, "Copy File") == 0 || strcmp(task_name, "Delete File") == 0 ||
+               strcmp(task_name, "File Info") == 0) {
+        return CLASS_FILE_IO;
+    } else if (strcmp(task_name, "Minesweeper") == 0 || strcmp(task_name, "Snake Game") == 0) {
+        return CLASS_GAME;
+    }
+    return CLASS_BATCH;
+}
+
+const char *task_class_name(TaskClass task_class) {
+    switch(task_class) {
+        case CLASS_SYSTEM: return "system";
+        case CLASS_INTERACTIVE: return "interactive";
+        case CLASS_FILE_IO: return "file-io";
+        case CLASS_GAME: return "game";
+        case CLASS_BATCH: return "batch";
+    }
+    return "unknown";
+}
+
+int parse_task_class(const char *name) {
+    for (int i = 0; i < TASK_CLASS_COUNT; i++) {
+        if (strcmp(name, task_class_name(i)) == 0) return i;
+    }
+    return -1;
+}
+
+int parse_scheduler_name(const char *name) {
+    if (strcmp(name, "fcfs") == 0) return FCFS;
+    if (strcmp(name, "rr") == 0 || strcmp(name, "round_robin") == 0) return ROUND_ROBIN;
+    if (strcmp(name, "priority") == 0) return PRIORITY;
+    if (strcmp(name, "mlfq") == 0) return MLFQ;
+    if (strcmp(name, "cfs") == 0) return CFS;
+    if (strcmp(name, "sjf") == 0) return SJF;
+    if (strcmp(name, "srtf") == 0) return SRTF;
+    if (strcmp(name, "edf") == 0) return EDF;
+    if (strcmp(name, "lottery") == 0) return LOTTERY;
+    if (strcmp(name, "stride") == 0) return STRIDE;
+    return -1;
+}
+
+const char *scheduler_name(SchedulingAlgorithm algorithm) {
+    switch(algorithm) {
+        case FCFS: return "FCFS";
+        case ROUND_ROBIN: return "Round Robin";
+        case PRIORITY: return "Priority";
+        case MLFQ: return "MLFQ";
+        case CFS: return "CFS";
+        case SJF: return "SJF";
+        case SRTF: return "SRTF";
+        case EDF: return "EDF";
+        case LOTTERY: return "Lottery";
+        case STRIDE: return "Stride";
+    }
+    return "Unknown";
+}
+
+void sim_seed(unsigned long long seed) {
+    // xorshift must never be seeded with zero
+    rng_state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+// xorshift64*: deterministic for a given seed, unlike rand()
+unsigned int rng_next(unsigned long long *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (unsigned int)((*state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+unsigned int sim_rand() {
+    return rng_next(&rng_state);
+}
+
+void sim_sleep(int seconds) {
+    if (!headless_mode) {
+        sleep(seconds);
+    }
+}
+
+// Trace format, one task per line:
+//   arrival,name,ram,hdd,cpu,priority,burst[,io_interval_ms,io_time_ms[,deadline[,tickets]]]
+// Blank lines and lines starting with '#' are ignored. A priority or burst
+// of -1 is drawn from the seeded RNG. The cpu column only turns away tasks
+// that ask for more cores than exist; replayed jobs share the cores
+// through the scheduling policy. Returns 1 on a record, 0 at EOF and
+// -1 on a malformed line.
+int read_trace_record(FILE *fp, TraceRecord *rec, int *line_no) {
+    char line[512];
+    
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        (*line_no)++;
+        
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+        
+        rec->io_interval = rec->io_time = -1;
+        rec->deadline = -1;
+        rec->tickets = -1;
+        if (sscanf(p, "%lf , %49[^,] , %d , %d , %d , %d , %d , %d , %d , %lf , %d",
+                   &rec->arrival, rec->name, &rec->ram, &rec->hdd,
+                   &rec->cpu, &rec->priority, &rec->burst,
+                   &rec->io_interval, &rec->io_time, &rec->deadline, &rec->tickets) < 7) {
+            return -1;
+        }
+        
+        // Trim trailing blanks from the name column
+        int len = strlen(rec->name);
+        while (len > 0 && (rec->name[len - 1] == ' ' || rec->name[len - 1] == '\t')) {
+            rec->name[--len] = '\0';
+        }
+        return 1;
+    }
+    return 0;
+}
+
+int trace_next_arrival(void *ctx, TraceRecord *rec) {
+    TraceReader *reader = ctx;
+    reader->status = read_trace_record(reader->fp, rec, &reader->line_no);
+    return reader->status == 1;
+}
+
+int replay_trace(const char *path) {
+    TraceReader reader = { NULL, 0, 0 };
+    reader.fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (reader.fp == NULL) {
+        fprintf(stderr, "Cannot open trace file %s\n", path);
+        return 1;
+    }
+    
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    
+    des_init(policy_for(current_scheduler));
+    des_set_arrivals(trace_next_arrival, &reader);
+    des_run_until(-1);
+    
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    if (reader.fp != stdin) fclose(reader.fp);
+    
+    if (reader.status < 0) {
+        fprintf(stderr, "Malformed trace record at line %d\n", reader.line_no);
+        return 1;
+    }
+    
+    double elapsed = (wall_end.tv_sec - wall_start.tv_sec) +
+                     (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+    
+    printf("=== Trace Replay Summary ===\n");
+    printf("Scheduler:        %s\n", scheduler_name(current_scheduler));
+    printf("Tasks submitted:  %ld\n", engine.submitted);
+    printf("Tasks started:    %ld\n", engine.started);
+    printf("Tasks rejected:   %ld\n", engine.rejected);
+    if (admission.queued > 0) {
+        printf("Tasks queued:     %ld (%s, max depth %d, %d still waiting)\n",
+               admission.queued, admission_policy_name(admission.policy),
+               admission.max_depth, admission.depth);
+        printf("Admission wait:   %.3f s (p99 %.3f s)\n",
+               metric_mean(&admission.wait) / TICKS_PER_SECOND,
+               metric_percentile(&admission.wait, 99) / TICKS_PER_SECOND);
+    }
+    printf("Tasks completed:  %ld\n", engine.completed);
+    printf("Context switches: %ld (%ld quantum expiries)\n",
+           engine.context_switches, engine.preemptions);
+    printf("Avg turnaround:   %.3f s (p99 %.3f s)\n",
+           metric_mean(&engine.turnaround) / TICKS_PER_SECOND,
+           metric_percentile(&engine.turnaround, 99) / TICKS_PER_SECOND);
+    printf("Avg waiting:      %.3f s\n", metric_mean(&engine.waiting) / TICKS_PER_SECOND);
+    printf("Avg response:     %.3f s\n", metric_mean(&engine.response) / TICKS_PER_SECOND);
+    printf("Deadline misses:  %ld (%.1f%%)\n", engine.deadline_misses,
+           engine.completed > 0 ? 100.0 * engine.deadline_misses / engine.completed : 0.0);
+    printf("Simulated time:   %.3f s\n", (double)engine.clock / TICKS_PER_SECOND);
+    printf("CPU busy:         %.1f%%\n",
+           engine.clock > 0 ?
+           100.0 * engine.busy_time / ((double)engine.clock * engine.core_count) : 0.0);
+    printf("Cores:            %d (%ld migrations)\n", engine.core_count, engine.migrations);
+    printf("Allocator:        %s, avg fragmentation %.1f%% external / %.1f%% internal, "
+           "%ld rejected while fragmented\n", alloc_strategy_name(phys.strategy),
+           phys.allocs > 0 ? 100.0 * phys.external_sum / phys.allocs : 0.0,
+           phys.allocs > 0 ? 100.0 * phys.internal_sum / phys.allocs : 0.0,
+           phys.fragmentation_rejects);
+    if (vm_accesses_per_tick > 0) {
+        printf("Paging:           %s, %ld faults / %ld accesses (%.3f%%), TLB hit %.2f%%\n",
+               replacement_policy_name(vm.policy), vm.faults, vm.accesses,
+               vm.accesses > 0 ? 100.0 * vm.faults / vm.accesses : 0.0,
+               vm.accesses > 0 ? 100.0 * vm.tlb_hits / vm.accesses : 0.0);
+    }
+    if (disk.enabled) {
+        printf("Disk:             %s, %ld requests, avg seek %.0f cylinders, %.1f IOPS, "
+               "latency avg %.1f ms (p99 %.1f ms)\n", disk_sched_name(disk.algorithm), disk.requests,
+               disk.requests > 0 ? (double)disk.seek_cylinders / disk.requests : 0.0,
+               disk.clock > 0 ? disk.requests / (disk.clock / 1e6) : 0.0, metric_mean(&disk.latency) / 1000,
+               metric_percentile(&disk.latency, 99) / 1000);
+    }
+    if (banker.mode != BANKER_OFF) {
+        printf("Deadlock:         %s, %ld requests (%ld deferred unsafe, %ld blocked), "
+               "%ld checks (%.1f%% fast path), %ld deadlocks\n",
+               banker_mode_name(banker.mode), banker.requests, banker.unsafe, banker.blocked,
+               banker.checks, banker.checks > 0 ? 100.0 * banker.fast_checks / banker.checks : 0.0,
+               banker.deadlocks);
+        if (banker.deadlocks > 0) {
+            printf("Last cycle:       %s\n", banker.last_cycle);
+        }
+    }
+    printf("Wall time:        %.3f s\n", elapsed);
+    printf("Throughput:       %.0f tasks/s\n", elapsed > 0 ? engine.submitted / elapsed : 0.0);
+    return 0;
+}
+
+// ---- Scheduler metrics and benchmarks ----
+
+void metric_add(MetricSeries *m, long long value) {
+    if (m->count == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 1024;
+        m->samples = realloc(m->samples, m->cap * sizeof(long long));
+    }
+    m->samples[m->count++] = value;
+    m->sum += value;
+}
+
+double metric_mean(MetricSeries *m) {
+    return m->count ? m->sum / m->count : 0.0;
+}
+
+int compare_long_long(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile; sorts the samples in place
+double metric_percentile(MetricSeries *m, double pct) {
+    if (m->count == 0) return 0.0;
+    
+    qsort(m->samples, m->count, sizeof(long long), compare_long_long);
+    long rank = (long)(pct / 100.0 * m->count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > m->count) rank = m->count;
+    return (double)m->samples[rank - 1];
+}
+
+void metric_free(MetricSeries *m) {
+    free(m->samples);
+    memset(m, 0, sizeof(*m));
+}
+
+const char *workload_name(WorkloadKind kind) {
+    switch(kind) {
+        case WORKLOAD_UNIFORM: return "uniform";
+        case WORKLOAD_BURSTY: return "bursty";
+        case WORKLOAD_HEAVY_TAILED: return "heavy-tailed";
+        case WORKLOAD_PRIORITY_SKEWED: return "priority-skewed";
+        case WORKLOAD_MIXED: return "mixed";
+    }
+    return "unknown";
+}
+
+// All workloads target roughly 85% load per unit of `rate` (one CPU's
+// worth of work) so queues build up without growing without bound.
+int synthetic_next_arrival(void *ctx, TraceRecord *rec) {
+    SyntheticWorkload *w = ctx;
+    if (w->remaining == 0) return 0;
+    w->remaining--;
+    
+    unsigned int r = rng_next(&w->rng);
+    rec->io_interval = rec->io_time = 0;
+    rec->deadline = -1;
+    rec->tickets = -1;
+    
+    switch(w->kind) {
+        case WORKLOAD_UNIFORM:
+            // Bursts 1-10 s (mean 5.5), gaps 0-12 s
+            rec->burst = r % 10 + 1;
+            w->clock += (rng_next(&w->rng) % 13) / w->rate;
+            rec->priority = rng_next(&w->rng) % 5 + 1;
+            break;
+        case WORKLOAD_BURSTY:
+            // 20 back-to-back arrivals, then a long idle gap
+            if (w->burst_left == 0) {
+                w->burst_left = 20;
+                w->clock += (110 + rng_next(&w->rng) % 40) / w->rate;
+            }
+            w->burst_left--;
+            rec->burst = r % 10 + 1;
+            rec->priority = rng_next(&w->rng) % 5 + 1;
+            break;
+        case WORKLOAD_HEAVY_TAILED: {
+            // Pareto(alpha = 1.5, xm = 1) bursts capped at 1000 s, mean ~3 s
+            double u = (r + 1.0) / 4294967297.0;
+            double burst = 1.0 / pow(u, 1.0 / 1.5);
+            rec->burst = burst > 1000 ? 1000 : (int)burst;
+            w->clock += (rng_next(&w->rng) % 7) / w->rate;
+            rec->priority = rng_next(&w->rng) % 5 + 1;
+            break;
+        }
+        case WORKLOAD_PRIORITY_SKEWED:
+            // 10% short high-priority work among long low-priority jobs
+            if (r % 10 == 0) {
+                rec->priority = 5;
+                rec->burst = rng_next(&w->rng) % 2 + 1;
+            } else {
+                rec->priority = 1;
+                rec->burst = rng_next(&w->rng) % 10 + 1;
+            }
+            w->clock += (rng_next(&w->rng) % 12) / w->rate;
+            break;
+        case WORKLOAD_MIXED:
+            // Half interactive (short CPU bursts between 200 ms waits),
+            // half CPU-bound batch work
+            rec->priority = rng_next(&w->rng) % 5 + 1;
+            if (r % 2 == 0) {
+                rec->burst = rng_next(&w->rng) % 2 + 1;
+                rec->io_interval = 20 + rng_next(&w->rng) % 30;
+                rec->io_time = 200;
+            } else {
+                rec->burst = rng_next(&w->rng) % 15 + 1;
+                rec->io_interval = rec->io_time = 0;
+            }
+            w->clock += (rng_next(&w->rng) % 11) / w->rate;
+            break;
+    }
+    
+    rec->arrival = w->clock;
+    strcpy(rec->name, "Synthetic");
+    rec->ram = rec->hdd = rec->cpu = 0;
+    return 1;
+}
+
+// Opens a benchmark's --csv file and writes its header row. NULL when
+// there is no path, or after reporting a file that cannot be opened, so
+// callers check `path != NULL && csv == NULL` for the failure.
+FILE *bench_csv_open(const char *path, const char *header) {
+    if (path == NULL) return NULL;
+    
+    FILE *csv = fopen(path, "w");
+    if (csv == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return NULL;
+    }
+    fprintf(csv, "%s\n", header);
+    return csv;
+}
+
+int run_scheduler_benchmark(long task_total, const char *csv_path) {
+    FILE *csv = bench_csv_open(csv_path, "workload,scheduler,tasks,makespan_s,throughput_per_s,"
+                                         "turnaround_avg_s,turnaround_p95_s,turnaround_p99_s,"
+                                         "waiting_avg_s,waiting_p95_s,waiting_p99_s,"
+                                         "response_avg_s,response_p95_s,response_p99_s,"
+                                         "deadline_miss_pct,cpu_util_pct,context_switches,ns_per_decision,wall_s");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    // Cost of the timer itself, subtracted from every timed decision
+    long long t0 = monotonic_ns();
+    for (int i = 0; i < 1000; i++) monotonic_ns();
+    double timer_ns = (monotonic_ns() - t0) / 1000.0;
+    
+    printf("=== Scheduler Benchmark (%ld tasks per workload, %d cores) ===\n",
+           task_total, system_res.total_cores > 0 ? system_res.total_cores : 1);
+    printf("%-16s %-12s %8s %9s %9s %9s %9s %9s %9s %6s %6s %9s %8s\n",
+           "Workload", "Scheduler", "Thru/s", "TAT avg", "TAT p95", "TAT p99",
+           "Wait avg", "Wait p99", "Resp p99", "Miss%", "Util%", "CtxSw", "ns/dec");
+    
+    for (int w = 0; w < WORKLOAD_KIND_COUNT; w++) {
+        for (int a = 0; a < SCHED_ALGORITHM_COUNT; a++) {
+            des_init(policy_for(a));
+            SyntheticWorkload workload = { w, task_total, 0, engine.core_count, 0, 0x5DEECE66DULL + w };
+            engine.jobs_only = 1;
+            engine.time_decisions = 1;
+            
+            long long wall_start = monotonic_ns();
+            des_set_arrivals(synthetic_next_arrival, &workload);
+            des_run_until(-1);
+            double wall = (monotonic_ns() - wall_start) / 1e9;
+            
+            double makespan = (double)engine.clock / TICKS_PER_SECOND;
+            double throughput = makespan > 0 ? engine.completed / makespan : 0.0;
+            double util = engine.clock > 0 ?
+                          100.0 * engine.busy_time / ((double)engine.clock * engine.core_count) : 0.0;
+            double ns_per_decision = 0.0;
+            if (engine.decisions > 0) {
+                ns_per_decision = (engine.decision_ns - engine.timed_calls * timer_ns) / engine.decisions;
+                if (ns_per_decision < 0) ns_per_decision = 0;
+            }
+            
+            double tat[3], wait[3], resp[3];
+            MetricSeries *series[3] = { &engine.turnaround, &engine.waiting, &engine.response };
+            double *out[3] = { tat, wait, resp };
+            for (int m = 0; m < 3; m++) {
+                out[m][0] = metric_mean(series[m]) / TICKS_PER_SECOND;
+                out[m][1] = metric_percentile(series[m], 95) / TICKS_PER_SECOND;
+                out[m][2] = metric_percentile(series[m], 99) / TICKS_PER_SECOND;
+            }
+            
+            double miss = engine.completed > 0 ?
+                          100.0 * engine.deadline_misses / engine.completed : 0.0;
+            
+            printf("%-16s %-12s %8.3f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %6.1f %6.1f %9ld %8.1f\n",
+                   workload_name(w), scheduler_name(a), throughput,
+                   tat[0], tat[1], tat[2], wait[0], wait[2], resp[2],
+                   miss, util, engine.context_switches, ns_per_decision);
+            
+            if (csv != NULL) {
+                fprintf(csv, "%s,%s,%ld,%.3f,%.6f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+                             "%.3f,%.3f,%.3f,%.2f,%.2f,%ld,%.1f,%.3f\n",
+                        workload_name(w), scheduler_name(a), engine.completed,
+                        makespan, throughput, tat[0], tat[1], tat[2],
+                        wait[0], wait[1], wait[2], resp[0], resp[1], resp[2],
+                        miss, util, engine.context_switches, ns_per_decision, wall);
+            }
+        }
+    }
+    
+    des_init(policy_for(current_scheduler));
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// Offers the same uniform workload (sized for 32 cores at ~85% load) to
+// 1..64 cores, so saturation and balancing overhead show up as the
+// machine grows.
+int run_smp_benchmark(long task_total, const char *csv_path) {
+    FILE *csv = bench_csv_open(csv_path, "scheduler,cores,tasks,makespan_s,throughput_per_s,turnaround_avg_s,"
+                                         "turnaround_p99_s,cpu_util_pct,migrations,steals,wall_s");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    printf("=== SMP Scaling Benchmark (%s, %ld tasks) ===\n",
+           scheduler_name(current_scheduler), task_total);
+    printf("%-6s %10s %9s %9s %9s %6s %11s %9s %8s\n",
+           "Cores", "Makespan", "Thru/s", "TAT avg", "TAT p99", "Util%",
+           "Migrations", "Steals", "Wall s");
+    
+    for (int cores = 1; cores <= 64; cores *= 2) {
+        system_res.total_cores = cores;
+        des_init(policy_for(current_scheduler));
+        engine.jobs_only = 1;
+        SyntheticWorkload workload = { WORKLOAD_UNIFORM, task_total, 0, 32, 0, 0x5DEECE66DULL };
+        
+        long long wall_start = monotonic_ns();
+        des_set_arrivals(synthetic_next_arrival, &workload);
+        des_run_until(-1);
+        double wall = (monotonic_ns() - wall_start) / 1e9;
+        
+        long steals = 0;
+        for (int c = 0; c < engine.core_count; c++) {
+            steals += engine.cores[c].steals;
+        }
+        double makespan = (double)engine.clock / TICKS_PER_SECOND;
+        double throughput = makespan > 0 ? engine.completed / makespan : 0.0;
+        double util = engine.clock > 0 ?
+                      100.0 * engine.busy_time / ((double)engine.clock * cores) : 0.0;
+        double tat_avg = metric_mean(&engine.turnaround) / TICKS_PER_SECOND;
+        double tat_p99 = metric_percentile(&engine.turnaround, 99) / TICKS_PER_SECOND;
+        
+        printf("%-6d %10.0f %9.3f %9.1f %9.1f %6.1f %11ld %9ld %8.3f\n",
+               cores, makespan, throughput, tat_avg, tat_p99, util,
+               engine.migrations, steals, wall);
+        if (csv != NULL) {
+            fprintf(csv, "%s,%d,%ld,%.3f,%.6f,%.3f,%.3f,%.2f,%ld,%ld,%.3f\n",
+                    scheduler_name(current_scheduler), cores, engine.completed, makespan,
+                    throughput, tat_avg, tat_p99, util, engine.migrations, steals, wall);
+        }
+    }
+    
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// Long-running CPU-bound clients with fixed tickets on the configured
+// cores: three single tasks plus a four-instance "Music Player" pool.
+// Prints how far the achieved CPU split is from the requested one as the
+// run grows; lottery error should shrink roughly with 1/sqrt(time), stride
+// error should stay within about one quantum.
+int run_share_benchmark(long seconds, const char *csv_path) {
+    static const char *names[] = { "Notepad", "Calculator", "Minesweeper", "Music Player" };
+    static const int tickets[] = { 100, 200, 300, 400 };
+    static const int instances[] = { 1, 1, 1, 4 };
+    static const SchedulingAlgorithm policies[] = { LOTTERY, STRIDE };
+    int client_count = 4;
+    
+    FILE *csv = bench_csv_open(csv_path, "scheduler,seconds,client,tickets,requested_pct,achieved_pct");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    set_ticket_pool("Music Player", tickets[3]);
+    long total_tickets = 0;
+    for (int c = 0; c < client_count; c++) {
+        total_tickets += tickets[c];
+    }
+    
+    printf("=== Proportional Share Benchmark (%ld s, quantum %lld ms) ===\n", seconds, rr_quantum);
+    printf("%-8s %8s", "Policy", "Time s");
+    for (int c = 0; c < client_count; c++) {
+        printf(" %13.13s", names[c]);
+    }
+    printf(" %8s %8s\n", "MaxErr", "MeanErr");
+    printf("%-8s %8s", "", "");
+    for (int c = 0; c < client_count; c++) {
+        printf(" %12.1f%%", 100.0 * tickets[c] / total_tickets);
+    }
+    printf("\n");
+    
+    for (int p = 0; p < 2; p++) {
+        des_init(policy_for(policies[p]));
+        
+        int jobs[16], owner[16], job_count = 0;
+        for (int c = 0; c < client_count; c++) {
+            for (int i = 0; i < instances[c]; i++) {
+                TraceRecord rec;
+                memset(&rec, 0, sizeof(rec));
+                strcpy(rec.name, names[c]);
+                rec.priority = 1;
+                rec.burst = seconds + 1;
+                rec.deadline = -1;
+                rec.tickets = tickets[c];
+                owner[job_count] = c;
+                jobs[job_count++] = des_submit(0, &rec);
+            }
+        }
+        
+        for (long t = 10; ; t *= 10) {
+            if (t > seconds) t = seconds;
+            des_run_until((long long)t * TICKS_PER_SECOND);
+            
+            double used[4] = { 0 }, total = 0;
+            for (int i = 0; i < job_count; i++) {
+                double ran = engine.jobs[jobs[i]].burst - des_job_remaining(jobs[i]);
+                used[owner[i]] += ran;
+                total += ran;
+            }
+            
+            double max_err = 0, sum_err = 0;
+            printf("%-8s %8ld", scheduler_name(policies[p]), t);
+            for (int c = 0; c < client_count; c++) {
+                double requested = 100.0 * tickets[c] / total_tickets;
+                double achieved = total > 0 ? 100.0 * used[c] / total : 0.0;
+                double err = fabs(achieved - requested);
+                if (err > max_err) max_err = err;
+                sum_err += err;
+                printf(" %12.2f%%", achieved);
+                if (csv != NULL) {
+                    fprintf(csv, "%s,%ld,%s,%d,%.3f,%.3f\n", scheduler_name(policies[p]), t,
+                            names[c], tickets[c], requested, achieved);
+                }
+            }
+            printf(" %8.3f %8.3f\n", max_err, sum_err / client_count);
+            
+            if (t == seconds) break;
+        }
+    }
+    
+    des_init(policy_for(current_scheduler));
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+void show_core_stats() {
+    printf("\nCPU Cores (virtual clock %.1f s):\n", (double)engine.clock / TICKS_PER_SECOND);
+    printf("%-6s %-8s %-20s %-8s %-11s %-8s\n",
+           "Core", "Util%", "Running", "Queued", "Migrations", "Steals");
+    
+    pthread_mutex_lock(&queue_mutex);
+    for (int c = 0; c < engine.core_count; c++) {
+        SimCore *core = &engine.cores[c];
+        long long busy = core->busy_time;
+        const char *running = "idle";
+        
+        if (core->running >= 0) {
+            busy += engine.clock - core->slice_start;
+            Task *task = task_by_pid(engine.jobs[core->running].pid);
+            running = task != NULL ? task->name : "job";
+        }
+        printf("%-6d %-8.1f %-20s %-8ld %-11ld %-8ld\n",
+               c, engine.clock > 0 ? 100.0 * busy / engine.clock : 0.0,
+               running, core->queued, core->migrations, core->steals);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// ---- Paged virtual memory ----
+
+// Each task owns a flat page table sized from its ram_usage; frames are
+// shared machine-wide. Translation goes through a set-associative TLB, so
+// the hit path is a few compares and a fault is a page table update plus
+// (when RAM is full) one victim selection:
+//   FIFO/LRU - intrusive list of frames in load / use order, O(1)
+//   Clock    - second chance over the reference bits
+//   WS       - WSClock: frames untouched for vm_ws_window accesses go first
+void vm_init(int frame_count) {
+    free(vm.frames);
+    for (int i = 0; i < vm.space_cap; i++) {
+        free(vm.spaces[i].pte);
+    }
+    free(vm.spaces);
+    
+    ReplacementPolicy policy = vm.policy;
+    memset(&vm, 0, sizeof(vm));
+    vm.policy = policy;
+    vm.frame_count = frame_count;
+    vm.frames = malloc(frame_count * sizeof(Frame));
+    vm.free_frame = -1;
+    vm.list_head = vm.list_tail = -1;
+    vm.free_space = -1;
+    for (int f = frame_count - 1; f >= 0; f--) {
+        vm.frames[f].asid = -1;
+        vm.frames[f].next = vm.free_frame;
+        vm.free_frame = f;
+    }
+}
+
+const char *replacement_policy_name(ReplacementPolicy policy) {
+    switch(policy) {
+        case REPLACE_FIFO: return "FIFO";
+        case REPLACE_LRU: return "LRU";
+        case REPLACE_CLOCK: return "Clock";
+        case REPLACE_WS: return "WS";
+    }
+    return "Unknown";
+}
+
+int parse_replacement_policy(const char *name) {
+    if (strcmp(name, "fifo") == 0) return REPLACE_FIFO;
+    if (strcmp(name, "lru") == 0) return REPLACE_LRU;
+    if (strcmp(name, "clock") == 0) return REPLACE_CLOCK;
+    if (strcmp(name, "ws") == 0) return REPLACE_WS;
+    return -1;
+}
+
+const char *access_pattern_name(AccessPattern pattern) {
+    switch(pattern) {
+        case ACCESS_SEQUENTIAL: return "sequential";
+        case ACCESS_RANDOM: return "random";
+        case ACCESS_HOT_COLD: return "hot-cold";
+        case ACCESS_LOOP: return "loop";
+    }
+    return "unknown";
+}
+
+AccessPattern access_pattern_for(TaskClass task_class) {
+    switch(task_class) {
+        case CLASS_FILE_IO: return ACCESS_SEQUENTIAL;
+        case CLASS_GAME: return ACCESS_LOOP;
+        case CLASS_BATCH: return ACCESS_RANDOM;
+        default: return ACCESS_HOT_COLD;
+    }
+}
+
+void vm_list_unlink(int f) {
+    Frame *fr = &vm.frames[f];
+    if (fr->prev >= 0) vm.frames[fr->prev].next = fr->next; else vm.list_head = fr->next;
+    if (fr->next >= 0) vm.frames[fr->next].prev = fr->prev; else vm.list_tail = fr->prev;
+}
+
+void vm_list_append(int f) {
+    Frame *fr = &vm.frames[f];
+    fr->prev = vm.list_tail;
+    fr->next = -1;
+    if (vm.list_tail >= 0) vm.frames[vm.list_tail].next = f; else vm.list_head = f;
+    vm.list_tail = f;
+}
+
+unsigned int tlb_set(unsigned long long tag) {
+    return (unsigned int)((tag * 0x9E3779B97F4A7C15ULL) >> 58) & (TLB_SETS - 1);
+}
+
+void tlb_invalidate(int asid, int vpn) {
+    unsigned long long tag = ((unsigned long long)asid << 32 | (unsigned int)vpn) + 1;
+    TlbEntry *set = vm.tlb[tlb_set(tag)];
+    for (int w = 0; w < TLB_WAYS; w++) {
+        if (set[w].tag == tag) set[w].tag = 0;
+    }
+}
+
+int vm_pick_victim() {
+    if (vm.policy == REPLACE_FIFO || vm.policy == REPLACE_LRU) {
+        return vm.list_head;
+    }
+    
+    // Clock / WSClock sweep. Clock may lap once clearing reference bits;
+    // WS looks at most WS_SCAN_LIMIT unreferenced frames and otherwise
+    // takes the oldest of them, so a window larger than RAM cannot turn
+    // every fault into a full sweep.
+    int oldest = -1, scanned = 0;
+    for (long step = 0; step < 2L * vm.frame_count; step++) {
+        int f = vm.hand;
+        Frame *fr = &vm.frames[f];
+        vm.hand = (vm.hand + 1) % vm.frame_count;
+        
+        if (fr->referenced) {
+            fr->referenced = 0;
+            continue;
+        }
+        if (vm.policy == REPLACE_CLOCK || vm.clock - fr->last_use > vm_ws_window) {
+            return f;
+        }
+        if (oldest < 0 || fr->last_use < vm.frames[oldest].last_use) oldest = f;
+        if (++scanned == WS_SCAN_LIMIT) break;
+    }
+    return oldest >= 0 ? oldest : vm.hand;
+}
+
+int vm_alloc_frame() {
+    int f = vm.free_frame;
+    
+    if (f >= 0) {
+        vm.free_frame = vm.frames[f].next;
+    } else {
+        f = vm_pick_victim();
+        Frame *fr = &vm.frames[f];
+        VmSpace *owner = &vm.spaces[fr->asid];
+        owner->pte[fr->vpn] = 0;
+        owner->resident--;
+        tlb_invalidate(fr->asid, fr->vpn);
+        if (vm.policy == REPLACE_FIFO || vm.policy == REPLACE_LRU) vm_list_unlink(f);
+        vm.evictions++;
+    }
+    if (vm.policy == REPLACE_FIFO || vm.policy == REPLACE_LRU) vm_list_append(f);
+    return f;
+}
+
+void vm_access(int asid, int vpn) {
+    VmSpace *sp = &vm.spaces[asid];
+    unsigned long long tag = ((unsigned long long)asid << 32 | (unsigned int)vpn) + 1;
+    TlbEntry *set = vm.tlb[tlb_set(tag)];
+    int f = -1;
+    
+    vm.clock++;
+    vm.accesses++;
+    for (int w = 0; w < TLB_WAYS; w++) {
+        if (set[w].tag == tag) {
+            set[w].stamp = vm.clock;
+            f = set[w].frame;
+            vm.tlb_hits++;
+            break;
+        }
+    }
+    
+    if (f < 0) {
+        unsigned int pte = sp->pte[vpn];
+        if (pte & PTE_PRESENT) {
+            f = pte & ~PTE_PRESENT;
+        } else {
+            f = vm_alloc_frame();
+            vm.frames[f].asid = asid;
+            vm.frames[f].vpn = vpn;
+            sp->pte[vpn] = PTE_PRESENT | f;
+            sp->resident++;
+            sp->faults++;
+            vm.faults++;
+        }
+        
+        int victim = 0;
+        for (int w = 0; w < TLB_WAYS; w++) {
+            if (set[w].tag == 0) {
+                victim = w;
+                break;
+            }
+            if (set[w].stamp < set[victim].stamp) victim = w;
+        }
+        set[victim].tag = tag;
+        set[victim].frame = f;
+        set[victim].stamp = vm.clock;
+    }
+    
+    Frame *fr = &vm.frames[f];
+    fr->referenced = 1;
+    fr->last_use = vm.clock;
+    if (vm.policy == REPLACE_LRU && vm.list_tail != f) {
+        vm_list_unlink(f);
+        vm_list_append(f);
+    }
+}
+
+int vm_next_page(VmSpace *sp) {
+    unsigned int r;
+    
+    switch(sp->pattern) {
+        case ACCESS_SEQUENTIAL:
+            // cursor counts cache lines, so each page is touched LINES_PER_PAGE times
+            sp->cursor = sp->cursor + 1 < sp->pages * LINES_PER_PAGE ? sp->cursor + 1 : 0;
+            return sp->cursor / LINES_PER_PAGE;
+        case ACCESS_RANDOM:
+            return rng_next(&sp->rng) % sp->pages;
+        case ACCESS_HOT_COLD:
+            // 80% of accesses land in the first 20% of the pages
+            r = rng_next(&sp->rng);
+            if (r % 10 < 8) return (r >> 8) % (sp->pages / 5 + 1);
+            return (r >> 8) % sp->pages;
+        case ACCESS_LOOP:
+            // Repeated sweeps over a quarter of the address space
+            sp->cursor = sp->cursor + 1 < (sp->pages / 4 + 1) * LINES_PER_PAGE ? sp->cursor + 1 : 0;
+            return sp->cursor / LINES_PER_PAGE % sp->pages;
+    }
+    return 0;
+}
+
+// Returns the address space id, or -1 if the paging model is off or out
+// of memory; the task then runs without one
+int vm_attach(int pages, AccessPattern pattern) {
+    if (vm.frame_count == 0 || pages <= 0) return -1;
+    
+    if (vm.free_space < 0) {
+        int cap = vm.space_cap > 0 ? vm.space_cap * 2 : 16;
+        VmSpace *spaces = realloc(vm.spaces, cap * sizeof(VmSpace));
+        if (spaces == NULL) return -1;
+        vm.spaces = spaces;
+        for (int i = cap - 1; i >= vm.space_cap; i--) {
+            vm.spaces[i].pte = NULL;
+            vm.spaces[i].next_free = vm.free_space;
+            vm.free_space = i;
+        }
+        vm.space_cap = cap;
+    }
+    
+    unsigned int *pte = calloc(pages, sizeof(unsigned int));
+    if (pte == NULL) return -1;
+    
+    int asid = vm.free_space;
+    VmSpace *sp = &vm.spaces[asid];
+    vm.free_space = sp->next_free;
+    
+    sp->pte = pte;
+    sp->pages = pages;
+    sp->pattern = pattern;
+    sp->cursor = 0;
+    sp->rng = 0x9E3779B97F4A7C15ULL ^ ((unsigned long long)asid << 17 | pages);
+    sp->faults = 0;
+    sp->resident = 0;
+    return asid;
+}
+
+void vm_detach(int asid) {
+    if (asid < 0) return;
+    VmSpace *sp = &vm.spaces[asid];
+    
+    for (int vpn = 0; vpn < sp->pages && sp->resident > 0; vpn++) {
+        if (!(sp->pte[vpn] & PTE_PRESENT)) continue;
+        
+        int f = sp->pte[vpn] & ~PTE_PRESENT;
+        if (vm.policy == REPLACE_FIFO || vm.policy == REPLACE_LRU) vm_list_unlink(f);
+        vm.frames[f].asid = -1;
+        vm.frames[f].referenced = 0;
+        vm.frames[f].next = vm.free_frame;
+        vm.free_frame = f;
+        sp->resident--;
+        tlb_invalidate(asid, vpn);
+    }
+    free(sp->pte);
+    sp->pte = NULL;
+    sp->next_free = vm.free_space;
+    vm.free_space = asid;
+}
+
+void vm_run(int asid, long accesses) {
+    if (asid < 0) return;
+    VmSpace *sp = &vm.spaces[asid];
+    for (long i = 0; i < accesses; i++) {
+        vm_access(asid, vm_next_page(sp));
+    }
+}
+
+// Switching policy rebuilds the FIFO/LRU list in frame order and clears
+// reference history
+void vm_set_policy(ReplacementPolicy policy) {
+    vm.policy = policy;
+    vm.list_head = vm.list_tail = -1;
+    for (int f = 0; f < vm.frame_count; f++) {
+        vm.frames[f].referenced = 0;
+        if (vm.frames[f].asid >= 0 && (policy == REPLACE_FIFO || policy == REPLACE_LRU)) {
+            vm_list_append(f);
+        }
+    }
+}
+
+void show_frame_map() {
+    int used = vm.frame_count;
+    for (int f = vm.free_frame; f >= 0; f = vm.frames[f].next) used--;
+    
+    printf("\nPaging: %s replacement | %d KB pages | %d/%d frames used\n",
+           replacement_policy_name(vm.policy), PAGE_SIZE_KB, used, vm.frame_count);
+    printf("Accesses: %ld | Page faults: %ld (%.3f%%) | Evictions: %ld | TLB hit rate: %.2f%%\n",
+           vm.accesses, vm.faults, vm.accesses > 0 ? 100.0 * vm.faults / vm.accesses : 0.0,
+           vm.evictions, vm.accesses > 0 ? 100.0 * vm.tlb_hits / vm.accesses : 0.0);
+    
+    // Each cell covers a run of frames and shows the owner of the first
+    // used one ('.' = all free)
+    int cells = FRAME_MAP_COLS * FRAME_MAP_ROWS;
+    int per_cell = (vm.frame_count + cells - 1) / cells;
+    if (per_cell < 1) per_cell = 1;
+    
+    printf("\nFrame Map (%d frame%s per cell):\n", per_cell, per_cell == 1 ? "" : "s");
+    for (int row = 0; row * FRAME_MAP_COLS * per_cell < vm.frame_count; row++) {
+        printf("  ");
+        for (int col = 0; col < FRAME_MAP_COLS; col++) {
+            int start = (row * FRAME_MAP_COLS + col) * per_cell;
+            if (start >= vm.frame_count) break;
+            
+            char cell = '.';
+            for (int f = start; f < start + per_cell && f < vm.frame_count; f++) {
+                if (vm.frames[f].asid >= 0) {
+                    cell = 'A' + vm.frames[f].asid % 26;
+                    break;
+                }
+            }
+            putchar(cell);
+        }
+        putchar('\n');
+    }
+}
+
+// Drives every address space with the same pattern for a fixed number of
+// accesses, interleaved in scheduler-slice sized bursts, with RAM at 25%,
+// 50% and 75% of the combined address spaces
+int run_vm_benchmark(long accesses, const char *csv_path) {
+    const int spaces = 8, pages = 4096, burst = 1000;
+    const int ram_pct[] = { 25, 50, 75 };
+    
+    FILE *csv = bench_csv_open(csv_path, "policy,pattern,ram_pct,frames,accesses,fault_pct,tlb_hit_pct,"
+                                         "evictions,maccesses_per_s");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    printf("=== Paging Benchmark (%ld accesses, %d spaces x %d pages) ===\n",
+           accesses, spaces, pages);
+    printf("%-7s %-11s %5s %8s %9s %9s %10s %9s\n",
+           "Policy", "Pattern", "RAM%", "Frames", "Fault%", "TLB hit%", "Evictions", "Macc/s");
+    
+    for (int p = 0; p < REPLACEMENT_POLICY_COUNT; p++) {
+        for (int pattern = 0; pattern < ACCESS_PATTERN_COUNT; pattern++) {
+            for (int r = 0; r < 3; r++) {
+                int frames = spaces * pages / 100 * ram_pct[r];
+                vm.policy = p;
+                vm_init(frames);
+                
+                int asid[8];
+                for (int s = 0; s < spaces; s++) {
+                    asid[s] = vm_attach(pages, pattern);
+                }
+                
+                long long start = monotonic_ns();
+                for (long done = 0; done < accesses; done += burst) {
+                    vm_run(asid[(done / burst) % spaces], burst);
+                }
+                double wall = (monotonic_ns() - start) / 1e9;
+                
+                double fault_pct = 100.0 * vm.faults / vm.accesses;
+                double hit_pct = 100.0 * vm.tlb_hits / vm.accesses;
+                double rate = wall > 0 ? vm.accesses / wall / 1e6 : 0.0;
+                printf("%-7s %-11s %5d %8d %9.3f %9.2f %10ld %9.1f\n",
+                       replacement_policy_name(p), access_pattern_name(pattern), ram_pct[r],
+                       frames, fault_pct, hit_pct, vm.evictions, rate);
+                if (csv != NULL) {
+                    fprintf(csv, "%s,%s,%d,%d,%ld,%.4f,%.3f,%ld,%.2f\n",
+                            replacement_policy_name(p), access_pattern_name(pattern), ram_pct[r],
+                            frames, vm.accesses, fault_pct, hit_pct, vm.evictions, rate);
+                }
+            }
+        }
+    }
+    
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// ---- Physical memory allocator ----
+
+// RAM is handed out as contiguous runs of 1 MB units. Every block keeps its
+// length at its first unit and a boundary tag (its first unit) at its last,
+// so both neighbours of a freed block are found in O(1). Free blocks sit on
+// per-bin lists; a max-tree over bins finds the first non-empty bin that
+// can satisfy a request, and a max-tree over addresses finds the lowest
+// free block that is large enough. Both are O(log n):
+//   Buddy      - power-of-two blocks, bin = order, split on allocate and
+//                merged with the buddy (start ^ size) on free
+//   First-fit  - lowest-addressed free block that fits
+//   Best-fit   - one bin per exact size, smallest block that fits
+//   Segregated - power-of-two size classes; the request is rounded up to
+//                a class so any block there fits, falling back to the
+//                request's own class
+void maxtree_init(MaxTree *t, int n) {
+    free(t->tree);
+    t->leaves = 1;
+    while (t->leaves < n) t->leaves <<= 1;
+    t->tree = calloc(2 * t->leaves, sizeof(int));
+}
+
+void maxtree_set(MaxTree *t, int i, int value) {
+    int node = t->leaves + i;
+    t->tree[node] = value;
+    for (node >>= 1; node >= 1; node >>= 1) {
+        int left = t->tree[2 * node], right = t->tree[2 * node + 1];
+        t->tree[node] = left > right ? left : right;
+    }
+}
+
+// Lowest leaf >= from whose value is >= min, or -1. Only subtrees that
+// straddle `from` or hold a large enough value are entered, so this is
+// O(log n).
+int maxtree_find_in(MaxTree *t, int node, int lo, int hi, int from, int min) {
+    if (hi < from || t->tree[node] < min) return -1;
+    if (lo == hi) return lo;
+    int mid = (lo + hi) / 2;
+    int found = maxtree_find_in(t, 2 * node, lo, mid, from, min);
+    return found >= 0 ? found : maxtree_find_in(t, 2 * node + 1, mid + 1, hi, from, min);
+}
+
+int maxtree_find(MaxTree *t, int from, int min) {
+    return maxtree_find_in(t, 1, 0, t->leaves - 1, from, min);
+}
+
+int floor_log2(int n) {
+    int order = 0;
+    while ((2 << order) <= n) order++;
+    return order;
+}
+
+int ceil_log2(int n) {
+    int order = floor_log2(n);
+    return (1 << order) < n ? order + 1 : order;
+}
+
+int phys_bin(int size) {
+    switch(phys.strategy) {
+        case ALLOC_BUDDY:
+        case ALLOC_SEGREGATED: return floor_log2(size);
+        case ALLOC_BEST_FIT: return size;
+        case ALLOC_FIRST_FIT: return 0;
+    }
+    return 0;
+}
+
+void phys_insert_free(int start, int size) {
+    int bin = phys_bin(size);
+    
+    phys.size[start] = size;
+    phys.tag[start + size - 1] = start;
+    phys.used[start] = 0;
+    phys.prev[start] = -1;
+    phys.next[start] = phys.bins[bin];
+    if (phys.bins[bin] >= 0) phys.prev[phys.bins[bin]] = start;
+    phys.bins[bin] = start;
+    maxtree_set(&phys.by_bin, bin, 1);
+    maxtree_set(&phys.by_addr, start, size);
+    phys.free_units += size;
+}
+
+void phys_remove_free(int start) {
+    int bin = phys_bin(phys.size[start]);
+    
+    if (phys.prev[start] >= 0) {
+        phys.next[phys.prev[start]] = phys.next[start];
+    } else {
+        phys.bins[bin] = phys.next[start];
+        if (phys.bins[bin] < 0) maxtree_set(&phys.by_bin, bin, 0);
+    }
+    if (phys.next[start] >= 0) phys.prev[phys.next[start]] = phys.prev[start];
+    maxtree_set(&phys.by_addr, start, 0);
+    phys.free_units -= phys.size[start];
+}
+
+void phys_release(PhysMem *p) {
+    free(p->size);
+    free(p->tag);
+    free(p->asked);
+    free(p->used);
+    free(p->next);
+    free(p->prev);
+    free(p->bins);
+    free(p->by_addr.tree);
+    free(p->by_bin.tree);
+}
+
+void phys_init(int units, AllocStrategy strategy) {
+    phys_release(&phys);
+    memset(&phys, 0, sizeof(phys));
+    phys.strategy = strategy;
+    phys.units = units > 0 ? units : 0;
+    phys.bin_count = strategy == ALLOC_BEST_FIT ? phys.units + 1 : 32;
+    phys.size = calloc(phys.units + 1, sizeof(int));
+    phys.tag = calloc(phys.units + 1, sizeof(int));
+    phys.asked = calloc(phys.units + 1, sizeof(int));
+    phys.used = calloc(phys.units + 1, 1);
+    phys.next = malloc((phys.units + 1) * sizeof(int));
+    phys.prev = malloc((phys.units + 1) * sizeof(int));
+    phys.bins = malloc(phys.bin_count * sizeof(int));
+    for (int b = 0; b < phys.bin_count; b++) phys.bins[b] = -1;
+    maxtree_init(&phys.by_addr, phys.units + 1);
+    maxtree_init(&phys.by_bin, phys.bin_count);
+    
+    if (phys.units == 0) return;
+    if (strategy == ALLOC_BUDDY) {
+        // RAM that is not a power of two becomes several top-level blocks,
+        // largest first, so each is aligned to its own size
+        int start = 0;
+        for (int order = floor_log2(phys.units); order >= 0; order--) {
+            if (phys.units - start >= (1 << order)) {
+                phys_insert_free(start, 1 << order);
+                start += 1 << order;
+            }
+        }
+    } else {
+        phys_insert_free(0, phys.units);
+    }
+}
+
+const char *alloc_strategy_name(AllocStrategy strategy) {
+    switch(strategy) {
+        case ALLOC_BUDDY: return "Buddy";
+        case ALLOC_FIRST_FIT: return "First-fit";
+        case ALLOC_BEST_FIT: return "Best-fit";
+        case ALLOC_SEGREGATED: return "Segregated";
+    }
+    return "Unknown";
+}
+
+int parse_alloc_strategy(const char *name) {
+    if (strcmp(name, "buddy") == 0) return ALLOC_BUDDY;
+    if (strcmp(name, "first-fit") == 0) return ALLOC_FIRST_FIT;
+    if (strcmp(name, "best-fit") == 0) return ALLOC_BEST_FIT;
+    if (strcmp(name, "segregated") == 0) return ALLOC_SEGREGATED;
+    return -1;
+}
+
+int phys_largest_free() {
+    return phys.by_addr.tree != NULL ? phys.by_addr.tree[1] : 0;
+}
+
+int phys_can_alloc(int units) {
+    if (units <= 0) return 1;
+    if (phys.strategy == ALLOC_BUDDY) {
+        return units <= phys.units && phys_largest_free() >= (1 << ceil_log2(units));
+    }
+    return phys_largest_free() >= units;
+}
+
+// What phys_alloc() hands out for a request of `units`
+int phys_block_size(int units) {
+    if (units <= 0) return 0;
+    return phys.strategy == ALLOC_BUDDY ? 1 << ceil_log2(units) : units;
+}
+
+double phys_external_fragmentation() {
+    return phys.free_units > 0 ? 1.0 - (double)phys_largest_free() / phys.free_units : 0.0;
+}
+
+double phys_internal_fragmentation() {
+    int allocated = phys.units - phys.free_units;
+    return allocated > 0 ? (double)(allocated - phys.requested) / allocated : 0.0;
+}
+
+// Returns the first unit of the block, or -1 if no free block fits
+int phys_alloc(int units) {
+    if (units <= 0) return -1;
+    long long started = monotonic_ns();
+    int start = -1, bin;
+    
+    switch(phys.strategy) {
+        case ALLOC_BUDDY:
+            if (units > phys.units) break;
+            bin = maxtree_find(&phys.by_bin, ceil_log2(units), 1);
+            if (bin >= 0) start = phys.bins[bin];
+            break;
+        case ALLOC_FIRST_FIT:
+            start = maxtree_find(&phys.by_addr, 0, units);
+            break;
+        case ALLOC_BEST_FIT:
+            bin = maxtree_find(&phys.by_bin, units, 1);
+            if (bin >= 0) start = phys.bins[bin];
+            break;
+        case ALLOC_SEGREGATED:
+            bin = maxtree_find(&phys.by_bin, ceil_log2(units), 1);
+            if (bin >= 0) {
+                start = phys.bins[bin];
+            } else {
+                for (int b = phys.bins[floor_log2(units)]; b >= 0; b = phys.next[b]) {
+                    if (phys.size[b] >= units) {
+                        start = b;
+                        break;
+                    }
+                }
+            }
+            break;
+    }
+    
+    if (start < 0) {
+        phys.failures++;
+        return -1;
+    }
+    
+    int size = phys.size[start];
+    phys_remove_free(start);
+    int keep = phys.strategy == ALLOC_BUDDY ? 1 << ceil_log2(units) : units;
+    if (phys.strategy == ALLOC_BUDDY) {
+        while (size > keep) {
+            size /= 2;
+            phys_insert_free(start + size, size);
+        }
+    } else if (size > keep) {
+        phys_insert_free(start + keep, size - keep);
+    }
+    
+    phys.size[start] = keep;
+    phys.tag[start + keep - 1] = start;
+    phys.used[start] = 1;
+    phys.asked[start] = units;
+    phys.requested += units;
+    phys.allocs++;
+    phys.external_sum += phys_external_fragmentation();
+    phys.internal_sum += phys_internal_fragmentation();
+    
+    long long elapsed = monotonic_ns() - started;
+    phys.alloc_ns += elapsed;
+    if (elapsed > phys.max_alloc_ns) phys.max_alloc_ns = elapsed;
+    return start;
+}
+
+// Returns the number of units given back
+int phys_free(int start) {
+    if (start < 0 || start >= phys.units || !phys.used[start]) return 0;
+    long long started = monotonic_ns();
+    int size = phys.size[start];
+    int released = size;
+    
+    phys.used[start] = 0;
+    phys.requested -= phys.asked[start];
+    phys.frees++;
+    
+    if (phys.strategy == ALLOC_BUDDY) {
+        for (;;) {
+            int buddy = start ^ size;
+            if (buddy + size > phys.units || phys.used[buddy] || phys.size[buddy] != size) break;
+            phys_remove_free(buddy);
+            phys.size[start > buddy ? start : buddy] = 0;
+            if (buddy < start) start = buddy;
+            size *= 2;
+        }
+    } else {
+        int right = start + size;
+        if (right < phys.units && !phys.used[right]) {
+            size += phys.size[right];
+            phys_remove_free(right);
+            phys.size[right] = 0;
+        }
+        if (start > 0 && !phys.used[phys.tag[start - 1]]) {
+            int left = phys.tag[start - 1];
+            size += phys.size[left];
+            phys_remove_free(left);
+            phys.size[start] = 0;
+            start = left;
+        }
+    }
+    phys_insert_free(start, size);
+    
+    phys.free_ns += monotonic_ns() - started;
+    return released;
+}
+
+// Caller holds queue_mutex. Lays every live task out again under the new
+// strategy (which also compacts RAM) in a fresh PhysMem, and only swaps it
+// in once every task fits; otherwise the old layout stays as it was.
+int phys_set_strategy(AllocStrategy strategy) {
+    int *bases = malloc((task_count + 1) * sizeof(int));
+    if (bases == NULL) return 0;
+    int old_free = phys.free_units;
+    
+    sem_wait(&resource_sem);
+    PhysMem previous = phys;
+    memset(&phys, 0, sizeof(phys));
+    phys_init(system_res.total_ram, strategy);
+    
+    int fits = 1, i = 0;
+    for (Task *t = task_first(); t != NULL && fits; t = task_next(t), i++) {
+        // Swapped-out tasks hold no RAM
+        bases[i] = t->is_swapped ? -1 : phys_alloc(t->ram_usage);
+        if (bases[i] < 0 && t->ram_usage > 0 && !t->is_swapped) fits = 0;
+    }
+    if (fits) {
+        phys_release(&previous);
+        i = 0;
+        for (Task *t = task_first(); t != NULL; t = task_next(t)) {
+            t->ram_base = bases[i++];
+        }
+    } else {
+        phys_release(&phys);
+        phys = previous;
+    }
+    res_adjust(phys.free_units - old_free, 0, 0);
+    sem_post(&resource_sem);
+    free(bases);
+    return fits;
+}
+
+void show_allocation_map() {
+    int cells = ALLOC_MAP_COLS * ALLOC_MAP_ROWS;
+    int per_cell = (phys.units + cells - 1) / cells;
+    if (per_cell < 1) per_cell = 1;
+    
+    printf("\nAllocator: %s | Largest free block: %d MB | External fragmentation: %.1f%%\n",
+           alloc_strategy_name(phys.strategy), phys_largest_free(),
+           100.0 * phys_external_fragmentation());
+    printf("Internal fragmentation: %.1f%% | Allocations: %ld (%ld failed) | "
+           "Rejected while fragmented: %ld | Avg alloc: %.0f ns (max %lld ns)\n",
+           100.0 * phys_internal_fragmentation(), phys.allocs, phys.failures,
+           phys.fragmentation_rejects, phys.allocs > 0 ? (double)phys.alloc_ns / phys.allocs : 0.0,
+           phys.max_alloc_ns);
+    
+    // Each cell shows a task with memory in it ('.' = all free), lettered
+    // in task list order
+    char *map = malloc(cells);
+    memset(map, '.', cells);
+    int letter = 0;
+    for (Task *t = task_first(); t != NULL; t = task_next(t), letter++) {
+        if (t->ram_base < 0) continue;
+        int first = t->ram_base / per_cell;
+        int last = (t->ram_base + phys.size[t->ram_base] - 1) / per_cell;
+        for (int cell = first; cell <= last && cell < cells; cell++) {
+            if (map[cell] == '.') map[cell] = 'A' + letter % 26;
+        }
+    }
+    
+    printf("\nAllocation Map (%d MB per cell):\n", per_cell);
+    for (int row = 0; row * ALLOC_MAP_COLS * per_cell < phys.units; row++) {
+        printf("  ");
+        for (int col = 0; col < ALLOC_MAP_COLS; col++) {
+            int cell = row * ALLOC_MAP_COLS + col;
+            if (cell * per_cell >= phys.units) break;
+            putchar(map[cell]);
+        }
+        putchar('\n');
+    }
+    free(map);
+}
+
+// Random allocate/free churn against 4 GB of RAM, biased towards
+// allocation so memory stays near full. Sizes are mostly small with a tail
+// of large blocks. "Fail util" is how much RAM was actually requested when
+// an allocation failed: the less a strategy fragments, the fuller memory
+// gets before it has to say no.
+int run_alloc_benchmark(long operations, const char *csv_path) {
+    const int units = 4096;
+    
+    FILE *csv = bench_csv_open(csv_path, "strategy,operations,allocations,external_frag_pct,internal_frag_pct,"
+                                         "utilization_pct,fail_utilization_pct,alloc_ns,free_ns");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    printf("=== Allocator Benchmark (%ld operations, %d MB) ===\n", operations, units);
+    printf("%-11s %10s %9s %9s %7s %11s %9s %8s\n",
+           "Strategy", "Allocs", "ExtFrag%", "IntFrag%", "Util%", "Fail util%", "Alloc ns", "Free ns");
+    
+    int *live = malloc(operations * sizeof(int));
+    for (int s = 0; s < ALLOC_STRATEGY_COUNT; s++) {
+        phys_init(units, s);
+        unsigned long long rng = 0x9e3779b97f4a7c15ULL;
+        int live_count = 0;
+        long attempts = 0;
+        double utilization_sum = 0.0, fail_utilization_sum = 0.0;
+        
+        for (long op = 0; op < operations; op++) {
+            unsigned int roll = rng_next(&rng) % 100;
+            if (live_count == 0 || roll < 55) {
+                unsigned int size_roll = rng_next(&rng) % 100;
+                int size = size_roll < 70 ? 1 + rng_next(&rng) % 16 :
+                           size_roll < 95 ? 16 + rng_next(&rng) % 112 :
+                                            128 + rng_next(&rng) % 384;
+                int start = phys_alloc(size);
+                attempts++;
+                if (start >= 0) {
+                    live[live_count++] = start;
+                } else {
+                    fail_utilization_sum += (double)phys.requested / units;
+                }
+                utilization_sum += (double)phys.requested / units;
+            } else {
+                int victim = rng_next(&rng) % live_count;
+                phys_free(live[victim]);
+                live[victim] = live[--live_count];
+            }
+        }
+        
+        double external_pct = phys.allocs > 0 ? 100.0 * phys.external_sum / phys.allocs : 0.0;
+        double internal_pct = phys.allocs > 0 ? 100.0 * phys.internal_sum / phys.allocs : 0.0;
+        double utilization_pct = attempts > 0 ? 100.0 * utilization_sum / attempts : 0.0;
+        double fail_pct = phys.failures > 0 ? 100.0 * fail_utilization_sum / phys.failures : 0.0;
+        double alloc_ns = phys.allocs > 0 ? (double)phys.alloc_ns / phys.allocs : 0.0;
+        double free_ns = phys.frees > 0 ? (double)phys.free_ns / phys.frees : 0.0;
+        printf("%-11s %10ld %9.2f %9.2f %7.1f %11.1f %9.0f %8.0f\n",
+               alloc_strategy_name(s), phys.allocs, external_pct, internal_pct,
+               utilization_pct, fail_pct, alloc_ns, free_ns);
+        if (csv != NULL) {
+            fprintf(csv, "%s,%ld,%ld,%.3f,%.3f,%.2f,%.2f,%.1f,%.1f\n",
+                    alloc_strategy_name(s), operations, phys.allocs, external_pct,
+                    internal_pct, utilization_pct, fail_pct, alloc_ns, free_ns);
+        }
+    }
+    
+    free(live);
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("Without --trace the simulator runs interactively.\n\n");
+    printf("  --trace FILE       Replay a workload trace headlessly ('-' for stdin)\n");
+    printf("  --seed N           Seed for the simulator RNG\n");
+    printf("  --ram MB           Total RAM for headless runs (default 4096)\n");
+    printf("  --hdd MB           Total HDD for headless runs (default 102400)\n");
+    printf("  --cores N          Simulated CPU cores for headless runs (default 8)\n");
+    printf("  --scheduler NAME   fcfs, rr, priority, mlfq, cfs, sjf,\n"
+           "                     srtf, edf, lottery or stride\n");
+    printf("  --quantum MS       Default Round Robin quantum (default %d000)\n", TIME_QUANTUM);
+    printf("  --class-quantum C=MS  Quantum for one task class (system, interactive,\n");
+    printf("                     file-io, game, batch)\n");
+    printf("  --aging SECONDS    Priority boost interval for waiting tasks (0 disables)\n");
+    printf("  --mlfq-quanta LIST Per-level MLFQ quanta in ms, e.g. 200,400,800\n");
+    printf("  --mlfq-boost MS    MLFQ priority boost period (0 disables)\n");
+    printf("  --cfs-latency MS   CFS target latency (default 200)\n");
+    printf("  --cfs-min-gran MS  CFS minimum granularity (default 20)\n");
+    printf("  --deadline-factor N  Default EDF deadline in bursts after arrival (default 4)\n");
+    printf("  --tickets NAME=N   Lottery/Stride ticket pool shared by every NAME task\n");
+    printf("  --bench-share [S]  Run the proportional-share fairness benchmark for S seconds\n");
+    printf("  --bench-vm [N]     Run the paging benchmark with N accesses per configuration\n");
+    printf("  --vm-policy NAME   Page replacement: fifo, lru, clock or ws\n");
+    printf("  --vm-rate N        Memory accesses per ms of CPU time (replays default to 0 = off)\n");
+    printf("  --vm-frames N      Physical frames (default: RAM / %d KB)\n", PAGE_SIZE_KB);
+    printf("  --mem-alloc NAME   RAM allocator: buddy, first-fit (default), best-fit\n"
+           "                     or segregated\n");
+    printf("  --bench-reserve [N]  Compare semaphore and lock-free resource reservation\n"
+           "                     under 1-64 launcher threads, N operations each run\n");
+    printf("  --swap             Swap minimized tasks out to the HDD when RAM runs short\n");
+    printf("  --admission NAME   Queue tasks that do not fit: fifo (default), smallest,\n"
+           "                     priority, or off to reject them\n");
+    printf("  --admit-batch N    Most queued tasks started per admission pass (default unlimited)\n");
+    printf("  --admit-limit N    Most tasks waiting for admission (default unlimited)\n");
+    printf("  --banker MODE      Tasks claim resources up front and request them in steps:\n"
+           "                     avoid (Banker's algorithm), detect (break deadlocks) or off\n");
+    printf("  --banker-steps N   Steps each claim is requested in (default 4)\n");
+    printf("  --bench-banker [N] Time N Banker's safety checks at 10-10000 tasks\n");
+    printf("  --launcher NAME    Start task processes with fork, spawn (posix_spawn) or\n"
+           "                     pool (pre-forked workers, the default)\n");
+    printf("  --launch-pool N    Idle workers the pool keeps ready (default 16, max %d)\n", LAUNCH_POOL_MAX);
+    printf("  --bench-launch [N] Time bursts of N launches with each launcher\n");
+    printf("  --enforce [MS]     Hold background processes to the scheduler's choices with\n"
+           "                     SIGSTOP/SIGCONT every MS of real time (default 10)\n");
+    printf("  --bench-enforce [S]  Compare simulated and real CPU shares of spinning\n"
+           "                     processes under enforcement, S seconds per policy\n"
+           "                     (default 50 quanta, see --quantum)\n");
+    printf("  --bench-copy [MB]  Compare copy methods on 4 KB files up to MB (default 1024,\n"
+           "                     10240 for the 10 GB row)\n");
+    printf("  --bench-tree [N]   Time recursive copy and delete of N small files with 1-%d\n"
+           "                     threads (default 100000)\n", TREE_MAX_THREADS);
+    printf("  --bench-fs [MB]    Time mounts, MB-sized sequential I/O and metadata operations on\n"
+           "                     the disk image filesystem against the host (default 256)\n");
+    printf("  --bench-cache [MB] Compare buffer cache policies and sizes on an MB file in a disk\n"
+           "                     image (default 256)\n");
+    printf("  --bench-dir DIR    Where --bench-copy, --bench-tree, --bench-fs and --bench-cache\n"
+           "                     write (default .)\n");
+    printf("  --tree-threads N   Worker threads for directory copy/move/delete (default 8)\n");
+    printf("  --disk-image PATH  Filesystem image the file apps use, created with the HDD size\n"
+           "                     if missing (default disk.img)\n");
+    printf("  --cache-mb N       RAM for the disk image's buffer cache in MB, 0 for none (default 16)\n");
+    printf("  --cache-policy NAME  Buffer cache replacement: lru or arc (default)\n");
+    printf("  --flush-ms N       Write dirty buffers back after N ms (default 1000)\n");
+    printf("  --disk-sched NAME  HDD head scheduling: fcfs, sstf, scan, c-scan, look, c-look\n"
+           "                     (default) or deadline\n");
+    printf("  --disk-io          Tasks' I/O waits become requests to the simulated HDD\n"
+           "                     instead of fixed times\n");
+    printf("  --bench-disk [N]   Compare disk head schedulers on N requests per workload\n"
+           "                     (default 20000), with the --hdd geometry\n");
+    printf("  --bench-alloc [N]  Run the allocator benchmark with N operations per strategy\n");
+    printf("  --max-tasks N      Cap on concurrently running tasks (default unlimited)\n");
+    printf("  --verbose          Print per-task messages during replay\n");
+    printf("  --bench-sched [N]  Benchmark every scheduler on N synthetic tasks per workload\n");
+    printf("  --bench-smp [N]    Scale one workload of N tasks from 1 to 64 cores\n");
+    printf("  --csv FILE         Also write benchmark results as CSV\n");
+}
+
+void notepad() {
+    clear_screen();
+    printf("=== Notepad ===\n");
+    printf("Type your text (enter 'SAVE' on a new line to save and exit):\n");
+    fs_path_hint();
+    printf("\n");
+    
+    char filename[MAX_PATH_LENGTH];
+    printf("Enter filename to save: ");
+    scanf("%s", filename);
+    
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF);
+    
+    const char *host = host_path(filename);
+    FILE *file = host != NULL ? fopen(host, "w") : NULL;
+    int ino = host == NULL ? fs_open_empty(filename) : -1;
+    if (file == NULL && ino < 0) {
+        printf("Error creating file!\n");
+        return;
+    }
+    
+    char buffer[256];
+    long long size = 0;
+    while (1) {
+        fgets(buffer, sizeof(buffer), stdin);
+        
+        if (strcmp(buffer, "SAVE\n") == 0) {
+            break;
+        }
+        
+        if (file != NULL) {
+            fputs(buffer, file);
+        } else if (fs_write(ino, size, buffer, strlen(buffer)) > 0) {
+            size += strlen(buffer);
+        }
+    }
+    
+    if (file != NULL) fclose(file);
+    printf("File saved successfully as %s\n", filename);
+    sleep(2);
+}
+
+void calculator() {
+    clear_screen();
+    printf("=== Calculator ===\n");
+    printf("Operations: +, -, *, /, %% (enter 'q' to quit)\n\n");
+    
+    while (1) {
+        double num1, num2;
+        char op;
+        
+        printf("Enter expression (e.g., 5 + 3): ");
+        if (scanf("%lf %c %lf", &num1, &op, &num2) != 3) {
+            break;
+        }
+        
+        double result;
+        switch(op) {
+            case '+': result = num1 + num2; break;
+            case '-': result = num1 - num2; break;
+            case '*': result = num1 * num2; break;
+            case '/': 
+                if (num2 == 0) {
+                    printf("Error: Division by zero!\n");
+                    continue;
+                }
+                result = num1 / num2; 
+                break;
+            case '%': 
+                result = (int)num1 % (int)num2; 
+                break;
+            default: 
+                printf("Invalid operator!\n");
+                continue;
+        }
+        
+        printf("Result: %.2lf\n", result);
+        
+        while ((getchar()) != '\n');
+        
+        printf("Press q to quit or any other key to continue...");
+        if (getchar() == 'q') {
+            break;
+        }
+    }
+}
+
+void show_time() {
+    time_t now = time(NULL);
+    struct tm *tm_info = localtime(&now);
+    
+    clear_screen();
+    printf("=== Current Time ===\n");
+    printf("%02d:%02d:%02d\n", tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
+    printf("%02d/%02d/%04d\n", tm_info->tm_mday, tm_info->tm_mon + 1, tm_info->tm_year + 1900);
+    
+    printf("\nPress any key to continue...");
+    getchar(); getchar();
+}
+
+void calendar() {
+    while (1) {
+        time_t now = time(NULL);
+        struct tm *tm_info = localtime(&now);
+        
+        clear_screen();
+        printf("=== Calendar ===\n");
+        
+        printf("     %02d/%04d\n", tm_info->tm_mon + 1, tm_info->tm_year + 1900);
+        printf("Su Mo Tu We Th Fr Sa\n");
+        
+        struct tm first_day = *tm_info;
+        first_day.tm_mday = 1;
+        mktime(&first_day);
+        
+        int day_of_week = first_day.tm_wday;
+        int days_in_month;
+        
+        switch(tm_info->tm_mon + 1) {
+            case 4: case 6: case 9: case 11: days_in_month = 30; break;
+            case 2: 
+                days_in_month = ((tm_info->tm_year + 1900) % 4 == 0) ? 29 : 28;
+                break;
+            default: days_in_month = 31;
+        }
+        
+        for (int i = 0; i < day_of_week; i++) {
+            printf("   ");
+        }
+        
+        for (int day = 1; day <= days_in_month; day++) {
+            printf("%2d ", day);
+            if ((day + day_of_week) % 7 == 0 || day == days_in_month) {
+                printf("\n");
+            }
+        }
+        
+        printf("\nPress 'q' to quit...");
+        if (kbhit()) {
+            char ch = getchar();
+            if (ch == 'q' || ch == 'Q') {
+                break;
+            }
+        }
+        
+        sleep(1);
+    }
+}
+
+// ---- Copy engine ----
+//
+// copy_engine() tries the cheapest way to copy a regular file first and
+// falls back one step at a time: a FICLONE reflink (shares the extents,
+// O(1) on btrfs/XFS), copy_file_range() (in-kernel, server-side on NFS
+// and SMB), sendfile(), and finally pread()/pwrite() through a 1 MB
+// page-aligned buffer. Holes are found with SEEK_DATA/SEEK_HOLE and
+// skipped, and the destination is truncated to the source size so
+// trailing holes survive. Every write path loops on short writes.
+
+const char *copy_method_name(CopyMethod method) {
+    switch (method) {
+        case COPY_LOOP: return "1 KB stdio loop";
+        case COPY_BUFFERED: return "Buffered";
+        case COPY_SENDFILE: return "sendfile";
+        case COPY_RANGE: return "copy_file_range";
+        case COPY_REFLINK: return "Reflink";
+    }
+    return "Unknown";
+}
+
+// The loop copy_file() used to run, kept as the benchmark baseline
+int copy_loop(const char *source, const char *dest, CopyStats *stats) {
+    FILE *src_file = fopen(source, "rb");
+    if (src_file == NULL) return -1;
+    FILE *dest_file = fopen(dest, "wb");
+    if (dest_file == NULL) {
+        fclose(src_file);
+        return -1;
+    }
+    
+    char buffer[1024];
+    size_t bytes;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), src_file)) > 0) {
+        fwrite(buffer, 1, bytes, dest_file);
+        stats->bytes += bytes;
+    }
+    
+    fclose(src_file);
+    return fclose(dest_file) == 0 ? 0 : -1;
+}
+
+// Copies [offset, end) with the given method. Returns 1 when done, 0 when
+// the method is not supported for this pair of files (nothing was
+// written), -1 on a real error.
+int copy_segment(int in, int out, long long offset, long long end, CopyMethod method,
+                 char *buffer, CopyStats *stats) {
+    while (offset < end) {
+        size_t want = end - offset < COPY_CHUNK ? (size_t)(end - offset) : COPY_CHUNK;
+        ssize_t n;
+        
+        if (method == COPY_RANGE) {
+            loff_t in_off = offset, out_off = offset;
+            n = copy_file_range(in, &in_off, out, &out_off, want, 0);
+        } else if (method == COPY_SENDFILE) {
+            off_t in_off = offset;
+            if (lseek(out, offset, SEEK_SET) < 0) return -1;
+            n = sendfile(out, in, &in_off, want);
+        } else {
+            if (want > COPY_BUFFER_SIZE) want = COPY_BUFFER_SIZE;
+            n = pread(in, buffer, want, offset);
+            for (ssize_t done = 0; n > 0 && done < n; ) {
+                ssize_t w = pwrite(out, buffer + done, n - done, offset + done);
+                if (w < 0 && errno == EINTR) continue;
+                if (w <= 0) return -1;
+                done += w;
+            }
+        }
+        
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Unsupported for these files; only fall back before any data moved
+            if (method != COPY_BUFFERED && stats->bytes == 0 &&
+                (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                 errno == EOPNOTSUPP || errno == EBADF)) {
+                return 0;
+            }
+            return -1;
+        }
+        if (n == 0) break;  // The source shrank underneath us
+        offset += n;
+        stats->bytes += n;
+        if (stats->progress != NULL) stats->progress(offset, stats->total);
+    }
+    return 1;
+}
+
+// Copies between two open files; out must be empty. Returns 0 or -1 with
+// errno set.
+int copy_fds(int in, int out, long long size, CopyMethod method, CopyStats *stats) {
+    int status = 0;
+    stats->total = size;
+    stats->method = method;
+    // Small files skip the reflink attempt and the hole search; neither
+    // can pay for its system calls there
+    int small = size <= COPY_SMALL_FILE;
+    
+    if (method == COPY_REFLINK) {
+        if (!small && ioctl(out, FICLONE, in) == 0) {
+            stats->bytes = size;
+        } else {
+            stats->method = method = COPY_RANGE;
+        }
+    }
+    
+    char *buffer = NULL;
+    long long offset = 0;
+    while (status == 0 && stats->method != COPY_REFLINK && offset < size) {
+        // Next data segment; without SEEK_DATA support the file is one segment
+        long long data = small ? offset : lseek(in, offset, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) break;  // Only a hole is left
+            data = offset;
+        }
+        long long hole = small ? size : lseek(in, data, SEEK_HOLE);
+        if (hole < 0) hole = size;
+        
+        int done = 0;
+        while (!done) {
+            if (method == COPY_BUFFERED && buffer == NULL &&
+                posix_memalign((void **)&buffer, 4096, COPY_BUFFER_SIZE) != 0) {
+                buffer = NULL;
+                status = -1;
+                break;
+            }
+            done = copy_segment(in, out, data, hole, method, buffer, stats);
+            if (done < 0) status = -1;
+            if (done == 0) stats->method = method = method - 1;  // Next cheaper fallback
+        }
+        offset = hole;
+    }
+    free(buffer);
+    
+    // Trailing holes have no data segment; the size carries them
+    if (status == 0 && stats->bytes < size) status = ftruncate(out, size);
+    stats->hole_bytes = size - stats->bytes;
+    if (status == 0 && stats->progress != NULL) stats->progress(size, size);
+    return status;
+}
+
+// Returns 0 on success and -1 with errno set on failure. stats->method
+// is the method that actually copied the data.
+int copy_engine(const char *source, const char *dest, CopyMethod method, CopyStats *stats) {
+    long long start = monotonic_ns();
+    stats->bytes = 0;
+    stats->hole_bytes = 0;
+    stats->method = method;
+    if (method == COPY_LOOP) {
+        int status = copy_loop(source, dest, stats);
+        stats->seconds = (monotonic_ns() - start) / 1e9;
+        return status;
+    }
+    
+    int in = open(source, O_RDONLY);
+    if (in < 0) return -1;
+    struct stat src_stat;
+    if (fstat(in, &src_stat) != 0) {
+        close(in);
+        return -1;
+    }
+    int out = open(dest, O_WRONLY | O_CREAT, src_stat.st_mode & 0777);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    
+    // Truncating the source onto itself would destroy it
+    struct stat dest_stat;
+    if (fstat(out, &dest_stat) != 0 ||
+        (dest_stat.st_dev == src_stat.st_dev && dest_stat.st_ino == src_stat.st_ino)) {
+        close(in);
+        close(out);
+        errno = EINVAL;
+        return -1;
+    }
+    int status = ftruncate(out, 0);
+    if (status == 0) status = copy_fds(in, out, src_stat.st_size, method, stats);
+    
+    int saved = errno;
+    close(in);
+    if (close(out) != 0 && status == 0) {
+        saved = errno;
+        status = -1;
+    }
+    errno = saved;
+    stats->seconds = (monotonic_ns() - start) / 1e9;
+    return status;
+}
+
+void copy_progress(long long done, long long total) {
+    static long long last_ns = 0;
+    long long now = monotonic_ns();
+    if (done < total && now - last_ns < 200000000) return;  // Five redraws a second
+    last_ns = now;
+    
+    printf("\rCopied %lld of %lld MB (%.0f%%)", done >> 20, total >> 20,
+           total > 0 ? 100.0 * done / total : 100.0);
+    fflush(stdout);
+}
+
+// Writes a file of `bytes` for the benchmark; sparse files get one 64 KB
+// extent per MB and holes in between
+int copy_bench_file(const char *path, long long bytes, int sparse) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    
+    char *chunk = malloc(COPY_BUFFER_SIZE);
+    for (int i = 0; i < COPY_BUFFER_SIZE; i++) {
+        chunk[i] = (char)(i * 31 + 7);
+    }
+    int status = 0;
+    for (long long offset = 0; status == 0 && offset < bytes; offset += COPY_BUFFER_SIZE) {
+        long long len = bytes - offset < COPY_BUFFER_SIZE ? bytes - offset : COPY_BUFFER_SIZE;
+        if (sparse && len > 65536) len = 65536;
+        if (pwrite(fd, chunk, len, offset) != len) status = -1;
+    }
+    if (status == 0) status = ftruncate(fd, bytes);
+    
+    free(chunk);
+    close(fd);
+    return status;
+}
+
+// Copies 4 KB to max_mb files with every method. Small files are copied
+// repeatedly so each row moves at least 256 MB. The page cache stays warm
+// and nothing is fsync()ed, so the figures are the copy path's own cost.
+int run_copy_benchmark(long max_mb, const char *dir, const char *csv_path) {
+    static const long long sizes[] = { 4LL << 10, 1LL << 20, 64LL << 20, 1LL << 30, 10LL << 30 };
+    static const char *size_names[] = { "4 KB", "1 MB", "64 MB", "1 GB", "10 GB" };
+    
+    FILE *csv = bench_csv_open(csv_path, "size_bytes,sparse,method,used,copies,mb_per_s,speedup,dest_mb_on_disk");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    char src_path[MAX_PATH_LENGTH], dst_path[MAX_PATH_LENGTH];
+    snprintf(src_path, sizeof(src_path), "%s/copy-bench.src", dir);
+    snprintf(dst_path, sizeof(dst_path), "%s/copy-bench.dst", dir);
+    
+    printf("=== Copy Benchmark (up to %ld MB in %s) ===\n", max_mb, dir);
+    printf("%-12s %-16s %-16s %7s %10s %8s %10s\n",
+           "File", "Method", "Used", "Copies", "MB/s", "Speedup", "Disk MB");
+    
+    for (int s = 0; s < 5; s++) {
+        for (int sparse = 0; sparse < 2; sparse++) {
+            long long bytes = sizes[s];
+            if (bytes > (long long)max_mb << 20) continue;
+            if (sparse && bytes < (64LL << 20)) continue;
+            if (copy_bench_file(src_path, bytes, sparse) != 0) {
+                fprintf(stderr, "Cannot write %s: %s\n", src_path, strerror(errno));
+                if (csv != NULL) fclose(csv);
+                return 1;
+            }
+            
+            long copies = bytes >= (256LL << 20) ? 1 : (256LL << 20) / bytes;
+            if (copies > 2000) copies = 2000;
+            double baseline = 0;
+            char label[32];
+            snprintf(label, sizeof(label), "%s%s", size_names[s], sparse ? " sparse" : "");
+            
+            for (int m = COPY_LOOP; m <= COPY_REFLINK; m++) {
+                CopyStats stats;
+                memset(&stats, 0, sizeof(stats));
+                double seconds = 0;
+                int failed = 0;
+                for (long c = 0; c < copies && !failed; c++) {
+                    failed = copy_engine(src_path, dst_path, m, &stats) != 0;
+                    seconds += stats.seconds;
+                }
+                if (failed) {
+                    printf("%-12s %-16s failed: %s\n", label, copy_method_name(m), strerror(errno));
+                    continue;
+                }
+                
+                struct stat dst_stat;
+                double disk_mb = stat(dst_path, &dst_stat) == 0 ? dst_stat.st_blocks * 512.0 / (1 << 20) : 0;
+                double rate = seconds > 0 ? (double)bytes * copies / seconds / (1 << 20) : 0;
+                if (m == COPY_LOOP) baseline = rate;
+                double speedup = baseline > 0 ? rate / baseline : 0;
+                printf("%-12s %-16s %-16s %7ld %10.0f %7.1fx %10.1f\n",
+                       label, copy_method_name(m), copy_method_name(stats.method),
+                       copies, rate, speedup, disk_mb);
+                if (csv != NULL) {
+                    fprintf(csv, "%lld,%d,%s,%s,%ld,%.1f,%.2f,%.1f\n", bytes, sparse,
+                            copy_method_name(m), copy_method_name(stats.method),
+                            copies, rate, speedup, disk_mb);
+                }
+            }
+            unlink(dst_path);
+        }
+    }
+    unlink(src_path);
+    
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// ---- Tree operations ----
+//
+// Recursive copy and delete walk directories with getdents64() on
+// directory descriptors and touch entries with the *at() calls, so no
+// path is ever rebuilt. Every entry becomes a work item on a shared
+// stack served by a pool of threads; popping the newest item first
+// keeps the walk roughly depth-first, which bounds the number of
+// directories held open. A directory counts its unfinished entries and
+// is finished (closed, and for a delete removed) by whichever thread
+// completes its last one, which then finishes its parent in turn.
+
+void tree_error(TreeWalk *w, const char *name) {
+    __atomic_add_fetch(&w->errors, 1, __ATOMIC_RELAXED);
+    int saved = errno;
+    pthread_mutex_lock(&w->lock);
+    if (w->first_error[0] == '\0') {
+        snprintf(w->first_error, sizeof(w->first_error), "%s: %s", name, strerror(saved));
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Drops one unfinished entry from dir, finishing it and any ancestors
+// that this completes
+void tree_dir_done(TreeWalk *w, TreeDir *dir) {
+    while (dir != NULL && __atomic_sub_fetch(&dir->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        TreeDir *parent = dir->parent;
+        close(dir->src_fd);
+        if (dir->dst_fd >= 0) close(dir->dst_fd);
+        
+        if (w->op == TREE_DELETE) {
+            int rc = parent != NULL ? unlinkat(parent->src_fd, dir->name, AT_REMOVEDIR) : rmdir(w->root);
+            if (rc == 0) {
+                __atomic_add_fetch(&w->dirs, 1, __ATOMIC_RELAXED);
+            } else {
+                tree_error(w, parent != NULL ? dir->name : w->root);
+            }
+        }
+        if (parent == NULL) {
+            pthread_mutex_lock(&w->lock);
+            w->done = 1;
+            pthread_cond_broadcast(&w->ready);
+            pthread_mutex_unlock(&w->lock);
+        }
+        free(dir->name);
+        free(dir);
+        dir = parent;
+    }
+}
+
+// Reads every entry of dir and queues it; each batch from getdents64()
+// goes onto the stack under one lock
+void tree_list(TreeWalk *w, TreeDir *dir) {
+    char buffer[TREE_DIRENT_BUFFER];
+    
+    while (1) {
+        long n = syscall(SYS_getdents64, dir->src_fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            if (n < 0) tree_error(w, dir->name != NULL ? dir->name : w->root);
+            break;
+        }
+        
+        int out_of_memory = 0;
+        pthread_mutex_lock(&w->lock);
+        for (long pos = 0; pos < n; ) {
+            TreeDirent *entry = (TreeDirent *)(buffer + pos);
+            pos += entry->d_reclen;
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(dir->src_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK :
+                           S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+                }
+            }
+            if (w->depth == w->cap) {
+                int cap = w->cap ? w->cap * 2 : 1024;
+                TreeItem *stack = realloc(w->stack, cap * sizeof(TreeItem));
+                if (stack == NULL) {
+                    out_of_memory = 1;
+                    break;
+                }
+                w->stack = stack;
+                w->cap = cap;
+            }
+            char *name = strdup(entry->d_name);
+            if (name == NULL) {
+                out_of_memory = 1;
+                break;
+            }
+            TreeItem *item = &w->stack[w->depth++];
+            item->dir = dir;
+            item->name = name;
+            item->type = type;
+            __atomic_add_fetch(&dir->pending, 1, __ATOMIC_RELAXED);
+        }
+        pthread_cond_broadcast(&w->ready);
+        pthread_mutex_unlock(&w->lock);
+        
+        // The rest of the directory is left out and counted as one error
+        if (out_of_memory) {
+            errno = ENOMEM;
+            tree_error(w, dir->name != NULL ? dir->name : w->root);
+            break;
+        }
+    }
+}
+
+// Opens subdirectory `name` of parent (creating its copy first) and
+// takes ownership of name. Returns NULL on failure.
+TreeDir *tree_open_dir(TreeWalk *w, TreeDir *parent, char *name) {
+    int src_fd = openat(parent->src_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (src_fd < 0) return NULL;
+    
+    int dst_fd = -1;
+    if (w->op == TREE_COPY) {
+        struct stat st;
+        if (fstat(src_fd, &st) != 0 ||
+            (mkdirat(parent->dst_fd, name, (st.st_mode & 07777) | S_IRWXU) != 0 && errno != EEXIST) ||
+            (dst_fd = openat(parent->dst_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+            close(src_fd);
+            return NULL;
+        }
+        __atomic_add_fetch(&w->dirs, 1, __ATOMIC_RELAXED);
+    }
+    
+    TreeDir *dir = calloc(1, sizeof(TreeDir));
+    dir->src_fd = src_fd;
+    dir->dst_fd = dst_fd;
+    dir->parent = parent;
+    dir->name = name;
+    dir->pending = 1;  // Held until the listing is complete
+    return dir;
+}
+
+// Copies or deletes one non-directory entry. Returns 0 or -1 with errno set.
+int tree_file(TreeWalk *w, TreeDir *dir, const char *name, unsigned char type) {
+    if (w->op == TREE_DELETE) return unlinkat(dir->src_fd, name, 0);
+    
+    if (type == DT_LNK) {
+        char target[MAX_PATH_LENGTH * 4];
+        ssize_t len = readlinkat(dir->src_fd, name, target, sizeof(target) - 1);
+        if (len < 0) return -1;
+        target[len] = '\0';
+        return symlinkat(target, dir->dst_fd, name);
+    }
+    if (type != DT_REG) {
+        errno = EOPNOTSUPP;  // Devices, FIFOs and sockets are not copied
+        return -1;
+    }
+    
+    int in = openat(dir->src_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in < 0) return -1;
+    struct stat st;
+    int out = -1;
+    if (fstat(in, &st) == 0) {
+        out = openat(dir->dst_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    }
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    
+    CopyStats stats;
+    memset(&stats, 0, sizeof(stats));
+    int status = st.st_size > 0 ? copy_fds(in, out, st.st_size, COPY_REFLINK, &stats) : 0;
+    int saved = errno;
+    close(in);
+    if (close(out) != 0 && status == 0) {
+        saved = errno;
+        status = -1;
+    }
+    __atomic_add_fetch(&w->bytes, stats.bytes, __ATOMIC_RELAXED);
+    errno = saved;
+    return status;
+}
+
+void *tree_worker(void *arg) {
+    TreeWalk *w = arg;
+    
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        while (w->depth == 0 && !w->done) {
+            pthread_cond_wait(&w->ready, &w->lock);
+        }
+        if (w->depth == 0) {
+            pthread_mutex_unlock(&w->lock);
+            break;
+        }
+        TreeItem item = w->stack[--w->depth];
+        pthread_mutex_unlock(&w->lock);
+        
+        if (item.type == DT_DIR) {
+            TreeDir *child = tree_open_dir(w, item.dir, item.name);
+            if (child != NULL) {
+                tree_list(w, child);
+                tree_dir_done(w, child);  // Finishes item.dir's entry when its last child does
+                continue;
+            }
+            tree_error(w, item.name);
+        } else if (tree_file(w, item.dir, item.name, item.type) == 0) {
+            __atomic_add_fetch(&w->files, 1, __ATOMIC_RELAXED);
+        } else {
+            tree_error(w, item.name);
+        }
+        free(item.name);
+        tree_dir_done(w, item.dir);
+    }
+    return NULL;
+}
+
+// Is dest, or the directory it would be created in, the directory `root`
+// or below it? Walks up through ".." comparing device and inode, as cp
+// does, so symlinks and relative paths cannot hide the overlap.
+int tree_contains(const struct stat *root, const char *dest) {
+    char parent[MAX_PATH_LENGTH * 4];
+    snprintf(parent, sizeof(parent), "%s", dest);
+    int fd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        char *slash = strrchr(parent, '/');
+        if (slash == NULL) {
+            strcpy(parent, ".");
+        } else {
+            slash[slash == parent] = '\0';
+        }
+        fd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    
+    int inside = 0;
+    while (fd >= 0 && !inside) {
+        struct stat st, up_st;
+        int up = -1;
+        if (fstat(fd, &st) != 0) break;
+        inside = st.st_dev == root->st_dev && st.st_ino == root->st_ino;
+        if (!inside) {
+            up = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            // The filesystem root is its own parent
+            if (up >= 0 && (fstat(up, &up_st) != 0 ||
+                            (up_st.st_dev == st.st_dev && up_st.st_ino == st.st_ino))) {
+                close(up);
+                up = -1;
+            }
+        }
+        close(fd);
+        fd = up;
+    }
+    if (fd >= 0) close(fd);
+    return inside;
+}
+
+// Copies source to dest or deletes source (dest unused), recursively
+// when it is a directory. Results are left in *w; returns 0 if every
+// entry succeeded.
+int tree_run(TreeOp op, const char *source, const char *dest, int threads, TreeWalk *w) {
+    memset(w, 0, sizeof(*w));
+    w->op = op;
+    w->root = source;
+    long long start = monotonic_ns();
+    
+    struct stat st;
+    if (lstat(source, &st) != 0) {
+        tree_error(w, source);
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        int status;
+        if (op == TREE_DELETE) {
+            status = unlink(source);
+        } else if (S_ISLNK(st.st_mode)) {
+            char target[MAX_PATH_LENGTH * 4];
+            ssize_t len = readlink(source, target, sizeof(target) - 1);
+            status = len < 0 ? -1 : (target[len] = '\0', symlink(target, dest));
+        } else {
+            CopyStats stats;
+            memset(&stats, 0, sizeof(stats));
+            status = copy_engine(source, dest, COPY_REFLINK, &stats);
+            w->bytes = stats.bytes;
+        }
+        if (status == 0) {
+            w->files = 1;
+        } else {
+            tree_error(w, source);
+        }
+        w->seconds = (monotonic_ns() - start) / 1e9;
+        return status;
+    }
+    
+    // Copying a directory into its own subtree would never run out of entries
+    if (op == TREE_COPY && tree_contains(&st, dest)) {
+        w->errors = 1;
+        snprintf(w->first_error, sizeof(w->first_error), "cannot copy %s into itself (%s)", source, dest);
+        errno = EINVAL;
+        return -1;
+    }
+    
+    // Wide trees keep many directories open at once
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    
+    TreeDir *root = calloc(1, sizeof(TreeDir));
+    root->src_fd = open(source, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    root->dst_fd = -1;
+    root->pending = 1;
+    if (root->src_fd >= 0 && op == TREE_COPY) {
+        if (mkdir(dest, (st.st_mode & 07777) | S_IRWXU) == 0) w->dirs++;
+        root->dst_fd = open(dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (root->src_fd < 0 || (op == TREE_COPY && root->dst_fd < 0)) {
+        tree_error(w, root->src_fd < 0 ? source : dest);
+        if (root->src_fd >= 0) close(root->src_fd);
+        free(root);
+        return -1;
+    }
+    
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->ready, NULL);
+    if (threads < 1) threads = 1;
+    if (threads > TREE_MAX_THREADS) threads = TREE_MAX_THREADS;
+    pthread_t tids[TREE_MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, tree_worker, w);
+    }
+    
+    tree_list(w, root);
+    tree_dir_done(w, root);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    
+    free(w->stack);
+    w->stack = NULL;
+    pthread_cond_destroy(&w->ready);
+    pthread_mutex_destroy(&w->lock);
+    w->seconds = (monotonic_ns() - start) / 1e9;
+    return w->errors == 0 ? 0 : -1;
+}
+
+// rename(), or across filesystems a tree copy followed by deleting the
+// source, which is kept if any part of the copy failed. *w holds the copy
+// counts; *removed the delete's when one ran.
+int tree_move(const char *source, const char *dest, int threads, TreeWalk *w, TreeWalk *removed) {
+    memset(removed, 0, sizeof(*removed));
+    long long start = monotonic_ns();
+    if (rename(source, dest) == 0) {
+        memset(w, 0, sizeof(*w));
+        w->op = TREE_MOVE;
+        w->root = source;
+        w->files = 1;
+        w->seconds = (monotonic_ns() - start) / 1e9;
+        return 0;
+    }
+    if (errno != EXDEV) {
+        memset(w, 0, sizeof(*w));
+        tree_error(w, source);
+        return -1;
+    }
+    
+    if (tree_run(TREE_COPY, source, dest, threads, w) != 0) return -1;
+    return tree_run(TREE_DELETE, source, NULL, threads, removed);
+}
+
+void print_tree_result(const char *verb, TreeWalk *w) {
+    printf("%s %ld files and %ld directories (%.1f MB) in %.2f s, %.0f files/s\n",
+           verb, w->files, w->dirs, w->bytes / (double)(1 << 20), w->seconds,
+           w->seconds > 0 ? w->files / w->seconds : 0.0);
+    if (w->errors > 0) {
+        printf("%ld entries failed, first: %s\n", w->errors, w->first_error);
+    }
+}
+
+// Builds a tree of small files (1000 per directory) and times recursive
+// copy and delete with 1 to TREE_MAX_THREADS threads
+int run_tree_benchmark(long files, const char *dir, const char *csv_path) {
+    FILE *csv = bench_csv_open(csv_path, "operation,threads,files,dirs,seconds,files_per_s,errors");
+    if (csv_path != NULL && csv == NULL) return 1;
+    
+    char src[MAX_PATH_LENGTH], dst[MAX_PATH_LENGTH], path[MAX_PATH_LENGTH + 64];
+    snprintf(src, sizeof(src), "%s/tree-bench.src", dir);
+    snprintf(dst, sizeof(dst), "%s/tree-bench.dst", dir);
+    
+    char payload[1024];
+    memset(payload, 'x', sizeof(payload));
+    long long build_start = monotonic_ns();
+    if (mkdir(src, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create %s: %s\n", src, strerror(errno));
+        return 1;
+    }
+    for (long i = 0; i < files; i++) {
+        if (i % 1000 == 0) {
+            snprintf(path, sizeof(path), "%s/d%05ld", src, i / 1000);
+            mkdir(path, 0755);
+        }
+        snprintf(path, sizeof(path), "%s/d%05ld/f%06ld", src, i / 1000, i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, payload, sizeof(payload)) != sizeof(payload)) {
+            fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+        close(fd);
+    }
+    
+    printf("=== Tree Benchmark (%ld files of 1 KB, built in %.1f s, %ld CPUs online) ===\n",
+           files, (monotonic_ns() - build_start) / 1e9, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s %7s %9s %8s %10s %7s\n", "Op", "Threads", "Files", "Seconds", "Files/s", "Errors");
+    
+    for (int threads = 1; threads <= TREE_MAX_THREADS; threads *= 2) {
+        TreeWalk w;
+        for (int op = TREE_COPY; op <= TREE_DELETE; op++) {
+            tree_run(op, op == TREE_COPY ? src : dst, dst, threads, &w);
+            double rate = w.seconds > 0 ? w.files / w.seconds : 0.0;
+            printf("%-8s %7d %9ld %8.2f %10.0f %7ld\n",
+                   op == TREE_COPY ? "Copy" : "Delete", threads, w.files, w.seconds, rate, w.errors);
+            if (csv != NULL) {
+                fprintf(csv, "%s,%d,%ld,%ld,%.3f,%.1f,%ld\n", op == TREE_COPY ? "copy" : "delete",
+                        threads, w.files, w.dirs, w.seconds, rate, w.errors);
+            }
+        }
+    }
+    
+    TreeWalk cleanup;
+    tree_run(TREE_DELETE, src, NULL, TREE_MAX_THREADS, &cleanup);
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// ---- Disk image filesystem ----
+//
+// The file apps work on a filesystem inside one image file that is
+// mmap()ed whole: a superblock, a block bitmap, a fixed inode table and
+// data blocks handed out as extents (start, length). A file that grows
+// first tries to extend its last extent in place and the bitmap is
+// searched a 64-bit word at a time, so sequential writes stay contiguous.
+// The superblock keeps the free counts, so mounting reads one block
+// whatever the image size; they are only rebuilt from the bitmap when
+// the image was not unmounted cleanly. Blocks in use are charged to the
+// HDD resource pool in whole MB.
+
+unsigned char *fs_block(unsigned long long block) {
+    return simfs.image + block * FS_BLOCK_SIZE;
+}
+
+FsInode *fs_inode(unsigned int ino) {
+    return &simfs.inodes[ino];
+}
+
+// Takes or gives back HDD so the pool tracks the blocks in use. Returns 0
+// if the pool cannot cover them.
+int fs_charge() {
+    unsigned long long used = simfs.sb->block_count - simfs.sb->free_blocks;
+    int want = (int)((used * FS_BLOCK_SIZE + (1 << 20) - 1) >> 20);
+    if (want > simfs.charged_mb) {
+        if (!res_reserve(0, want - simfs.charged_mb, 0)) return 0;
+    } else if (want < simfs.charged_mb) {
+        res_adjust(0, simfs.charged_mb - want, 0);
+    }
+    simfs.charged_mb = want;
+    return 1;
+}
+
+// First block in [from, to) whose bitmap bit equals used, or to
+unsigned long long fs_scan(unsigned long long from, unsigned long long to, int used) {
+    while (from < to) {
+        unsigned long long word = simfs.bitmap[from >> 6];
+        if (!used) word = ~word;
+        word &= ~0ULL << (from & 63);
+        if (word != 0) {
+            unsigned long long block = (from & ~63ULL) + __builtin_ctzll(word);
+            return block < to ? block : to;
+        }
+        from = (from | 63) + 1;
+    }
+    return to;
+}
+
+void fs_mark(unsigned long long start, unsigned long long count, int used) {
+    unsigned long long end = start + count;
+    for (unsigned long long b = start; b < end; ) {
+        if ((b & 63) == 0 && b + 64 <= end) {
+            simfs.bitmap[b >> 6] = used ? ~0ULL : 0;
+            b += 64;
+        } else {
+            if (used) {
+                simfs.bitmap[b >> 6] |= 1ULL << (b & 63);
+            } else {
+                simfs.bitmap[b >> 6] &= ~(1ULL << (b & 63));
+            }
+            b++;
+        }
+    }
+    if (used) {
+        simfs.sb->free_blocks -= count;
+    } else {
+        simfs.sb->free_blocks += count;
+        bcache_forget(start, count);  // No late write-back may land on a reused block
+    }
+}
+
+// Takes the free run starting at the first free block at or after goal
+// (wrapping once), up to want blocks
+int fs_alloc_extent(unsigned long long goal, unsigned long long want, FsExtent *out) {
+    FsSuper *sb = simfs.sb;
+    if (sb->free_blocks == 0) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (goal < sb->data_start || goal >= sb->block_count) goal = sb->alloc_hint;
+    if (goal < sb->data_start || goal >= sb->block_count) goal = sb->data_start;
+    if (want > 1 << 20) want = 1 << 20;
+    
+    unsigned long long start = fs_scan(goal, sb->block_count, 0);
+    if (start == sb->block_count) {
+        start = fs_scan(sb->data_start, goal, 0);
+        if (start == goal) {
+            errno = ENOSPC;
+            return -1;
+        }
+    }
+    unsigned long long end = fs_scan(start, start + want < sb->block_count ? start + want : sb->block_count, 1);
+    
+    fs_mark(start, end - start, 1);
+    if (!fs_charge()) {
+        fs_mark(start, end - start, 0);
+        errno = ENOSPC;
+        return -1;
+    }
+    sb->alloc_hint = end;
+    out->start = start;
+    out->length = end - start;
+    return 0;
+}
+
+FsExtent *fs_extent(FsInode *node, unsigned int i) {
+    if (i < FS_INLINE_EXTENTS) return &node->extents[i];
+    return (FsExtent *)fs_block(node->extent_block) + (i - FS_INLINE_EXTENTS);
+}
+
+// Releases the file's blocks past the first `blocks`
+void fs_shrink(FsInode *node, unsigned long long blocks) {
+    while (node->blocks > blocks) {
+        FsExtent *last = fs_extent(node, node->extent_count - 1);
+        unsigned int drop = node->blocks - blocks < last->length ? node->blocks - blocks : last->length;
+        fs_mark(last->start + last->length - drop, drop, 0);
+        last->length -= drop;
+        node->blocks -= drop;
+        if (last->length == 0) node->extent_count--;
+    }
+    if (node->extent_count <= FS_INLINE_EXTENTS && node->extent_block != 0) {
+        fs_mark(node->extent_block, 1, 0);
+        node->extent_block = 0;
+    }
+    fs_charge();
+}
+
+// Gives the file at least `blocks` blocks, extending its last extent
+// whenever the blocks after it are free
+int fs_grow(FsInode *node, unsigned long long blocks) {
+    while (node->blocks < blocks) {
+        FsExtent *last = node->extent_count > 0 ? fs_extent(node, node->extent_count - 1) : NULL;
+        unsigned long long goal = last != NULL ? last->start + last->length : 0;
+        FsExtent got;
+        if (fs_alloc_extent(goal, blocks - node->blocks, &got) != 0) return -1;
+        
+        if (last != NULL && got.start == goal && last->length + (unsigned long long)got.length < 1ULL << 31) {
+            last->length += got.length;
+        } else {
+            if (node->extent_count == FS_INLINE_EXTENTS + FS_EXTENTS_PER_BLOCK) {
+                fs_mark(got.start, got.length, 0);
+                fs_charge();
+                errno = EFBIG;
+                return -1;
+            }
+            if (node->extent_count == FS_INLINE_EXTENTS && node->extent_block == 0) {
+                FsExtent spill;
+                if (fs_alloc_extent(0, 1, &spill) != 0) {
+                    fs_mark(got.start, got.length, 0);
+                    fs_charge();
+                    return -1;
+                }
+                node->extent_block = spill.start;
+            }
+            *fs_extent(node, node->extent_count++) = got;
+        }
+        node->blocks += got.length;
+    }
+    return 0;
+}
+
+// Copies between buf and an allocated byte range of the file, one block
+// at a time through the buffer cache; a NULL buf writes zeros
+void fs_io(FsInode *node, unsigned long long offset, char *buf, size_t len, int write) {
+    for (unsigned int i = 0; i < node->extent_count && len > 0; i++) {
+        FsExtent *e = fs_extent(node, i);
+        unsigned long long bytes = (unsigned long long)e->length * FS_BLOCK_SIZE;
+        if (offset >= bytes) {
+            offset -= bytes;
+            continue;
+        }
+        for (; offset < bytes && len > 0; ) {
+            unsigned int in = offset % FS_BLOCK_SIZE;
+            size_t n = FS_BLOCK_SIZE - in < len ? FS_BLOCK_SIZE - in : len;
+            bcache_io(e->start + offset / FS_BLOCK_SIZE, e->start + e->length, in, buf, n, write);
+            if (buf != NULL) buf += n;
+            len -= n;
+            offset += n;
+        }
+        offset = 0;
+    }
+}
+
+long long fs_read(unsigned int ino, unsigned long long offset, void *buf, size_t len) {
+    FsInode *node = fs_inode(ino);
+    if (offset >= node->size) return 0;
+    if (len > node->size - offset) len = node->size - offset;
+    fs_io(node, offset, buf, len, 0);
+    simfs.bytes_read += len;
+    return len;
+}
+
+long long fs_write(unsigned int ino, unsigned long long offset, const void *buf, size_t len) {
+    FsInode *node = fs_inode(ino);
+    unsigned long long end = offset + len;
+    if (fs_grow(node, (end + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE) != 0) {
+        fs_shrink(node, (node->size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE);
+        return -1;
+    }
+    // Freed blocks keep their old contents, so a gap before offset is zeroed
+    if (offset > node->size) fs_io(node, node->size, NULL, offset - node->size, 1);
+    fs_io(node, offset, (char *)buf, len, 1);
+    if (end > node->size) node->size = end;
+    node->mtime = time(NULL);
+    simfs.bytes_written += len;
+    return len;
+}
+
+int fs_truncate(unsigned int ino, unsigned long long size) {
+    FsInode *node = fs_inode(ino);
+    if (size > node->size) {
+        if (fs_grow(node, (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE) != 0) return -1;
+        fs_io(node, node->size, NULL, size - node->size, 1);
+    } else {
+        fs_shrink(node, (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE);
+    }
+    node->size = size;
+    node->mtime = time(NULL);
+    return 0;
+}
+
+int fs_inode_alloc(FsType type, unsigned int parent) {
+    FsSuper *sb = simfs.sb;
+    if (sb->free_inodes == 0) {
+        errno = ENOSPC;
+        return -1;
+    }
+    unsigned int ino = sb->inode_hint;
+    for (unsigned int n = 0; n < sb->inode_count; n++, ino++) {
+        if (ino <= FS_ROOT || ino >= sb->inode_count) ino = FS_ROOT + 1;
+        FsInode *node = fs_inode(ino);
+        if (node->type == FS_FREE) {
+            memset(node, 0, sizeof(*node));
+            node->type = type;
+            node->links = 1;
+            node->parent = parent;
+            node->ctime = node->mtime = time(NULL);
+            sb->free_inodes--;
+            sb->inode_hint = ino + 1;
+            return ino;
+        }
+    }
+    errno = ENOSPC;
+    return -1;
+}
+
+void fs_inode_free(unsigned int ino) {
+    fs_shrink(fs_inode(ino), 0);
+    memset(fs_inode(ino), 0, sizeof(FsInode));
+    simfs.sb->free_inodes++;
+}
+
+unsigned int fs_name_hash(const char *name) {
+    unsigned int hash = 2166136261u;  // FNV-1a
+    while (*name) hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    return hash;
+}
+
+void fs_dir_open(FsDirIter *it, unsigned int dir) {
+    it->dir = dir;
+    it->offset = 0;
+}
+
+// Returns a copy of the next used entry, NULL at the end; its slot is
+// it->offset - sizeof(FsDirent). Entries are read a block at a time.
+FsDirent *fs_dir_next(FsDirIter *it) {
+    FsInode *node = fs_inode(it->dir);
+    while (it->offset < node->size) {
+        unsigned int i = it->offset % FS_BLOCK_SIZE / sizeof(FsDirent);
+        if (i == 0) {
+            unsigned long long left = node->size - it->offset;
+            fs_io(node, it->offset, (char *)it->block, left < FS_BLOCK_SIZE ? left : FS_BLOCK_SIZE, 0);
+        }
+        it->offset += sizeof(FsDirent);
+        if (it->block[i].inode != 0) return &it->block[i];
+    }
+    return NULL;
+}
+
+// Returns the inode of name in dir, 0 if absent; *slot receives the
+// entry's offset
+unsigned int fs_dir_find(unsigned int dir, const char *name, unsigned long long *slot) {
+    unsigned int hash = fs_name_hash(name);
+    FsDirIter it;
+    FsDirent *d;
+    fs_dir_open(&it, dir);
+    while ((d = fs_dir_next(&it)) != NULL) {
+        if (d->hash == hash && strcmp(d->name, name) == 0) {
+            if (slot != NULL) *slot = it.offset - sizeof(FsDirent);
+            return d->inode;
+        }
+    }
+    return 0;
+}
+
+// Points the entry at slot to ino; 0 frees the slot
+void fs_dir_set(unsigned int dir, unsigned long long slot, unsigned int ino) {
+    fs_io(fs_inode(dir), slot, (char *)&ino, sizeof(ino), 1);
+    fs_inode(dir)->mtime = time(NULL);
+}
+
+// Adds an entry, reusing the first free slot before growing the directory
+int fs_dir_add(unsigned int dir, const char *name, unsigned int ino) {
+    FsInode *node = fs_inode(dir);
+    FsDirent entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.inode = ino;
+    entry.hash = fs_name_hash(name);
+    strcpy(entry.name, name);
+    
+    FsDirent block[FS_BLOCK_SIZE / sizeof(FsDirent)];
+    for (unsigned long long offset = 0; offset < node->size; offset += FS_BLOCK_SIZE) {
+        unsigned long long left = node->size - offset;
+        unsigned int count = (left < FS_BLOCK_SIZE ? left : FS_BLOCK_SIZE) / sizeof(FsDirent);
+        fs_io(node, offset, (char *)block, count * sizeof(FsDirent), 0);
+        for (unsigned int i = 0; i < count; i++) {
+            if (block[i].inode == 0) {
+                fs_io(node, offset + i * sizeof(FsDirent), (char *)&entry, sizeof(entry), 1);
+                node->mtime = time(NULL);
+                return 0;
+            }
+        }
+    }
+    return fs_write(dir, node->size, &entry, sizeof(entry)) < 0 ? -1 : 0;
+}
+
+// Walks path from the root directory. Returns the inode it names, or 0
+// if only the last component is missing; either way *parent and leaf
+// receive the directory and name of the last component. Returns -1 if
+// the path cannot be followed that far.
+int fs_resolve(const char *path, unsigned int *parent, char *leaf) {
+    unsigned int ino = FS_ROOT;
+    *parent = FS_ROOT;
+    leaf[0] = '\0';
+    
+    while (1) {
+        while (*path == '/') path++;
+        if (*path == '\0') return ino;
+        size_t n = strcspn(path, "/");
+        if (n > FS_NAME_MAX) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        if (fs_inode(ino)->type != FS_DIR) {
+            errno = ENOTDIR;
+            return -1;
+        }
+        *parent = ino;
+        memcpy(leaf, path, n);
+        leaf[n] = '\0';
+        path += n;
+        
+        unsigned int next = fs_dir_find(ino, leaf, NULL);
+        if (next == 0) {
+            while (*path == '/') path++;
+            if (*path != '\0') {
+                errno = ENOENT;
+                return -1;
+            }
+            return 0;
+        }
+        ino = next;
+    }
+}
+
+int fs_lookup(const char *path) {
+    unsigned int parent;
+    char leaf[FS_NAME_MAX + 1];
+    int ino = fs_resolve(path, &parent, leaf);
+    if (ino == 0) errno = ENOENT;
+    return ino > 0 ? ino : -1;
+}
+
+int fs_create_at(unsigned int dir, const char *leaf, FsType type) {
+    int ino = fs_inode_alloc(type, dir);
+    if (ino < 0) return -1;
+    if (fs_dir_add(dir, leaf, ino) != 0) {
+        fs_inode_free(ino);
+        return -1;
+    }
+    return ino;
+}
+
+int fs_create(const char *path, FsType type) {
+    unsigned int parent;
+    char leaf[FS_NAME_MAX + 1];
+    int ino = fs_resolve(path, &parent, leaf);
+    if (ino != 0) {
+        if (ino > 0) errno = EEXIST;
+        return -1;
+    }
+    return fs_create_at(parent, leaf, type);
+}
+
+// Opens a regular file for writing from scratch, creating it if needed
+int fs_open_empty(const char *path) {
+    int ino = fs_lookup(path);
+    if (ino < 0) return errno == ENOENT ? fs_create(path, FS_FILE) : -1;
+    if (fs_inode(ino)->type == FS_DIR) {
+        errno = EISDIR;
+        return -1;
+    }
+    return fs_truncate(ino, 0) == 0 ? ino : -1;
+}
+
+int fs_dir_empty(unsigned int dir) {
+    FsDirIter it;
+    fs_dir_open(&it, dir);
+    return fs_dir_next(&it) == NULL;
+}
+
+int fs_unlink(const char *path) {
+    unsigned int parent;
+    char leaf[FS_NAME_MAX + 1];
+    int ino = fs_resolve(path, &parent, leaf);
+    if (ino <= 0 || ino == FS_ROOT) {
+        if (ino >= 0) errno = ino == 0 ? ENOENT : EBUSY;
+        return -1;
+    }
+    if (fs_inode(ino)->type == FS_DIR && !fs_dir_empty(ino)) {
+        errno = ENOTEMPTY;
+        return -1;
+    }
+    unsigned long long slot;
+    fs_dir_find(parent, leaf, &slot);
+    fs_dir_set(parent, slot, 0);
+    fs_inode_free(ino);
+    return 0;
+}
+
+// Whether dir is ino or lies below it
+int fs_within(unsigned int dir, unsigned int ino) {
+    for (; dir != FS_ROOT; dir = fs_inode(dir)->parent) {
+        if (dir == (unsigned int)ino) return 1;
+    }
+    return ino == FS_ROOT;
+}
+
+// Where a copy or move of source to dest lands: dest itself, or inside it
+// under the source's name when dest is a directory. Returns the inode
+// already there, 0 if none, -1 if dest cannot be reached.
+int fs_target(const char *dest, const char *source_leaf, unsigned int *parent, char *leaf) {
+    int ino = fs_resolve(dest, parent, leaf);
+    if (ino > 0 && fs_inode(ino)->type == FS_DIR) {
+        *parent = ino;
+        strcpy(leaf, source_leaf);
+        return fs_dir_find(ino, leaf, NULL);
+    }
+    return ino;
+}
+
+int fs_rename(const char *source, const char *dest) {
+    unsigned int src_dir, dst_dir;
+    char src_leaf[FS_NAME_MAX + 1], dst_leaf[FS_NAME_MAX + 1];
+    int ino = fs_resolve(source, &src_dir, src_leaf);
+    if (ino <= 0 || ino == FS_ROOT) {
+        if (ino >= 0) errno = ino == 0 ? ENOENT : EBUSY;
+        return -1;
+    }
+    int target = fs_target(dest, src_leaf, &dst_dir, dst_leaf);
+    if (target < 0) return -1;
+    if (target == ino) return 0;
+    if (fs_within(dst_dir, ino)) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    if (target > 0) {
+        // Replace a file in place, like rename(2)
+        if (fs_inode(target)->type == FS_DIR || fs_inode(ino)->type == FS_DIR) {
+            errno = fs_inode(target)->type == FS_DIR ? EISDIR : ENOTDIR;
+            return -1;
+        }
+        unsigned long long slot;
+        fs_dir_find(dst_dir, dst_leaf, &slot);
+        fs_dir_set(dst_dir, slot, ino);
+        fs_inode_free(target);
+    } else if (fs_dir_add(dst_dir, dst_leaf, ino) != 0) {
+        return -1;
+    }
+    unsigned long long slot;
+    fs_dir_find(src_dir, src_leaf, &slot);
+    fs_dir_set(src_dir, slot, 0);
+    fs_inode(ino)->parent = dst_dir;
+    return 0;
+}
+
+// Replaces the contents of file out with those of file ino. The buffer
+// lives on the heap, as fs_copy_node() recurses once per directory level.
+int fs_copy_data(unsigned int ino, unsigned int out) {
+    if (fs_truncate(out, 0) != 0) return -1;
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (buffer == NULL) return -1;
+    
+    long long got;
+    int status = 0;
+    for (unsigned long long offset = 0; (got = fs_read(ino, offset, buffer, COPY_BUFFER_SIZE)) > 0; offset += got) {
+        if (fs_write(out, offset, buffer, got) < 0) {
+            status = -1;
+            break;
+        }
+    }
+    if (got < 0) status = -1;
+    int saved = errno;
+    free(buffer);
+    errno = saved;
+    return status;
+}
+
+// Copies inode ino to the entry leaf of dir, reusing what is there
+int fs_copy_node(unsigned int ino, unsigned int dir, const char *leaf) {
+    int out = fs_dir_find(dir, leaf, NULL);
+    if (out == 0) out = fs_create_at(dir, leaf, fs_inode(ino)->type);
+    if (out < 0) return -1;
+    if (fs_inode(out)->type != fs_inode(ino)->type) {
+        errno = fs_inode(out)->type == FS_DIR ? EISDIR : ENOTDIR;
+        return -1;
+    }
+    
+    if (fs_inode(ino)->type == FS_DIR) {
+        FsDirIter it;
+        FsDirent *d;
+        fs_dir_open(&it, ino);
+        while ((d = fs_dir_next(&it)) != NULL) {
+            if (fs_copy_node(d->inode, out, d->name) != 0) return -1;
+        }
+        return 0;
+    }
+    return fs_copy_data(ino, out);
+}
+
+// Copies a file or a directory tree within the image
+int fs_copy(const char *source, const char *dest) {
+    unsigned int src_dir, dst_dir;
+    char src_leaf[FS_NAME_MAX + 1], dst_leaf[FS_NAME_MAX + 1];
+    int ino = fs_resolve(source, &src_dir, src_leaf);
+    if (ino <= 0) {
+        if (ino == 0) errno = ENOENT;
+        return -1;
+    }
+    int target = fs_target(dest, src_leaf, &dst_dir, dst_leaf);
+    if (target < 0) return -1;
+    if (target == ino || (fs_inode(ino)->type == FS_DIR && fs_within(dst_dir, ino))) {
+        errno = EINVAL;
+        return -1;
+    }
+    return fs_copy_node(ino, dst_dir, dst_leaf);
+}
+
+// Frees ino and, for a directory, everything below it. Returns the number
+// of inodes freed.
+long fs_remove_node(unsigned int ino) {
+    long count = 1;
+    if (fs_inode(ino)->type == FS_DIR) {
+        FsDirIter it;
+        FsDirent *d;
+        fs_dir_open(&it, ino);
+        while ((d = fs_dir_next(&it)) != NULL) count += fs_remove_node(d->inode);
+    }
+    fs_inode_free(ino);
+    return count;
+}
+
+long fs_remove_tree(const char *path) {
+    unsigned int parent;
+    char leaf[FS_NAME_MAX + 1];
+    int ino = fs_resolve(path, &parent, leaf);
+    if (ino <= 0 || ino == FS_ROOT) {
+        if (ino >= 0) errno = ino == 0 ? ENOENT : EBUSY;
+        return -1;
+    }
+    unsigned long long slot;
+    fs_dir_find(parent, leaf, &slot);
+    fs_dir_set(parent, slot, 0);
+    return fs_remove_node(ino);
+}
+
+// Copies a regular host file into the image
+int fs_import(const char *host, const char *path) {
+    int in = open(host, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return -1;
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        return -1;
+    }
+    const char *base = strrchr(host, '/') != NULL ? strrchr(host, '/') + 1 : host;
+    if (S_ISDIR(st.st_mode) || strlen(base) > FS_NAME_MAX) {
+        errno = S_ISDIR(st.st_mode) ? EISDIR : ENAMETOOLONG;
+        close(in);
+        return -1;
+    }
+    
+    unsigned int dir;
+    char leaf[FS_NAME_MAX + 1];
+    int out = fs_target(path, base, &dir, leaf);
+    if (out == 0) out = fs_create_at(dir, leaf, FS_FILE);
+    if (out > 0 && fs_inode(out)->type == FS_DIR) {
+        errno = EISDIR;
+        out = -1;
+    }
+    if (out < 0 || fs_truncate(out, 0) != 0) {
+        close(in);
+        return -1;
+    }
+    
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (buffer == NULL) {
+        close(in);
+        return -1;
+    }
+    long long offset = 0;
+    ssize_t got;
+    while ((got = read(in, buffer, COPY_BUFFER_SIZE)) > 0) {
+        if (fs_write(out, offset, buffer, got) < 0) break;
+        offset += got;
+    }
+    int saved = errno;
+    free(buffer);
+    close(in);
+    errno = saved;
+    return got == 0 ? 0 : -1;
+}
+
+// Copies a regular image file out to the host; a host directory receives
+// it under the same name
+int fs_export(const char *path, const char *host) {
+    int ino = fs_lookup(path);
+    if (ino < 0) return -1;
+    if (fs_inode(ino)->type == FS_DIR) {
+        errno = EISDIR;
+        return -1;
+    }
+    
+    char target[MAX_PATH_LENGTH * 2];
+    struct stat st;
+    const char *base = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+    if (stat(host, &st) == 0 && S_ISDIR(st.st_mode)) {
+        snprintf(target, sizeof(target), "%s/%s", host, base);
+    } else {
+        snprintf(target, sizeof(target), "%s", host);
+    }
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (buffer == NULL) return -1;
+    int out = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        free(buffer);
+        return -1;
+    }
+    
+    long long got;
+    int status = 0;
+    for (unsigned long long offset = 0; status == 0 && (got = fs_read(ino, offset, buffer, COPY_BUFFER_SIZE)) > 0;
+         offset += got) {
+        for (long long done = 0; done < got; ) {
+            ssize_t n = write(out, buffer + done, got - done);
+            if (n < 0) {
+                status = -1;
+                break;
+            }
+            done += n;
+        }
+    }
+    int saved = errno;
+    free(buffer);
+    if (close(out) != 0) status = -1;
+    if (status != 0) errno = saved;
+    return status;
+}
+
+// Lays out an empty filesystem in a freshly created, zero-filled image
+int fs_format(unsigned long long blocks) {
+    unsigned long long inodes = blocks * FS_BLOCK_SIZE / FS_BYTES_PER_INODE;
+    if (inodes < 16) inodes = 16;
+    if (inodes > FS_MAX_INODES) inodes = FS_MAX_INODES;
+    unsigned long long inode_start = 1 + (blocks + FS_BLOCK_SIZE * 8 - 1) / (FS_BLOCK_SIZE * 8);
+    unsigned long long data_start = inode_start + (inodes * sizeof(FsInode) + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    if (data_start + 1 >= blocks) {
+        errno = ENOSPC;
+        return -1;
+    }
+    
+    FsSuper *sb = simfs.sb;
+    sb->magic = FS_MAGIC;
+    sb->block_size = FS_BLOCK_SIZE;
+    sb->clean = 1;
+    sb->block_count = blocks;
+    sb->free_blocks = blocks;
+    sb->bitmap_start = 1;
+    sb->inode_start = inode_start;
+    sb->data_start = data_start;
+    sb->alloc_hint = data_start;
+    sb->inode_count = inodes;
+    sb->free_inodes = inodes - 2;  // Inode 0 is never used, 1 is the root
+    sb->inode_hint = FS_ROOT + 1;
+    sb->formatted = time(NULL);
+    
+    simfs.bitmap = (unsigned long long *)fs_block(sb->bitmap_start);
+    simfs.inodes = (FsInode *)fs_block(sb->inode_start);
+    fs_mark(0, data_start, 1);
+    FsInode *root = fs_inode(FS_ROOT);
+    root->type = FS_DIR;
+    root->links = 1;
+    root->parent = FS_ROOT;
+    root->ctime = root->mtime = sb->formatted;
+    return 0;
+}
+
+// Rebuilds the free counts after an unclean shutdown
+void fs_recount() {
+    FsSuper *sb = simfs.sb;
+    unsigned long long used = 0;
+    for (unsigned long long w = 0; w < (sb->block_count + 63) / 64; w++) {
+        used += __builtin_popcountll(simfs.bitmap[w]);
+    }
+    sb->free_blocks = sb->block_count - used;
+    
+    unsigned int free_inodes = 0;
+    for (unsigned int ino = FS_ROOT + 1; ino < sb->inode_count; ino++) {
+        if (fs_inode(ino)->type == FS_FREE) free_inodes++;
+    }
+    sb->free_inodes = free_inodes;
+}
+
+// Every region must lie inside the image and in on-disk order: the
+// superblock, the bitmap, the inode table, then the data blocks
+int fs_super_valid(const FsSuper *sb, off_t size) {
+    unsigned long long blocks = size / FS_BLOCK_SIZE;
+    if (sb->magic != FS_MAGIC || sb->block_size != FS_BLOCK_SIZE) return 0;
+    if (sb->block_count > blocks || sb->data_start >= sb->block_count) return 0;
+    if (sb->inode_count <= FS_ROOT || sb->inode_count > FS_MAX_INODES) return 0;
+    
+    unsigned long long bitmap_blocks = (sb->block_count + FS_BLOCK_SIZE * 8 - 1) / (FS_BLOCK_SIZE * 8);
+    unsigned long long inode_blocks = ((unsigned long long)sb->inode_count * sizeof(FsInode) +
+                                       FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    return sb->bitmap_start >= 1 && sb->inode_start < sb->data_start &&
+           sb->bitmap_start < sb->inode_start &&
+           sb->inode_start - sb->bitmap_start >= bitmap_blocks &&
+           sb->data_start - sb->inode_start >= inode_blocks;
+}
+
+// Undoes a fresh image that could not be formatted: a file we created is
+// removed, an empty one that was already there is left empty
+void fs_discard(const char *path, int fd, int created) {
+    if (created) {
+        unlink(path);
+    } else if (ftruncate(fd, 0) != 0) {
+        print_warning("Could not truncate the unformatted disk image");
+    }
+    close(fd);
+}
+
+// Maps the image at path, first formatting a new one of mb MB if the file
+// is missing or empty. Returns 0, 1 if mounted but the HDD pool cannot
+// cover the blocks in use, or -1.
+int fs_mount(const char *path, long long mb) {
+    long long start = monotonic_ns();
+    int created = access(path, F_OK) != 0;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    int fresh = st.st_size == 0;
+    if (fresh) {
+        st.st_size = mb << 20;  // Sparse until written
+        if (mb <= 0 || ftruncate(fd, st.st_size) != 0) {
+            if (mb <= 0) errno = EINVAL;
+            int saved = errno;
+            fs_discard(path, fd, created);
+            errno = saved;
+            return -1;
+        }
+    }
+    void *image = st.st_size >= 2 * FS_BLOCK_SIZE ?
+                  mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (image == MAP_FAILED) {
+        if (st.st_size < 2 * FS_BLOCK_SIZE) errno = EINVAL;
+        int saved = errno;
+        if (fresh) fs_discard(path, fd, created); else close(fd);
+        errno = saved;
+        return -1;
+    }
+    
+    simfs.image = image;
+    simfs.size = st.st_size;
+    simfs.sb = (FsSuper *)image;
+    FsSuper *sb = simfs.sb;
+    int valid = fresh ? fs_format(st.st_size / FS_BLOCK_SIZE) == 0 : fs_super_valid(sb, st.st_size);
+    if (!valid) {
+        if (!fresh) errno = EINVAL;
+        int saved = errno;
+        munmap(image, st.st_size);
+        if (fresh) fs_discard(path, fd, created); else close(fd);
+        simfs.image = NULL;
+        errno = saved;
+        return -1;
+    }
+    
+    simfs.fd = fd;
+    simfs.bitmap = (unsigned long long *)fs_block(sb->bitmap_start);
+    simfs.inodes = (FsInode *)fs_block(sb->inode_start);
+    simfs.recovered = !sb->clean;
+    if (simfs.recovered) fs_recount();
+    sb->clean = 0;
+    sb->mounts++;
+    snprintf(simfs.path, sizeof(simfs.path), "%s", path);
+    simfs.charged_mb = 0;
+    simfs.bytes_read = simfs.bytes_written = 0;
+    simfs.mount_ns = monotonic_ns() - start;
+    return fs_charge() ? 0 : 1;
+}
+
+void fs_unmount() {
+    if (simfs.fd < 0) return;
+    bcache_stop();
+    simfs.sb->clean = 1;
+    msync(simfs.image, simfs.size, MS_SYNC);
+    fsync(simfs.fd);
+    munmap(simfs.image, simfs.size);
+    close(simfs.fd);
+    res_adjust(0, simfs.charged_mb, 0);
+    simfs.charged_mb = 0;
+    simfs.image = NULL;
+    simfs.fd = -1;
+}
+
+// Paths name files on the disk image; a "host:" prefix reaches the real
+// filesystem, as does every path when no image is mounted. Returns the
+// host path, or NULL for an image path.
+const char *host_path(const char *path) {
+    if (strncmp(path, "host:", 5) == 0) return path + 5;
+    return simfs.fd < 0 ? path : NULL;
+}
+
+void fs_path_hint() {
+    if (simfs.fd >= 0) printf("(Paths are on the disk image; prefix host: for the real filesystem)\n");
+}
+
+void show_fs_stats() {
+    if (simfs.fd < 0) {
+        printf("\nDisk image: not mounted, file apps use the host filesystem\n");
+        return;
+    }
+    FsSuper *sb = simfs.sb;
+    printf("\nDisk image: %s, %llu MB, mounted in %.0f us%s\n", simfs.path,
+           sb->block_count * FS_BLOCK_SIZE >> 20, simfs.mount_ns / 1e3,
+           simfs.recovered ? " (free counts rebuilt after an unclean shutdown)" : "");
+    printf("Blocks: %llu/%llu used (%d MB of HDD) | Inodes: %u/%u used | Read %lld KB, wrote %lld KB\n",
+           sb->block_count - sb->free_blocks, sb->block_count, simfs.charged_mb,
+           sb->inode_count - 1 - sb->free_inodes, sb->inode_count - 1,
+           simfs.bytes_read >> 10, simfs.bytes_written >> 10);
+}
+
+void fs_print_info(const char *path) {
+    int ino = fs_lookup(path);
+    if (ino < 0) {
+        printf("Error getting file info: %s\n", strerror(errno));
+        return;
+    }
+    FsInode *node = fs_inode(ino);
+    time_t created = node->ctime, modified = node->mtime;
+    
+    printf("\nFile Information for: %s (inode %d on %s)\n", path, ino, simfs.path);
+    if (node->type == FS_DIR) {
+        long entries = 0;
+        FsDirIter it;
+        fs_dir_open(&it, ino);
+        while (fs_dir_next(&it) != NULL) entries++;
+        printf("Directory with %ld entries\n", entries);
+    } else {
+        printf("Size: %llu bytes\n", node->size);
+    }
+    printf("Blocks: %u in %u extents", node->blocks, node->extent_count);
+    for (unsigned int i = 0; i < node->extent_count && i < 4; i++) {
+        FsExtent *e = fs_extent(node, i);
+        printf("%s %u-%u", i == 0 ? ":" : ",", e->start, e->start + e->length - 1);
+    }
+    printf("%s\n", node->extent_count > 4 ? ", ..." : "");
+    printf("Created: %s", ctime(&created));
+    printf("Last modified: %s", ctime(&modified));
+}
+
+void fs_bench_row(FILE *csv, const char *op, long count, double image_s, double host_s) {
+    printf("%-18s %14.0f %14.0f\n", op, image_s > 0 ? count / image_s : 0.0, host_s > 0 ? count / host_s : 0.0);
+    if (csv != NULL) {
+        fprintf(csv, "%s,image,%ld,%.6f,%.1f\n", op, count, image_s, image_s > 0 ? count / image_s : 0.0);
+        fprintf(csv, "%s,host,%ld,%.6f,%.1f\n", op, count, host_s, host_s > 0 ? count / host_s : 0.0);
+    }
+}
+
+int run_fs_benchmark(long mb, const char *dir, const char *csv_path) {
+    FILE *csv = bench_csv_open(csv_path, "operation,target,count,seconds,rate");
+    if (csv_path != NULL && csv == NULL) return 1;
+    res_init(bcache.mb, (1 << RES_HDD_BITS) - 1, 0);
+    phys_init(bcache.mb, alloc_strategy);
+    
+    char image[MAX_PATH_LENGTH + 32], host[MAX_PATH_LENGTH + 32], path[MAX_PATH_LENGTH + 64];
+    snprintf(image, sizeof(image), "%s/fs-bench.img", dir);
+    snprintf(host, sizeof(host), "%s/fs-bench.host", dir);
+    
+    // Mounting reads the superblock only, whatever the image size
+    printf("=== Filesystem Benchmark (%ld MB files, images in %s) ===\n", mb, dir);
+    printf("%-12s %12s %12s\n", "Image", "Format ms", "Mount us");
+    for (long long size = 64; size <= 256 << 10; size *= 16) {
+        unlink(image);
+        long long start = monotonic_ns();
+        if (fs_mount(image, size) < 0) {
+            printf("%9lld MB %25s\n", size, strerror(errno));
+            continue;
+        }
+        double format_ms = (monotonic_ns() - start) / 1e6;
+        fs_unmount();
+        fs_mount(image, size);
+        printf("%9lld MB %12.2f %12.1f\n", size, format_ms, simfs.mount_ns / 1e3);
+        if (csv != NULL) fprintf(csv, "mount,%lld MB,1,%.9f,%.1f\n", size, simfs.mount_ns / 1e9, 1e9 / simfs.mount_ns);
+        fs_unmount();
+    }
+    
+    unlink(image);
+    if (fs_mount(image, mb * 2 + 256) < 0 || mkdir(host, 0755) != 0) {
+        fprintf(stderr, "Cannot create %s: %s\n", simfs.fd < 0 ? image : host, strerror(errno));
+        return 1;
+    }
+    bcache_start(bcache.mb, bcache.policy);  // As the file apps see it
+    char *buffer = malloc(1 << 16);
+    memset(buffer, 'x', 1 << 16);
+    long chunks = mb * 16;
+    
+    // Sequential 64 KB writes, made durable, then reads
+    printf("\n%-18s %14s %14s\n", "Operation/s", "Disk image", "Host FS");
+    int ino = fs_create("seq", FS_FILE);
+    long long start = monotonic_ns();
+    for (long i = 0; i < chunks; i++) fs_write(ino, (long long)i << 16, buffer, 1 << 16);
+    bcache_sync();
+    fsync(simfs.fd);
+    double image_s = (monotonic_ns() - start) / 1e9;
+    
+    snprintf(path, sizeof(path), "%s/seq", host);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    start = monotonic_ns();
+    for (long i = 0; i < chunks; i++) {
+        if (pwrite(fd, buffer, 1 << 16, (long long)i << 16) != 1 << 16) break;
+    }
+    fsync(fd);
+    fs_bench_row(csv, "Seq write MB", mb, image_s, (monotonic_ns() - start) / 1e9);
+    
+    start = monotonic_ns();
+    for (long i = 0; i < chunks; i++) fs_read(ino, (long long)i << 16, buffer, 1 << 16);
+    image_s = (monotonic_ns() - start) / 1e9;
+    start = monotonic_ns();
+    for (long i = 0; i < chunks; i++) {
+        if (pread(fd, buffer, 1 << 16, (long long)i << 16) != 1 << 16) break;
+    }
+    fs_bench_row(csv, "Seq read MB", mb, image_s, (monotonic_ns() - start) / 1e9);
+    
+    long reads = 100000;
+    unsigned long long state = 12345;
+    start = monotonic_ns();
+    for (long i = 0; i < reads; i++) {
+        fs_read(ino, (unsigned long long)(rng_next(&state) % (chunks * 16)) << 12, buffer, 4096);
+    }
+    image_s = (monotonic_ns() - start) / 1e9;
+    state = 12345;
+    start = monotonic_ns();
+    for (long i = 0; i < reads; i++) {
+        if (pread(fd, buffer, 4096, (long long)(rng_next(&state) % (chunks * 16)) << 12) != 4096) break;
+    }
+    fs_bench_row(csv, "Random 4K reads", reads, image_s, (monotonic_ns() - start) / 1e9);
+    close(fd);
+    unlink(path);
+    printf("(the %ld MB file sits in %u extent%s)\n", mb, fs_inode(ino)->extent_count,
+           fs_inode(ino)->extent_count == 1 ? "" : "s");
+    fs_unlink("seq");
+    
+    // Metadata: 1 KB files, 1000 to a directory
+    long files = 20000;
+    double image_meta[3], host_meta[3];
+    for (int target = 0; target < 2; target++) {
+        double *seconds = target == 0 ? image_meta : host_meta;
+        const char *root = target == 0 ? "" : host;
+        
+        start = monotonic_ns();
+        for (long i = 0; i < files; i++) {
+            if (i % 1000 == 0) {
+                snprintf(path, sizeof(path), "%s/d%03ld", root, i / 1000);
+                if (target == 0) fs_create(path, FS_DIR); else mkdir(path, 0755);
+            }
+            snprintf(path, sizeof(path), "%s/d%03ld/f%06ld", root, i / 1000, i);
+            if (target == 0) {
+                int file = fs_create(path, FS_FILE);
+                if (file > 0) fs_write(file, 0, buffer, 1024);
+            } else if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+                if (write(fd, buffer, 1024) != 1024) fprintf(stderr, "Short write to %s\n", path);
+                close(fd);
+            }
+        }
+        seconds[0] = (monotonic_ns() - start) / 1e9;
+        
+        start = monotonic_ns();
+        struct stat st;
+        for (long i = 0; i < files; i++) {
+            snprintf(path, sizeof(path), "%s/d%03ld/f%06ld", root, i / 1000, i);
+            if (target == 0) fs_lookup(path); else stat(path, &st);
+        }
+        seconds[1] = (monotonic_ns() - start) / 1e9;
+        
+        start = monotonic_ns();
+        for (long i = 0; i < files; i++) {
+            snprintf(path, sizeof(path), "%s/d%03ld/f%06ld", root, i / 1000, i);
+            if (target == 0) fs_unlink(path); else unlink(path);
+            if (i % 1000 == 999) {
+                snprintf(path, sizeof(path), "%s/d%03ld", root, i / 1000);
+                if (target == 0) fs_unlink(path); else rmdir(path);
+            }
+        }
+        seconds[2] = (monotonic_ns() - start) / 1e9;
+    }
+    fs_bench_row(csv, "Creates", files, image_meta[0], host_meta[0]);
+    fs_bench_row(csv, "Lookups", files, image_meta[1], host_meta[1]);
+    fs_bench_row(csv, "Unlinks", files, image_meta[2], host_meta[2]);
+    
+    printf("%llu blocks still in use after deleting everything (metadata only)\n",
+           simfs.sb->block_count - simfs.sb->free_blocks);
+    free(buffer);
+    fs_unmount();
+    unlink(image);
+    rmdir(host);
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// ---- Buffer cache ----
+//
+// File and directory blocks go through a cache of 4 KB buffers found by
+// block number in a hash table; superblock, bitmap and inodes stay in the
+// mapping. The disk below it is the image file itself, reached with
+// pread()/pwrite(). Replacement is plain LRU or ARC, which splits the
+// buffers between blocks seen once (T1) and more often (T2) and moves the
+// split towards whichever side's ghost list (B1/B2) gets hit, so one big
+// sequential scan cannot flush the blocks that are in real use.
+//
+// Writes only dirty a buffer. A flusher thread writes back blocks that
+// have been dirty for flush_ms, sorted so that neighbours go out as one
+// write, with the lock dropped during the I/O; a buffer being written is
+// never evicted or invalidated until its write completed. A dirty victim
+// of eviction is written synchronously. Reads of consecutive blocks open
+// a read-ahead window that doubles up to CACHE_READAHEAD_MAX and is
+// fetched with one read per run of uncached blocks. The buffers are
+// charged to the simulated RAM like a task's memory.
+
+const char *cache_policy_name(CachePolicy policy) {
+    switch (policy) {
+        case CACHE_LRU: return "LRU";
+        case CACHE_ARC: return "ARC";
+    }
+    return "Unknown";
+}
+
+int parse_cache_policy(const char *name) {
+    if (strcmp(name, "lru") == 0) return CACHE_LRU;
+    if (strcmp(name, "arc") == 0) return CACHE_ARC;
+    return -1;
+}
+
+int disk_read(unsigned long long block, void *buf, unsigned long long count) {
+    bcache.disk_reads++;
+    bcache.disk_blocks_read += count;
+    for (size_t done = 0; done < count * FS_BLOCK_SIZE; ) {
+        ssize_t n = pread(simfs.fd, (char *)buf + done, count * FS_BLOCK_SIZE - done,
+                          block * FS_BLOCK_SIZE + done);
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+int disk_write(unsigned long long block, const void *buf, unsigned long long count) {
+    bcache.disk_writes++;
+    bcache.disk_blocks_written += count;
+    for (size_t done = 0; done < count * FS_BLOCK_SIZE; ) {
+        ssize_t n = pwrite(simfs.fd, (const char *)buf + done, count * FS_BLOCK_SIZE - done,
+                           block * FS_BLOCK_SIZE + done);
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+CacheBuf **cache_bucket(unsigned long long block) {
+    return &bcache.buckets[(block * 0x9E3779B97F4A7C15ULL >> 20) & bcache.hash_mask];
+}
+
+CacheBuf *cache_find(unsigned long long block) {
+    CacheBuf *buf = *cache_bucket(block);
+    while (buf != NULL && buf->block != block) buf = buf->hash_next;
+    return buf;
+}
+
+void cache_unlink(CacheBuf *buf) {
+    CacheQueue *q = &bcache.lists[buf->list];
+    if (buf->prev != NULL) buf->prev->next = buf->next; else q->head = buf->next;
+    if (buf->next != NULL) buf->next->prev = buf->prev; else q->tail = buf->prev;
+    q->count--;
+}
+
+// Moves buf (already on a list unless fresh) to the MRU end of list
+void cache_push(CacheBuf *buf, CacheList list, int fresh) {
+    if (!fresh) cache_unlink(buf);
+    CacheQueue *q = &bcache.lists[list];
+    buf->list = list;
+    buf->prev = NULL;
+    buf->next = q->head;
+    if (q->head != NULL) q->head->prev = buf; else q->tail = buf;
+    q->head = buf;
+    q->count++;
+}
+
+// Forgets a header entirely: off its list and out of the hash
+void cache_drop(CacheBuf *buf) {
+    cache_unlink(buf);
+    CacheBuf **link = cache_bucket(buf->block);
+    while (*link != buf) link = &(*link)->hash_next;
+    *link = buf->hash_next;
+    if (buf->data != NULL) bcache.slots[bcache.free_slots++] = buf->data;
+    buf->data = NULL;
+    buf->hash_next = bcache.spare;
+    bcache.spare = buf;
+}
+
+// LRU-most buffer of list that is not being written back
+CacheBuf *cache_victim(CacheList list) {
+    CacheBuf *buf = bcache.lists[list].tail;
+    while (buf != NULL && buf->writing) buf = buf->prev;
+    return buf;
+}
+
+// Writes back a dirty victim in one go with the dirty blocks after it,
+// which a sequential writer is about to have evicted too. A block that
+// cannot be written stays dirty, except the victim, whose data goes with
+// its buffer; either way it is counted in write_errors.
+void cache_write_cluster(CacheBuf *buf) {
+    struct iovec iov[CACHE_READAHEAD_MAX];
+    CacheBuf *cluster[CACHE_READAHEAD_MAX];
+    int n = 0;
+    CacheBuf *next = buf;
+    while (n < CACHE_READAHEAD_MAX && next != NULL && next->data != NULL && next->dirty && !next->writing) {
+        iov[n].iov_base = next->data;
+        iov[n].iov_len = FS_BLOCK_SIZE;
+        cluster[n++] = next;
+        next = cache_find(buf->block + n);
+    }
+    bcache.evict_writes++;
+    bcache.disk_writes++;
+    bcache.disk_blocks_written += n;
+    ssize_t done = pwritev(simfs.fd, iov, n, buf->block * FS_BLOCK_SIZE);
+    int written = done > 0 ? done / FS_BLOCK_SIZE : 0;
+    for (int i = 0; i < n; i++) {
+        if (i >= written && disk_write(buf->block + i, iov[i].iov_base, 1) != 0) {
+            bcache.write_errors++;
+            if (i > 0) continue;
+        }
+        cluster[i]->dirty = 0;
+        bcache.dirty--;
+    }
+}
+
+// Takes a resident buffer's data away, leaving a ghost on `ghost` or,
+// with -1, nothing
+void cache_evict(CacheBuf *buf, int ghost) {
+    if (buf->dirty) cache_write_cluster(buf);
+    if (buf->prefetched) buf->prefetched = 0;
+    if (ghost < 0) {
+        cache_drop(buf);
+        return;
+    }
+    bcache.slots[bcache.free_slots++] = buf->data;
+    buf->data = NULL;
+    cache_push(buf, ghost, 0);
+}
+
+// ARC's REPLACE: frees one buffer from T1 or T2 depending on the target
+void cache_replace(int in_b2) {
+    long t1 = bcache.lists[CACHE_T1].count;
+    int from_t1 = t1 > 0 && (t1 > bcache.target || (in_b2 && t1 == bcache.target));
+    CacheBuf *victim = cache_victim(from_t1 ? CACHE_T1 : CACHE_T2);
+    if (victim == NULL) victim = cache_victim(from_t1 ? CACHE_T2 : CACHE_T1);
+    while (victim == NULL) {
+        // Everything is being written back; wait for the flusher
+        pthread_cond_wait(&bcache.idle, &bcache.lock);
+        victim = cache_victim(CACHE_T1);
+        if (victim == NULL) victim = cache_victim(CACHE_T2);
+    }
+    cache_evict(victim, victim->list == CACHE_T1 ? CACHE_B1 : CACHE_B2);
+}
+
+// Makes block resident, evicting as the policy says; ghost is its ghost
+// header if it has one. The data is not filled in.
+CacheBuf *cache_admit(unsigned long long block, CacheBuf *ghost) {
+    long resident = bcache.lists[CACHE_T1].count + bcache.lists[CACHE_T2].count;
+    
+    if (bcache.policy == CACHE_LRU) {
+        if (resident == bcache.capacity) {
+            CacheBuf *victim = cache_victim(CACHE_T1);
+            while (victim == NULL) {
+                pthread_cond_wait(&bcache.idle, &bcache.lock);
+                victim = cache_victim(CACHE_T1);
+            }
+            cache_evict(victim, -1);
+        }
+    } else if (ghost != NULL) {
+        // A ghost hit: the list it fell out of deserves more room
+        long b1 = bcache.lists[CACHE_B1].count, b2 = bcache.lists[CACHE_B2].count;
+        if (ghost->list == CACHE_B1) {
+            bcache.target += b2 > b1 ? b2 / b1 : 1;
+            if (bcache.target > bcache.capacity) bcache.target = bcache.capacity;
+        } else {
+            bcache.target -= b1 > b2 ? b1 / b2 : 1;
+            if (bcache.target < 0) bcache.target = 0;
+        }
+        if (resident == bcache.capacity) cache_replace(ghost->list == CACHE_B2);
+    } else {
+        long t1 = bcache.lists[CACHE_T1].count, b1 = bcache.lists[CACHE_B1].count;
+        long total = resident + b1 + bcache.lists[CACHE_B2].count;
+        if (t1 + b1 >= bcache.capacity) {
+            if (b1 > 0) {
+                cache_drop(bcache.lists[CACHE_B1].tail);
+                if (resident == bcache.capacity) cache_replace(0);
+            } else {
+                CacheBuf *victim = cache_victim(CACHE_T1);
+                if (victim != NULL) cache_evict(victim, -1); else cache_replace(0);
+            }
+        } else if (total >= bcache.capacity) {
+            if (total >= 2 * bcache.capacity) cache_drop(bcache.lists[CACHE_B2].tail);
+            if (resident == bcache.capacity) cache_replace(0);
+        }
+    }
+    
+    CacheBuf *buf = ghost;
+    if (buf == NULL) {
+        buf = bcache.spare;
+        bcache.spare = buf->hash_next;
+        memset(buf, 0, sizeof(*buf));
+        buf->block = block;
+        CacheBuf **bucket = cache_bucket(block);
+        buf->hash_next = *bucket;
+        *bucket = buf;
+    }
+    buf->data = bcache.slots[--bcache.free_slots];
+    cache_push(buf, ghost != NULL && bcache.policy == CACHE_ARC ? CACHE_T2 : CACHE_T1, ghost == NULL);
+    return buf;
+}
+
+// Returns block's buffer, reading it from the disk on a miss if fill
+CacheBuf *cache_get(unsigned long long block, int fill) {
+    CacheBuf *buf = cache_find(block);
+    if (buf != NULL && buf->data != NULL) {
+        bcache.hits++;
+        // The first use of a block read ahead is its first reference
+        CacheList list = bcache.policy == CACHE_ARC && !buf->prefetched ? CACHE_T2 : CACHE_T1;
+        if (buf->prefetched) {
+            buf->prefetched = 0;
+            bcache.readahead_used++;
+        }
+        cache_push(buf, list, 0);
+        return buf;
+    }
+    bcache.misses++;
+    if (buf != NULL) bcache.ghost_hits++;
+    buf = cache_admit(block, buf);
+    if (fill) disk_read(block, buf->data, 1);
+    return buf;
+}
+
+// Reads [from, to) into the cache, skipping resident blocks, with one disk
+// read per run of missing ones
+void cache_prefetch(unsigned long long from, unsigned long long to) {
+    while (from < to) {
+        CacheBuf *buf = cache_find(from);
+        if (buf != NULL && buf->data != NULL) {
+            from++;
+            continue;
+        }
+        unsigned long long end = from + 1;
+        while (end < to && ((buf = cache_find(end)) == NULL || buf->data == NULL)) end++;
+        if (disk_read(from, bcache.staging, end - from) != 0) return;
+        for (unsigned long long b = from; b < end; b++) {
+            CacheBuf *ghost = cache_find(b);
+            if (ghost != NULL && ghost->data != NULL) continue;
+            buf = cache_admit(b, ghost);
+            memcpy(buf->data, bcache.staging + (b - from) * FS_BLOCK_SIZE, FS_BLOCK_SIZE);
+            buf->prefetched = 1;
+            bcache.readahead++;
+        }
+        from = end;
+    }
+}
+
+// Called after every read; end bounds the window to the file's extent
+void cache_readahead(unsigned long long block, unsigned long long end) {
+    if (block != bcache.ra_next) {
+        bcache.ra_window = CACHE_READAHEAD_MIN;
+        bcache.ra_end = 0;
+        bcache.ra_next = block + 1;
+        return;
+    }
+    bcache.ra_next = block + 1;
+    // Refill once less than half a window is still ahead of the reader
+    if (bcache.ra_end > block + bcache.ra_window / 2) return;
+    unsigned long long from = bcache.ra_end > block + 1 ? bcache.ra_end : block + 1;
+    unsigned long long to = block + 1 + bcache.ra_window;
+    if (to > end) to = end;
+    if (bcache.ra_window < CACHE_READAHEAD_MAX) bcache.ra_window *= 2;
+    if (from >= to) return;
+    bcache.ra_end = to;
+    cache_prefetch(from, to);
+}
+
+void bcache_io(unsigned long long block, unsigned long long end, unsigned int in, char *buf, size_t len,
+               int write) {
+    static const char zeros[FS_BLOCK_SIZE];
+    if (bcache.capacity == 0) {
+        off_t offset = block * FS_BLOCK_SIZE + in;
+        ssize_t n = write ? pwrite(simfs.fd, buf != NULL ? buf : zeros, len, offset) :
+                    pread(simfs.fd, buf, len, offset);
+        if (write) {
+            bcache.disk_writes++;
+            bcache.disk_blocks_written++;
+        } else {
+            bcache.disk_reads++;
+            bcache.disk_blocks_read++;
+        }
+        if (n != (ssize_t)len) {
+            if (write) bcache.write_errors++; else memset(buf, 0, len);
+        }
+        return;
+    }
+    
+    pthread_mutex_lock(&bcache.lock);
+    CacheBuf *b = cache_get(block, !write || len < FS_BLOCK_SIZE);
+    if (!write) {
+        memcpy(buf, b->data + in, len);
+        cache_readahead(block, end);
+    } else {
+        memcpy(b->data + in, buf != NULL ? buf : zeros, len);
+        if (!b->dirty) {
+            b->dirty = 1;
+            b->dirtied = monotonic_ns();
+            bcache.dirty++;
+            if (bcache.dirty > bcache.capacity / 2) pthread_cond_signal(&bcache.wake);
+        }
+    }
+    pthread_mutex_unlock(&bcache.lock);
+}
+
+// Drops freed blocks without writing them back
+void bcache_forget(unsigned long long start, unsigned long long count) {
+    if (bcache.capacity == 0) return;
+    pthread_mutex_lock(&bcache.lock);
+    unsigned long long scan = count < (unsigned long long)bcache.capacity * 2 ? count : (unsigned long long)bcache.capacity * 2;
+    for (unsigned long long i = 0; i < scan; i++) {
+        // Small ranges are looked up block by block, large ones by scanning every header
+        CacheBuf *buf = NULL;
+        if (count == scan) {
+            buf = cache_find(start + i);
+        } else if (bcache.headers[i].data != NULL || bcache.headers[i].list >= CACHE_B1) {
+            buf = &bcache.headers[i];
+            if (buf->block < start || buf->block >= start + count || cache_find(buf->block) != buf) buf = NULL;
+        }
+        if (buf == NULL) continue;
+        while (buf->writing) pthread_cond_wait(&bcache.idle, &bcache.lock);
+        if (buf->dirty) bcache.dirty--;
+        buf->dirty = 0;
+        cache_drop(buf);
+    }
+    pthread_mutex_unlock(&bcache.lock);
+}
+
+int cache_by_block(const void *a, const void *b) {
+    unsigned long long x = (*(CacheBuf * const *)a)->block, y = (*(CacheBuf * const *)b)->block;
+    return x < y ? -1 : x > y;
+}
+
+// Writes back dirty blocks, every one if all is set, otherwise those past
+// flush_ms. Called and returns with the lock held. Blocks whose write
+// fails are dirty again afterwards, to be retried on the next pass.
+void cache_flush(int all) {
+    long long start = monotonic_ns();
+    long long cutoff = all || bcache.dirty > bcache.capacity / 2 ? start : start - bcache.flush_ms * 1000000;
+    CacheBuf **batch = malloc(bcache.dirty * sizeof(CacheBuf *) + 1);
+    unsigned char *staging = malloc((size_t)CACHE_FLUSH_BATCH * FS_BLOCK_SIZE);
+    if (batch == NULL || staging == NULL) {
+        free(batch);
+        free(staging);
+        return;
+    }
+    long n = 0;
+    for (long i = 0; i < bcache.capacity * 2 && n < bcache.dirty; i++) {
+        CacheBuf *buf = &bcache.headers[i];
+        if (buf->data != NULL && buf->dirty && !buf->writing && buf->dirtied <= cutoff) batch[n++] = buf;
+    }
+    if (n == 0) {
+        free(staging);
+        free(batch);
+        return;
+    }
+    qsort(batch, n, sizeof(CacheBuf *), cache_by_block);
+    
+    unsigned char failed[CACHE_FLUSH_BATCH];
+    for (long i = 0; i < n; ) {
+        long count = 0;
+        for (; i + count < n && count < CACHE_FLUSH_BATCH; count++) {
+            CacheBuf *buf = batch[i + count];
+            memcpy(staging + count * FS_BLOCK_SIZE, buf->data, FS_BLOCK_SIZE);
+            buf->dirty = 0;
+            buf->writing = 1;
+        }
+        bcache.dirty -= count;
+        bcache.writing += count;
+        pthread_mutex_unlock(&bcache.lock);
+        
+        // One write per run of consecutive blocks
+        for (long run = 0; run < count; ) {
+            long len = 1;
+            while (run + len < count && batch[i + run + len]->block == batch[i + run]->block + len) len++;
+            memset(failed + run, disk_write(batch[i + run]->block, staging + run * FS_BLOCK_SIZE, len) != 0, len);
+            run += len;
+        }
+        
+        pthread_mutex_lock(&bcache.lock);
+        for (long j = i; j < i + count; j++) {
+            CacheBuf *buf = batch[j];
+            buf->writing = 0;
+            if (!failed[j - i]) continue;
+            // A buffer written to meanwhile is dirty already
+            bcache.write_errors++;
+            if (!buf->dirty) {
+                buf->dirty = 1;
+                bcache.dirty++;
+            }
+        }
+        bcache.writing -= count;
+        pthread_cond_broadcast(&bcache.idle);
+        i += count;
+    }
+    free(staging);
+    free(batch);
+    bcache.flushes++;
+    metric_add(&bcache.flush_latency, (monotonic_ns() - start) / 1000);
+}
+
+void *bcache_flusher(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&bcache.lock);
+    while (bcache.running) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        long long ns = wake.tv_nsec + bcache.flush_ms * 1000000 / 2;
+        wake.tv_sec += ns / 1000000000;
+        wake.tv_nsec = ns % 1000000000;
+        pthread_cond_timedwait(&bcache.wake, &bcache.lock, &wake);
+        if (bcache.dirty > 0) cache_flush(0);
+    }
+    pthread_mutex_unlock(&bcache.lock);
+    return NULL;
+}
+
+// Writes back every dirty block and waits for writes in flight
+void bcache_sync() {
+    if (bcache.capacity == 0) return;
+    pthread_mutex_lock(&bcache.lock);
+    cache_flush(1);
+    while (bcache.writing > 0) pthread_cond_wait(&bcache.idle, &bcache.lock);
+    pthread_mutex_unlock(&bcache.lock);
+}
+
+// Sets up an mb MB cache, charged to the simulated RAM. Returns 0, or -1
+// (running uncached) if that much RAM is not free.
+int bcache_start(int mb, CachePolicy policy) {
+    bcache.policy = policy;
+    bcache.mb = mb;
+    bcache.capacity = 0;
+    memset(bcache.lists, 0, sizeof(bcache.lists));
+    bcache.target = bcache.dirty = bcache.writing = 0;
+    bcache.ra_next = bcache.ra_end = 0;
+    bcache.ra_window = CACHE_READAHEAD_MIN;
+    bcache.hits = bcache.misses = bcache.ghost_hits = bcache.readahead = bcache.readahead_used = 0;
+    bcache.evict_writes = bcache.disk_reads = bcache.disk_writes = 0;
+    bcache.disk_blocks_read = bcache.disk_blocks_written = bcache.write_errors = 0;
+    bcache.flushes = 0;
+    metric_free(&bcache.flush_latency);
+    if (mb <= 0) return 0;
+    if (!manage_resources(mb, 0, 0, 1, &bcache.ram_base)) {
+        bcache.ram_base = -1;
+        return -1;
+    }
+    
+    long capacity = (long)mb * ((1 << 20) / FS_BLOCK_SIZE);
+    bcache.headers = calloc(capacity * 2, sizeof(CacheBuf));
+    bcache.slots = malloc(capacity * sizeof(unsigned char *));
+    if (posix_memalign((void **)&bcache.memory, FS_BLOCK_SIZE, (size_t)capacity * FS_BLOCK_SIZE) != 0) {
+        bcache.memory = NULL;
+    }
+    unsigned long long buckets = 1;
+    while (buckets < (unsigned long long)capacity * 2) buckets <<= 1;
+    bcache.buckets = calloc(buckets, sizeof(CacheBuf *));
+    bcache.hash_mask = buckets - 1;
+    bcache.staging = malloc((size_t)CACHE_READAHEAD_MAX * FS_BLOCK_SIZE);
+    if (bcache.headers == NULL || bcache.slots == NULL || bcache.memory == NULL ||
+        bcache.buckets == NULL || bcache.staging == NULL) {
+        bcache_stop();
+        return -1;
+    }
+    
+    // ARC needs a second header per buffer for the ghosts
+    bcache.spare = NULL;
+    for (long i = capacity * 2 - 1; i >= 0; i--) {
+        bcache.headers[i].hash_next = bcache.spare;
+        bcache.spare = &bcache.headers[i];
+    }
+    for (long i = 0; i < capacity; i++) bcache.slots[i] = bcache.memory + (size_t)i * FS_BLOCK_SIZE;
+    bcache.free_slots = capacity;
+    bcache.capacity = capacity;
+    
+    pthread_mutex_init(&bcache.lock, NULL);
+    pthread_cond_init(&bcache.wake, NULL);
+    pthread_cond_init(&bcache.idle, NULL);
+    bcache.running = 1;
+    if (pthread_create(&bcache.flusher, NULL, bcache_flusher, NULL) != 0) bcache.running = 0;
+    return 0;
+}
+
+// Writes everything back and gives the memory and its RAM back
+void bcache_stop() {
+    if (bcache.running) {
+        pthread_mutex_lock(&bcache.lock);
+        bcache.running = 0;
+        pthread_cond_signal(&bcache.wake);
+        pthread_mutex_unlock(&bcache.lock);
+        pthread_join(bcache.flusher, NULL);
+    }
+    bcache_sync();
+    free(bcache.headers);
+    free(bcache.slots);
+    free(bcache.memory);
+    free(bcache.buckets);
+    free(bcache.staging);
+    bcache.headers = NULL;
+    bcache.slots = NULL;
+    bcache.memory = NULL;
+    bcache.buckets = NULL;
+    bcache.staging = NULL;
+    bcache.capacity = 0;
+    if (bcache.ram_base >= 0) manage_resources(bcache.mb, 0, 0, 0, &bcache.ram_base);
+}
+
+void show_cache_stats() {
+    if (simfs.fd < 0) return;
+    long long lookups = bcache.hits + bcache.misses;
+    if (bcache.capacity == 0) {
+        printf("\nBuffer cache: off | Disk: %lld reads, %lld writes, %lld failed\n", bcache.disk_reads,
+               bcache.disk_writes, bcache.write_errors);
+        return;
+    }
+    printf("\nBuffer cache: %s, %d MB (%ld of %ld buffers used, %ld dirty) | Hit ratio %.1f%% (%lld hits, %lld misses",
+           cache_policy_name(bcache.policy), bcache.mb, bcache.capacity - bcache.free_slots, bcache.capacity,
+           bcache.dirty, lookups > 0 ? 100.0 * bcache.hits / lookups : 0.0, bcache.hits, bcache.misses);
+    if (bcache.policy == CACHE_ARC) printf(", %lld ghost hits, T1 target %ld", bcache.ghost_hits, bcache.target);
+    printf(")\n");
+    printf("Read-ahead: %lld blocks, %.0f%% used | Flusher: %ld passes, avg %.0f us, p99 %.0f us | "
+           "%lld dirty evictions written synchronously\n",
+           bcache.readahead, bcache.readahead > 0 ? 100.0 * bcache.readahead_used / bcache.readahead : 0.0,
+           bcache.flushes, metric_mean(&bcache.flush_latency), metric_percentile(&bcache.flush_latency, 99),
+           bcache.evict_writes);
+    printf("Disk: %lld reads (%lld blocks), %lld writes (%lld blocks), %lld blocks failed to write back\n",
+           bcache.disk_reads, bcache.disk_blocks_read, bcache.disk_writes, bcache.disk_blocks_written,
+           bcache.write_errors);
+}
+
+void cache_bench_row(FILE *csv, const char *workload, long ops, double seconds) {
+    long long lookups = bcache.hits + bcache.misses;
+    char hit[16] = "-";
+    if (bcache.capacity > 0 && lookups > 0) snprintf(hit, sizeof(hit), "%.1f", 100.0 * bcache.hits / lookups);
+    printf("%-6s %6d %-16s %12.0f %8s %10lld %10lld %10.0f\n", bcache.capacity > 0 ?
+           cache_policy_name(bcache.policy) : "none", bcache.mb, workload, seconds > 0 ? ops / seconds : 0.0, hit,
+           bcache.disk_blocks_read, bcache.disk_blocks_written, metric_percentile(&bcache.flush_latency, 99));
+    if (csv != NULL) {
+        fprintf(csv, "%s,%d,%s,%ld,%.6f,%s,%lld,%lld,%lld,%.0f\n", bcache.capacity > 0 ?
+                cache_policy_name(bcache.policy) : "none", bcache.mb, workload, ops, seconds, hit,
+                bcache.disk_blocks_read, bcache.disk_blocks_written, bcache.readahead_used,
+                metric_percentile(&bcache.flush_latency, 99));
+    }
+}
+
+int run_cache_benchmark(long mb, const char *dir, const char *csv_path) {
+    FILE *csv = bench_csv_open(csv_path, "policy,cache_mb,workload,ops,seconds,hit_pct,blocks_read,blocks_written,"
+                                         "readahead_used,flush_p99_us");
+    if (csv_path != NULL && csv == NULL) return 1;
+    res_init(mb + 64, (1 << RES_HDD_BITS) - 1, 0);
+    phys_init(mb + 64, alloc_strategy);
+    
+    char image[MAX_PATH_LENGTH + 32];
+    snprintf(image, sizeof(image), "%s/cache-bench.img", dir);
+    unlink(image);
+    if (fs_mount(image, mb + 256) < 0) {
+        fprintf(stderr, "Cannot create %s: %s\n", image, strerror(errno));
+        return 1;
+    }
+    char *buffer = malloc(1 << 16);
+    memset(buffer, 'x', 1 << 16);
+    int ino = fs_create("data", FS_FILE);
+    for (long i = 0; i < mb * 16; i++) fs_write(ino, (long long)i << 16, buffer, 1 << 16);
+    fsync(simfs.fd);
+    
+    // Every configuration sees the same requests: the hot set is a sixteenth
+    // of the file and each round of the mixed workload also scans a quarter
+    // of it once, which pushes the hot set out of an LRU cache
+    long blocks = mb * 256, hot = blocks / 16, scan = blocks / 4, reads = 200000;
+    long sizes[3] = { 0, mb / 8, mb / 2 };
+    printf("=== Buffer Cache Benchmark (%ld MB file, image in %s) ===\n", mb, dir);
+    printf("%-6s %6s %-16s %12s %8s %10s %10s %10s\n", "Policy", "MB", "Workload", "Ops/s", "Hit %",
+           "Blocks rd", "Blocks wr", "Flush p99");
+    for (int s = 0; s < 3; s++) {
+        for (int policy = 0; policy < CACHE_POLICY_COUNT; policy++) {
+            if (sizes[s] == 0 && policy > 0) continue;
+            
+            // Two sequential passes in 64 KB reads
+            bcache_start(sizes[s], policy);
+            long long start = monotonic_ns();
+            for (int pass = 0; pass < 2; pass++) {
+                for (long i = 0; i < mb * 16; i++) fs_read(ino, (long long)i << 16, buffer, 1 << 16);
+            }
+            cache_bench_row(csv, "Seq read x2 MB", mb * 2, (monotonic_ns() - start) / 1e9);
+            bcache_stop();
+            
+            // 80% of random 4 KB reads go to the first 20% of the file
+            bcache_start(sizes[s], policy);
+            unsigned long long state = 12345;
+            start = monotonic_ns();
+            for (long i = 0; i < reads; i++) {
+                unsigned int r = rng_next(&state);
+                long block = r % 10 < 8 ? (long)(rng_next(&state) % (blocks / 5)) : (long)(rng_next(&state) % blocks);
+                fs_read(ino, (long long)block << 12, buffer, 4096);
+            }
+            cache_bench_row(csv, "80/20 reads", reads, (monotonic_ns() - start) / 1e9);
+            bcache_stop();
+            
+            bcache_start(sizes[s], policy);
+            state = 12345;
+            long ops = 0, next_scan = hot;
+            start = monotonic_ns();
+            for (int round = 0; round < 8; round++) {
+                for (long i = 0; i < hot * 4; i++) {
+                    fs_read(ino, (long long)(rng_next(&state) % hot) << 12, buffer, 4096);
+                }
+                for (long i = 0; i < scan; i++) {
+                    fs_read(ino, (long long)(next_scan + i) % blocks << 12, buffer, 4096);
+                }
+                next_scan = (next_scan + scan) % blocks;
+                ops += hot * 4 + scan;
+            }
+            cache_bench_row(csv, "Hot set + scans", ops, (monotonic_ns() - start) / 1e9);
+            bcache_stop();
+            
+            // Random 4 KB writes to the hot set, then everything made durable
+            bcache_start(sizes[s], policy);
+            state = 12345;
+            start = monotonic_ns();
+            for (long i = 0; i < reads; i++) {
+                fs_write(ino, (long long)(rng_next(&state) % hot) << 12, buffer, 4096);
+            }
+            bcache_sync();
+            fsync(simfs.fd);
+            cache_bench_row(csv, "Hot writes", reads, (monotonic_ns() - start) / 1e9);
+            bcache_stop();
+        }
+    }
+    
+    free(buffer);
+    fs_unmount();
+    unlink(image);
+    if (csv != NULL) fclose(csv);
+    return 0;
+}
+
+// ---- Disk head scheduling ----
+//
+// The HDD behind the resource pool gets a geometry: cylinders of heads x
+// sectors_per_track 512-byte sectors, a seek curve that grows with the
+// square root of the distance up to a third of the stroke and linearly
+// beyond it (Ruemmler and Wilkes), and a platter turning at rpm, so a
+// request waits for its sector to come round after the seek. Times are in
+// us. Requests queue in arrival order and the selected algorithm picks
+// the next one whenever the disk falls idle:
+//   FCFS     - oldest first
+//   SSTF     - nearest cylinder first
+//   SCAN     - sweeps to the edge in one direction, serving what it passes
+//   C-SCAN   - sweeps up only, then returns to cylinder 0
+//   LOOK     - SCAN turning at the last request instead of the edge
+//   C-LOOK   - C-SCAN jumping back to the lowest request
+//   Deadline - C-LOOK, but requests past their expiry (reads 500 ms,
+//              writes 5 s) go first, in C-LOOK order among themselves;
+//              the sweep then carries on from where it was
+// With --disk-io every I/O wait of a simulated task becomes a request,
+// and the task stays blocked until the disk has served it.
+
+const char *disk_sched_name(DiskSchedAlgorithm algorithm) {
+    switch (algorithm) {
+        case DISK_FCFS: return "FCFS";
+        case DISK_SSTF: return "SSTF";
+        case DISK_SCAN: return "SCAN";
+        case DISK_CSCAN: return "C-SCAN";
+        case DISK_LOOK: return "LOOK";
+        case DISK_CLOOK: return "C-LOOK";
+        case DISK_DEADLINE: return "Deadline";
+    }
+    return "Unknown";
+}
+
+int parse_disk_sched(const char *name) {
+    if (strcmp(name, "fcfs") == 0) return DISK_FCFS;
+    if (strcmp(name, "sstf") == 0) return DISK_SSTF;
+    if (strcmp(name, "scan") == 0) return DISK_SCAN;
+    if (strcmp(name, "c-scan") == 0 || strcmp(name, "cscan") == 0) return DISK_CSCAN;
+    if (strcmp(name, "look") == 0) return DISK_LOOK;
+    if (strcmp(name, "c-look") == 0 || strcmp(name, "clook") == 0) return DISK_CLOOK;
+    if (strcmp(name, "deadline") == 0) return DISK_DEADLINE;
+    return -1;
+}
+
+// Sizes the geometry for an mb MB disk and empties the queue
+void disk_init(long long mb) {
+    disk.cylinders = mb * (1024 * 1024 / DISK_SECTOR_SIZE) / ((long long)disk.heads * disk.sectors_per_track);
+    if (disk.cylinders < 2) disk.cylinders = 2;
+    disk.head = 0;
+    disk.direction = 1;
+    disk.clock = 0;
+    disk.travel_us = 0;
+    disk.sweep = 0;
+    disk.count = 0;
+    disk.busy = 0;
+    disk.requests = 0;
+    disk.dropped = 0;
+    disk.sectors_done = 0;
+    disk.seek_cylinders = 0;
+    disk.busy_us = 0;
+    metric_free(&disk.latency);
+}
+
+double disk_seek_us(long long distance) {
+    if (distance == 0) return 0;
+    long long knee = disk.cylinders / 3 > 2 ? disk.cylinders / 3 : 2;
+    if (distance <= knee) {
+        return disk.track_seek_us + (disk.avg_seek_us - disk.track_seek_us) * sqrt((double)(distance - 1) / (knee - 1));
+    }
+    return disk.avg_seek_us + (double)(disk.full_seek_us - disk.avg_seek_us) * (distance - knee) /
+           (disk.cylinders - 1 - knee);
+}
+
+// Moves the head without serving anything, for the sweeps of SCAN and C-SCAN
+void disk_travel(long long cylinder) {
+    long long distance = llabs(cylinder - disk.head);
+    disk.travel_us += disk_seek_us(distance);
+    disk.seek_cylinders += distance;
+    disk.head = cylinder;
+}
+
+// Distance from cylinder `from` to request i along direction, negative
+// if it lies behind; direction 0 counts both ways
+long long disk_distance(int i, long long from, int direction) {
+    long long distance = disk.queue[i].cylinder - from;
+    return direction == 0 ? llabs(distance) : distance * direction;
+}
+
+// Closest of the first n requests to `from` in direction, -1 if there is
+// none; the oldest wins a tie
+int disk_nearest(int n, long long from, int direction) {
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+        long long distance = disk_distance(i, from, direction);
+        if (distance >= 0 && (best < 0 || distance < disk_distance(best, from, direction))) best = i;
+    }
+    return best;
+}
+
+// Deadline: the first expired request at or above the head, else the
+// lowest expired one, so a backlog of expired requests is still served
+// in one sweep rather than oldest first. -1 if nothing has expired.
+int disk_expired_pick(int n, long long now) {
+    int ahead = -1, lowest = -1;
+    for (int i = 0; i < n; i++) {
+        if (disk.queue[i].deadline > now) continue;
+        long long distance = disk_distance(i, disk.head, 1);
+        if (distance >= 0 && (ahead < 0 || distance < disk_distance(ahead, disk.head, 1))) ahead = i;
+        if (lowest < 0 || disk.queue[i].cylinder < disk.queue[lowest].cylinder) lowest = i;
     }
-    
-    tasks[task_index].is_minimized = 0;
-    print_success("Task restored successfully!");
-    sleep(1);
+    return ahead >= 0 ? ahead : lowest;
 }
 
-void switch_mode() {
-    current_mode = !current_mode;
-    print_success(current_mode ? "Switched to Kernel Mode" : "Switched to User Mode");
-    sleep(1);
+// Chooses among the first n queued requests, those that have arrived by now
+int disk_pick(int n, long long now) {
+    int next;
+    switch (disk.algorithm) {
+        case DISK_FCFS:
+            return 0;
+        case DISK_SSTF:
+            return disk_nearest(n, disk.head, 0);
+        case DISK_SCAN:
+        case DISK_LOOK:
+            next = disk_nearest(n, disk.head, disk.direction);
+            if (next >= 0) return next;
+            if (disk.algorithm == DISK_SCAN) disk_travel(disk.direction > 0 ? disk.cylinders - 1 : 0);
+            disk.direction = -disk.direction;
+            return disk_nearest(n, disk.head, disk.direction);
+        case DISK_DEADLINE:
+            next = disk_expired_pick(n, now);
+            if (next >= 0) return next;
+            // C-LOOK from where the sweep had got to, so the requests it
+            // passed over to serve expired ones are not left for a lap
+            next = disk_nearest(n, disk.sweep, 1);
+            if (next < 0) {
+                next = 0;
+                for (int i = 1; i < n; i++) {
+                    if (disk.queue[i].cylinder < disk.queue[next].cylinder) next = i;
+                }
+            }
+            disk.sweep = disk.queue[next].cylinder;
+            return next;
+        case DISK_CSCAN:
+        case DISK_CLOOK:
+            next = disk_nearest(n, disk.head, 1);
+            if (next >= 0) return next;
+            if (disk.algorithm == DISK_CSCAN) {
+                disk_travel(disk.cylinders - 1);
+                disk_travel(0);
+            } else {
+                long long lowest = disk.queue[0].cylinder;
+                for (int i = 1; i < n; i++) {
+                    if (disk.queue[i].cylinder < lowest) lowest = disk.queue[i].cylinder;
+                }
+                disk_travel(lowest);
+            }
+            return disk_nearest(n, disk.head, 1);
+    }
+    return 0;
 }
 
-void shutdown_os() {
-    clear_screen();
-    printf("\n\n");
-    printf("    ███████╗██╗  ██╗██╗   ██╗████████╗███████╗██████╗ \n");
-    printf("    ██╔════╝██║  ██║██║   ██║╚══██╔══╝██╔════╝██╔══██╗\n");
-    printf("    ███████╗███████║██║   ██║   ██║   █████╗  ██║  ██║\n");
-    printf("    ╚════██║██╔══██║██║   ██║   ██║   ██╔══╝  ██║  ██║\n");
-    printf("    ███████║██║  ██║╚██████╔╝   ██║   ███████╗██████╔╝\n");
-    printf("    ╚══════╝╚═╝  ╚═╝ ╚═════╝    ╚═╝   ╚══════╝╚═════╝ \n");
-    
-    for (int i = 0; i < task_count; i++) {
-        if (tasks[i].is_running) {
-            kill(tasks[i].pid, SIGTERM);
-            waitpid(tasks[i].pid, NULL, 0);
-        }
+// Returns 0, or -1 with the queue unchanged if it cannot grow
+int disk_enqueue(DiskRequest *r) {
+    if (disk.count == disk.cap) {
+        int cap = disk.cap ? disk.cap * 2 : 64;
+        DiskRequest *queue = realloc(disk.queue, cap * sizeof(DiskRequest));
+        if (queue == NULL) return -1;
+        disk.queue = queue;
+        disk.cap = cap;
     }
-    
-    loading_animation("Shutting down", 3);
-    exit(0);
+    r->cylinder = r->lba / ((long long)disk.heads * disk.sectors_per_track);
+    r->deadline = r->arrival + (r->write ? DISK_WRITE_EXPIRE_US : DISK_READ_EXPIRE_US);
+    disk.queue[disk.count++] = *r;
+    return 0;
 }
 
-void manage_resources(int ram, int hdd, int cpu, int allocate) {
-    sem_wait(&resource_sem);
+// Serves the next request, starting no earlier than now, and returns when
+// it completes. The queue must not be empty.
+long long disk_start(long long now) {
+    long long start = disk.clock > now ? disk.clock : now;
+    if (disk.queue[0].arrival > start) start = disk.queue[0].arrival;
+    int n = 1;
+    while (n < disk.count && disk.queue[n].arrival <= start) n++;
+    int next = disk_pick(n, start);
+    DiskRequest *r = &disk.queue[next];
     
-    if (allocate) {
-        system_res.available_ram -= ram;
-        system_res.available_hdd -= hdd;
-        system_res.available_cores -= cpu;
-    } else {
-        system_res.available_ram += ram;
-        system_res.available_hdd += hdd;
-        system_res.available_cores += cpu;
-    }
+    long long distance = llabs(r->cylinder - disk.head);
+    double rotation_us = 60e6 / disk.rpm, sector_us = rotation_us / disk.sectors_per_track;
+    double t = start + disk.travel_us + disk_seek_us(distance);
+    // Wait for the first sector to come under the head, then transfer
+    double under = fmod(t, rotation_us) / sector_us;
+    t += fmod(r->lba % disk.sectors_per_track - under + disk.sectors_per_track, disk.sectors_per_track) * sector_us;
+    t += r->sectors * sector_us;
+    long long finish = (long long)ceil(t);
     
-    sem_post(&resource_sem);
+    disk.seek_cylinders += distance;
+    disk.head = r->cylinder;
+    disk.travel_us = 0;
+    disk.busy_us += finish - start;
+    disk.clock = finish;
+    disk.requests++;
+    disk.sectors_done += r->sectors;
+    metric_add(&disk.latency, finish - r->arrival);
+    disk.current = *r;
+    disk.busy = 1;
+    memmove(r, r + 1, (disk.count - next - 1) * sizeof(DiskRequest));
+    disk.count--;
+    return finish;
 }
 
-int check_resources(int ram, int hdd, int cpu) {
-    sem_wait(&resource_sem);
-    
-    int result = (system_res.available_ram >= ram) && 
-                 (system_res.available_hdd >= hdd) && 
-                 (system_res.available_cores >= cpu);
-    
-    sem_post(&resource_sem);
-    return result;
+// Queues the I/O of a job that just blocked. A job works through its own
+// file sequentially, 64 KB at a time for file I/O tasks and 4 KB for the
+// rest; one request in four moves on to another file and one in four is
+// a write.
+void disk_submit_job(int job) {
+    SimJob *j = &engine.jobs[job];
+    long long sectors = disk.cylinders * disk.heads * disk.sectors_per_track;
+    DiskRequest r;
+    r.job = job;
+    r.write = sim_rand() % 4 == 0;
+    r.sectors = j->task_class == CLASS_FILE_IO ? 128 : 8;
+    if (j->disk_lba < 0 || j->disk_lba + r.sectors > sectors || sim_rand() % 4 == 0) {
+        j->disk_lba = (((unsigned long long)sim_rand() << 32 | sim_rand()) % (sectors - r.sectors + 1)) & ~7LL;
+    }
+    r.lba = j->disk_lba;
+    j->disk_lba += r.sectors;
+    r.arrival = engine.clock * 1000;
+    if (disk_enqueue(&r) != 0) {
+        disk.dropped++;
+        j->io_total += j->io_time;
+        event_push(EV_IO_DONE, engine.clock + j->io_time, -1, job, 0);
+        return;
+    }
+    if (!disk.busy) event_push(EV_DISK_DONE, (disk_start(r.arrival) + 999) / 1000, -1, -1, 0);
 }
 
-void notepad() {
-    clear_screen();
-    printf("=== Notepad ===\n");
-    printf("Type your text (enter 'SAVE' on a new line to save and exit):\n\n");
-    
-    char filename[MAX_PATH_LENGTH];
-    printf("Enter filename to save: ");
-    scanf("%s", filename);
-    
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF);
-    
-    FILE *file = fopen(filename, "w");
-    if (file == NULL) {
-        printf("Error creating file!\n");
+void configure_disk_scheduler() {
+    printf("\nDisk scheduling:");
+    for (int i = 0; i < DISK_SCHED_COUNT; i++) {
+        printf(" %d. %s", i + 1, disk_sched_name(i));
+    }
+    printf(" [%s]: ", disk_sched_name(disk.algorithm));
+    int choice;
+    if (scanf("%d", &choice) != 1 || choice < 1 || choice > DISK_SCHED_COUNT) {
+        print_error("Invalid input!");
         return;
     }
     
-    char buffer[256];
-    while (1) {
-        fgets(buffer, sizeof(buffer), stdin);
-        
-        if (strcmp(buffer, "SAVE\n") == 0) {
-            break;
-        }
-        
-        fputs(buffer, file);
+    printf("Task I/O waits go to the disk (1) or take fixed times (0) [%d]: ", disk.enabled);
+    int enabled;
+    if (scanf("%d", &enabled) != 1 || enabled < 0 || enabled > 1) {
+        print_error("Invalid input!");
+        return;
     }
     
-    fclose(file);
-    printf("File saved successfully as %s\n", filename);
-    sleep(2);
+    // Requests already queued are picked by the new algorithm from now on
+    pthread_mutex_lock(&queue_mutex);
+    disk.algorithm = choice - 1;
+    disk.enabled = enabled;
+    pthread_mutex_unlock(&queue_mutex);
+    print_success("Disk scheduling updated!");
+    sleep(1);
 }
 
-void calculator() {
-    clear_screen();
-    printf("=== Calculator ===\n");
-    printf("Operations: +, -, *, /, %% (enter 'q' to quit)\n\n");
-    
-    while (1) {
-        double num1, num2;
-        char op;
-        
-        printf("Enter expression (e.g., 5 + 3): ");
-        if (scanf("%lf %c %lf", &num1, &op, &num2) != 3) {
-            break;
+void show_disk_stats() {
+    printf("\nDisk scheduling: %s | %lld cylinders x %d heads x %d sectors, %d rpm | Task I/O %s\n",
+           disk_sched_name(disk.algorithm), disk.cylinders, disk.heads, disk.sectors_per_track, disk.rpm,
+           disk.enabled ? "goes to the disk" : "waits fixed times");
+    pthread_mutex_lock(&queue_mutex);
+    if (disk.requests > 0) {
+        double seconds = disk.clock / 1e6;
+        printf("Requests: %ld served, %d queued | Avg seek %.0f cylinders | %.1f IOPS, %.2f MB/s, %.1f%% busy\n",
+               disk.requests, disk.count, (double)disk.seek_cylinders / disk.requests, disk.requests / seconds,
+               disk.sectors_done * DISK_SECTOR_SIZE / 1e6 / seconds, 100.0 * disk.busy_us / disk.clock);
+        printf("Request latency: avg %.1f ms, p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+               metric_mean(&disk.latency) / 1000, metric_percentile(&disk.latency, 50) / 1000,
+               metric_percentile(&disk.latency, 99) / 1000, metric_percentile(&disk.latency, 100) / 1000);
+        if (disk.dropped > 0) printf("Not queued for lack of memory: %ld, waited fixed times\n", disk.dropped);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// Serves reqs with the current algorithm, either at their arrival times or,
+// with depth > 0, as a closed loop issuing the next request whenever one
+// of the depth outstanding ones completes. The `chained` requests after
+// the first n are issued one at a time, each as the last one completes.
+// Returns 0, or -1 if the queue ran out of memory.
+int disk_bench_run(DiskRequest *reqs, long n, int depth, long chained, long long mb) {
+    disk_init(mb);
+    long next = 0, chain = n;
+    for (; next < depth && next < n; next++) {
+        reqs[next].arrival = 0;
+        if (disk_enqueue(&reqs[next]) != 0) return -1;
+    }
+    if (chained > 0) {
+        reqs[chain].arrival = 0;
+        if (disk_enqueue(&reqs[chain++]) != 0) return -1;
+    }
+    for (long done = 0; done < n + chained; done++) {
+        // What arrived while the disk was busy, or the next arrival for an idle disk
+        while (depth == 0 && next < n && (disk.count == 0 || reqs[next].arrival <= disk.clock)) {
+            if (disk_enqueue(&reqs[next++]) != 0) return -1;
         }
-        
-        double result;
-        switch(op) {
-            case '+': result = num1 + num2; break;
-            case '-': result = num1 - num2; break;
-            case '*': result = num1 * num2; break;
-            case '/': 
-                if (num2 == 0) {
-                    printf("Error: Division by zero!\n");
-                    continue;
-                }
-                result = num1 / num2; 
-                break;
-            case '%': 
-                result = (int)num1 % (int)num2; 
-                break;
-            default: 
-                printf("Invalid operator!\n");
-                continue;
+        long long finish = disk_start(disk.clock);
+        if (disk.current.job == 1 && chain < n + chained) {
+            reqs[chain].arrival = finish;
+            if (disk_enqueue(&reqs[chain++]) != 0) return -1;
         }
-        
-        printf("Result: %.2lf\n", result);
-        
-        while ((getchar()) != '\n');
-        
-        printf("Press q to quit or any other key to continue...");
-        if (getchar() == 'q') {
-            break;
+        if (depth > 0 && next < n) {
+            reqs[next].arrival = finish;
+            if (disk_enqueue(&reqs[next++]) != 0) return -1;
         }
     }
+    return 0;
 }
 
-void show_time() {
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
+int run_disk_benchmark(long requests, int hdd_mb, const char *csv_path) {
+    // Random 4 KB requests below and near what FCFS can serve, sequential
+    // 64 KB streams mixed with random reads, a queue kept 32 deep, and
+    // random reads beside a reader that issues its next 64 KB the moment
+    // the last one completes, which the elevators follow and starve the
+    // rest behind
+    const char *workloads[] = { "Random 4K at 30 IOPS", "Random 4K at 70 IOPS", "8 streams + random",
+                                "Random 4K 32 deep", "Greedy reader + random" };
+    const double iops[] = { 30, 70, 60, 0, 30 };
+    const int depths[] = { 0, 0, 0, 32, 0 };
     
-    clear_screen();
-    printf("=== Current Time ===\n");
-    printf("%02d:%02d:%02d\n", tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
-    printf("%02d/%02d/%04d\n", tm_info->tm_mday, tm_info->tm_mon + 1, tm_info->tm_year + 1900);
+    FILE *csv = bench_csv_open(csv_path, "workload,algorithm,requests,avg_seek_cylinders,iops,mb_per_s,busy_pct,"
+                                         "latency_avg_ms,latency_p50_ms,latency_p99_ms,latency_max_ms");
+    if (csv_path != NULL && csv == NULL) return 1;
     
-    printf("\nPress any key to continue...");
-    getchar(); getchar();
-}
-
-void calendar() {
-    while (1) {
-        time_t now = time(NULL);
-        struct tm *tm_info = localtime(&now);
-        
-        clear_screen();
-        printf("=== Calendar ===\n");
-        
-        printf("     %02d/%04d\n", tm_info->tm_mon + 1, tm_info->tm_year + 1900);
-        printf("Su Mo Tu We Th Fr Sa\n");
-        
-        struct tm first_day = *tm_info;
-        first_day.tm_mday = 1;
-        mktime(&first_day);
-        
-        int day_of_week = first_day.tm_wday;
-        int days_in_month;
-        
-        switch(tm_info->tm_mon + 1) {
-            case 4: case 6: case 9: case 11: days_in_month = 30; break;
-            case 2: 
-                days_in_month = ((tm_info->tm_year + 1900) % 4 == 0) ? 29 : 28;
-                break;
-            default: days_in_month = 31;
-        }
-        
-        for (int i = 0; i < day_of_week; i++) {
-            printf("   ");
+    disk_init(hdd_mb);
+    long long sectors = disk.cylinders * disk.heads * disk.sectors_per_track;
+    DiskRequest *reqs = malloc(requests * sizeof(DiskRequest));
+    if (reqs == NULL) {
+        fprintf(stderr, "Cannot allocate %ld requests\n", requests);
+        if (csv != NULL) fclose(csv);
+        return 1;
+    }
+    printf("=== Disk Scheduling Benchmark (%ld requests, %lld cylinders, %d rpm) ===\n",
+           requests, disk.cylinders, disk.rpm);
+    
+    for (int w = 0; w < 5; w++) {
+        unsigned long long state = 12345;
+        long long cursor[8];
+        double clock = 0;
+        for (int s = 0; s < 8; s++) {
+            cursor[s] = (((unsigned long long)rng_next(&state) << 32 | rng_next(&state)) % (sectors / 2)) & ~7LL;
         }
-        
-        for (int day = 1; day <= days_in_month; day++) {
-            printf("%2d ", day);
-            if ((day + day_of_week) % 7 == 0 || day == days_in_month) {
-                printf("\n");
+        // The greedy reader takes the second half
+        long open = w == 4 ? requests / 2 : requests;
+        for (long i = 0; i < requests; i++) {
+            DiskRequest *r = &reqs[i];
+            if (i >= open) {
+                r->job = 1;
+                r->write = 0;
+                r->sectors = 128;
+                r->lba = cursor[0];
+                cursor[0] += r->sectors;
+                continue;
+            }
+            r->job = -1;
+            r->write = rng_next(&state) % 4 == 0;
+            if (iops[w] > 0) {
+                // Poisson arrivals
+                clock += -log((rng_next(&state) + 1.0) / 4294967296.0) / iops[w] * 1e6;
+            }
+            r->arrival = (long long)clock;
+            if (w == 2 && i % 2 == 0) {
+                int s = rng_next(&state) % 8;
+                r->sectors = 128;
+                r->lba = cursor[s];
+                cursor[s] += r->sectors;
+            } else {
+                r->sectors = 8;
+                r->lba = (((unsigned long long)rng_next(&state) << 32 | rng_next(&state)) % (sectors - 8)) & ~7LL;
             }
         }
         
-        printf("\nPress 'q' to quit...");
-        if (kbhit()) {
-            char ch = getchar();
-            if (ch == 'q' || ch == 'Q') {
-                break;
+        printf("\n%s\n", workloads[w]);
+        printf("%-9s %10s %8s %7s %6s %9s %9s %9s %9s\n", "Algorithm", "Avg seek", "IOPS", "MB/s", "Busy%",
+               "Avg ms", "p50 ms", "p99 ms", "Max ms");
+        for (int a = 0; a < DISK_SCHED_COUNT; a++) {
+            disk.algorithm = a;
+            if (disk_bench_run(reqs, open, depths[w], requests - open, hdd_mb) != 0) {
+                fprintf(stderr, "Cannot grow the disk queue\n");
+                free(reqs);
+                if (csv != NULL) fclose(csv);
+                return 1;
+            }
+            
+            double seconds = disk.clock / 1e6;
+            double seek = (double)disk.seek_cylinders / disk.requests;
+            double rate = disk.requests / seconds, mb = disk.sectors_done * DISK_SECTOR_SIZE / 1e6 / seconds;
+            double busy = 100.0 * disk.busy_us / disk.clock;
+            double avg = metric_mean(&disk.latency) / 1000, p50 = metric_percentile(&disk.latency, 50) / 1000;
+            double p99 = metric_percentile(&disk.latency, 99) / 1000;
+            double max = metric_percentile(&disk.latency, 100) / 1000;
+            printf("%-9s %10.0f %8.1f %7.2f %6.1f %9.1f %9.1f %9.1f %9.1f\n", disk_sched_name(a), seek, rate, mb,
+                   busy, avg, p50, p99, max);
+            if (csv != NULL) {
+                fprintf(csv, "%s,%s,%ld,%.1f,%.2f,%.3f,%.1f,%.2f,%.2f,%.2f,%.2f\n", workloads[w],
+                        disk_sched_name(a), disk.requests, seek, rate, mb, busy, avg, p50, p99, max);
             }
         }
-        
-        sleep(1);
     }
+    
+    free(reqs);
+    if (csv != NULL) fclose(csv);
+    return 0;
 }
 
 void create_file() {
     clear_screen();
     printf("=== Create File ===\n");
+    fs_path_hint();
     
     char filename[MAX_PATH_LENGTH];
-    printf("Enter filename: ");
+    printf("Enter filename (end it with / for a directory): ");
     scanf("%s", filename);
     
-    FILE *file = fopen(filename, "w");
+    const char *host = host_path(filename);
+    if (host == NULL) {
+        int is_dir = filename[strlen(filename) - 1] == '/';
+        if ((is_dir ? fs_create(filename, FS_DIR) : fs_open_empty(filename)) < 0) {
+            printf("Error creating file: %s\n", strerror(errno));
+        } else {
+            printf("%s created successfully: %s\n", is_dir ? "Directory" : "File", filename);
+        }
+        sleep(2);
+        return;
+    }
+    
+    FILE *file = fopen(host, "w");
     if (file == NULL) {
         printf("Error creating file!\n");
     } else {
@@ -813,6 +10688,7 @@ void create_file() {
 void move_file() {
     clear_screen();
     printf("=== Move File ===\n");
+    fs_path_hint();
     
     char source[MAX_PATH_LENGTH], dest[MAX_PATH_LENGTH];
     printf("Enter source file path: ");
@@ -820,10 +10696,40 @@ void move_file() {
     printf("Enter destination path: ");
     scanf("%s", dest);
     
-    if (rename(source, dest) == 0) {
+    const char *from = host_path(source), *to = host_path(dest);
+    if (from == NULL || to == NULL) {
+        // Between the image and the host a file is copied, then removed
+        int rc = from == NULL && to == NULL ? fs_rename(source, dest) :
+                 from == NULL ? fs_export(source, to) : fs_import(from, dest);
+        if (rc == 0 && (from == NULL) != (to == NULL)) {
+            rc = from == NULL ? fs_unlink(source) : unlink(from);
+        }
+        if (rc == 0) {
+            printf("File moved successfully from %s to %s\n", source, dest);
+        } else {
+            printf("Error moving file: %s\n", strerror(errno));
+        }
+        sleep(2);
+        return;
+    }
+    
+    // Across filesystems this copies the tree and then removes the source
+    TreeWalk copied, removed;
+    if (tree_move(from, to, tree_threads, &copied, &removed) == 0) {
         printf("File moved successfully from %s to %s\n", source, dest);
+        if (copied.op != TREE_MOVE) {
+            print_tree_result("Copied across filesystems:", &copied);
+            print_tree_result("Then removed", &removed);
+        }
+    } else if (copied.errors > 0 && copied.files + copied.dirs > 0) {
+        print_tree_result("Error moving file! Copied", &copied);
+        if (removed.errors > 0) {
+            print_tree_result("Removed", &removed);
+        } else {
+            printf("The source was kept.\n");
+        }
     } else {
-        printf("Error moving file!\n");
+        printf("Error moving file: %s\n", copied.first_error);
     }
     
     sleep(2);
@@ -832,6 +10738,7 @@ void move_file() {
 void copy_file() {
     clear_screen();
     printf("=== Copy File ===\n");
+    fs_path_hint();
     
     char source[MAX_PATH_LENGTH], dest[MAX_PATH_LENGTH];
     printf("Enter source file path: ");
@@ -839,44 +10746,87 @@ void copy_file() {
     printf("Enter destination path: ");
     scanf("%s", dest);
     
-    FILE *src_file = fopen(source, "rb");
-    if (src_file == NULL) {
-        printf("Error opening source file!\n");
+    const char *from = host_path(source), *to = host_path(dest);
+    if (from == NULL || to == NULL) {
+        int rc = from == NULL && to == NULL ? fs_copy(source, dest) :
+                 from == NULL ? fs_export(source, to) : fs_import(from, dest);
+        if (rc == 0) {
+            printf("File copied successfully from %s to %s\n", source, dest);
+        } else {
+            printf("Error copying file: %s\n", strerror(errno));
+        }
         sleep(2);
         return;
     }
     
-    FILE *dest_file = fopen(dest, "wb");
-    if (dest_file == NULL) {
-        printf("Error creating destination file!\n");
-        fclose(src_file);
+    struct stat src_stat;
+    if (stat(from, &src_stat) == 0 && S_ISDIR(src_stat.st_mode)) {
+        TreeWalk w;
+        if (tree_run(TREE_COPY, from, to, tree_threads, &w) == 0) {
+            printf("Directory copied successfully from %s to %s\n", source, dest);
+        }
+        print_tree_result("Copied", &w);
         sleep(2);
         return;
     }
     
-    char buffer[1024];
-    size_t bytes;
-    
-    while ((bytes = fread(buffer, 1, sizeof(buffer), src_file)) > 0) {
-        fwrite(buffer, 1, bytes, dest_file);
+    CopyStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.progress = copy_progress;
+    if (copy_engine(from, to, COPY_REFLINK, &stats) != 0) {
+        printf("\nError copying file: %s\n", strerror(errno));
+        sleep(2);
+        return;
     }
     
-    fclose(src_file);
-    fclose(dest_file);
-    
-    printf("File copied successfully from %s to %s\n", source, dest);
+    printf("\nFile copied successfully from %s to %s\n", source, dest);
+    printf("%lld bytes in %.2f s (%.1f MB/s) via %s", stats.total, stats.seconds,
+           stats.seconds > 0 ? stats.total / stats.seconds / (1 << 20) : 0.0,
+           copy_method_name(stats.method));
+    if (stats.hole_bytes > 0) printf(", %lld bytes of holes kept sparse", stats.hole_bytes);
+    printf("\n");
     sleep(2);
 }
 
 void delete_file() {
     clear_screen();
     printf("=== Delete File ===\n");
+    fs_path_hint();
     
     char filename[MAX_PATH_LENGTH];
     printf("Enter filename to delete: ");
     scanf("%s", filename);
     
-    if (remove(filename) == 0) {
+    const char *host = host_path(filename);
+    int ino = host == NULL ? fs_lookup(filename) : -1;
+    struct stat file_stat;
+    int is_tree = host == NULL ? ino > 0 && fs_inode(ino)->type == FS_DIR && !fs_dir_empty(ino) :
+                  lstat(host, &file_stat) == 0 && S_ISDIR(file_stat.st_mode);
+    if (is_tree) {
+        char confirm;
+        printf("%s is a directory. Delete it and everything in it? (y/n): ", filename);
+        scanf(" %c", &confirm);
+        if (confirm != 'y' && confirm != 'Y') {
+            printf("Nothing deleted.\n");
+            sleep(2);
+            return;
+        }
+        
+        if (host == NULL) {
+            long removed = fs_remove_tree(filename);
+            if (removed > 0) {
+                printf("Directory deleted successfully: %s (%ld entries)\n", filename, removed - 1);
+            } else {
+                printf("Error deleting directory: %s\n", strerror(errno));
+            }
+        } else {
+            TreeWalk w;
+            if (tree_run(TREE_DELETE, host, NULL, tree_threads, &w) == 0) {
+                printf("Directory deleted successfully: %s\n", filename);
+            }
+            print_tree_result("Deleted", &w);
+        }
+    } else if (host == NULL ? fs_unlink(filename) == 0 : remove(host) == 0) {
         printf("File deleted successfully: %s\n", filename);
     } else {
         printf("Error deleting file!\n");
@@ -888,24 +10838,30 @@ void delete_file() {
 void file_info() {
     clear_screen();
     printf("=== File Info ===\n");
+    fs_path_hint();
     
     char filename[MAX_PATH_LENGTH];
     printf("Enter filename: ");
     scanf("%s", filename);
     
-    struct stat file_stat;
-    if (stat(filename, &file_stat) == -1) {
-        printf("Error getting file info!\n");
-        sleep(2);
-        return;
+    const char *host = host_path(filename);
+    if (host == NULL) {
+        fs_print_info(filename);
+    } else {
+        struct stat file_stat;
+        if (stat(host, &file_stat) == -1) {
+            printf("Error getting file info!\n");
+            sleep(2);
+            return;
+        }
+        
+        printf("\nFile Information for: %s\n", filename);
+        printf("Size: %ld bytes\n", file_stat.st_size);
+        printf("Permissions: %o\n", file_stat.st_mode & 0777);
+        printf("Last accessed: %s", ctime(&file_stat.st_atime));
+        printf("Last modified: %s", ctime(&file_stat.st_mtime));
     }
     
-    printf("\nFile Information for: %s\n", filename);
-    printf("Size: %ld bytes\n", file_stat.st_size);
-    printf("Permissions: %o\n", file_stat.st_mode & 0777);
-    printf("Last accessed: %s", ctime(&file_stat.st_atime));
-    printf("Last modified: %s", ctime(&file_stat.st_mtime));
-    
     printf("\nPress any key to continue...");
     getchar(); getchar();
 }
@@ -1020,7 +10976,7 @@ void music_player() {
     printf("Playing background music...\n");
     
     for (int i = 0; i < 5; i++) {
-        if (task_count == 0 || !tasks[task_count-1].is_running) break;
+        if (task_count == 0 || !task_last()->is_running) break;
         
         printf("Playing note %d/5...\n", i+1);
         beep_sound(500, 440 + i * 100);
@@ -1038,22 +10994,35 @@ void system_monitor() {
         
         printf("\nSystem Resources:\n");
         printf("RAM: %d/%d MB (%.1f%% used)\n", 
-               system_res.total_ram - system_res.available_ram, 
+               system_res.total_ram - res_available_ram(), 
                system_res.total_ram,
-               ((float)(system_res.total_ram - system_res.available_ram) / system_res.total_ram * 100));
+               ((float)(system_res.total_ram - res_available_ram()) / system_res.total_ram * 100));
         printf("HDD: %d/%d MB (%.1f%% used)\n", 
-               system_res.total_hdd - system_res.available_hdd, 
+               system_res.total_hdd - res_available_hdd(), 
                system_res.total_hdd,
-               ((float)(system_res.total_hdd - system_res.available_hdd) / system_res.total_hdd * 100));
+               ((float)(system_res.total_hdd - res_available_hdd()) / system_res.total_hdd * 100));
         printf("CPU Cores: %d/%d in use\n", 
-               system_res.total_cores - system_res.available_cores, 
+               system_res.total_cores - res_available_cores(), 
                system_res.total_cores);
+        show_core_stats();
+        show_swap_stats();
+        show_admission_stats();
+        show_banker_stats();
+        show_reaper_stats();
+        show_launcher_stats();
+        show_enforcer_stats();
+        show_fs_stats();
+        show_cache_stats();
+        show_disk_stats();
         
-        printf("\nPress q to quit or any other key to refresh...");
+        printf("\nPress q to quit, s to toggle swapping, or any other key to refresh...");
         char ch = getchar();
         if (ch == 'q') {
             break;
         }
+        if (ch == 's') {
+            swap_space.enabled = !swap_space.enabled;
+        }
         while ((getchar()) != '\n'); // Clear input buffer
     }
 }
@@ -1069,14 +11038,14 @@ void process_manager() {
             printf("%-5s %-20s %-10s %-10s %-10s %-10s\n", 
                    "ID", "Name", "RAM(MB)", "HDD(MB)", "CPU", "Status");
             
-            for (int i = 0; i < task_count; i++) {
+            for (Task *t = task_first(); t != NULL; t = task_next(t)) {
                 printf("%-5d %-20s %-10d %-10d %-10d %-10s\n", 
-                       i, 
-                       tasks[i].name, 
-                       tasks[i].ram_usage, 
-                       tasks[i].hdd_usage, 
-                       tasks[i].cpu_usage,
-                       tasks[i].is_minimized ? "Minimized" : "Running");
+                       t->id, 
+                       t->name, 
+                       t->ram_usage, 
+                       t->hdd_usage, 
+                       t->cpu_usage,
+                       t->is_swapped ? "Swapped" : t->is_minimized ? "Minimized" : "Running");
             }
         }
         
@@ -1095,16 +11064,65 @@ void memory_viewer() {
     
     printf("\nMemory Allocation Map:\n");
     printf("Total RAM: %d MB\n", system_res.total_ram);
-    printf("Used RAM: %d MB\n", system_res.total_ram - system_res.available_ram);
-    printf("Free RAM: %d MB\n", system_res.available_ram);
+    printf("Used RAM: %d MB\n", system_res.total_ram - res_available_ram());
+    printf("Free RAM: %d MB\n", res_available_ram());
     
     printf("\nProcess Memory Usage:\n");
-    for (int i = 0; i < task_count; i++) {
-        printf("%-20s: %4d MB\n", tasks[i].name, tasks[i].ram_usage);
+    pthread_mutex_lock(&queue_mutex);
+    int letter = 0;
+    for (Task *t = task_first(); t != NULL; t = task_next(t), letter++) {
+        printf("%-20s: %4d MB", t->name, t->ram_usage);
+        if (t->ram_base >= 0) {
+            printf("  {%c} at %d MB", 'A' + letter % 26, t->ram_base);
+        }
+        if (t->asid >= 0) {
+            VmSpace *sp = &vm.spaces[t->asid];
+            printf("  [%c] %d/%d pages resident, %ld faults, %s",
+                   'A' + t->asid % 26, sp->resident, sp->pages, sp->faults,
+                   access_pattern_name(sp->pattern));
+        }
+        printf("\n");
+    }
+    show_allocation_map();
+    if (vm.frame_count > 0) show_frame_map();
+    pthread_mutex_unlock(&queue_mutex);
+    
+    printf("\nAllocator:");
+    for (int i = 0; i < ALLOC_STRATEGY_COUNT; i++) {
+        printf(" %d. %s", i + 1, alloc_strategy_name(i));
     }
+    printf(" (0 keeps %s): ", alloc_strategy_name(phys.strategy));
     
-    printf("\nPress any key to continue...");
-    getchar(); getchar();
+    int choice;
+    if (scanf("%d", &choice) == 1 && choice >= 1 && choice <= ALLOC_STRATEGY_COUNT &&
+        choice - 1 != (int)phys.strategy) {
+        pthread_mutex_lock(&queue_mutex);
+        int changed = phys_set_strategy(choice - 1);
+        pthread_mutex_unlock(&queue_mutex);
+        if (changed) {
+            alloc_strategy = choice - 1;
+            print_success("Allocator changed and memory compacted!");
+        } else {
+            print_error("Running tasks do not fit under that allocator!");
+        }
+        sleep(1);
+    }
+    
+    if (vm.frame_count == 0) return;
+    
+    printf("\nReplacement policy:");
+    for (int i = 0; i < REPLACEMENT_POLICY_COUNT; i++) {
+        printf(" %d. %s", i + 1, replacement_policy_name(i));
+    }
+    printf(" (0 keeps %s): ", replacement_policy_name(vm.policy));
+    
+    if (scanf("%d", &choice) == 1 && choice >= 1 && choice <= REPLACEMENT_POLICY_COUNT) {
+        pthread_mutex_lock(&queue_mutex);
+        vm_set_policy(choice - 1);
+        pthread_mutex_unlock(&queue_mutex);
+        print_success("Replacement policy changed!");
+        sleep(1);
+    }
 }
 
 int kbhit() {
@@ -1255,33 +11273,38 @@ void clear_screen() {
     #ifdef _WIN32
         system("cls");
     #else
-        system("clear");
+        // Escape codes rather than system("clear"), so no shell is forked
+        printf("\033[H\033[2J\033[3J");
+        fflush(stdout);
     #endif
 }
 
 void print_header() {
     printf("OS Simulator - RAM: %d/%d MB | HDD: %d/%d MB | Cores: %d/%d | Mode: %s | Scheduler: %s\n\n",
-           system_res.total_ram - system_res.available_ram, system_res.total_ram,
-           system_res.total_hdd - system_res.available_hdd, system_res.total_hdd,
-           system_res.total_cores - system_res.available_cores, system_res.total_cores,
+           system_res.total_ram - res_available_ram(), system_res.total_ram,
+           system_res.total_hdd - res_available_hdd(), system_res.total_hdd,
+           system_res.total_cores - res_available_cores(), system_res.total_cores,
            current_mode ? "Kernel" : "User",
-           current_scheduler == FCFS ? "FCFS" : 
-           current_scheduler == ROUND_ROBIN ? "Round Robin" : "Priority");
+           scheduler_name(current_scheduler));
 }
 
 void print_error(char *message) {
+    if (quiet_mode) return;
     printf("\033[1;31m[ERROR] %s\033[0m\n", message);
 }
 
 void print_success(char *message) {
+    if (quiet_mode) return;
     printf("\033[1;32m[SUCCESS] %s\033[0m\n", message);
 }
 
 void print_warning(char *message) {
+    if (quiet_mode) return;
     printf("\033[1;33m[WARNING] %s\033[0m\n", message);
 }
 
 void print_info(char *message) {
+    if (quiet_mode) return;
     printf("\033[1;34m[INFO] %s\033[0m\n", message);
 }
 